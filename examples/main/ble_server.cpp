@@ -23,6 +23,25 @@
 
 #define TAG "ESP_BLE_SERVER"
 
+// Uncomment to stream transfers into the "storage" partition instead of RAM
+// #define STREAM_TO_STORAGE_PARTITION
+
+// Uncomment to bond with clients: they pair once and reconnect without rediscovering services
+// #define ENABLE_BONDING
+
+// Firmware update completion: the new image is already set as boot partition
+void on_firmware_update_complete(uint32_t size) {
+    ESP_LOGI(TAG, "=== FIRMWARE UPDATE RECEIVED (%lu bytes) - restarting ===", size);
+    vTaskDelay(pdMS_TO_TICKS(500));  // Let the ACK and disconnect go out
+    esp_restart();
+}
+
+// Download request: id 1 sends the "storage" partition (e.g. stored captures or logs) to the client
+TransferSource* on_download_request(uint32_t download_id) {
+    static PartitionSource storage_source(PartitionSink::find_data_partition("storage"));
+    return (download_id == 1) ? &storage_source : nullptr;
+}
+
 // Device configuration
 static const char* DEVICE_NAME = "ESP_BLE_SERVER";
 
@@ -32,9 +51,6 @@ static const uint8_t service_uuid[16] = {
     0x93, 0xf3, 0xa3, 0xb5, 0x01, 0x00, 0x40, 0x6e
 };
 
-// Global reference to image service for callback cleanup
-static ImageService* g_image_service = nullptr;
-
 // Image transfer completion callback function
 void on_image_transfer_complete(const uint8_t* image_data, uint32_t size, bool is_valid_jpeg) {
     ESP_LOGI(TAG, "=== IMAGE TRANSFER COMPLETED ===");
@@ -66,49 +82,15 @@ void on_image_transfer_complete(const uint8_t* image_data, uint32_t size, bool i
         // - Analyze image properties
         
         ESP_LOGI(TAG, "Image processing completed successfully");
+    } else if (!image_data && size > 0) {
+        ESP_LOGI(TAG, "Image streamed to the transfer sink");
     } else {
         ESP_LOGW(TAG, "Invalid image data received");
     }
     
-    // CRITICAL: Release the image buffer to prevent memory leaks and use-after-free
-    if (g_image_service) {
-        g_image_service->release_image_buffer();
-        ESP_LOGI(TAG, "Image buffer released");
-    } else {
-        ESP_LOGE(TAG, "Cannot release image buffer - service reference not available");
-    }
-    
-    // Memory monitoring - after buffer release
-    uint32_t free_heap_after = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
-    uint32_t free_internal_after = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
-    uint32_t free_spiram_after = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
-    uint32_t min_free_heap_final = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
-    
-    ESP_LOGI(TAG, "📊 MEMORY STATUS AFTER CLEANUP:");
-    ESP_LOGI(TAG, "  Free heap (total): %lu bytes (%.1f KB)", free_heap_after, free_heap_after / 1024.0f);
-    ESP_LOGI(TAG, "  Free internal RAM: %lu bytes (%.1f KB)", free_internal_after, free_internal_after / 1024.0f);
-    ESP_LOGI(TAG, "  Free SPIRAM: %lu bytes (%.1f KB)", free_spiram_after, free_spiram_after / 1024.0f);
-    ESP_LOGI(TAG, "  Minimum free heap ever: %lu bytes (%.1f KB)", min_free_heap_final, min_free_heap_final / 1024.0f);
-    
-    // Memory difference analysis
-    int32_t heap_diff = (int32_t)free_heap_after - (int32_t)free_heap_before;
-    int32_t internal_diff = (int32_t)free_internal_after - (int32_t)free_internal_before;
-    int32_t spiram_diff = (int32_t)free_spiram_after - (int32_t)free_spiram_before;
-    
-    ESP_LOGI(TAG, "📈 MEMORY CHANGE ANALYSIS:");
-    ESP_LOGI(TAG, "  Heap difference: %ld bytes (%.1f KB) %s", 
-             heap_diff, heap_diff / 1024.0f, heap_diff >= 0 ? "✅ RECOVERED" : "❌ LEAKED");
-    ESP_LOGI(TAG, "  Internal RAM difference: %ld bytes (%.1f KB) %s", 
-             internal_diff, internal_diff / 1024.0f, internal_diff >= 0 ? "✅" : "❌");
-    ESP_LOGI(TAG, "  SPIRAM difference: %ld bytes (%.1f KB) %s", 
-             spiram_diff, spiram_diff / 1024.0f, spiram_diff >= 0 ? "✅" : "❌");
-    
-    // Expected memory recovery (image buffer size should be freed)
-    if (heap_diff >= (int32_t)size * 0.9) {  // Allow 10% tolerance
-        ESP_LOGI(TAG, "✅ MEMORY LEAK CHECK PASSED: Expected ~%lu bytes recovered, got %ld bytes", size, heap_diff);
-    } else {
-        ESP_LOGW(TAG, "⚠️  POTENTIAL MEMORY LEAK: Expected ~%lu bytes recovered, only got %ld bytes", size, heap_diff);
-    }
+    // The completion worker owns image_data and frees it once this callback returns,
+    // so no release_image_buffer() call here. Heavy work (decoding, display refresh)
+    // does not delay the BLE stack: ACK and disconnect were already sent.
     
     ESP_LOGI(TAG, "=== IMAGE CALLBACK FINISHED ===");
 }
@@ -138,13 +120,13 @@ void app_main(void) {
 
     // Create and configure BLE server
     BLEServer ble_server;
+#ifdef ENABLE_BONDING
+    ble_server.set_bonding_enabled(true);
+#endif
     
     // Add image service
     auto image_service = std::make_unique<ImageService>();
     
-    // Store global reference for callback cleanup (before moving ownership)
-    g_image_service = image_service.get();
-    
     // Register image transfer completion callback
     image_service->set_image_transfer_callback(on_image_transfer_complete);
     ESP_LOGI(TAG, "Image transfer callback registered");
@@ -152,6 +134,46 @@ void app_main(void) {
     image_service->set_device_type(1);           // Device type 0-255
     image_service->set_battery_level(85);        // Battery level 0-255 (85%)
     image_service->set_display_size(1280, 720);   // Width x Height pixels
+    
+    // Keep chunks in flight instead of waiting for every batch to drain
+    image_service->set_flow_mode(ImageService::FlowMode::SLIDING_WINDOW);
+    image_service->set_adaptive_batching(true);  // Tune the window to the connected client
+    
+    // Keep the last image so incremental screen updates can be sent as small patches
+    image_service->set_delta_base_enabled(true);
+    
+    // Serve two clients at once (one arena slot each)
+    image_service->set_max_sessions(2);
+    
+    // Offer all data characteristics for clients that queue writes per characteristic
+    image_service->set_data_channel_count(ImageService::MAX_DATA_CHANNELS);
+    
+#ifdef STREAM_TO_STORAGE_PARTITION
+    // Multi-megabyte transfers: only a small reorder window is kept in RAM
+    static PartitionSink storage_sink(PartitionSink::find_data_partition("storage"));
+    image_service->set_transfer_sink(&storage_sink);
+#endif
+    
+    // Firmware updates over BLE into the next OTA slot
+    static OtaSink ota_sink;
+    image_service->set_firmware_sink(&ota_sink);
+    image_service->set_firmware_update_callback(on_firmware_update_complete);
+    
+    // Let clients pull data off the device over the data characteristic
+    image_service->set_download_request_callback(on_download_request);
+    
+    // Process data writes on core 1 so the Bluedroid task only enqueues them
+    ret = image_service->enable_ingest_task();
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Ingest task unavailable, processing chunks inline: %s", esp_err_to_name(ret));
+    }
+    
+    // Run the image callback on a worker so ACK and disconnect are not delayed
+    ret = image_service->enable_completion_worker();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start completion worker: %s", esp_err_to_name(ret));
+        return;
+    }
 
     ble_server.add_service(std::move(image_service));
     
@@ -5,6 +5,7 @@
 
 import Foundation
 import CoreBluetooth
+import Compression
 #if canImport(UIKit)
 import UIKit
 #elseif canImport(AppKit)
@@ -17,16 +18,31 @@ struct BLETinyFlowProtocol {
     static let serviceUUID = CBUUID(string: "6E400001-B5A3-F393-E0A9-E50E24DCCA9E")
     static let controlCharacteristicUUID = CBUUID(string: "6E400002-B5A3-F393-E0A9-E50E24DCCA9E")
     static let dataChannelUUID = CBUUID(string: "6E400010-B5A3-F393-E0A9-E50E24DCCA9E")
+    static let maxDataChannels = 4  // Optional extra data characteristics 6E400011...6E400013
+    static let dataChannelUUIDs = (0..<maxDataChannels).map {
+        CBUUID(string: String(format: "6E4000%02X-B5A3-F393-E0A9-E50E24DCCA9E", 0x10 + $0))
+    }
     
     static let maxMTU = 512
     static let maxFileSize = (65536*5)
+    static let maxFirmwareSize = 0x200000  // ota_0/ota_1 slot size in partitions.csv
+    static let transferFlagsIndex = 4  // TRANSFER_INIT flags byte within the reserved bytes
+    static let transferFlagDelta: UInt8 = 0x20  // Chunks carry a patch against the device's previous image
+    static let transferFlagLZ4: UInt8 = 0x40  // Chunks carry an LZ4 block stream
+    static let errorBaseMismatch: UInt32 = 0x12  // Device does not hold the patch base
+    static let transferFlagCRC32: UInt8 = 0x80  // Reserved bytes 0-3 carry the file CRC32
     static let defaultMTU = 512
     static let controlMessageSize = 20
     static let attHeaderSize = 3  // ATT protocol header overhead
     static let dataHeaderSize = 4  // Our data packet header (chunkID + dataLength)
     static let maxDataPayload = maxMTU - attHeaderSize - dataHeaderSize  // 512 - 3 - 4 = 505
     static let deviceName = "ESP_GATTS_DEMO"
-    static let chunkTransmissionDelayMicroseconds: UInt32 = 100000  // 100ms delay between chunks
+    static let chunkTransmissionDelayMicroseconds: UInt32 = 0  // Optional pacing between data writes (0 = flow control only)
+    static let benchmarkPageIndex = 0  // BENCHMARK page number within the reserved bytes
+    static let benchmarkPageCount = 4  // Ready page + three result pages
+    static let benchmarkChannelsIndex = 2  // Ready page: data channels the device offers
+    static let downloadGapTimeout: TimeInterval = 0.5  // Quiet time before missing download chunks are re-requested
+    static let downloadMaxRetries = 5
 }
 
 // MARK: - Command Types
@@ -34,8 +50,132 @@ struct BLETinyFlowProtocol {
 enum CommandType: UInt8 {
     case transferInit = 0x01
     case deviceInfo = 0x02
+    case requestDownload = 0x03
+    case benchmark = 0x05
+    case manifest = 0x06
     case chunkRequest = 0x82
     case transferCompleteAck = 0x83
+    case transferError = 0x84
+}
+
+// Transfer type, carried in the low nibble of the TRANSFER_INIT flags byte
+enum TransferType: UInt8 {
+    case asset = 0x00
+    case firmware = 0x01
+}
+
+// MARK: - LZ4 Block Stream
+
+// Independently compressed LZ4 blocks, decoded by Lz4BlockDecoder on the device:
+// [rawLength u16][storedLength u16 | 0x8000 if uncompressed][payload] per block
+enum LZ4BlockStream {
+    static let blockSize = 4096
+    static let storedFlag: UInt16 = 0x8000
+    
+    static func encode(_ data: Data) -> Data {
+        var output = Data()
+        let capacity = blockSize + blockSize / 255 + 16
+        var scratch = [UInt8](repeating: 0, count: capacity)
+        var offset = 0
+        while offset < data.count {
+            let block = data.subdata(in: offset..<min(offset + blockSize, data.count))
+            let compressedSize = block.withUnsafeBytes { (src: UnsafeRawBufferPointer) -> Int in
+                compression_encode_buffer(&scratch, capacity,
+                                          src.bindMemory(to: UInt8.self).baseAddress!, block.count,
+                                          nil, COMPRESSION_LZ4_RAW)
+            }
+            
+            // Blocks that do not shrink are sent as they are
+            let stored = compressedSize == 0 || compressedSize >= block.count
+            let storedLength = UInt16(stored ? block.count : compressedSize) | (stored ? storedFlag : 0)
+            output.append(contentsOf: withUnsafeBytes(of: UInt16(block.count).littleEndian) { Array($0) })
+            output.append(contentsOf: withUnsafeBytes(of: storedLength.littleEndian) { Array($0) })
+            if stored {
+                output.append(block)
+            } else {
+                output.append(contentsOf: scratch[0..<compressedSize])
+            }
+            offset += block.count
+        }
+        return output
+    }
+}
+
+// MARK: - Delta Patch
+
+// Block-level patch against the previously sent file, applied by DeltaPatcher on the device:
+// [baseCRC u32][baseSize u32] followed by COPY [0x01][offset u32][length u32] and
+// DATA [0x02][length u32][bytes] ops
+enum DeltaPatch {
+    static let blockSize = 64
+    static let opCopy: UInt8 = 0x01
+    static let opData: UInt8 = 0x02
+    
+    static func encode(_ data: Data, base: Data, baseCRC: UInt32) -> Data {
+        var patch = Data()
+        appendLE(&patch, baseCRC)
+        appendLE(&patch, UInt32(base.count))
+        
+        let new = [UInt8](data)
+        let old = [UInt8](base)
+        var runStart = 0
+        var runIsCopy: Bool?
+        
+        func flush(upTo end: Int) {
+            guard let isCopy = runIsCopy, end > runStart else { return }
+            if isCopy {
+                patch.append(opCopy)
+                appendLE(&patch, UInt32(runStart))
+                appendLE(&patch, UInt32(end - runStart))
+            } else {
+                patch.append(opData)
+                appendLE(&patch, UInt32(end - runStart))
+                patch.append(contentsOf: new[runStart..<end])
+            }
+        }
+        
+        // Unchanged blocks at the same offset become one COPY per run, the rest DATA
+        var offset = 0
+        while offset < new.count {
+            let end = min(offset + blockSize, new.count)
+            let same = end <= old.count && new[offset..<end].elementsEqual(old[offset..<end])
+            if runIsCopy != same {
+                flush(upTo: offset)
+                runStart = offset
+                runIsCopy = same
+            }
+            offset = end
+        }
+        flush(upTo: new.count)
+        return patch
+    }
+    
+    private static func appendLE(_ data: inout Data, _ value: UInt32) {
+        data.append(contentsOf: withUnsafeBytes(of: value.littleEndian) { Array($0) })
+    }
+}
+
+// MARK: - CRC32
+
+// IEEE 802.3 CRC32 (zlib-compatible), matches esp_rom_crc32_le on the device
+enum CRC32 {
+    private static let table: [UInt32] = (0..<256).map { index -> UInt32 in
+        var crc = UInt32(index)
+        for _ in 0..<8 {
+            crc = (crc & 1) != 0 ? (0xEDB88320 ^ (crc >> 1)) : (crc >> 1)
+        }
+        return crc
+    }
+    
+    static func checksum(_ data: Data) -> UInt32 {
+        var crc: UInt32 = 0xFFFFFFFF
+        data.withUnsafeBytes { buffer in
+            for byte in buffer {
+                crc = table[Int((crc ^ UInt32(byte)) & 0xFF)] ^ (crc >> 8)
+            }
+        }
+        return crc ^ 0xFFFFFFFF
+    }
 }
 
 // MARK: - Message Structures
@@ -61,12 +201,41 @@ struct DeviceInfo {
     }
 }
 
+struct BenchmarkResult {
+    var chunksSent: UInt32 = 0
+    var chunkSize: UInt32 = 0
+    var channels = 1  // Data characteristics the chunks were spread over
+    var bytesReceived: UInt32 = 0
+    var durationMicroseconds: UInt32 = 0
+    var throughput: UInt32 = 0  // Bytes per second measured by the device
+    var chunksReceived: UInt32 = 0
+    var duplicates: UInt16 = 0
+    var connectionInterval: UInt16 = 0  // 1.25ms units
+    var latency: UInt16 = 0
+    var supervisionTimeout: UInt16 = 0  // 10ms units
+    var mtu: UInt16 = 0
+    var txPHY: UInt8 = 0
+    var rxPHY: UInt8 = 0
+    var dataLength: UInt16 = 0
+    
+    var lossRate: Double {
+        return chunksSent > 0 ? Double(chunksSent - min(chunksReceived, chunksSent)) / Double(chunksSent) : 0
+    }
+    
+    var description: String {
+        return String(format: "%.1f KB/s over %d channel(s), %u/%u chunks (%.1f%% loss), interval %.2fms, MTU %u, PHY %u/%u, data length %u",
+                      Double(throughput) / 1024.0, channels, chunksReceived, chunksSent, lossRate * 100,
+                      Double(connectionInterval) * 1.25, mtu, txPHY, rxPHY, dataLength)
+    }
+}
+
 struct ControlMessage {
     let command: CommandType
     let sequenceNumber: UInt16
     let param1: UInt32
     let param2: UInt32
     let param3: UInt32
+    var reserved = [UInt8](repeating: 0, count: 5)
     
     func toData() -> Data {
         var data = Data(capacity: BLETinyFlowProtocol.controlMessageSize)
@@ -75,6 +244,7 @@ struct ControlMessage {
         data.append(contentsOf: withUnsafeBytes(of: param1.littleEndian) { Array($0) })
         data.append(contentsOf: withUnsafeBytes(of: param2.littleEndian) { Array($0) })
         data.append(contentsOf: withUnsafeBytes(of: param3.littleEndian) { Array($0) })
+        data.append(contentsOf: reserved)
         
         while data.count < BLETinyFlowProtocol.controlMessageSize {
             data.append(0)
@@ -94,7 +264,11 @@ struct ControlMessage {
         let p2 = data.withUnsafeBytes { $0.loadUnaligned(fromByteOffset: 7, as: UInt32.self) }.littleEndian
         let p3 = data.withUnsafeBytes { $0.loadUnaligned(fromByteOffset: 11, as: UInt32.self) }.littleEndian
         
-        return ControlMessage(command: cmd, sequenceNumber: seqNum, param1: p1, param2: p2, param3: p3)
+        var message = ControlMessage(command: cmd, sequenceNumber: seqNum, param1: p1, param2: p2, param3: p3)
+        if data.count >= BLETinyFlowProtocol.controlMessageSize {
+            message.reserved = Array(data[15..<20])
+        }
+        return message
     }
 }
 
@@ -210,6 +384,8 @@ class BLETinyFlowManager: NSObject, ObservableObject {
     private var peripheral: CBPeripheral?
     private var controlCharacteristic: CBCharacteristic?
     private var dataCharacteristic: CBCharacteristic?
+    private var dataChannels: [Int: CBCharacteristic] = [:]  // Channel index → data characteristic
+    private var dataChannelLimit = 1
     private var controlNotificationsEnabled = false
     
     private var transferState: TransferState = .idle
@@ -217,13 +393,47 @@ class BLETinyFlowManager: NSObject, ObservableObject {
     private var fileData: Data?
     private var sequenceNumber: UInt16 = 0
     private var chunkDelayMicroseconds: UInt32 = BLETinyFlowProtocol.chunkTransmissionDelayMicroseconds
-    private var fileChunks: [Data] = []
+    private var transferPayload = Data()  // Wire bytes of the transfer; chunks are sliced from it when sent
+    private var transferChunkSize = 0
     private var totalChunks: Int = 0
     private var transferStartTime: Date?
     private var transferFileSize: Int = 0
-    private var chunkSendStartTime: Date?
+    private var transferType: TransferType = .asset
+    private var transferCRC: UInt32 = 0
+    private var transferCompressed = false
+    private var transferAllowDelta = false
+    private var transferUsedDelta = false
+    private var deltaBases: [String: (crc: UInt32, data: Data)] = [:]  // Last asset acknowledged per device
+    private var chunkSendStartTime: Date?  // First write of the current queue
+    private var pendingWrites: [(chunkID: UInt32, channel: CBCharacteristic)] = []
+    private var packetScratch = Data()  // Packet being written, rebuilt in place for every chunk
+    private var benchmarkChunkSize = 0  // > 0: queued chunks are benchmark chunks of this size
+    private var pendingWriteIndex = 0  // Next entry of pendingWrites to send
+    private var queuedChunkIDs = Set<UInt32>()
+    private var writeDelayPending = false
+    private var writeStalls = 0  // canSendWriteWithoutResponse was false
+    private var queueStartChunksSent = 0
+    private var queueStartBytesWritten = 0
     private var totalChunksSent: Int = 0
     private var totalBytesWritten: Int = 0
+    private var benchmarkCompletion: ((Result<BenchmarkResult, Error>) -> Void)?
+    private var benchmarkResult = BenchmarkResult()
+    private var benchmarkChannels = 1
+    private var batchFiles: [Data] = []  // Files of the running batch still to be sent
+    private var batchType: TransferType = .asset
+    private var batchCompressed = false
+    private var batchFilesSent = 0
+    private var batchCompletion: ((Result<Int, Error>) -> Void)?
+    private var downloadCompletion: ((Result<Data, Error>) -> Void)?
+    private var downloadID: UInt32 = 0
+    private var downloadRequested = false  // REQUEST_DOWNLOAD sent, waiting for TRANSFER_INIT
+    private var downloadData = Data()
+    private var downloadReceived: [Bool] = []
+    private var downloadChunksReceived = 0
+    private var downloadChunkSize = 0
+    private var downloadCRC: UInt32 = 0
+    private var downloadRetries = 0
+    private var downloadGapTimer: Timer?
     
     private var connectionTimer: Timer?
     private var transferTimer: Timer?
@@ -236,6 +446,8 @@ class BLETinyFlowManager: NSObject, ObservableObject {
     private var connectedDevice: DiscoveredDevice?
     private var connectionState: ConnectionState = .disconnected
     private var currentDeviceInfo: DeviceInfo?
+    private var lastPeripheralIdentifier: UUID?  // Target of reconnect()
+    private var fastReconnect = false  // Known device: enable notifications without descriptor discovery
     
     enum ConnectionState {
         case disconnected
@@ -289,11 +501,20 @@ class BLETinyFlowManager: NSObject, ObservableObject {
         return stateString
     }
     
+    // Extra pacing between data writes on top of flow control (default 0 = none)
     func setChunkDelay(microseconds: UInt32) {
         chunkDelayMicroseconds = microseconds
         NSLog("[BTTransfer] Chunk delay set to %d microseconds", microseconds)
     }
     
+    // Spread data chunks over up to `count` data characteristics (as many as the device
+    // offers). Helps clients that queue writes without response per characteristic;
+    // compare with runBenchmark(channels:) before relying on it.
+    func setDataChannels(_ count: Int) {
+        dataChannelLimit = max(1, min(count, BLETinyFlowProtocol.maxDataChannels))
+        NSLog("[BTTransfer] Using up to %d data channels", dataChannelLimit)
+    }
+    
     
     func startGeneralScan() {
         NSLog("[BTTransfer] Starting general BLE device scan")
@@ -387,6 +608,29 @@ class BLETinyFlowManager: NSObject, ObservableObject {
         stopTargetDeviceScan()
     }
     
+    // Connects to the last device again without scanning for it (the device advertises fast
+    // right after a disconnect). With bonding enabled on the device, services and characteristics
+    // come from the GATT cache and notifications are enabled as soon as they are known
+    func reconnect() {
+        guard connectionState == .disconnected else {
+            NSLog("[BTTransfer] Already connecting or connected")
+            return
+        }
+        guard let identifier = lastPeripheralIdentifier,
+              let known = centralManager.retrievePeripherals(withIdentifiers: [identifier]).first else {
+            NSLog("[BTTransfer] No known device to reconnect to")
+            return
+        }
+        
+        NSLog("[BTTransfer] Reconnecting to \(known.name ?? identifier.uuidString)")
+        connectionState = .connecting
+        peripheral = known
+        known.delegate = self
+        fastReconnect = true
+        centralManager.connect(known, options: nil)
+        stopTargetDeviceScan()
+    }
+    
     private func handleConnectionTimeout(_ device: DiscoveredDevice) {
         connectionState = .disconnected
         delegate?.deviceConnectionDidFail(device, error: TransferError.connectionTimeout)
@@ -410,7 +654,16 @@ class BLETinyFlowManager: NSObject, ObservableObject {
         peripheral = nil
         controlCharacteristic = nil
         dataCharacteristic = nil
+        dataChannels = [:]
+        clearPendingWrites()
+        if batchCompletion != nil {
+            finishBatch(.failure(TransferError.notConnected))
+        }
+        if downloadCompletion != nil {
+            finishDownload(.failure(TransferError.notConnected))
+        }
         controlNotificationsEnabled = false
+        fastReconnect = false
         connectionTimer?.invalidate()
         transferTimer?.invalidate()
     }
@@ -432,11 +685,16 @@ class BLETinyFlowManager: NSObject, ObservableObject {
         return currentDeviceInfo
     }
     
-    func transferFile(_ fileData: Data) {
-        NSLog("[BTTransfer] Transfer requested for \(fileData.count) bytes")
-        
-        guard fileData.count <= BLETinyFlowProtocol.maxFileSize else {
-            NSLog("[BTTransfer] File too large: \(fileData.count) bytes (max: \(BLETinyFlowProtocol.maxFileSize))")
+    // compressed: send LZ4 blocks if that makes the transfer smaller (raw framebuffers,
+    // bitmaps, JSON); already compressed formats such as JPEG are sent as they are
+    // allowDelta: send only the changes against the last asset this device acknowledged;
+    // falls back to the full file if the device no longer holds that image
+    func transferFile(_ fileData: Data, type: TransferType = .asset, compressed: Bool = false, allowDelta: Bool = false) {
+        NSLog("[BTTransfer] Transfer requested for \(fileData.count) bytes (type \(type))")
+        
+        let maxSize = (type == .firmware) ? BLETinyFlowProtocol.maxFirmwareSize : BLETinyFlowProtocol.maxFileSize
+        guard fileData.count <= maxSize else {
+            NSLog("[BTTransfer] File too large: \(fileData.count) bytes (max: \(maxSize))")
             delegate?.transferDidFail(error: TransferError.fileTooLarge)
             return
         }
@@ -460,10 +718,14 @@ class BLETinyFlowManager: NSObject, ObservableObject {
         }
         
         self.fileData = fileData
+        transferType = type
+        transferCompressed = compressed
+        transferAllowDelta = allowDelta
         transferFileSize = fileData.count
         transferStartTime = Date()
         totalChunksSent = 0
         totalBytesWritten = 0
+        writeStalls = 0
         
         NSLog("[BTTransfer] Starting transfer to connected device")
         delegate?.transferDidStart()
@@ -485,9 +747,34 @@ class BLETinyFlowManager: NSObject, ObservableObject {
         
         negotiateMTU()
         let chunkSize = currentMTU - BLETinyFlowProtocol.attHeaderSize - BLETinyFlowProtocol.dataHeaderSize
-        let totalChunks = (fileData.count + chunkSize - 1) / chunkSize
         
-        let initMessage = ControlMessage(
+        // Param 1 stays the file size; chunks carry the compressed stream
+        var payload = fileData
+        var flags = transferType.rawValue | BLETinyFlowProtocol.transferFlagCRC32
+        transferUsedDelta = false
+        if transferAllowDelta && transferType == .asset,
+           let deviceID = connectedDevice?.identifier, let base = deltaBases[deviceID] {
+            let patch = DeltaPatch.encode(fileData, base: base.data, baseCRC: base.crc)
+            if patch.count < fileData.count {
+                NSLog("[BTTransfer] Delta: %d byte patch against base %08X", patch.count, base.crc)
+                payload = patch
+                flags |= BLETinyFlowProtocol.transferFlagDelta
+                transferUsedDelta = true
+            }
+        }
+        if transferCompressed {
+            let encoded = LZ4BlockStream.encode(payload)
+            if encoded.count < payload.count {
+                NSLog("[BTTransfer] LZ4: %d -> %d bytes (%.1fx)", payload.count, encoded.count, Double(payload.count) / Double(encoded.count))
+                payload = encoded
+                flags |= BLETinyFlowProtocol.transferFlagLZ4
+            } else {
+                NSLog("[BTTransfer] LZ4 does not shrink this file, sending uncompressed")
+            }
+        }
+        let totalChunks = (payload.count + chunkSize - 1) / chunkSize
+        
+        var initMessage = ControlMessage(
             command: .transferInit,
             sequenceNumber: nextSequenceNumber(),
             param1: UInt32(fileData.count),
@@ -495,18 +782,20 @@ class BLETinyFlowManager: NSObject, ObservableObject {
             param3: UInt32(totalChunks)
         )
         
-        // Pre-prepare chunks for sending when requested
-        fileChunks = []
-        var offset = 0
-        while offset < fileData.count {
-            let currentChunkSize = min(fileData.count - offset, chunkSize)
-            let chunkData = fileData.subdata(in: offset..<(offset + currentChunkSize))
-            fileChunks.append(chunkData)
-            offset += currentChunkSize
-        }
+        // File CRC32 lets the device verify the transfer while it arrives
+        transferCRC = CRC32.checksum(fileData)
+        let crcBytes = withUnsafeBytes(of: transferCRC.littleEndian) { Array($0) }
+        initMessage.reserved.replaceSubrange(0..<4, with: crcBytes)
+        initMessage.reserved[BLETinyFlowProtocol.transferFlagsIndex] = flags
+        
+        // Chunks are cut from the payload only when they are written (writes queued for a
+        // previous attempt are dropped)
+        clearPendingWrites()
+        transferPayload = payload
+        transferChunkSize = chunkSize
         self.totalChunks = totalChunks
         
-        NSLog("[BTTransfer] Sending TRANSFER_INIT: fileSize=\(fileData.count), chunkSize=\(chunkSize), chunks=\(totalChunks)")
+        NSLog("[BTTransfer] Sending TRANSFER_INIT: fileSize=\(fileData.count), chunkSize=\(chunkSize), chunks=\(totalChunks), crc32=%08X", transferCRC)
         peripheral.writeValue(initMessage.toData(), for: controlChar, type: .withResponse)
         
         transferState = .waitingForChunkRequest
@@ -516,6 +805,144 @@ class BLETinyFlowManager: NSObject, ObservableObject {
         }
     }
     
+    // Measures link capacity: streams `chunks` discarded chunks and returns what the device
+    // received (rate, loss, connection parameters). chunkSize 0 uses the device's optimal size;
+    // channels > 1 spreads the chunks over that many data characteristics
+    func runBenchmark(chunks: Int = 1000, chunkSize: Int = 0, channels: Int = 1,
+                      completion: @escaping (Result<BenchmarkResult, Error>) -> Void) {
+        guard connectionState == .connected, let peripheral = peripheral, peripheral.state == .connected,
+              let controlChar = controlCharacteristic, dataCharacteristic != nil else {
+            NSLog("[BTTransfer] Benchmark failed - no device connected")
+            completion(.failure(TransferError.notConnected))
+            return
+        }
+        switch transferState {
+        case .sendingInit, .waitingForChunkRequest, .sendingData, .waitingForComplete:
+            NSLog("[BTTransfer] Benchmark refused - transfer in progress")
+            completion(.failure(TransferError.busy))
+            return
+        default:
+            break
+        }
+        guard benchmarkCompletion == nil else {
+            NSLog("[BTTransfer] Benchmark refused - benchmark already running")
+            completion(.failure(TransferError.busy))
+            return
+        }
+        
+        negotiateMTU()
+        let maxChunkSize = currentMTU - BLETinyFlowProtocol.attHeaderSize - BLETinyFlowProtocol.dataHeaderSize
+        benchmarkCompletion = completion
+        benchmarkResult = BenchmarkResult()
+        benchmarkChannels = max(1, min(channels, BLETinyFlowProtocol.maxDataChannels))
+        
+        let request = ControlMessage(
+            command: .benchmark,
+            sequenceNumber: nextSequenceNumber(),
+            param1: UInt32(chunks),
+            param2: UInt32(min(chunkSize, maxChunkSize)),
+            param3: 0
+        )
+        NSLog("[BTTransfer] Sending BENCHMARK: chunks=%d, chunkSize=%d", chunks, chunkSize)
+        peripheral.writeValue(request.toData(), for: controlChar, type: .withResponse)
+        
+        transferTimer?.invalidate()
+        transferTimer = Timer.scheduledTimer(withTimeInterval: 30.0, repeats: false) { [weak self] _ in
+            self?.finishBenchmark(.failure(TransferError.timeout))
+        }
+    }
+    
+    // Sends several files over one connection: a MANIFEST announces them, then they follow
+    // one after another (each reported through the delegate as usual). The device keeps the
+    // connection until the last one; completion returns the number of files sent
+    func transferFiles(_ files: [Data], type: TransferType = .asset, compressed: Bool = false,
+                       completion: @escaping (Result<Int, Error>) -> Void) {
+        guard connectionState == .connected, let peripheral = peripheral, peripheral.state == .connected,
+              let controlChar = controlCharacteristic, dataCharacteristic != nil else {
+            NSLog("[BTTransfer] Batch failed - no device connected")
+            completion(.failure(TransferError.notConnected))
+            return
+        }
+        switch transferState {
+        case .sendingInit, .waitingForChunkRequest, .sendingData, .waitingForComplete:
+            NSLog("[BTTransfer] Batch refused - transfer in progress")
+            completion(.failure(TransferError.busy))
+            return
+        default:
+            break
+        }
+        guard batchCompletion == nil && benchmarkCompletion == nil else {
+            NSLog("[BTTransfer] Batch refused - batch or benchmark already running")
+            completion(.failure(TransferError.busy))
+            return
+        }
+        let maxSize = (type == .firmware) ? BLETinyFlowProtocol.maxFirmwareSize : BLETinyFlowProtocol.maxFileSize
+        guard !files.isEmpty, files.allSatisfy({ $0.count <= maxSize }) else {
+            NSLog("[BTTransfer] Batch refused - empty or a file is too large")
+            completion(.failure(TransferError.fileTooLarge))
+            return
+        }
+        
+        batchFiles = files
+        batchType = type
+        batchCompressed = compressed
+        batchFilesSent = 0
+        batchCompletion = completion
+        
+        let totalBytes = files.reduce(0) { $0 + $1.count }
+        let manifest = ControlMessage(
+            command: .manifest,
+            sequenceNumber: nextSequenceNumber(),
+            param1: UInt32(files.count),
+            param2: UInt32(totalBytes),
+            param3: 0
+        )
+        NSLog("[BTTransfer] Sending MANIFEST: files=%d, bytes=%d", files.count, totalBytes)
+        peripheral.writeValue(manifest.toData(), for: controlChar, type: .withResponse)
+    }
+    
+    // Asks the device for the download with the application-defined `id` (camera capture,
+    // log, ...). Chunks arrive as data notifications; gaps are re-requested and the
+    // completion returns the file once its size and CRC32 match TRANSFER_INIT
+    func downloadFile(id: UInt32, completion: @escaping (Result<Data, Error>) -> Void) {
+        guard connectionState == .connected, let peripheral = peripheral, peripheral.state == .connected,
+              controlCharacteristic != nil, let dataChar = dataCharacteristic else {
+            NSLog("[BTTransfer] Download failed - no device connected")
+            completion(.failure(TransferError.notConnected))
+            return
+        }
+        switch transferState {
+        case .sendingInit, .waitingForChunkRequest, .sendingData, .waitingForComplete:
+            NSLog("[BTTransfer] Download refused - transfer in progress")
+            completion(.failure(TransferError.busy))
+            return
+        default:
+            break
+        }
+        guard downloadCompletion == nil && batchCompletion == nil && benchmarkCompletion == nil else {
+            NSLog("[BTTransfer] Download refused - download, batch or benchmark already running")
+            completion(.failure(TransferError.busy))
+            return
+        }
+        
+        downloadCompletion = completion
+        downloadID = id
+        downloadRequested = false
+        
+        // The device only sends a download once data notifications are on
+        if dataChar.isNotifying {
+            sendDownloadRequest()
+        } else {
+            NSLog("[BTTransfer] Enabling data notifications for the download")
+            peripheral.setNotifyValue(true, for: dataChar)
+        }
+        
+        transferTimer?.invalidate()
+        transferTimer = Timer.scheduledTimer(withTimeInterval: 30.0, repeats: false) { [weak self] _ in
+            self?.finishDownload(.failure(TransferError.timeout))
+        }
+    }
+    
     func disconnect() {
         transferTimer?.invalidate()
         connectionTimer?.invalidate()
@@ -526,10 +953,20 @@ class BLETinyFlowManager: NSObject, ObservableObject {
         
         transferState = .idle
         fileData = nil
+        clearPendingWrites()
     }
     
     // MARK: - Private Methods
     
+    // Data characteristics to spread chunks over: channel 0 plus consecutive extra channels
+    private func activeDataChannels(limit: Int) -> [CBCharacteristic] {
+        var channels: [CBCharacteristic] = []
+        while channels.count < limit, let characteristic = dataChannels[channels.count] {
+            channels.append(characteristic)
+        }
+        return channels
+    }
+    
     private func nextSequenceNumber() -> UInt16 {
         sequenceNumber = sequenceNumber &+ 1
         return sequenceNumber
@@ -548,7 +985,8 @@ class BLETinyFlowManager: NSObject, ObservableObject {
     }
     
     private func sendRequestedChunks(startChunk: UInt32, numChunks: UInt32) {
-        guard let dataChar = dataCharacteristic else {
+        let channels = activeDataChannels(limit: dataChannelLimit)
+        guard !channels.isEmpty else {
             delegate?.transferDidFail(error: TransferError.notConnected)
             return
         }
@@ -557,81 +995,363 @@ class BLETinyFlowManager: NSObject, ObservableObject {
         NSLog("[BTTransfer] Sending %d chunks starting from %d (range %d-%d)", numChunks, startChunk, startChunk, endChunk)
         transferState = .sendingData
         
-        // Pre-calculate packets to reduce overhead in loop
-        var packets: [(Data, UInt32)] = []
+        // Chunks still waiting in the queue from an earlier request are not queued twice
+        var queued = 0
         for chunkID in startChunk...endChunk {
-            guard chunkID < fileChunks.count else {
-                NSLog("[BTTransfer] Requested chunk %d exceeds available chunks (%d)", chunkID, fileChunks.count)
+            guard chunkID < totalChunks else {
+                NSLog("[BTTransfer] Requested chunk %d exceeds available chunks (%d)", chunkID, totalChunks)
                 break
             }
+            guard !queuedChunkIDs.contains(chunkID) else { continue }
             
-            let chunkData = fileChunks[Int(chunkID)]
-            let packet = DataPacket(
-                chunkID: UInt16(chunkID),
-                dataLength: UInt16(chunkData.count),
-                data: chunkData
-            )
-            packets.append((packet.toData(), chunkID))
+            enqueueWrite(chunkID: chunkID, channel: channels[Int(chunkID) % channels.count])
+            queued += 1
+        }
+        NSLog("[BTTransfer] Queued %d chunks (%d waiting)", queued, pendingWrites.count - pendingWriteIndex)
+        pumpWrites()
+    }
+    
+    private func sendBenchmarkChunks(count: UInt32, chunkSize: UInt32, channelLimit: Int) {
+        let channels = activeDataChannels(limit: channelLimit)
+        guard !channels.isEmpty else {
+            finishBenchmark(.failure(TransferError.notConnected))
+            return
         }
         
-        // Start timing this batch
-        chunkSendStartTime = Date()
-        let batchStartTime = Date()
+        // The device discards the payload, so benchmark chunks carry whatever is in the scratch buffer
+        benchmarkChunkSize = Int(chunkSize)
+        for chunkID in 0..<count {
+            enqueueWrite(chunkID: chunkID, channel: channels[Int(chunkID) % channels.count])
+        }
+        NSLog("[BTTransfer] Benchmark: %d chunks queued on %d channels", count, channels.count)
+        pumpWrites()
+    }
+    
+    // MARK: - Flow-Controlled Sending
+    
+    private func enqueueWrite(chunkID: UInt32, channel: CBCharacteristic) {
+        if pendingWriteIndex == pendingWrites.count {
+            chunkSendStartTime = Date()
+            queueStartChunksSent = totalChunksSent
+            queueStartBytesWritten = totalBytesWritten
+        }
+        pendingWrites.append((chunkID, channel))
+        queuedChunkIDs.insert(chunkID)
+    }
+    
+    // Writes queued chunks for as long as CoreBluetooth accepts writes without response and
+    // stops when its buffer is full; peripheralIsReady(toSendWriteWithoutResponse:) resumes.
+    // How many chunks are in flight is up to the device's CHUNK_REQUEST window.
+    private func pumpWrites() {
+        guard let peripheral = peripheral, peripheral.state == .connected else {
+            clearPendingWrites()
+            return
+        }
+        guard !writeDelayPending else { return }
         
-        // Send packets in tight loop
-        for (packetData, chunkID) in packets {
-            let writeStartTime = Date()
-            
-            // Reduce logging frequency for performance
-            if chunkID % 10 == 0 {
-                NSLog("[BTTransfer] Sending chunk %d - Size: %d bytes", chunkID, packetData.count)
+        while pendingWriteIndex < pendingWrites.count {
+            guard peripheral.canSendWriteWithoutResponse else {
+                writeStalls += 1
+                return
             }
             
-            peripheral?.writeValue(packetData, for: dataChar, type: .withoutResponse)
-            
-            let writeTime = Date().timeIntervalSince(writeStartTime)
+            let write = pendingWrites[pendingWriteIndex]
+            pendingWriteIndex += 1
+            queuedChunkIDs.remove(write.chunkID)
+            buildPacket(chunkID: write.chunkID)
+            peripheral.writeValue(packetScratch, for: write.channel, type: .withoutResponse)
             totalChunksSent += 1
-            totalBytesWritten += packetData.count
+            totalBytesWritten += packetScratch.count
             
-            // Log slow writes
-            if writeTime > 0.001 { // > 1ms
-                NSLog("[BTTransfer] SLOW WRITE: chunk %d took %.3fms", chunkID, writeTime * 1000)
+            // Update progress less frequently to reduce overhead
+            if transferState == .sendingData && write.chunkID % 5 == 0 {
+                delegate?.transferProgress(Float(write.chunkID + 1) / Float(totalChunks))
             }
             
-            // Update progress less frequently to reduce overhead
-            if chunkID % 5 == 0 {
-                let progress = Float(chunkID + 1) / Float(totalChunks)
-                DispatchQueue.main.async { [weak self] in
-                    self?.delegate?.transferProgress(progress)
+            // Optional pacing (setChunkDelay); 0 leaves it to flow control alone
+            if chunkDelayMicroseconds > 0 && pendingWriteIndex < pendingWrites.count {
+                writeDelayPending = true
+                DispatchQueue.main.asyncAfter(deadline: .now() + .microseconds(Int(chunkDelayMicroseconds))) { [weak self] in
+                    self?.writeDelayPending = false
+                    self?.pumpWrites()
                 }
+                return
             }
-            
-            // Add delay to prevent overwhelming ESP32 receive buffer
-            //usleep(chunkDelayMicroseconds)
         }
         
-        // Log batch timing
-        let batchTime = Date().timeIntervalSince(batchStartTime)
-        let bytesInBatch = packets.reduce(0) { $0 + $1.0.count }
-        let batchThroughput = Double(bytesInBatch) / 1024.0 / batchTime
-        NSLog("[BTTransfer] Batch of %d chunks (%d bytes) sent in %.3fms (%.1f KB/s)", packets.count, bytesInBatch, batchTime * 1000, batchThroughput)
+        // Queue drained
+        if let startTime = chunkSendStartTime {
+            let time = Date().timeIntervalSince(startTime)
+            let chunks = totalChunksSent - queueStartChunksSent
+            let bytes = totalBytesWritten - queueStartBytesWritten
+            NSLog("[BTTransfer] Sent %d chunks (%d bytes) in %.3fms (%.1f KB/s), %d flow control stalls",
+                  chunks, bytes, time * 1000, Double(bytes) / 1024.0 / max(time, 0.000001), writeStalls)
+            chunkSendStartTime = nil
+        }
+        pendingWrites.removeAll(keepingCapacity: true)
+        pendingWriteIndex = 0
+        benchmarkChunkSize = 0
+        
+        if transferState == .sendingData {
+            if let startTime = transferStartTime {
+                let totalTime = Date().timeIntervalSince(startTime)
+                let cumulativeThroughput = Double(totalBytesWritten) / 1024.0 / totalTime
+                NSLog("[BTTransfer] Cumulative: %d chunks (%d bytes) in %.3fs (%.1f KB/s)", totalChunksSent, totalBytesWritten, totalTime, cumulativeThroughput)
+            }
+            NSLog("[BTTransfer] Finished sending requested chunks, waiting for next request or completion")
+            transferState = .waitingForChunkRequest
+        }
+    }
+    
+    // [ChunkID][Length][Payload] in packetScratch: the header is written in place and the
+    // payload copied once, straight from transferPayload (no per-chunk Data slices)
+    private func buildPacket(chunkID: UInt32) {
+        let offset = Int(chunkID) * transferChunkSize
+        let length = benchmarkChunkSize > 0 ? benchmarkChunkSize : min(transferChunkSize, transferPayload.count - offset)
+        let headerSize = BLETinyFlowProtocol.dataHeaderSize
+        packetScratch.count = headerSize + length
+        
+        packetScratch.withUnsafeMutableBytes { buffer in
+            buffer.storeBytes(of: UInt16(chunkID).littleEndian, toByteOffset: 0, as: UInt16.self)
+            buffer.storeBytes(of: UInt16(length).littleEndian, toByteOffset: 2, as: UInt16.self)
+            guard benchmarkChunkSize == 0, let base = buffer.baseAddress else { return }
+            let start = transferPayload.startIndex + offset
+            transferPayload.copyBytes(to: base.advanced(by: headerSize).assumingMemoryBound(to: UInt8.self),
+                                      from: start..<(start + length))
+        }
+    }
+    
+    private func clearPendingWrites() {
+        pendingWrites.removeAll()
+        pendingWriteIndex = 0
+        benchmarkChunkSize = 0
+        queuedChunkIDs.removeAll()
+        chunkSendStartTime = nil
+    }
+    
+    private func handleBenchmarkPage(_ message: ControlMessage) {
+        guard benchmarkCompletion != nil else {
+            NSLog("[BTTransfer] Ignoring BENCHMARK page - no benchmark running")
+            return
+        }
         
-        // Log cumulative stats
-        if let startTime = transferStartTime {
-            let totalTime = Date().timeIntervalSince(startTime)
-            let cumulativeThroughput = Double(totalBytesWritten) / 1024.0 / totalTime
-            NSLog("[BTTransfer] Cumulative: %d chunks (%d bytes) in %.3fs (%.1f KB/s)", totalChunksSent, totalBytesWritten, totalTime, cumulativeThroughput)
+        switch message.reserved[BLETinyFlowProtocol.benchmarkPageIndex] {
+        case 0:
+            benchmarkResult.chunksSent = message.param1
+            benchmarkResult.chunkSize = message.param2
+            let deviceChannels = max(1, Int(message.reserved[BLETinyFlowProtocol.benchmarkChannelsIndex]))
+            benchmarkResult.channels = min(benchmarkChannels, deviceChannels, max(1, dataChannels.count))
+            NSLog("[BTTransfer] BENCHMARK ready: %d chunks of %d bytes, %d channels", message.param1, message.param2,
+                  benchmarkResult.channels)
+            sendBenchmarkChunks(count: message.param1, chunkSize: message.param2, channelLimit: benchmarkResult.channels)
+        case 1:
+            benchmarkResult.bytesReceived = message.param1
+            benchmarkResult.durationMicroseconds = message.param2
+            benchmarkResult.throughput = message.param3
+        case 2:
+            benchmarkResult.chunksReceived = message.param1
+            benchmarkResult.duplicates = UInt16(message.param3 & 0xFFFF)
+        case 3:
+            benchmarkResult.connectionInterval = UInt16(message.param1 & 0xFFFF)
+            benchmarkResult.latency = UInt16(message.param1 >> 16)
+            benchmarkResult.supervisionTimeout = UInt16(message.param2 & 0xFFFF)
+            benchmarkResult.mtu = UInt16(message.param2 >> 16)
+            benchmarkResult.txPHY = UInt8(message.param3 & 0xFF)
+            benchmarkResult.rxPHY = UInt8((message.param3 >> 8) & 0xFF)
+            benchmarkResult.dataLength = UInt16(message.param3 >> 16)
+            NSLog("[BTTransfer] Benchmark result: %@", benchmarkResult.description)
+            finishBenchmark(.success(benchmarkResult))
+        default:
+            NSLog("[BTTransfer] Unknown BENCHMARK page %d", message.reserved[BLETinyFlowProtocol.benchmarkPageIndex])
+        }
+    }
+    
+    private func finishBenchmark(_ result: Result<BenchmarkResult, Error>) {
+        transferTimer?.invalidate()
+        let completion = benchmarkCompletion
+        benchmarkCompletion = nil
+        DispatchQueue.main.async {
+            completion?(result)
+        }
+    }
+    
+    private func sendNextBatchFile() {
+        guard batchCompletion != nil else { return }
+        guard !batchFiles.isEmpty else {
+            finishBatch(.success(batchFilesSent))
+            return
+        }
+        let file = batchFiles.removeFirst()
+        batchFilesSent += 1
+        transferFile(file, type: batchType, compressed: batchCompressed)
+    }
+    
+    private func finishBatch(_ result: Result<Int, Error>) {
+        let completion = batchCompletion
+        batchCompletion = nil
+        batchFiles = []
+        DispatchQueue.main.async {
+            completion?(result)
+        }
+    }
+    
+    private func sendDownloadRequest() {
+        guard downloadCompletion != nil, !downloadRequested,
+              let peripheral = peripheral, let controlChar = controlCharacteristic else { return }
+        negotiateMTU()
+        let maxChunkSize = currentMTU - BLETinyFlowProtocol.attHeaderSize - BLETinyFlowProtocol.dataHeaderSize
+        let request = ControlMessage(
+            command: .requestDownload,
+            sequenceNumber: nextSequenceNumber(),
+            param1: downloadID,
+            param2: UInt32(maxChunkSize),
+            param3: 0
+        )
+        downloadRequested = true
+        NSLog("[BTTransfer] Sending REQUEST_DOWNLOAD: id=%d, maxChunkSize=%d", downloadID, maxChunkSize)
+        peripheral.writeValue(request.toData(), for: controlChar, type: .withResponse)
+    }
+    
+    private func handleDownloadInit(_ message: ControlMessage) {
+        guard downloadCompletion != nil && downloadRequested else {
+            NSLog("[BTTransfer] Ignoring TRANSFER_INIT - no download requested")
+            return
+        }
+        let size = Int(message.param1)
+        let chunks = Int(message.param3)
+        guard size > 0, message.param2 > 0, chunks == (size + Int(message.param2) - 1) / Int(message.param2) else {
+            NSLog("[BTTransfer] Invalid download TRANSFER_INIT: size=%d, chunkSize=%d, chunks=%d",
+                  message.param1, message.param2, message.param3)
+            finishDownload(.failure(TransferError.deviceError(code: 0)))
+            return
         }
         
-        NSLog("[BTTransfer] Finished sending requested chunks, waiting for next request or completion")
-        DispatchQueue.main.async { [weak self] in
-            self?.transferState = .waitingForChunkRequest
+        downloadData = Data(count: size)
+        downloadReceived = [Bool](repeating: false, count: chunks)
+        downloadChunksReceived = 0
+        downloadChunkSize = Int(message.param2)
+        downloadCRC = message.reserved[0..<4].enumerated().reduce(UInt32(0)) { $0 | (UInt32($1.element) << (8 * $1.offset)) }
+        downloadRetries = 0
+        transferStartTime = Date()
+        NSLog("[BTTransfer] Download %d: %d bytes in %d chunks of %d bytes, crc32=%08X",
+              downloadID, size, chunks, downloadChunkSize, downloadCRC)
+        restartDownloadGapTimer()
+    }
+    
+    private func handleDownloadChunk(_ packet: Data) {
+        guard downloadCompletion != nil, !downloadReceived.isEmpty,
+              packet.count >= BLETinyFlowProtocol.dataHeaderSize else { return }
+        let header = packet.startIndex
+        let chunkID = Int(UInt16(packet[header]) | (UInt16(packet[header + 1]) << 8))
+        let length = Int(UInt16(packet[header + 2]) | (UInt16(packet[header + 3]) << 8))
+        let offset = chunkID * downloadChunkSize
+        guard chunkID < downloadReceived.count, length == packet.count - BLETinyFlowProtocol.dataHeaderSize,
+              offset + length <= downloadData.count else {
+            NSLog("[BTTransfer] Ignoring malformed download chunk %d (%d bytes)", chunkID, packet.count)
+            return
+        }
+        if downloadReceived[chunkID] {
+            return  // Duplicate of a re-requested chunk
+        }
+        
+        let payloadStart = header + BLETinyFlowProtocol.dataHeaderSize
+        downloadData.replaceSubrange(offset..<(offset + length), with: packet[payloadStart..<(payloadStart + length)])
+        downloadReceived[chunkID] = true
+        downloadChunksReceived += 1
+        
+        if downloadChunksReceived == downloadReceived.count {
+            completeDownload()
+        } else {
+            restartDownloadGapTimer()
+        }
+    }
+    
+    // The device sends every chunk once, so a quiet link means the rest was lost
+    private func restartDownloadGapTimer() {
+        downloadGapTimer?.invalidate()
+        downloadGapTimer = Timer.scheduledTimer(withTimeInterval: BLETinyFlowProtocol.downloadGapTimeout, repeats: false) { [weak self] _ in
+            self?.requestMissingDownloadChunks()
+        }
+    }
+    
+    private func requestMissingDownloadChunks() {
+        guard downloadCompletion != nil, let peripheral = peripheral, let controlChar = controlCharacteristic else { return }
+        downloadRetries += 1
+        guard downloadRetries <= BLETinyFlowProtocol.downloadMaxRetries else {
+            NSLog("[BTTransfer] Download %d: %d of %d chunks after %d retries - giving up",
+                  downloadID, downloadChunksReceived, downloadReceived.count, BLETinyFlowProtocol.downloadMaxRetries)
+            finishDownload(.failure(TransferError.timeout))
+            return
+        }
+        
+        var chunk = 0
+        while chunk < downloadReceived.count {
+            guard !downloadReceived[chunk] else {
+                chunk += 1
+                continue
+            }
+            var end = chunk
+            while end < downloadReceived.count && !downloadReceived[end] {
+                end += 1
+            }
+            let request = ControlMessage(
+                command: .chunkRequest,
+                sequenceNumber: nextSequenceNumber(),
+                param1: UInt32(chunk),
+                param2: UInt32(end - chunk),
+                param3: 0
+            )
+            NSLog("[BTTransfer] Download CHUNK_REQUEST: start=%d, numChunks=%d", chunk, end - chunk)
+            peripheral.writeValue(request.toData(), for: controlChar, type: .withResponse)
+            chunk = end
+        }
+        restartDownloadGapTimer()
+    }
+    
+    private func completeDownload() {
+        guard let peripheral = peripheral, let controlChar = controlCharacteristic else { return }
+        let crc = CRC32.checksum(downloadData)
+        let ack = ControlMessage(
+            command: .transferCompleteAck,
+            sequenceNumber: nextSequenceNumber(),
+            param1: UInt32(downloadData.count),
+            param2: crc,
+            param3: 0
+        )
+        peripheral.writeValue(ack.toData(), for: controlChar, type: .withResponse)
+        
+        guard crc == downloadCRC else {
+            NSLog("[BTTransfer] Download CRC32 mismatch: device sent %08X, received %08X", downloadCRC, crc)
+            finishDownload(.failure(TransferError.checksumMismatch))
+            return
+        }
+        if let startTime = transferStartTime {
+            let duration = Date().timeIntervalSince(startTime)
+            NSLog("[BTTransfer] Download completed: %d bytes in %.2f seconds (%.2f KB/s)",
+                  downloadData.count, duration, Double(downloadData.count) / 1024.0 / duration)
+        }
+        finishDownload(.success(downloadData))
+    }
+    
+    private func finishDownload(_ result: Result<Data, Error>) {
+        transferTimer?.invalidate()
+        downloadGapTimer?.invalidate()
+        let completion = downloadCompletion
+        downloadCompletion = nil
+        downloadRequested = false
+        downloadData = Data()
+        downloadReceived = []
+        DispatchQueue.main.async {
+            completion?(result)
         }
     }
     
     private func handleTransferTimeout() {
         transferState = .failed(TransferError.timeout)
         delegate?.transferDidFail(error: TransferError.timeout)
+        if batchCompletion != nil {
+            finishBatch(.failure(TransferError.timeout))
+        }
     }
 }
 
@@ -724,6 +1444,7 @@ extension BLETinyFlowManager: CBCentralManagerDelegate {
     func centralManager(_ central: CBCentralManager, didConnect peripheral: CBPeripheral) {
         NSLog("[BTTransfer] Connected to peripheral: \(peripheral.name ?? "Unknown")")
         connectionState = .connected
+        lastPeripheralIdentifier = peripheral.identifier
         
         // Find the connected device in our target devices
         if let device = targetDevices.values.first(where: { $0.peripheral.identifier == peripheral.identifier }) {
@@ -781,7 +1502,7 @@ extension BLETinyFlowManager: CBPeripheralDelegate {
             NSLog("[BTTransfer] Service UUID: \(service.uuid)")
             if service.uuid == BLETinyFlowProtocol.serviceUUID {
                 NSLog("[BTTransfer] Found target service, discovering characteristics")
-                peripheral.discoverCharacteristics([BLETinyFlowProtocol.controlCharacteristicUUID, BLETinyFlowProtocol.dataChannelUUID], for: service)
+                peripheral.discoverCharacteristics([BLETinyFlowProtocol.controlCharacteristicUUID] + BLETinyFlowProtocol.dataChannelUUIDs, for: service)
             }
         }
     }
@@ -803,21 +1524,33 @@ extension BLETinyFlowManager: CBPeripheralDelegate {
                 NSLog("[BTTransfer] Control characteristic supports indicate: \(characteristic.properties.contains(.indicate))")
                 controlCharacteristic = characteristic
                 
-                if characteristic.properties.contains(.notify) || characteristic.properties.contains(.indicate) {
+                if (characteristic.properties.contains(.notify) || characteristic.properties.contains(.indicate)) && fastReconnect {
+                    NSLog("[BTTransfer] Reconnect: enabling control notifications directly")
+                    peripheral.setNotifyValue(true, for: characteristic)
+                } else if characteristic.properties.contains(.notify) || characteristic.properties.contains(.indicate) {
                     NSLog("[BTTransfer] Control characteristic supports notifications")
                     NSLog("[BTTransfer] Immediately discovering descriptors for control characteristic...")
                     peripheral.discoverDescriptors(for: characteristic)
                 } else {
                     NSLog("[BTTransfer] Control characteristic does not support notifications!")
                 }
-            } else if characteristic.uuid == BLETinyFlowProtocol.dataChannelUUID {
-                NSLog("[BTTransfer] Found data characteristic")
-                dataCharacteristic = characteristic
+            } else if let channel = BLETinyFlowProtocol.dataChannelUUIDs.firstIndex(of: characteristic.uuid) {
+                NSLog("[BTTransfer] Found data characteristic (channel %d)", channel)
+                dataChannels[channel] = characteristic
+                if channel == 0 {
+                    dataCharacteristic = characteristic
+                }
             }
         }
         
         NSLog("[BTTransfer] Characteristics discovery complete - control: \(controlCharacteristic != nil), data: \(dataCharacteristic != nil)")
         
+        // Reconnect: notifications are already being enabled, no deferred descriptor discovery
+        if fastReconnect && controlCharacteristic != nil {
+            fastReconnect = false
+            return
+        }
+        
         // Defer descriptor discovery to ensure characteristic discovery is fully complete
         if let controlChar = controlCharacteristic {
             if controlChar.properties.contains(.notify) || controlChar.properties.contains(.indicate) {
@@ -907,6 +1640,12 @@ extension BLETinyFlowManager: CBPeripheralDelegate {
             if let nsError = error as NSError? {
                 NSLog("[BTTransfer] NSError userInfo: \(nsError.userInfo)")
             }
+            if characteristic.uuid == BLETinyFlowProtocol.dataChannelUUIDs[0] {
+                if downloadCompletion != nil {
+                    finishDownload(.failure(error))
+                }
+                return
+            }
             NSLog("[BTTransfer] This usually means the CCCD descriptor is missing on the ESP32 side")
             NSLog("[BTTransfer] Attempting to proceed without notifications (will use polling mode)")
             
@@ -938,14 +1677,25 @@ extension BLETinyFlowManager: CBPeripheralDelegate {
                     attemptTransfer()
                 }
             }
+        } else if characteristic.uuid == BLETinyFlowProtocol.dataChannelUUIDs[0] {
+            NSLog("[BTTransfer] Data characteristic notifications enabled: \(characteristic.isNotifying)")
+            if characteristic.isNotifying {
+                sendDownloadRequest()
+            }
         }
     }
     
+    func peripheralIsReady(toSendWriteWithoutResponse peripheral: CBPeripheral) {
+        pumpWrites()
+    }
+    
     func peripheral(_ peripheral: CBPeripheral, didUpdateValueFor characteristic: CBCharacteristic, error: Error?) {
         guard let data = characteristic.value else { return }
         
         if characteristic.uuid == BLETinyFlowProtocol.controlCharacteristicUUID {
             handleControlMessage(data)
+        } else if characteristic.uuid == BLETinyFlowProtocol.dataChannelUUIDs[0] {
+            handleDownloadChunk(data)
         }
     }
     
@@ -977,9 +1727,7 @@ extension BLETinyFlowManager: CBPeripheralDelegate {
             NSLog("[BTTransfer] Received CHUNK_REQUEST: start=%d, numChunks=%d", message.param1, message.param2)
             if transferState == .waitingForChunkRequest || transferState == .sendingData {
                 NSLog("[BTTransfer] Processing chunk request (current state: %@)", String(describing: transferState))
-                DispatchQueue.global(qos: .userInitiated).async { [weak self] in
-                    self?.sendRequestedChunks(startChunk: message.param1, numChunks: message.param2)
-                }
+                sendRequestedChunks(startChunk: message.param1, numChunks: message.param2)
             } else {
                 NSLog("[BTTransfer] Ignoring chunk request - wrong state: %@", String(describing: transferState))
             }
@@ -988,8 +1736,23 @@ extension BLETinyFlowManager: CBPeripheralDelegate {
             NSLog("[BTTransfer] Received TRANSFER_COMPLETE_ACK, transfer finished")
             if transferState == .waitingForChunkRequest || transferState == .sendingData {
                 transferTimer?.invalidate()
+                
+                guard message.param2 == transferCRC else {
+                    NSLog("[BTTransfer] CRC32 mismatch: sent %08X, device computed %08X", transferCRC, message.param2)
+                    transferState = .failed(TransferError.checksumMismatch)
+                    delegate?.transferDidFail(error: TransferError.checksumMismatch)
+                    if batchCompletion != nil {
+                        finishBatch(.failure(TransferError.checksumMismatch))
+                    }
+                    return
+                }
                 transferState = .completed
                 
+                // Becomes the base for the next delta transfer to this device
+                if transferType == .asset, let deviceID = connectedDevice?.identifier, let fileData = fileData {
+                    deltaBases[deviceID] = (transferCRC, fileData)
+                }
+                
                 if let startTime = transferStartTime {
                     let duration = Date().timeIntervalSince(startTime)
                     let throughputKBps = Double(transferFileSize) / 1024.0 / duration
@@ -998,6 +1761,50 @@ extension BLETinyFlowManager: CBPeripheralDelegate {
                 } else {
                     delegate?.transferDidComplete()
                 }
+                
+                // Param 3: files of the batch the device still waits for
+                if batchCompletion != nil {
+                    NSLog("[BTTransfer] Batch: %d files sent, device expects %d more", batchFilesSent, message.param3)
+                    sendNextBatchFile()
+                }
+            }
+            
+        case .transferInit:
+            handleDownloadInit(message)
+            
+        case .benchmark:
+            handleBenchmarkPage(message)
+            
+        case .manifest:
+            NSLog("[BTTransfer] Received MANIFEST ack: files=%d, bytes=%d", message.param1, message.param2)
+            sendNextBatchFile()
+            
+        case .transferError:
+            NSLog("[BTTransfer] Received TRANSFER_ERROR: code=0x%02X, info=0x%08X", message.param1, message.param2)
+            transferTimer?.invalidate()
+            if benchmarkCompletion != nil {
+                finishBenchmark(.failure(TransferError.deviceError(code: message.param1)))
+                return
+            }
+            if downloadCompletion != nil {
+                finishDownload(.failure(TransferError.deviceError(code: message.param1)))
+                return
+            }
+            if message.param1 == BLETinyFlowProtocol.errorBaseMismatch && transferUsedDelta {
+                // The device holds a different image (restart, other client): send everything
+                NSLog("[BTTransfer] Device base is %08X, retrying with the full file", message.param2)
+                if let deviceID = connectedDevice?.identifier {
+                    deltaBases[deviceID] = nil
+                }
+                transferAllowDelta = false
+                attemptTransfer()
+                return
+            }
+            let error = TransferError.deviceError(code: message.param1)
+            transferState = .failed(error)
+            delegate?.transferDidFail(error: error)
+            if batchCompletion != nil {
+                finishBatch(.failure(error))
             }
             
         default:
@@ -1020,6 +1827,9 @@ enum TransferError: Error, LocalizedError {
     case timeout
     case fileTooLarge
     case deviceNotFound
+    case checksumMismatch
+    case deviceError(code: UInt32)
+    case busy
     
     var errorDescription: String? {
         switch self {
@@ -1043,6 +1853,12 @@ enum TransferError: Error, LocalizedError {
             return "File is too large. Maximum size is 64 KB."
         case .deviceNotFound:
             return "ESP32 device not found. Make sure the device is powered on and nearby."
+        case .checksumMismatch:
+            return "The device received data with a different CRC32 checksum."
+        case .deviceError(let code):
+            return String(format: "The device reported transfer error 0x%02X.", code)
+        case .busy:
+            return "A transfer or benchmark is already running."
         }
     }
 }
@@ -9,10 +9,23 @@
 
 static const char* TAG = "AdvertisingManager";
 
-AdvertisingManager::AdvertisingManager() : adv_config_done_(ADV_CONFIG_FLAG | SCAN_RSP_CONFIG_FLAG) {
+constexpr uint16_t AdvertisingManager::FAST_INTERVAL_MIN;
+constexpr uint16_t AdvertisingManager::FAST_INTERVAL_MAX;
+
+AdvertisingManager::AdvertisingManager()
+    : adv_config_done_(ADV_CONFIG_FLAG | SCAN_RSP_CONFIG_FLAG), fast_duration_ms_(DEFAULT_FAST_DURATION_MS),
+      fast_timer_(nullptr), fast_active_(false), switch_pending_(false) {
     setup_adv_params();
 }
 
+AdvertisingManager::~AdvertisingManager() {
+    if (fast_timer_) {
+        esp_timer_stop(fast_timer_);
+        esp_timer_delete(fast_timer_);
+        fast_timer_ = nullptr;
+    }
+}
+
 void AdvertisingManager::init(const char* device_name, const uint8_t* service_uuid) {
     // Copy service UUID
     memcpy(service_uuid_, service_uuid, ESP_UUID_LEN_128);
@@ -72,8 +85,13 @@ void AdvertisingManager::handle_gap_event(esp_gap_ble_cb_event_t event, esp_ble_
     case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
         if (param->adv_stop_cmpl.status != ESP_BT_STATUS_SUCCESS) {
             ESP_LOGE(TAG, "Advertising stop failed, status %d", param->adv_stop_cmpl.status);
+            switch_pending_ = false;  // Not advertising anymore (e.g. a client connected)
         } else {
             ESP_LOGI(TAG, "Advertising stop successfully");
+            if (switch_pending_.exchange(false)) {
+                // End of the fast burst: continue at the normal interval
+                esp_ble_gap_start_advertising(&adv_params_);
+            }
         }
         break;
         
@@ -98,13 +116,77 @@ void AdvertisingManager::handle_gap_event(esp_gap_ble_cb_event_t event, esp_ble_
 }
 
 esp_err_t AdvertisingManager::start_advertising() {
+    if (fast_active_ || switch_pending_) {
+        return ESP_OK;  // Already advertising; the burst ends at the normal interval
+    }
     return esp_ble_gap_start_advertising(&adv_params_);
 }
 
 esp_err_t AdvertisingManager::stop_advertising() {
+    on_connected();  // Cancels the burst the same way
     return esp_ble_gap_stop_advertising();
 }
 
+esp_err_t AdvertisingManager::start_fast_advertising() {
+    if (fast_duration_ms_ == 0) {
+        return start_advertising();
+    }
+    if (!fast_timer_) {
+        esp_timer_create_args_t timer_args = {};
+        timer_args.callback = &AdvertisingManager::fast_timer_callback;
+        timer_args.arg = this;
+        timer_args.dispatch_method = ESP_TIMER_TASK;
+        timer_args.name = "adv_fast";
+        esp_err_t ret = esp_timer_create(&timer_args, &fast_timer_);
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Fast advertising timer unavailable: %s", esp_err_to_name(ret));
+            fast_timer_ = nullptr;
+            return start_advertising();
+        }
+    }
+    
+    // A burst still running (or switching back) is restarted from the beginning
+    esp_timer_stop(fast_timer_);
+    switch_pending_ = false;
+    if (fast_active_) {
+        esp_timer_start_once(fast_timer_, static_cast<uint64_t>(fast_duration_ms_) * 1000);
+        return ESP_OK;
+    }
+    
+    esp_err_t ret = esp_ble_gap_start_advertising(&fast_adv_params_);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    fast_active_ = true;
+    esp_timer_start_once(fast_timer_, static_cast<uint64_t>(fast_duration_ms_) * 1000);
+    ESP_LOGI(TAG, "Fast advertising (%d-%d x 0.625ms) for %lu ms", FAST_INTERVAL_MIN, FAST_INTERVAL_MAX, fast_duration_ms_);
+    return ESP_OK;
+}
+
+void AdvertisingManager::on_connected() {
+    if (fast_timer_) {
+        esp_timer_stop(fast_timer_);
+    }
+    fast_active_ = false;
+    switch_pending_ = false;
+}
+
+void AdvertisingManager::set_interval(uint16_t min_interval, uint16_t max_interval) {
+    adv_params_.adv_int_min = min_interval;
+    adv_params_.adv_int_max = max_interval;
+}
+
+void AdvertisingManager::fast_timer_callback(void* arg) {
+    AdvertisingManager* manager = static_cast<AdvertisingManager*>(arg);
+    if (manager->fast_active_.exchange(false)) {
+        // Advertising parameters cannot change while advertising: stop, then restart slower
+        manager->switch_pending_ = true;
+        if (esp_ble_gap_stop_advertising() != ESP_OK) {
+            manager->switch_pending_ = false;
+        }
+    }
+}
+
 void AdvertisingManager::setup_adv_data() {
     adv_data_ = {
         .set_scan_rsp = false,
@@ -143,8 +225,8 @@ void AdvertisingManager::setup_scan_rsp_data() {
 
 void AdvertisingManager::setup_adv_params() {
     adv_params_ = {
-        .adv_int_min = 0x20,
-        .adv_int_max = 0x40,
+        .adv_int_min = DEFAULT_INTERVAL_MIN,
+        .adv_int_max = DEFAULT_INTERVAL_MAX,
         .adv_type = ADV_TYPE_IND,
         .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
         .peer_addr = {},
@@ -152,4 +234,8 @@ void AdvertisingManager::setup_adv_params() {
         .channel_map = ADV_CHNL_ALL,
         .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
     };
+    
+    fast_adv_params_ = adv_params_;
+    fast_adv_params_.adv_int_min = FAST_INTERVAL_MIN;
+    fast_adv_params_.adv_int_max = FAST_INTERVAL_MAX;
 }
\ No newline at end of file
@@ -2,12 +2,21 @@
 
 #include "esp_gap_ble_api.h"
 #include "esp_bt_defs.h"
+#include "esp_timer.h"
+#include <atomic>
 #include <cstdint>
 
 class AdvertisingManager {
 public:
+    // Advertising intervals, 0.625ms units
+    static constexpr uint16_t DEFAULT_INTERVAL_MIN = 0xA0;   // 100ms: steady state, low duty cycle
+    static constexpr uint16_t DEFAULT_INTERVAL_MAX = 0xF4;   // 152.5ms (one of Apple's recommended intervals)
+    static constexpr uint16_t FAST_INTERVAL_MIN = 0x20;      // 20ms, the minimum for connectable advertising
+    static constexpr uint16_t FAST_INTERVAL_MAX = 0x30;      // 30ms
+    static constexpr uint32_t DEFAULT_FAST_DURATION_MS = 5000;
+    
     AdvertisingManager();
-    ~AdvertisingManager() = default;
+    ~AdvertisingManager();
     
     // Initialize advertising configuration
     void init(const char* device_name, const uint8_t* service_uuid);
@@ -18,6 +27,15 @@ public:
     // Start/stop advertising
     esp_err_t start_advertising();
     esp_err_t stop_advertising();
+    // Advertise at the fast interval for the fast duration, then fall back to the normal
+    // interval: a client reconnecting right after a disconnect finds the device sooner
+    esp_err_t start_fast_advertising();
+    // Connecting stops advertising (and cancels a running fast burst)
+    void on_connected();
+    
+    // Normal interval (applies from the next start) and fast burst length (0 = no burst)
+    void set_interval(uint16_t min_interval, uint16_t max_interval);
+    void set_fast_duration(uint32_t duration_ms) { fast_duration_ms_ = duration_ms; }
     
     // Check if advertising is configured
     bool is_config_done() const { return adv_config_done_ == 0; }
@@ -31,10 +49,18 @@ private:
     esp_ble_adv_data_t adv_data_;
     esp_ble_adv_data_t scan_rsp_data_;
     esp_ble_adv_params_t adv_params_;
+    esp_ble_adv_params_t fast_adv_params_;
     uint8_t service_uuid_[ESP_UUID_LEN_128];
     
+    // Fast advertising burst
+    uint32_t fast_duration_ms_;
+    esp_timer_handle_t fast_timer_;
+    std::atomic<bool> fast_active_;      // Advertising with fast_adv_params_
+    std::atomic<bool> switch_pending_;   // Burst over: restart with adv_params_ once the stop completed
+    
     // Helper methods
     void setup_adv_data();
     void setup_scan_rsp_data();
     void setup_adv_params();
+    static void fast_timer_callback(void* arg);
 };
\ No newline at end of file
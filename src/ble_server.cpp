@@ -4,6 +4,9 @@
 // created with the help of Claude AI
 
 #include "ble_server.h"
+#include "state_lock.h"
+#include "sdkconfig.h"
+#include <cstring>
 #include "esp_log.h"
 #include "esp_bt.h"
 #include "esp_bt_main.h"
@@ -12,16 +15,30 @@
 
 static const char* TAG = "BLEServer";
 
+constexpr BLEServer::LinkProfile BLEServer::DEFAULT_LINK_PROFILE;
+
 // Static instance for singleton pattern
 BLEServer* BLEServer::instance_ = nullptr;
 
-BLEServer::BLEServer() : initialized_(false), started_(false), local_mtu_(512), connected_count_(0) {
+BLEServer::BLEServer()
+    : initialized_(false), started_(false), bonding_enabled_(false), local_mtu_(512), connected_count_(0),
+      link_profile_(DEFAULT_LINK_PROFILE), pending_data_length_link_(-1), phy_unavailable_(false),
+      data_length_unavailable_(false), link_mutex_(nullptr) {
+    memset(links_, 0, sizeof(links_));
+    link_mutex_ = xSemaphoreCreateMutex();
+    if (!link_mutex_) {
+        ESP_LOGE(TAG, "Failed to create link mutex");
+    }
     instance_ = this;
 }
 
 BLEServer::~BLEServer() {
     stop();
     instance_ = nullptr;
+    if (link_mutex_) {
+        vSemaphoreDelete(link_mutex_);
+        link_mutex_ = nullptr;
+    }
 }
 
 esp_err_t BLEServer::init(const char* device_name) {
@@ -44,6 +61,14 @@ esp_err_t BLEServer::init(const char* device_name) {
         return ret;
     }
     
+    if (bonding_enabled_) {
+        ret = configure_security();
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to configure bonding");
+            return ret;
+        }
+    }
+    
     ret = register_services();
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register services");
@@ -92,6 +117,7 @@ esp_err_t BLEServer::stop() {
 }
 
 void BLEServer::add_service(std::unique_ptr<GATTService> service) {
+    service->set_link_control(this);
     services_.push_back(std::move(service));
 }
 
@@ -104,14 +130,14 @@ GATTService* BLEServer::get_service(uint16_t app_id) {
     return nullptr;
 }
 
-esp_err_t BLEServer::restart_advertising() {
+esp_err_t BLEServer::restart_advertising(bool fast) {
     if (!initialized_ || !started_) {
         ESP_LOGW(TAG, "Cannot restart advertising: server not initialized or started");
         return ESP_ERR_INVALID_STATE;
     }
     
     ESP_LOGI(TAG, "Restarting advertising to accept new connections");
-    esp_err_t ret = advertising_manager_.start_advertising();
+    esp_err_t ret = fast ? advertising_manager_.start_fast_advertising() : advertising_manager_.start_advertising();
     if (ret == ESP_OK) {
         ESP_LOGI(TAG, "Advertising restarted successfully");
     } else {
@@ -141,6 +167,11 @@ void BLEServer::handle_gatts_event(esp_gatts_cb_event_t event, esp_gatt_if_t gat
         ESP_LOGI(TAG, "🔗 BLE client connected (conn_id: %d, total connections: %d)", 
                  param->connect.conn_id, connected_count_);
         ESP_LOGI(TAG, "Client address: " ESP_BD_ADDR_STR, ESP_BD_ADDR_HEX(param->connect.remote_bda));
+        advertising_manager_.on_connected();  // The controller stopped advertising
+        {
+            StateLock lock(link_mutex_);
+            on_link_connected(param);
+        }
         break;
         
     case ESP_GATTS_DISCONNECT_EVT:
@@ -150,6 +181,10 @@ void BLEServer::handle_gatts_event(esp_gatts_cb_event_t event, esp_gatt_if_t gat
         ESP_LOGI(TAG, "🔌 BLE client disconnected (conn_id: %d, reason: 0x%02x, remaining connections: %d)", 
                  param->disconnect.conn_id, param->disconnect.reason, connected_count_);
         ESP_LOGI(TAG, "Client address: " ESP_BD_ADDR_STR, ESP_BD_ADDR_HEX(param->disconnect.remote_bda));
+        {
+            StateLock lock(link_mutex_);
+            on_link_disconnected(param->disconnect.conn_id);
+        }
         
         // Automatically restart advertising when no clients are connected
         if (connected_count_ == 0) {
@@ -185,10 +220,236 @@ void BLEServer::handle_gatts_event(esp_gatts_cb_event_t event, esp_gatt_if_t gat
 }
 
 void BLEServer::handle_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+    // Record negotiated link values before services are told about them
+    int32_t updated_conn_id = -1;
+    {
+        StateLock lock(link_mutex_);
+        Link* link = nullptr;
+        switch (event) {
+        case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+            link = find_link_by_address(param->update_conn_params.bda);
+            if (link && param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) {
+                link->info.interval = param->update_conn_params.conn_int;
+                link->info.latency = param->update_conn_params.latency;
+                link->info.timeout = param->update_conn_params.timeout;
+                updated_conn_id = link->conn_id;
+            }
+            break;
+            
+        case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT:
+            if (param->pkt_data_length_cmpl.status != ESP_BT_STATUS_SUCCESS) {
+                // Central without data length extension: the link keeps 27-byte PDUs, chunks still fit the MTU
+                ESP_LOGD(TAG, "Data length not changed, status %d - staying on 27-byte PDUs",
+                         param->pkt_data_length_cmpl.status);
+            } else if (pending_data_length_link_ >= 0 && links_[pending_data_length_link_].in_use) {
+                link = &links_[pending_data_length_link_];
+                link->info.tx_data_length = param->pkt_data_length_cmpl.params.tx_len;
+                link->info.rx_data_length = param->pkt_data_length_cmpl.params.rx_len;
+                updated_conn_id = link->conn_id;
+            }
+            pending_data_length_link_ = -1;
+            break;
+            
+        case ESP_GAP_BLE_SEC_REQ_EVT:
+            // Central asks for security: accept, pairing is "Just Works"
+            esp_ble_gap_security_rsp(param->ble_security.ble_req.bd_addr, true);
+            break;
+            
+        case ESP_GAP_BLE_AUTH_CMPL_EVT:
+            link = find_link_by_address(param->ble_security.auth_cmpl.bd_addr);
+            if (param->ble_security.auth_cmpl.success) {
+                ESP_LOGI(TAG, "🔒 Link encrypted, " ESP_BD_ADDR_STR " (%d bonded devices)",
+                         ESP_BD_ADDR_HEX(param->ble_security.auth_cmpl.bd_addr), esp_ble_get_bond_device_num());
+                if (link) {
+                    link->info.encrypted = true;
+                }
+            } else {
+                // The client may have dropped its keys: forget ours so the next connection pairs again
+                ESP_LOGW(TAG, "Pairing failed, reason 0x%02x", param->ble_security.auth_cmpl.fail_reason);
+                esp_ble_remove_bond_device(param->ble_security.auth_cmpl.bd_addr);
+            }
+            break;
+            
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+        case ESP_GAP_BLE_SET_PREFERRED_PHY_COMPLETE_EVT:
+            if (param->set_perf_phy.status != ESP_BT_STATUS_SUCCESS) {
+                ESP_LOGD(TAG, "Preferred PHY not set, status %d - staying on 1M", param->set_perf_phy.status);
+            }
+            break;
+            
+        case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT:
+            link = find_link_by_address(param->phy_update.bda);
+            if (param->phy_update.status != ESP_BT_STATUS_SUCCESS) {
+                // 1M-only (Bluetooth 4.x) central: the link stays on 1M, which is what LinkInfo already says
+                ESP_LOGD(TAG, "PHY update rejected, status %d - staying on 1M", param->phy_update.status);
+            } else if (link) {
+                ESP_LOGI(TAG, "PHY update, tx %d, rx %d", param->phy_update.tx_phy, param->phy_update.rx_phy);
+                link->info.tx_phy = param->phy_update.tx_phy;
+                link->info.rx_phy = param->phy_update.rx_phy;
+                updated_conn_id = link->conn_id;
+            }
+            break;
+#endif
+            
+        default:
+            break;
+        }
+    }
+    if (updated_conn_id >= 0) {
+        notify_link_update(static_cast<uint16_t>(updated_conn_id));
+    }
+    
     // Delegate to advertising manager
     advertising_manager_.handle_gap_event(event, param);
 }
 
+// ==================== LINK PROFILE ====================
+
+esp_err_t BLEServer::set_link_mode(uint16_t conn_id, LinkMode mode) {
+    StateLock lock(link_mutex_);
+    Link* link = find_link(conn_id);
+    if (!link) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (link->info.mode == mode) {
+        return ESP_OK;
+    }
+    return apply_connection_params(*link, mode);
+}
+
+bool BLEServer::get_link_info(uint16_t conn_id, LinkInfo* info) const {
+    StateLock lock(link_mutex_);
+    for (const auto& link : links_) {
+        if (link.in_use && link.conn_id == conn_id) {
+            *info = link.info;
+            return true;
+        }
+    }
+    return false;
+}
+
+void BLEServer::on_link_connected(esp_ble_gatts_cb_param_t *param) {
+    Link* link = nullptr;
+    for (auto& candidate : links_) {
+        if (!candidate.in_use) {
+            link = &candidate;
+            break;
+        }
+    }
+    if (!link) {
+        ESP_LOGW(TAG, "No link slot for conn_id %d - keeping default link settings", param->connect.conn_id);
+        return;
+    }
+    
+    link->in_use = true;
+    link->conn_id = param->connect.conn_id;
+    memcpy(link->bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+    link->info.tx_phy = 1;          // Every connection starts on 1M with 27-byte PDUs
+    link->info.rx_phy = 1;
+    link->info.tx_data_length = 27;
+    link->info.rx_data_length = 27;
+    link->info.interval = param->connect.conn_params.interval;
+    link->info.latency = param->connect.conn_params.latency;
+    link->info.timeout = param->connect.conn_params.timeout;
+    link->info.encrypted = false;
+    
+    if (bonding_enabled_) {
+        // A bonded client is re-encrypted from its stored keys (no pairing round trip), a new one pairs once
+        esp_err_t ret = esp_ble_set_encryption(link->bda, ESP_BLE_SEC_ENCRYPT);
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Encryption request failed: %s", esp_err_to_name(ret));
+        }
+    }
+    
+    // Optional link upgrades: when the controller cannot do them the link works as it is
+    // (1M PHY, 27-byte PDUs), so the failure is reported once and not requested again
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    if (link_profile_.preferred_phys && !phy_unavailable_) {
+        esp_err_t ret = esp_ble_gap_set_preferred_phy(link->bda, 0, link_profile_.preferred_phys,
+                                                      link_profile_.preferred_phys, 0);  // No coded PHY option
+        if (ret != ESP_OK) {
+            phy_unavailable_ = true;
+            ESP_LOGI(TAG, "Preferred PHY not available (%s) - connections stay on 1M", esp_err_to_name(ret));
+        }
+    }
+#else
+    if ((link_profile_.preferred_phys & ~PHY_PREF_1M) && !phy_unavailable_) {
+        phy_unavailable_ = true;
+        ESP_LOGW(TAG, "Preferred PHY ignored: CONFIG_BT_BLE_50_FEATURES_SUPPORTED is disabled - connections stay on 1M");
+    }
+#endif
+    
+    if (link_profile_.data_length && !data_length_unavailable_) {
+        esp_err_t ret = esp_ble_gap_set_pkt_data_len(link->bda, link_profile_.data_length);
+        if (ret == ESP_OK) {
+            pending_data_length_link_ = static_cast<int8_t>(link - links_);
+        } else {
+            data_length_unavailable_ = true;
+            ESP_LOGI(TAG, "Data length extension not available (%s) - connections use 27-byte PDUs",
+                     esp_err_to_name(ret));
+        }
+    }
+    
+    // Fast parameters for service discovery and the first transfer
+    apply_connection_params(*link, LinkMode::BULK);
+}
+
+void BLEServer::on_link_disconnected(uint16_t conn_id) {
+    Link* link = find_link(conn_id);
+    if (link) {
+        if (pending_data_length_link_ == link - links_) {
+            pending_data_length_link_ = -1;
+        }
+        link->in_use = false;
+    }
+}
+
+BLEServer::Link* BLEServer::find_link(uint16_t conn_id) {
+    for (auto& link : links_) {
+        if (link.in_use && link.conn_id == conn_id) {
+            return &link;
+        }
+    }
+    return nullptr;
+}
+
+BLEServer::Link* BLEServer::find_link_by_address(const esp_bd_addr_t bda) {
+    for (auto& link : links_) {
+        if (link.in_use && memcmp(link.bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            return &link;
+        }
+    }
+    return nullptr;
+}
+
+esp_err_t BLEServer::apply_connection_params(Link& link, LinkMode mode) {
+    const ConnectionParams& params = (mode == LinkMode::BULK) ? link_profile_.bulk : link_profile_.idle;
+    
+    esp_ble_conn_update_params_t conn_params = {};
+    memcpy(conn_params.bda, link.bda, sizeof(esp_bd_addr_t));
+    conn_params.min_int = params.min_interval;
+    conn_params.max_int = params.max_interval;
+    conn_params.latency = params.latency;
+    conn_params.timeout = params.timeout;
+    
+    ESP_LOGI(TAG, "Requesting %s connection parameters for conn_id %d: %d-%d x 1.25ms, latency %d",
+             (mode == LinkMode::BULK) ? "bulk" : "idle", link.conn_id,
+             params.min_interval, params.max_interval, params.latency);
+    esp_err_t ret = esp_ble_gap_update_conn_params(&conn_params);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Connection parameter update failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    link.info.mode = mode;
+    return ESP_OK;
+}
+
+void BLEServer::notify_link_update(uint16_t conn_id) {
+    for (auto& service : services_) {
+        service->on_link_update(conn_id);
+    }
+}
+
 esp_err_t BLEServer::init_bluetooth_stack() {
     ESP_LOGI(TAG, "Initializing Bluetooth stack");
     
@@ -226,6 +487,57 @@ esp_err_t BLEServer::init_bluetooth_stack() {
     return ESP_OK;
 }
 
+esp_err_t BLEServer::configure_security() {
+    ESP_LOGI(TAG, "Enabling bonding (%d bonded devices)", esp_ble_get_bond_device_num());
+    
+    // Secure connections with bonding, no input/output: "Just Works" pairing
+    esp_ble_auth_req_t auth_req = ESP_LE_AUTH_REQ_SC_BOND;
+    esp_ble_io_cap_t iocap = ESP_IO_CAP_NONE;
+    uint8_t key_size = 16;
+    uint8_t init_key = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
+    uint8_t rsp_key = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
+    
+    esp_err_t ret = esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth_req, sizeof(auth_req));
+    if (ret == ESP_OK) {
+        ret = esp_ble_gap_set_security_param(ESP_BLE_SM_IOCAP_MODE, &iocap, sizeof(iocap));
+    }
+    if (ret == ESP_OK) {
+        ret = esp_ble_gap_set_security_param(ESP_BLE_SM_MAX_KEY_SIZE, &key_size, sizeof(key_size));
+    }
+    if (ret == ESP_OK) {
+        ret = esp_ble_gap_set_security_param(ESP_BLE_SM_SET_INIT_KEY, &init_key, sizeof(init_key));
+    }
+    if (ret == ESP_OK) {
+        ret = esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY, &rsp_key, sizeof(rsp_key));
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Set security parameters failed: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+int BLEServer::get_bonded_device_count() const {
+    return esp_ble_get_bond_device_num();
+}
+
+esp_err_t BLEServer::remove_all_bonds() {
+    int count = esp_ble_get_bond_device_num();
+    if (count <= 0) {
+        return ESP_OK;
+    }
+    
+    std::vector<esp_ble_bond_dev_t> devices(count);
+    esp_err_t ret = esp_ble_get_bond_device_list(&count, devices.data());
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    for (int i = 0; i < count; i++) {
+        esp_ble_remove_bond_device(devices[i].bd_addr);
+    }
+    ESP_LOGI(TAG, "Removed %d bonded devices", count);
+    return ESP_OK;
+}
+
 esp_err_t BLEServer::register_callbacks() {
     ESP_LOGI(TAG, "Registering callbacks");
     
@@ -7,8 +7,11 @@
 
 #include "gatt_service.h"
 #include "advertising.h"
+#include "transfer_transport.h"
 #include "esp_gatts_api.h"
 #include "esp_gap_ble_api.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include <vector>
 #include <memory>
 
@@ -21,7 +24,7 @@
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
-
+    
     // Create and configure BLE server
     BLEServer ble_server;
     
@@ -51,8 +54,34 @@
     ESP_LOGI(TAG, "Ready to accept image transfers via BLE");
 
 */
-class BLEServer {
+class BLEServer : public LinkControl {
 public:
+    // Preferred PHY bits (same values as ESP_BLE_GAP_PHY_*_PREF_MASK)
+    static constexpr uint8_t PHY_PREF_1M = 0x01;
+    static constexpr uint8_t PHY_PREF_2M = 0x02;
+    static constexpr uint8_t PHY_PREF_CODED = 0x04;
+    
+    // Connection parameters requested from the central
+    struct ConnectionParams {
+        uint16_t min_interval;  // 1.25ms units
+        uint16_t max_interval;  // 1.25ms units
+        uint16_t latency;       // Connection events the peripheral may skip
+        uint16_t timeout;       // Supervision timeout, 10ms units
+    };
+    
+    // Link settings requested for every connection
+    struct LinkProfile {
+        uint8_t preferred_phys;     // PHY_PREF_* bits (needs CONFIG_BT_BLE_50_FEATURES_SUPPORTED, 0 = leave as is)
+        uint16_t data_length;       // LL PDU payload with data length extension, 27-251 bytes (0 = leave as is)
+        ConnectionParams bulk;      // While a transfer is running (and right after connecting)
+        ConnectionParams idle;      // Between transfers
+    };
+    static constexpr LinkProfile DEFAULT_LINK_PROFILE = {
+        PHY_PREF_2M, 251,
+        {0x06, 0x0C, 0, 400},       // 7.5-15ms, no latency, 4s timeout
+        {0x18, 0x28, 4, 400}        // 30-50ms, 4 events latency, 4s timeout
+    };
+    
     BLEServer();
     ~BLEServer();
     
@@ -65,9 +94,24 @@ public:
     void add_service(std::unique_ptr<GATTService> service);
     GATTService* get_service(uint16_t app_id);
     
-    // Advertising
+    // Advertising (fast: start with a short fast-advertising burst, e.g. right after a disconnect)
     AdvertisingManager& get_advertising_manager() { return advertising_manager_; }
-    esp_err_t restart_advertising();
+    esp_err_t restart_advertising(bool fast = false) override;
+    
+    // Bonding (call before init()): clients pair once ("Just Works") and are re-encrypted with
+    // the stored keys on every reconnect, which lets them keep their GATT cache
+    void set_bonding_enabled(bool enabled) { bonding_enabled_ = enabled; }
+    bool is_bonding_enabled() const { return bonding_enabled_; }
+    int get_bonded_device_count() const;
+    esp_err_t remove_all_bonds();
+    
+    // Link profile (applied to connections established afterwards)
+    void set_link_profile(const LinkProfile& profile) { link_profile_ = profile; }
+    const LinkProfile& get_link_profile() const { return link_profile_; }
+    // Request the bulk or idle connection parameters of the profile for a connection
+    esp_err_t set_link_mode(uint16_t conn_id, LinkMode mode) override;
+    // Negotiated PHY, data length and interval (LinkControl::LinkInfo); false if conn_id is not connected
+    bool get_link_info(uint16_t conn_id, LinkInfo* info) const override;
     
     // Event handlers (static callbacks for ESP-IDF)
     static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
@@ -77,21 +121,48 @@ public:
     static BLEServer* get_instance() { return instance_; }
     
 private:
+    static constexpr uint8_t MAX_LINKS = 4;  // Bluedroid default CONFIG_BT_ACL_CONNECTIONS
+    
+    struct Link {
+        bool in_use;
+        uint16_t conn_id;
+        esp_bd_addr_t bda;
+        LinkInfo info;
+    };
+    
     static BLEServer* instance_;
     
     std::vector<std::unique_ptr<GATTService>> services_;
     AdvertisingManager advertising_manager_;
     bool initialized_;
     bool started_;
+    bool bonding_enabled_;
     uint16_t local_mtu_;
     uint16_t connected_count_;
     
+    // Link state (GAP events identify connections by address, GATTS events by conn_id)
+    LinkProfile link_profile_;
+    Link links_[MAX_LINKS];
+    int8_t pending_data_length_link_; // Link of the last data length request (its event carries no address)
+    bool phy_unavailable_;            // Local PHY request failed once: later connections stay on 1M without asking
+    bool data_length_unavailable_;    // Same for data length extension (27-byte PDUs)
+    SemaphoreHandle_t link_mutex_;    // Services call set_link_mode() from their own tasks and timers
+    
     // Internal event handling
     void handle_gatts_event(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
     void handle_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
     
+    // Link helpers (called with link_mutex_ held; notify_link_update() without)
+    void on_link_connected(esp_ble_gatts_cb_param_t *param);
+    void on_link_disconnected(uint16_t conn_id);
+    Link* find_link(uint16_t conn_id);
+    Link* find_link_by_address(const esp_bd_addr_t bda);
+    esp_err_t apply_connection_params(Link& link, LinkMode mode);
+    void notify_link_update(uint16_t conn_id);
+    
     // Initialization helpers
     esp_err_t init_bluetooth_stack();
+    esp_err_t configure_security();
     esp_err_t register_callbacks();
     esp_err_t register_services();
 };
\ No newline at end of file
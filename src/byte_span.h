@@ -0,0 +1,42 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief ByteSpan - Non-owning view of a byte range
+ *
+ * Used to pass received data (e.g. param->write.value of a GATT write) down the
+ * ingest path without copying it. A span never outlives the buffer it points into:
+ * whoever needs the bytes after the call that received the span must copy them.
+ */
+struct ByteSpan {
+    const uint8_t* data;
+    uint32_t size;
+    
+    constexpr ByteSpan() : data(nullptr), size(0) {}
+    constexpr ByteSpan(const uint8_t* d, uint32_t s) : data(d), size(s) {}
+    
+    constexpr bool empty() const { return size == 0; }
+    constexpr const uint8_t* begin() const { return data; }
+    constexpr const uint8_t* end() const { return data + size; }
+    constexpr uint8_t operator[](uint32_t i) const { return data[i]; }
+    
+    // Little-endian uint16_t at 'offset' (no alignment requirement)
+    constexpr uint16_t read_u16(uint32_t offset) const {
+        return static_cast<uint16_t>(data[offset] | (data[offset + 1] << 8));
+    }
+    
+    // Bytes from 'offset' to the end (empty if offset is past the end)
+    constexpr ByteSpan subspan(uint32_t offset) const {
+        return (offset < size) ? ByteSpan(data + offset, size - offset) : ByteSpan();
+    }
+    // At most 'len' bytes from 'offset'
+    constexpr ByteSpan subspan(uint32_t offset, uint32_t len) const {
+        return (offset < size) ? ByteSpan(data + offset, (len < size - offset) ? len : size - offset) : ByteSpan();
+    }
+};
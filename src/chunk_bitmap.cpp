@@ -0,0 +1,128 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "chunk_bitmap.h"
+#include <cstring>
+#include "esp_heap_caps.h"
+
+ChunkBitmap::ChunkBitmap() : words_(nullptr), num_bits_(0), capacity_words_(0) {
+}
+
+ChunkBitmap::~ChunkBitmap() {
+    release();
+}
+
+bool ChunkBitmap::allocate(uint32_t num_bits) {
+    if (num_bits == 0) {
+        release();
+        return false;
+    }
+    
+    size_t words = (static_cast<size_t>(num_bits) + 31) >> 5;
+    if (words_ && words <= capacity_words_) {
+        // Storage kept by discard() (or a larger previous map) is reused
+        memset(words_, 0, words * sizeof(uint32_t));
+        num_bits_ = num_bits;
+        return true;
+    }
+    
+    release();
+    words_ = static_cast<uint32_t*>(heap_caps_calloc(words, sizeof(uint32_t), MALLOC_CAP_DEFAULT));
+    if (!words_) {
+        return false;
+    }
+    num_bits_ = num_bits;
+    capacity_words_ = words;
+    return true;
+}
+
+void ChunkBitmap::release() {
+    if (words_) {
+        heap_caps_free(words_);
+        words_ = nullptr;
+    }
+    num_bits_ = 0;
+    capacity_words_ = 0;
+}
+
+uint32_t ChunkBitmap::count_set(uint32_t begin, uint32_t end) const {
+    if (end > num_bits_) {
+        end = num_bits_;
+    }
+    if (begin >= end) {
+        return 0;
+    }
+    
+    uint32_t count = 0;
+    uint32_t first_word = begin >> 5;
+    uint32_t last_word = (end - 1) >> 5;
+    
+    for (uint32_t w = first_word; w <= last_word; w++) {
+        uint32_t word = words_[w];
+        if (w == first_word) {
+            word &= ~0u << (begin & 31);
+        }
+        if (w == last_word && (end & 31) != 0) {
+            word &= ~0u >> (32 - (end & 31));
+        }
+        count += __builtin_popcount(word);
+    }
+    return count;
+}
+
+uint32_t ChunkBitmap::find_bit(uint32_t from, uint32_t end, bool want_set) const {
+    if (end > num_bits_) {
+        end = num_bits_;
+    }
+    if (from >= end) {
+        return num_bits_;
+    }
+    
+    uint32_t w = from >> 5;
+    uint32_t last_word = (end - 1) >> 5;
+    
+    // Invert the words when looking for clear bits so both cases search for a 1
+    uint32_t word = want_set ? words_[w] : ~words_[w];
+    word &= ~0u << (from & 31);
+    
+    while (true) {
+        if (word != 0) {
+            uint32_t bit = (w << 5) + __builtin_ctz(word);
+            return (bit < end) ? bit : num_bits_;
+        }
+        if (++w > last_word) {
+            return num_bits_;
+        }
+        word = want_set ? words_[w] : ~words_[w];
+    }
+}
+
+uint32_t ChunkBitmap::next_missing(uint32_t from) const {
+    return find_bit(from, num_bits_, false);
+}
+
+uint32_t ChunkBitmap::next_set(uint32_t from) const {
+    return find_bit(from, num_bits_, true);
+}
+
+bool ChunkBitmap::find_missing_run(uint32_t begin, uint32_t end, uint32_t* run_start, uint32_t* run_length) const {
+    if (end > num_bits_) {
+        end = num_bits_;
+    }
+    
+    uint32_t start = find_bit(begin, end, false);
+    if (start >= end) {
+        return false;
+    }
+    
+    uint32_t stop = find_bit(start, end, true);
+    if (stop > end) {
+        stop = end;
+    }
+    
+    *run_start = start;
+    *run_length = stop - start;
+    return true;
+}
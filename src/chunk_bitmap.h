@@ -0,0 +1,68 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief ChunkBitmap - Bit-packed received-chunk map
+ * 
+ * Stores one bit per chunk in 32-bit words (8x smaller than a bool array) and
+ * finds gaps a word at a time with count-trailing-zeros, so scanning a 1MB
+ * transfer (~2000 chunks) touches only ~64 words.
+ * 
+ * All search functions use half-open ranges [begin, end) and return size()
+ * when nothing was found.
+ */
+class ChunkBitmap {
+public:
+    ChunkBitmap();
+    ~ChunkBitmap();
+    
+    ChunkBitmap(const ChunkBitmap&) = delete;
+    ChunkBitmap& operator=(const ChunkBitmap&) = delete;
+    
+    // Allocate a cleared map for num_bits chunks (reuses the previous storage if it is large enough)
+    bool allocate(uint32_t num_bits);
+    void release();
+    // Empty the map but keep its storage for the next allocate()
+    void discard() { num_bits_ = 0; }
+    
+    bool is_allocated() const { return num_bits_ != 0; }
+    uint32_t size() const { return num_bits_; }
+    size_t memory_bytes() const { return capacity_words_ * sizeof(uint32_t); }
+    
+    bool test(uint32_t bit) const {
+        return (words_[bit >> 5] >> (bit & 31)) & 1u;
+    }
+    void set(uint32_t bit) {
+        words_[bit >> 5] |= (1u << (bit & 31));
+    }
+    void clear(uint32_t bit) {
+        words_[bit >> 5] &= ~(1u << (bit & 31));
+    }
+    
+    // Number of set bits in [begin, end)
+    uint32_t count_set(uint32_t begin, uint32_t end) const;
+    
+    // First clear bit at or after 'from' (size() if every bit from there on is set)
+    uint32_t next_missing(uint32_t from) const;
+    
+    // First set bit at or after 'from' (size() if none)
+    uint32_t next_set(uint32_t from) const;
+    
+    // First run of clear bits in [begin, end); returns false if the range has no gaps
+    bool find_missing_run(uint32_t begin, uint32_t end, uint32_t* run_start, uint32_t* run_length) const;
+    
+private:
+    uint32_t* words_;
+    uint32_t num_bits_;
+    size_t capacity_words_;           // Allocated words (>= word_count())
+    
+    size_t word_count() const { return (num_bits_ + 31) >> 5; }
+    uint32_t find_bit(uint32_t from, uint32_t end, bool want_set) const;
+};
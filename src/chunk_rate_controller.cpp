@@ -0,0 +1,60 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "chunk_rate_controller.h"
+
+constexpr ChunkRateController::Config ChunkRateController::DEFAULT_CONFIG;
+
+ChunkRateController::ChunkRateController()
+    : config_(DEFAULT_CONFIG), batch_size_(DEFAULT_CONFIG.min_chunks), round_start_us_(0),
+      best_chunk_time_us_(0), out_of_range_chunks_(0), duplicate_chunks_(0), timeouts_(0) {
+}
+
+void ChunkRateController::reset(uint16_t initial_chunks, int64_t now_us) {
+    batch_size_ = clamp(initial_chunks);
+    round_start_us_ = now_us;
+    best_chunk_time_us_ = 0;
+    out_of_range_chunks_ = 0;
+    duplicate_chunks_ = 0;
+    timeouts_ = 0;
+}
+
+uint16_t ChunkRateController::end_round(int64_t now_us, uint32_t chunks_delivered) {
+    bool loss = (out_of_range_chunks_ > 0) || (duplicate_chunks_ > 0) || (timeouts_ > 0);
+    
+    if (loss) {
+        // Multiplicative decrease: the client or the link cannot keep up with this batch size
+        batch_size_ = clamp(static_cast<uint32_t>(batch_size_) * config_.decrease_percent / 100);
+    } else if (chunks_delivered > 0 && now_us > round_start_us_) {
+        uint32_t chunk_time_us = static_cast<uint32_t>((now_us - round_start_us_) / chunks_delivered);
+        
+        if (best_chunk_time_us_ == 0 || chunk_time_us < best_chunk_time_us_) {
+            best_chunk_time_us_ = chunk_time_us;
+        }
+        
+        // Additive increase while per-chunk time stays close to the best observed
+        uint32_t tolerated_us = best_chunk_time_us_ +
+                                best_chunk_time_us_ * config_.latency_tolerance_percent / 100;
+        if (chunk_time_us <= tolerated_us) {
+            batch_size_ = clamp(static_cast<uint32_t>(batch_size_) + config_.increase_step);
+        }
+    }
+    
+    round_start_us_ = now_us;
+    out_of_range_chunks_ = 0;
+    duplicate_chunks_ = 0;
+    timeouts_ = 0;
+    return batch_size_;
+}
+
+uint16_t ChunkRateController::clamp(uint32_t chunks) const {
+    if (chunks < config_.min_chunks) {
+        return config_.min_chunks;
+    }
+    if (chunks > config_.max_chunks) {
+        return config_.max_chunks;
+    }
+    return static_cast<uint16_t>(chunks);
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief ChunkRateController - AIMD controller for the chunks-per-request batch size
+ * 
+ * A "round" is the interval between two consecutive CHUNK_REQUESTs that open new
+ * chunk ranges. At the end of each round the controller looks at what happened:
+ * - Loss signals (out-of-range chunks, duplicates, batch timeouts) → multiplicative decrease
+ * - Per-chunk round time close to the best observed → additive increase
+ * - Per-chunk round time clearly above the best observed (queueing) → hold
+ * 
+ * The controller is platform independent: timestamps are passed in by the caller
+ * (esp_timer_get_time() on target).
+ */
+class ChunkRateController {
+public:
+    struct Config {
+        uint16_t min_chunks;                 // Lower bound for the batch size
+        uint16_t max_chunks;                 // Upper bound for the batch size
+        uint16_t increase_step;              // Additive increase per clean round
+        uint8_t decrease_percent;            // New size in percent of old size after loss
+        uint8_t latency_tolerance_percent;   // Allowed per-chunk time above best before holding
+    };
+    
+    static constexpr Config DEFAULT_CONFIG = {
+        8,      // min_chunks
+        160,    // max_chunks
+        4,      // increase_step
+        50,     // decrease_percent
+        25      // latency_tolerance_percent
+    };
+    
+    ChunkRateController();
+    
+    void set_config(const Config& config) { config_ = config; }
+    const Config& get_config() const { return config_; }
+    
+    // Start a new transfer with the given batch size (clamped to the configured bounds)
+    void reset(uint16_t initial_chunks, int64_t now_us);
+    
+    // Loss signals observed during the current round
+    void on_out_of_range_chunk() { out_of_range_chunks_++; }
+    void on_duplicate_chunk() { duplicate_chunks_++; }
+    void on_timeout() { timeouts_++; }
+    
+    // Close the current round and return the batch size to use for the next request
+    uint16_t end_round(int64_t now_us, uint32_t chunks_delivered);
+    
+    uint16_t get_batch_size() const { return batch_size_; }
+    uint32_t get_best_chunk_time_us() const { return best_chunk_time_us_; }
+    
+private:
+    Config config_;
+    uint16_t batch_size_;
+    int64_t round_start_us_;
+    uint32_t best_chunk_time_us_;   // Lowest observed per-chunk round time (0 = unknown)
+    
+    // Loss signals accumulated in the current round
+    uint16_t out_of_range_chunks_;
+    uint16_t duplicate_chunks_;
+    uint16_t timeouts_;
+    
+    uint16_t clamp(uint32_t chunks) const;
+};
@@ -0,0 +1,138 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "delta_patcher.h"
+#include "esp_log.h"
+#include <cstring>
+
+static const char* TAG = "DeltaPatcher";
+
+constexpr uint8_t DeltaPatcher::HEADER_SIZE;
+
+static uint32_t read_le32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+DeltaPatcher::DeltaPatcher()
+    : base_(nullptr), base_size_(0), base_crc_(0), state_(State::HEADER), field_(), field_fill_(0),
+      data_remaining_(0), failed_(false), base_mismatch_(false) {
+}
+
+void DeltaPatcher::begin(const uint8_t* base, uint32_t base_size, uint32_t base_crc) {
+    base_ = base;
+    base_size_ = base ? base_size : 0;
+    base_crc_ = base_crc;
+    state_ = State::HEADER;
+    field_fill_ = 0;
+    data_remaining_ = 0;
+    failed_ = false;
+    base_mismatch_ = false;
+}
+
+bool DeltaPatcher::feed(const uint8_t* data, uint32_t len, OutputCallback output, void* ctx) {
+    if (failed_) {
+        return false;
+    }
+    
+    while (len > 0) {
+        if (state_ == State::DATA) {
+            // Literal bytes are passed through without copying
+            uint32_t take = (len < data_remaining_) ? len : data_remaining_;
+            if (!output(ctx, data, take)) {
+                return false;
+            }
+            data += take;
+            len -= take;
+            data_remaining_ -= take;
+            if (data_remaining_ == 0) {
+                state_ = State::OP;
+            }
+            continue;
+        }
+        
+        field_[field_fill_++] = *data++;
+        len--;
+        if (field_fill_ < field_size(state_)) {
+            continue;
+        }
+        field_fill_ = 0;
+        if (!process_field(output, ctx)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint8_t DeltaPatcher::field_size(State state) {
+    switch (state) {
+        case State::HEADER:
+            return HEADER_SIZE;
+        case State::OP:
+            return 1;
+        case State::COPY_ARGS:
+            return 8;
+        case State::DATA_ARGS:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+bool DeltaPatcher::process_field(OutputCallback output, void* ctx) {
+    switch (state_) {
+        case State::HEADER: {
+            uint32_t crc = read_le32(field_);
+            uint32_t size = read_le32(field_ + 4);
+            if (!base_ || crc != base_crc_ || size != base_size_) {
+                ESP_LOGW(TAG, "Patch base 0x%08lX (%lu bytes) does not match retained base 0x%08lX (%lu bytes)",
+                         crc, size, base_crc_, base_size_);
+                base_mismatch_ = true;
+                failed_ = true;
+                return false;
+            }
+            state_ = State::OP;
+            return true;
+        }
+        
+        case State::OP:
+            if (field_[0] == static_cast<uint8_t>(Op::COPY)) {
+                state_ = State::COPY_ARGS;
+            } else if (field_[0] == static_cast<uint8_t>(Op::DATA)) {
+                state_ = State::DATA_ARGS;
+            } else {
+                ESP_LOGE(TAG, "Unknown patch op 0x%02X", field_[0]);
+                failed_ = true;
+                return false;
+            }
+            return true;
+        
+        case State::COPY_ARGS: {
+            uint32_t offset = read_le32(field_);
+            uint32_t length = read_le32(field_ + 4);
+            if (length == 0 || offset > base_size_ || length > base_size_ - offset) {
+                ESP_LOGE(TAG, "COPY %lu+%lu outside base of %lu bytes", offset, length, base_size_);
+                failed_ = true;
+                return false;
+            }
+            state_ = State::OP;
+            return output(ctx, base_ + offset, length);
+        }
+        
+        case State::DATA_ARGS:
+            data_remaining_ = read_le32(field_);
+            if (data_remaining_ == 0) {
+                ESP_LOGE(TAG, "Empty DATA op");
+                failed_ = true;
+                return false;
+            }
+            state_ = State::DATA;
+            return true;
+        
+        default:
+            failed_ = true;
+            return false;
+    }
+}
@@ -0,0 +1,74 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief DeltaPatcher - Streaming block-level patch applier
+ *
+ * Rebuilds a new image from a base image (the previously received one) and a
+ * patch stream that is fed in arbitrary pieces. Copied ranges are emitted
+ * straight from the base and literal data straight from the input, so the
+ * patcher needs no buffers of its own.
+ *
+ * Patch format (little-endian):
+ *   [base_crc u32][base_size u32]           header, must match the base
+ *   [COPY u8][offset u32][length u32]       copy length bytes of the base
+ *   [DATA u8][length u32][length bytes]     literal bytes
+ *
+ * Ops may appear in any order and number; the emitted bytes form the new image.
+ */
+class DeltaPatcher {
+public:
+    static constexpr uint8_t HEADER_SIZE = 8;
+    
+    enum class Op : uint8_t {
+        COPY = 0x01,
+        DATA = 0x02
+    };
+    
+    // Receives each output range; returning false stops patching
+    typedef bool (*OutputCallback)(void* ctx, const uint8_t* data, uint32_t len);
+    
+    DeltaPatcher();
+    
+    // Start a patch against base (nullptr = no base, any patch is rejected)
+    void begin(const uint8_t* base, uint32_t base_size, uint32_t base_crc);
+    
+    // Apply the next piece of the patch; false on malformed input or callback failure
+    bool feed(const uint8_t* data, uint32_t len, OutputCallback output, void* ctx);
+    
+    // True between ops, i.e. the patch so far is complete
+    bool is_idle() const { return state_ == State::OP; }
+    // True if feed() failed because of the patch (not because of the callback)
+    bool has_failed() const { return failed_; }
+    // True if the patch was made against a different base
+    bool base_mismatch() const { return base_mismatch_; }
+
+private:
+    enum class State : uint8_t {
+        HEADER,
+        OP,
+        COPY_ARGS,
+        DATA_ARGS,
+        DATA
+    };
+    
+    const uint8_t* base_;
+    uint32_t base_size_;
+    uint32_t base_crc_;
+    State state_;
+    uint8_t field_[HEADER_SIZE];      // Header or op arguments being collected
+    uint8_t field_fill_;
+    uint32_t data_remaining_;         // Literal bytes left in the current DATA op
+    bool failed_;
+    bool base_mismatch_;
+    
+    static uint8_t field_size(State state);
+    bool process_field(OutputCallback output, void* ctx);
+};
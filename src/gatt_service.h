@@ -10,6 +10,8 @@
 #include <cstdint>
 #include <cstring>
 
+class LinkControl;
+
 class GATTService {
 public:
     virtual ~GATTService() = default;
@@ -17,6 +19,10 @@ public:
     // Pure virtual methods that derived services must implement
     virtual void handle_event(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param) = 0;
     virtual void init(esp_gatt_if_t gatts_if) = 0;
+    // PHY, data length or connection interval of a connection changed (see LinkControl::get_link_info())
+    virtual void on_link_update(uint16_t conn_id) {}
+    // Set by the server the service is added to
+    void set_link_control(LinkControl* link_control) { link_control_ = link_control; }
     
     // Getters
     uint16_t get_app_id() const { return app_id_; }
@@ -25,7 +31,8 @@ public:
     
 protected:
     GATTService(uint16_t app_id, const uint8_t* service_uuid, uint16_t num_handles)
-        : app_id_(app_id), service_handle_(0), gatts_if_(ESP_GATT_IF_NONE), num_handles_(num_handles) {
+        : app_id_(app_id), service_handle_(0), gatts_if_(ESP_GATT_IF_NONE), num_handles_(num_handles),
+          link_control_(nullptr) {
         memcpy(service_uuid_, service_uuid, ESP_UUID_LEN_128);
     }
     
@@ -39,4 +46,5 @@ protected:
     esp_gatt_if_t gatts_if_;
     uint16_t num_handles_;
     uint8_t service_uuid_[ESP_UUID_LEN_128];
+    LinkControl* link_control_;
 };
\ No newline at end of file
@@ -4,22 +4,32 @@
 // created with the help of Claude AI
 
 #include "image_service.h"
+#include "transfer_session.h"
+#include "state_lock.h"
+#include "transfer_log.h"
 #include <cstring>
 #include <cstdlib>
+#include <utility>
 #include "esp_heap_caps.h"
-#include "ble_server.h"
-
-// Uncomment for detailed chunk logging (impacts performance)
-// #define CHUNK_LOGGING
-
-#ifdef CHUNK_LOGGING
-    #define CHUNK_LOG(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
-#else
-    #define CHUNK_LOG(tag, format, ...) do {} while(0)
-#endif
+#include "esp_timer.h"
 
 static const char* TAG = "ImageService";
 
+constexpr ImageService::IngestConfig ImageService::DEFAULT_INGEST_CONFIG;
+constexpr ImageService::CompletionConfig ImageService::DEFAULT_COMPLETION_CONFIG;
+constexpr uint32_t ImageService::MAX_CHUNKS;
+constexpr uint32_t ImageService::MAX_CHUNKS_PER_REQUEST;
+constexpr uint8_t ImageService::TRANSFER_FLAGS_INDEX;
+constexpr uint8_t ImageService::TRANSFER_TYPE_MASK;
+constexpr uint8_t ImageService::TRANSFER_FLAG_DELTA;
+constexpr uint8_t ImageService::TRANSFER_FLAG_LZ4;
+constexpr uint8_t ImageService::TRANSFER_FLAG_CRC32;
+constexpr uint8_t ImageService::MAX_SESSIONS;
+constexpr uint8_t ImageService::DEFAULT_MAX_SESSIONS;
+constexpr uint8_t ImageService::STATS_PAGE_COUNT;
+constexpr uint8_t ImageService::BENCHMARK_PAGE_COUNT;
+constexpr uint8_t ImageService::MAX_DATA_CHANNELS;
+
 // 128-bit UUID: 6E400001-B5A3-F393-E0A9-E50E24DCCA9E
 static uint8_t service_uuid_image[16] = {
     0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0,
@@ -28,30 +38,108 @@ static uint8_t service_uuid_image[16] = {
 
 ImageService::ImageService() 
     : GATTService(APP_ID, service_uuid_image, NUM_HANDLES),
-      control_char_handle_(0), data_char_handle_(0), 
-      control_notify_handle_(0), data_notify_handle_(0),
-      conn_id_(0), mtu_(23),
-      control_notifications_enabled_(false), data_notifications_enabled_(false),
-      char_count_(0), descr_count_(0), char_creation_state_(CharCreationState::WAITING_FOR_CONTROL),
-      status_(Status::IDLE), sequence_number_(0),
-      total_size_(0), chunk_size_(0), expected_chunks_(0),
-      image_buffer_(nullptr), received_size_(0), next_expected_chunk_(0),
-      chunk_received_map_(nullptr),
-      current_request_start_(0), current_request_end_(0), chunks_per_request_(DEFAULT_CHUNKS_PER_REQUEST),
-      total_chunks_received_(0), current_batch_received_(0),
-      image_callback_(nullptr),
+      control_char_handle_(0), data_char_handles_(), 
+      control_notify_handle_(0), data_notify_handles_{},
+      char_count_(0), descr_count_(0), data_channel_count_(1), data_channels_created_(0), char_creation_state_(CharCreationState::WAITING_FOR_CONTROL),
+      default_arena_(MAX_TRANSFER_SIZE, DEFAULT_BUFFER_SLOTS), allocator_(nullptr), transport_(&gatts_transport_),
+      max_sessions_(DEFAULT_MAX_SESSIONS), session_memory_budget_(0), primary_session_(nullptr),
+      sink_(nullptr), firmware_sink_(nullptr), reorder_window_chunks_(DEFAULT_REORDER_WINDOW_CHUNKS),
+      delta_base_enabled_(false), base_crc_(0), pending_base_updates_(0),
+      chunks_per_request_(DEFAULT_CHUNKS_PER_REQUEST), flow_mode_(FlowMode::STOP_AND_WAIT),
+      adaptive_batching_(false), rate_config_(ChunkRateController::DEFAULT_CONFIG),
+      resume_grace_ms_(RESUME_GRACE_PERIOD_MS),
+      state_mutex_(nullptr),
+      ingest_task_(nullptr), ingest_enabled_(false), ingest_stop_(false), ingest_mutex_(nullptr), ingest_exited_(nullptr),
+      transfer_generation_(0), ingest_dropped_chunks_(0),
+      completion_enabled_(false), completion_depth_(0), completion_queue_(nullptr), completion_exited_(nullptr), completion_task_(nullptr),
+      download_crc_tasks_(0), download_crc_waiter_(nullptr),
+      image_callback_(nullptr), firmware_callback_(nullptr),
+      download_request_callback_(nullptr), download_complete_callback_(nullptr),
+      progress_callback_(nullptr), progress_step_(DEFAULT_PROGRESS_STEP),
       device_type_(0), battery_level_(0), width_(0), height_(0) {
+    // Reuse PSRAM arena slots for all transfers; per-transfer heap allocation if none fits
+    if (default_arena_.init()) {
+        allocator_ = &default_arena_;
+    } else {
+        ESP_LOGW(TAG, "Transfer arena unavailable - using per-transfer heap allocation");
+        allocator_ = &heap_allocator_;
+    }
+    
+    state_mutex_ = xSemaphoreCreateMutex();
+    if (!state_mutex_) {
+        ESP_LOGE(TAG, "Failed to create state mutex");
+    }
+    ingest_mutex_ = xSemaphoreCreateMutex();
+    if (!ingest_mutex_) {
+        ESP_LOGE(TAG, "Failed to create ingest mutex");
+    }
+    
+    if (!tx_scheduler_.init(state_mutex_)) {
+        ESP_LOGE(TAG, "Failed to initialize notification scheduler");
+    }
+    tx_scheduler_.set_coalesce_callback(&ImageService::coalesce_control_message);
+    tx_scheduler_.set_transport(transport_);
+    
+    // Sessions are small (buffers are only allocated per transfer), so the pool is created up front
+    for (auto& session : sessions_) {
+        session.reset(new TransferSession(*this));
+    }
+    primary_session_ = sessions_[0].get();
 }
 
 ImageService::~ImageService() {
-    reset_transfer();
+    disable_ingest_task();
+    if (ingest_task_) {
+        // Past the stop timeout (e.g. a stalled sink): it still works on the sessions and the state mutex
+        ESP_LOGE(TAG, "Waiting for the ingest task to exit before tearing down the service");
+        reap_ingest_task(portMAX_DELAY);
+    }
+    disable_completion_worker();
+    if (completion_task_) {
+        // Still inside the image callback: it reads the callback and the queue of this service
+        ESP_LOGE(TAG, "Waiting for the completion worker to exit before tearing down the service");
+        reap_completion_task(portMAX_DELAY);
+    }
+    stop_download_crc_tasks();
+    
+    // Sessions abort their transfers and delete their timers
+    for (auto& session : sessions_) {
+        session.reset();
+    }
+    primary_session_ = nullptr;
+    tx_scheduler_.release();
+    
+    if (state_mutex_) {
+        vSemaphoreDelete(state_mutex_);
+        state_mutex_ = nullptr;
+    }
+    if (ingest_mutex_) {
+        vSemaphoreDelete(ingest_mutex_);
+        ingest_mutex_ = nullptr;
+    }
 }
 
 void ImageService::init(esp_gatt_if_t gatts_if) {
     set_gatts_if(gatts_if);
+    gatts_transport_.set_gatts_if(gatts_if);
+    gatts_transport_.set_link_control(link_control_);
+}
+
+void ImageService::set_transport(TransferTransport* transport) {
+    StateLock lock(state_mutex_);
+    transport_ = transport ? transport : &gatts_transport_;
+    tx_scheduler_.set_transport(transport_);
 }
 
 void ImageService::handle_event(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param) {
+    // Ingest fast path: data writes are only copied into the ring, no state lock taken
+    if (event == ESP_GATTS_WRITE_EVT && is_data_char_handle(param->write.handle) &&
+        ingest_enabled_.load(std::memory_order_acquire) && enqueue_data_chunk(gatts_if, param)) {
+        return;
+    }
+    
+    StateLock lock(state_mutex_);
+    
     switch (event) {
     case ESP_GATTS_REG_EVT:
         handle_reg_event(param);
@@ -77,43 +165,89 @@ void ImageService::handle_event(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_
     case ESP_GATTS_MTU_EVT:
         handle_mtu_event(param);
         break;
+    case ESP_GATTS_CONGEST_EVT:
+        // Sends are held back while the link is congested and resume when it clears
+        tx_scheduler_.on_congestion(param->congest.conn_id, param->congest.congested);
+        break;
     default:
         break;
     }
 }
 
-void ImageService::release_image_buffer() {
-    if (image_buffer_) {
-        ESP_LOGI(TAG, "Releasing image buffer (%lu bytes)", total_size_);
-        free(image_buffer_);
-        image_buffer_ = nullptr;
-    } else {
-        ESP_LOGW(TAG, "Image buffer already released or never allocated");
+void ImageService::set_buffer_allocator(TransferBufferAllocator* allocator) {
+    StateLock lock(state_mutex_);
+    // Buffers already handed out keep a reference to the allocator that created them
+    allocator_ = allocator ? allocator : (default_arena_.is_initialized() ?
+                                          static_cast<TransferBufferAllocator*>(&default_arena_) :
+                                          static_cast<TransferBufferAllocator*>(&heap_allocator_));
+}
+
+void ImageService::set_transfer_sink(TransferSink* sink) {
+    StateLock lock(state_mutex_);
+    // A running streamed transfer cannot switch sinks
+    for (auto& session : sessions_) {
+        if (session->is_streaming()) {
+            session->reset_transfer();
+        }
+    }
+    sink_ = sink;
+}
+
+void ImageService::set_firmware_sink(TransferSink* sink) {
+    StateLock lock(state_mutex_);
+    for (auto& session : sessions_) {
+        if (session->is_streaming()) {
+            session->reset_transfer();
+        }
     }
+    firmware_sink_ = sink;
+}
+
+void ImageService::set_delta_base_enabled(bool enabled) {
+    StateLock lock(state_mutex_);
+    delta_base_enabled_ = enabled;
+    if (!enabled) {
+        base_image_.reset();
+        base_crc_ = 0;
+    }
+}
+
+void ImageService::set_max_sessions(uint8_t max_sessions) {
+    StateLock lock(state_mutex_);
+    max_sessions_ = (max_sessions == 0) ? 1 : (max_sessions > MAX_SESSIONS) ? MAX_SESSIONS : max_sessions;
+}
+
+void ImageService::set_data_channel_count(uint8_t count) {
+    StateLock lock(state_mutex_);
+    data_channel_count_ = (count == 0) ? 1 : (count > MAX_DATA_CHANNELS) ? MAX_DATA_CHANNELS : count;
+}
+
+bool ImageService::is_data_char_handle(uint16_t handle) const {
+    for (uint8_t channel = 0; channel < data_channels_created_; channel++) {
+        if (data_char_handles_[channel] == handle) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int ImageService::data_notify_channel(uint16_t handle) const {
+    for (uint8_t channel = 0; channel < data_channels_created_; channel++) {
+        if (data_notify_handles_[channel] != 0 && data_notify_handles_[channel] == handle) {
+            return channel;
+        }
+    }
+    return -1;
+}
+
+void ImageService::release_image_buffer() {
+    primary_session_->release_image_buffer();
 }
 
 void ImageService::reset_transfer() {
-    // release_image_buffer();
-    // DO NOT release image_buffer here, as it may be used by the callback
-    // MUST BE freed by the user after processing the image data
-    
-    if (chunk_received_map_) {
-        free(chunk_received_map_);
-        chunk_received_map_ = nullptr;
+    for (auto& session : sessions_) {
+        session->reset_transfer();
     }
-    
-    total_size_ = 0;
-    chunk_size_ = 0;
-    expected_chunks_ = 0;
-    received_size_ = 0;
-    next_expected_chunk_ = 0;
-    current_request_start_ = 0;
-    current_request_end_ = 0;
-    total_chunks_received_ = 0;
-    current_batch_received_ = 0;
-    status_ = Status::IDLE;
-    
-    ESP_LOGI(TAG, "Image transfer reset");
 }
 
 void ImageService::handle_reg_event(esp_ble_gatts_cb_param_t *param) {
@@ -125,10 +259,11 @@ void ImageService::handle_reg_event(esp_ble_gatts_cb_param_t *param) {
     descr_count_ = 0;
     char_creation_state_ = CharCreationState::WAITING_FOR_CONTROL;
     control_char_handle_ = 0;
-    data_char_handle_ = 0;
+    memset(data_char_handles_, 0, sizeof(data_char_handles_));
+    data_channels_created_ = 0;
     control_notify_handle_ = 0;
-    data_notify_handle_ = 0;
-    // Note: Keep conn_id_ if already connected
+    memset(data_notify_handles_, 0, sizeof(data_notify_handles_));
+    // Note: Sessions keep their connections
     
     ESP_LOGI(TAG, "Service handles reset for new registration");
     
@@ -240,36 +375,16 @@ void ImageService::handle_add_char_event(esp_ble_gatts_cb_param_t *param) {
         ESP_LOGI(TAG, "✅ Control characteristic ready - handle: %d", control_char_handle_);
         
         // Create CCCD descriptor immediately for control characteristic
-        ESP_LOGI(TAG, "Creating CCCD descriptor for control characteristic...");
-        
-        esp_bt_uuid_t notify_descr_uuid;
-        notify_descr_uuid.len = ESP_UUID_LEN_16;
-        notify_descr_uuid.uuid.uuid16 = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
-        
-        // CCCD initial value (notifications disabled)
-        uint8_t cccd_value[2] = {0x00, 0x00};
-        esp_attr_value_t cccd_val = {
-            .attr_max_len = 2,
-            .attr_len = 2,
-            .attr_value = cccd_value
-        };
-        
-        ESP_LOGI(TAG, "Adding CCCD descriptor for control characteristic (handle %d)...", control_char_handle_);
-        esp_err_t ret = esp_ble_gatts_add_char_descr(get_service_handle(), &notify_descr_uuid,
-                                                   ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-                                                   &cccd_val, nullptr);
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "CRITICAL: Failed to add control CCCD descriptor: %s (0x%x)", esp_err_to_name(ret), ret);
-        } else {
-            ESP_LOGI(TAG, "CCCD descriptor creation initiated - waiting for add event...");
-        }
+        add_notify_descriptor("control");
         
     } else if (char_creation_state_ == CharCreationState::WAITING_FOR_DATA) {
-        // This should be the data characteristic
-        data_char_handle_ = param->add_char.attr_handle;
-        char_creation_state_ = CharCreationState::BOTH_CREATED;
-        ESP_LOGI(TAG, "✅ Data characteristic ready - handle: %d", data_char_handle_);
-        ESP_LOGI(TAG, "✅ Both characteristics created successfully");
+        // This should be the next data channel; its CCCD follows before the next channel
+        data_char_handles_[data_channels_created_] = param->add_char.attr_handle;
+        char_creation_state_ = CharCreationState::WAITING_FOR_DATA_CCCD;
+        ESP_LOGI(TAG, "✅ Data characteristic %d ready - handle: %d", data_channels_created_,
+                 param->add_char.attr_handle);
+        
+        add_notify_descriptor("data");
         
     } else {
         ESP_LOGW(TAG, "Unexpected characteristic add event in state: %d (count: %d)", 
@@ -289,19 +404,33 @@ void ImageService::handle_add_char_descr_event(esp_ble_gatts_cb_param_t *param)
     }
     
     /**
-     * Store descriptor handles based on creation order
-     * Currently only creating control CCCD descriptor
+     * Store descriptor handles based on creation state
+     * The control CCCD comes first, then one CCCD after each data characteristic
      */
     descr_count_++;
     ESP_LOGI(TAG, "CCCD descriptor successfully created - count: %d", descr_count_);
     
-    if (descr_count_ == 1 && char_creation_state_ == CharCreationState::WAITING_FOR_CONTROL_CCCD) {
+    if (char_creation_state_ == CharCreationState::WAITING_FOR_CONTROL_CCCD) {
         control_notify_handle_ = param->add_char_descr.attr_handle;
         ESP_LOGI(TAG, "✅ Control CCCD descriptor ready - handle: %d", control_notify_handle_);
         ESP_LOGI(TAG, "Control characteristic setup complete - now creating data characteristic");
         
         // Now that control characteristic and its CCCD are ready, create data characteristic
-        create_data_characteristic();
+        create_data_characteristic(0);
+        
+    } else if (char_creation_state_ == CharCreationState::WAITING_FOR_DATA_CCCD) {
+        data_notify_handles_[data_channels_created_] = param->add_char_descr.attr_handle;
+        ESP_LOGI(TAG, "✅ Data %d CCCD descriptor ready - handle: %d", data_channels_created_,
+                 param->add_char_descr.attr_handle);
+        data_channels_created_++;
+        
+        // Channels are created one after another, like control and data above
+        if (data_channels_created_ < data_channel_count_) {
+            create_data_characteristic(data_channels_created_);
+        } else {
+            char_creation_state_ = CharCreationState::BOTH_CREATED;
+            ESP_LOGI(TAG, "✅ All characteristics created successfully (%d data channels)", data_channels_created_);
+        }
         
     } else {
         ESP_LOGW(TAG, "Unexpected descriptor event: count=%d, state=%d", 
@@ -310,584 +439,621 @@ void ImageService::handle_add_char_descr_event(esp_ble_gatts_cb_param_t *param)
 }
 
 void ImageService::handle_write_event(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param) {
-    ESP_LOGI(TAG, "Write event: conn_id %d, handle %d, len %d", 
-             param->write.conn_id, param->write.handle, param->write.len);
-    
-    ESP_LOGI(TAG, "Handle comparison: control_char=%d, data_char=%d, control_notify=%d, data_notify=%d",
-             control_char_handle_, data_char_handle_, control_notify_handle_, data_notify_handle_);
-    
-    // Route to appropriate handler based on handle
-    if (param->write.handle == control_char_handle_) {
-        ESP_LOGI(TAG, "Control message received");
-        handle_control_message(gatts_if, param->write.value, param->write.len);
-    } else if (param->write.handle == data_char_handle_) {
-        ESP_LOGI(TAG, "Data chunk received");
-        handle_data_chunk(param->write.value, param->write.len);
-    } else if (param->write.handle == control_notify_handle_) {
+    TRANSFER_TRACE(GATT_WRITE, param->write.conn_id, param->write.handle, param->write.len);
+    HOT_PATH_LOG(TAG, "Write event: conn_id %d, handle %d, len %d", 
+                 param->write.conn_id, param->write.handle, param->write.len);
+    
+    CHUNK_LOG(TAG, "Handle comparison: control_char=%d, data_char=%d (+%d), control_notify=%d, data_notify=%d",
+              control_char_handle_, data_char_handles_[0], data_channels_created_ - 1,
+              control_notify_handle_, data_notify_handles_[0]);
+    
+    process_write(param->write.conn_id, param->write.handle, param->write.value, param->write.len);
+    
+    // Send response if needed
+    if (param->write.need_rsp) {
+        esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, 
+                                  ESP_GATT_OK, nullptr);
+    }
+}
+
+void ImageService::process_write(uint16_t conn_id, uint16_t handle, const uint8_t* value, uint16_t len) {
+    // Writes go to the session of the writing connection
+    TransferSession* session = find_session(conn_id);
+    if (!session) {
+        ESP_LOGW(TAG, "Write from conn_id %d without a session - ignored", conn_id);
+    } else if (handle == control_char_handle_) {
+        HOT_PATH_LOG(TAG, "Control message received");
+        primary_session_ = session;
+        session->handle_control_message(value, len);
+    } else if (is_data_char_handle(handle)) {
+        HOT_PATH_LOG(TAG, "Data chunk received");
+        session->handle_data_chunk(value, len);
+    } else if (handle == control_notify_handle_) {
         ESP_LOGI(TAG, "Control notification descriptor write");
-        if (param->write.len == 2) {
-            uint16_t notify_value = param->write.value[0] | (param->write.value[1] << 8);
-            bool was_enabled = control_notifications_enabled_;
-            control_notifications_enabled_ = (notify_value & 0x0001) != 0;
-            ESP_LOGI(TAG, "Control notifications %s", 
-                     control_notifications_enabled_ ? "enabled" : "disabled");
-            
-            // Send device info automatically when notifications are first enabled
-            if (control_notifications_enabled_ && !was_enabled) {
-                ESP_LOGI(TAG, "Control notifications just enabled - sending device info");
-                if (send_device_info()) {
-                    ESP_LOGI(TAG, "✅ Device info sent successfully after notification enablement");
-                } else {
-                    ESP_LOGE(TAG, "❌ Failed to send device info after notification enablement");
-                }
-            }
+        if (len == 2) {
+            uint16_t notify_value = value[0] | (value[1] << 8);
+            session->set_control_notifications((notify_value & 0x0001) != 0);
         } else {
-            ESP_LOGW(TAG, "Invalid descriptor write length: %d", param->write.len);
+            ESP_LOGW(TAG, "Invalid descriptor write length: %d", len);
         }
-    } else if (param->write.handle == data_notify_handle_) {
-        ESP_LOGI(TAG, "Data notification descriptor write");
-        if (param->write.len == 2) {
-            uint16_t notify_value = param->write.value[0] | (param->write.value[1] << 8);
-            data_notifications_enabled_ = (notify_value & 0x0001) != 0;
-            ESP_LOGI(TAG, "Data notifications %s", 
-                     data_notifications_enabled_ ? "enabled" : "disabled");
+    } else if (int channel = data_notify_channel(handle); channel >= 0) {
+        ESP_LOGI(TAG, "Data %d notification descriptor write", channel);
+        if (len == 2) {
+            uint16_t notify_value = value[0] | (value[1] << 8);
+            // Downloads are sent on channel 0; the other channels only carry uploads
+            if (channel == 0) {
+                session->set_data_notifications((notify_value & 0x0001) != 0);
+            }
+            ESP_LOGI(TAG, "Data %d notifications %s", channel,
+                     (notify_value & 0x0001) ? "enabled" : "disabled");
         } else {
-            ESP_LOGW(TAG, "Invalid descriptor write length: %d", param->write.len);
+            ESP_LOGW(TAG, "Invalid descriptor write length: %d", len);
         }
     } else {
         ESP_LOGW(TAG, "Write to unknown handle: %d (expected: char=%d,%d or descr=%d,%d)", 
-                 param->write.handle, control_char_handle_, data_char_handle_,
-                 control_notify_handle_, data_notify_handle_);
-    }
-    
-    // Send response if needed
-    if (param->write.need_rsp) {
-        esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, 
-                                  ESP_GATT_OK, nullptr);
+                 handle, control_char_handle_, data_char_handles_[0],
+                 control_notify_handle_, data_notify_handles_[0]);
     }
 }
 
 
 void ImageService::handle_connect_event(esp_ble_gatts_cb_param_t *param) {
-    esp_ble_conn_update_params_t conn_params = {};
-    memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
-    conn_params.latency = 0;
-    conn_params.min_int = 0x06;    // 6 * 1.25ms = 7.5ms
-    conn_params.max_int = 0x0C;    // 12 * 1.25ms = 15ms
-    conn_params.timeout = 400;     // timeout = 400*10ms = 4000ms
-    
+    // PHY, data length and connection parameters are requested by BLEServer (link profile)
     ESP_LOGI(TAG, "Image service connected, conn_id %d, remote " ESP_BD_ADDR_STR "",
              param->connect.conn_id, ESP_BD_ADDR_HEX(param->connect.remote_bda));
-    
-    conn_id_ = param->connect.conn_id;
-    ESP_LOGI(TAG, "Connection ID assigned: %d", conn_id_);
+    process_connect(param->connect.conn_id);
+}
+
+void ImageService::process_connect(uint16_t conn_id) {
+    TransferSession* session = acquire_session(conn_id);
+    if (!session) {
+        ESP_LOGW(TAG, "All %d sessions in use - closing conn_id %d", max_sessions_, conn_id);
+        transport_->close(conn_id);
+        return;
+    }
+    primary_session_ = session;
+    ESP_LOGI(TAG, "Connection ID assigned: %d (%d/%d sessions active)",
+             conn_id, get_active_session_count(), max_sessions_);
     ESP_LOGI(TAG, "Device info will be sent automatically after client enables notifications");
-    esp_ble_gap_update_conn_params(&conn_params);
+    
+    // Connecting stops advertising; keep accepting clients while sessions are free
+    if (get_active_session_count() < max_sessions_) {
+        restart_advertising();
+    }
 }
 
 void ImageService::handle_disconnect_event(esp_ble_gatts_cb_param_t *param) {
-    ESP_LOGI(TAG, "Image service disconnected, remote " ESP_BD_ADDR_STR ", reason 0x%02x",
-             ESP_BD_ADDR_HEX(param->disconnect.remote_bda), param->disconnect.reason);
-    reset_transfer(); // Clean up any ongoing transfer
-    mtu_ = 23; // Reset MTU for next connection
-    
-    // Reset notification state
-    control_notifications_enabled_ = false;
-    data_notifications_enabled_ = false;
-    
-    // Restart advertising to allow new connections
-    BLEServer* server = BLEServer::get_instance();
-    if (server) {
-        ESP_LOGI(TAG, "Requesting server to restart advertising for new connections");
-        esp_err_t ret = server->restart_advertising();
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to restart advertising: %s", esp_err_to_name(ret));
+    ESP_LOGI(TAG, "Image service disconnected, conn_id %d, remote " ESP_BD_ADDR_STR ", reason 0x%02x",
+             param->disconnect.conn_id, ESP_BD_ADDR_HEX(param->disconnect.remote_bda), param->disconnect.reason);
+    process_disconnect(param->disconnect.conn_id);
+}
+
+void ImageService::process_disconnect(uint16_t conn_id) {
+    TransferSession* session = find_session(conn_id);
+    if (session) {
+        if (session->can_suspend_transfer()) {
+            session->suspend_transfer();  // Keep received chunks for a reconnecting client
+        } else {
+            session->reset_transfer(); // Clean up any ongoing transfer
         }
-    } else {
-        ESP_LOGE(TAG, "Cannot restart advertising: BLEServer instance not available");
+        session->unbind();
+    }
+    tx_scheduler_.remove_connection(conn_id);
+    
+    // Restart advertising to allow new connections - fast, the client is likely to come back
+    restart_advertising(true);
+}
+
+// ==================== TRANSPORT-NEUTRAL ENTRY POINTS ====================
+
+void ImageService::on_client_connected(uint16_t conn_id) {
+    StateLock lock(state_mutex_);
+    process_connect(conn_id);
+}
+
+void ImageService::on_client_disconnected(uint16_t conn_id) {
+    StateLock lock(state_mutex_);
+    process_disconnect(conn_id);
+}
+
+void ImageService::on_client_mtu(uint16_t conn_id, uint16_t mtu) {
+    StateLock lock(state_mutex_);
+    process_mtu(conn_id, mtu);
+}
+
+void ImageService::on_client_write(uint16_t conn_id, uint16_t handle, const uint8_t* value, uint16_t len) {
+    StateLock lock(state_mutex_);
+    process_write(conn_id, handle, value, len);
+}
+
+void ImageService::on_link_update(uint16_t conn_id) {
+    StateLock lock(state_mutex_);
+    TransferSession* session = find_session(conn_id);
+    if (session) {
+        session->on_link_update();
     }
 }
 
 void ImageService::handle_mtu_event(esp_ble_gatts_cb_param_t *param) {
-    ESP_LOGI(TAG, "MTU exchange, MTU %d", param->mtu.mtu);
-    mtu_ = param->mtu.mtu;
+    ESP_LOGI(TAG, "MTU exchange, conn_id %d, MTU %d", param->mtu.conn_id, param->mtu.mtu);
+    process_mtu(param->mtu.conn_id, param->mtu.mtu);
 }
 
+void ImageService::process_mtu(uint16_t conn_id, uint16_t mtu) {
+    TransferSession* session = find_session(conn_id);
+    if (session) {
+        session->set_mtu(mtu);
+        session->on_link_update();  // Tell the client its new chunk size
+    }
+}
 
-bool ImageService::validate_jpeg_header() const {
-    return received_size_ >= 2 && image_buffer_[0] == 0xFF && image_buffer_[1] == 0xD8;
+void ImageService::restart_advertising(bool fast) {
+    ESP_LOGI(TAG, "Requesting transport to restart advertising for new connections");
+    esp_err_t ret = transport_->restart_advertising(fast);
+    if (ret != ESP_OK && ret != ESP_ERR_NOT_SUPPORTED) {  // A loopback transport does not advertise
+        ESP_LOGE(TAG, "Failed to restart advertising: %s", esp_err_to_name(ret));
+    }
 }
 
-// ==================== PROTOCOL IMPLEMENTATION ====================
+// ==================== SESSIONS ====================
 
-void ImageService::handle_control_message(esp_gatt_if_t gatts_if, const uint8_t* data, uint16_t len) {
-    if (len < sizeof(ControlMessage)) {
-        ESP_LOGE(TAG, "Control message too short: %d bytes", len);
-        send_transfer_error(ErrorCode::CONTROL_MESSAGE_TOO_SHORT);
-        return;
+ImageService::TransferSession* ImageService::find_session(uint16_t conn_id) const {
+    for (const auto& session : sessions_) {
+        if (session->is_bound() && session->get_connection_id() == conn_id) {
+            return session.get();
+        }
+    }
+    return nullptr;
+}
+
+ImageService::TransferSession* ImageService::acquire_session(uint16_t conn_id) {
+    if (get_active_session_count() >= max_sessions_) {
+        return nullptr;
     }
     
-    const ControlMessage* msg = reinterpret_cast<const ControlMessage*>(data);
-    ESP_LOGI(TAG, "Control message: cmd=0x%02X, seq=%d, p1=%lu, p2=%lu, p3=%lu",
-             msg->command, msg->sequence_number, 
-             msg->param1, msg->param2, msg->param3);
+    // Suspended sessions stay in the pool so their clients can come back
+    TransferSession* suspended = nullptr;
+    for (auto& session : sessions_) {
+        if (session->is_free()) {
+            session->reset_transfer();
+            session->bind(conn_id);
+            return session.get();
+        }
+        if (!suspended && !session->is_bound()) {
+            suspended = session.get();
+        }
+    }
     
-    switch (msg->command) {
-        case static_cast<uint8_t>(CommandType::TRANSFER_INIT):
-            handle_transfer_init(*msg);
-            break;
-        case static_cast<uint8_t>(CommandType::DEVICE_INFO):
-            handle_device_info_request(*msg);
-            break;
-        default:
-            ESP_LOGW(TAG, "Unknown control command: 0x%02X", msg->command);
-            send_transfer_error(ErrorCode::INVALID_COMMAND);
-            break;
+    // A new client wins over a transfer that may never be resumed
+    if (suspended) {
+        ESP_LOGW(TAG, "No free session - discarding a suspended transfer for conn_id %d", conn_id);
+        suspended->reset_transfer();
+        suspended->bind(conn_id);
     }
+    return suspended;
 }
 
-void ImageService::handle_device_info_request(const ControlMessage& msg) {
-    ESP_LOGI(TAG, "DEVICE_INFO received from client (ignoring param1=%lu, param2=%lu, param3=%lu)", 
-             msg.param1, msg.param2, msg.param3);
-    
-    // Send our device info in response to client's device info
-    ESP_LOGI(TAG, "Responding with server device info");
-    if (send_device_info()) {
-        ESP_LOGI(TAG, "✅ Device info response sent successfully");
-    } else {
-        ESP_LOGE(TAG, "❌ Failed to send device info response");
+ImageService::TransferSession* ImageService::find_resumable_session(const ControlMessage& msg) const {
+    for (const auto& session : sessions_) {
+        if (!session->is_bound() && session->get_status() == Status::SUSPENDED && session->is_resumable(msg)) {
+            return session.get();
+        }
     }
+    return nullptr;
 }
 
-void ImageService::handle_transfer_init(const ControlMessage& msg) {
-    ESP_LOGI(TAG, "TRANSFER_INIT: size=%lu, chunk_size=%lu, chunks=%lu", 
-             msg.param1, msg.param2, msg.param3);
-    
-    // Validate parameters
-    if (msg.param1 > MAX_TRANSFER_SIZE) {
-        ESP_LOGE(TAG, "Transfer too large: %lu bytes (max: %lu)", msg.param1, MAX_TRANSFER_SIZE);
-        send_transfer_error(ErrorCode::TRANSFER_TOO_LARGE);
-        status_ = Status::ERROR;
-        return;
+bool ImageService::is_sink_busy(const TransferSink* sink) const {
+    for (const auto& session : sessions_) {
+        if (session->uses_sink(sink)) {
+            return true;
+        }
     }
-    
-    if (msg.param2 > MAX_MTU_SIZE - DATA_HEADER_SIZE) {
-        ESP_LOGE(TAG, "Chunk size too large: %lu bytes", msg.param2);
-        send_transfer_error(ErrorCode::CHUNK_SIZE_TOO_LARGE);
-        status_ = Status::ERROR;
-        return;
+    return false;
+}
+
+bool ImageService::is_source_busy(const TransferSource* source) const {
+    for (const auto& session : sessions_) {
+        if (session->uses_source(source)) {
+            return true;
+        }
     }
-    
-    // Reset any previous transfer
-    reset_transfer();
-    
-    // Store transfer parameters
-    total_size_ = msg.param1;
-    chunk_size_ = msg.param2;
-    expected_chunks_ = msg.param3;
-    
-    // Allocate buffer for image data
-    image_buffer_ = static_cast<uint8_t*>(malloc(total_size_));
-    if (!image_buffer_) {
-        ESP_LOGE(TAG, "Failed to allocate %lu bytes for image buffer", total_size_);
-        send_transfer_error(ErrorCode::MEMORY_ALLOCATION_FAILED);
-        status_ = Status::ERROR;
-        return;
+    return false;
+}
+
+bool ImageService::fits_memory_budget(uint32_t required_bytes) const {
+    if (session_memory_budget_ == 0) {
+        return true;
     }
-    
-    // Allocate chunk tracking map
-    chunk_received_map_ = static_cast<bool*>(calloc(expected_chunks_, sizeof(bool)));
-    if (!chunk_received_map_) {
-        ESP_LOGE(TAG, "Failed to allocate chunk tracking map");
-        free(image_buffer_);
-        image_buffer_ = nullptr;
-        send_transfer_error(ErrorCode::MEMORY_ALLOCATION_FAILED);
-        status_ = Status::ERROR;
-        return;
+    uint32_t usage = get_session_memory_usage();
+    return usage <= session_memory_budget_ && required_bytes <= session_memory_budget_ - usage;
+}
+
+uint8_t ImageService::get_active_session_count() const {
+    uint8_t count = 0;
+    for (const auto& session : sessions_) {
+        if (session->is_bound()) {
+            count++;
+        }
     }
-    
-    status_ = Status::INIT_RECEIVED;
-    
-    // Immediately send first chunk request (no TRANSFER_READY per specs)
-    uint16_t first_request_size = (expected_chunks_ < chunks_per_request_) ? 
-                                expected_chunks_ : chunks_per_request_;
-    
-    CHUNK_LOG(TAG, "Sending first chunk request for %d chunks (of %lu total)", 
-             first_request_size, expected_chunks_);
-    
-    if (send_chunk_request(0, first_request_size)) {
-        // Minimal always-on logging: first chunk request sent
-        ESP_LOGI(TAG, "CHUNK_REQUEST sent: chunks 0-%d", first_request_size - 1);
-    } else {
-        ESP_LOGE(TAG, "❌ Failed to send first chunk request");
-        send_transfer_error(ErrorCode::NOTIFICATION_SEND_FAILED);
-        status_ = Status::ERROR;
+    return count;
+}
+
+uint32_t ImageService::get_session_memory_usage() const {
+    uint32_t usage = 0;
+    for (const auto& session : sessions_) {
+        usage += session->get_memory_usage();
     }
+    return usage;
 }
 
-void ImageService::handle_data_chunk(const uint8_t* data, uint16_t len) {
-    if (status_ != Status::REQUESTING_CHUNKS && status_ != Status::RECEIVING) {
-        ESP_LOGW(TAG, "Data chunk received in wrong state: %d", static_cast<int>(status_));
-        return;
+const ImageService::TransferSession* ImageService::get_session(uint16_t conn_id) const {
+    return find_session(conn_id);
+}
+
+bool ImageService::coalesce_control_message(uint8_t* queued, const uint8_t* incoming, uint16_t len) {
+    if (len != sizeof(ControlMessage)) {
+        return false;
     }
-    
-    // Comprehensive size logging for debugging (conditional)
-    CHUNK_LOG(TAG, "=== DATA CHUNK RECEIVED ===");
-    CHUNK_LOG(TAG, "Total received length: %d bytes", len);
-    CHUNK_LOG(TAG, "Transfer state: %s", 
-             (status_ == Status::REQUESTING_CHUNKS) ? "REQUESTING_CHUNKS" : "RECEIVING");
-    CHUNK_LOG(TAG, "Current request range: %d-%d", current_request_start_, current_request_end_);
-    CHUNK_LOG(TAG, "Current negotiated MTU: %d bytes", mtu_);
-    CHUNK_LOG(TAG, "ATT header overhead: %d bytes", ATT_HEADER_SIZE);
-    CHUNK_LOG(TAG, "Expected ATT payload: %d bytes (MTU - ATT header)", MAX_ATT_PAYLOAD);
-    CHUNK_LOG(TAG, "Data header size: %d bytes", DATA_HEADER_SIZE);
-    CHUNK_LOG(TAG, "Maximum data payload: %d bytes", MAX_DATA_PAYLOAD);
-    CHUNK_LOG(TAG, "Actual received vs expected ATT payload: %d vs %d (%s)", 
-             len, MAX_ATT_PAYLOAD, (len == MAX_ATT_PAYLOAD) ? "MATCH" : "MISMATCH");
-    CHUNK_LOG(TAG, "Payload size after removing data header: %d bytes", len - DATA_HEADER_SIZE);
-    
-    if (len < DATA_HEADER_SIZE) {
-        ESP_LOGE(TAG, "Data chunk too short: %d bytes (minimum: %d)", len, DATA_HEADER_SIZE);
-        send_transfer_error(ErrorCode::DATA_CHUNK_TOO_SHORT);
-        return;
+    ControlMessage queued_msg;
+    ControlMessage incoming_msg;
+    memcpy(&queued_msg, queued, sizeof(queued_msg));
+    memcpy(&incoming_msg, incoming, sizeof(incoming_msg));
+    
+    // Only CHUNK_REQUESTs that have not left the device yet are merged
+    if (queued_msg.command != static_cast<uint8_t>(CommandType::CHUNK_REQUEST) ||
+        incoming_msg.command != static_cast<uint8_t>(CommandType::CHUNK_REQUEST)) {
+        return false;
     }
     
-    const DataChunkHeader* header = reinterpret_cast<const DataChunkHeader*>(data);
-    uint16_t chunk_id = header->chunk_id;
-    uint16_t data_length = header->data_length;  // This should be payload size only
-    
-    CHUNK_LOG(TAG, "Header - Chunk ID: %d", chunk_id);
-    CHUNK_LOG(TAG, "Header - Data Length: %d bytes (payload only)", data_length);
-    CHUNK_LOG(TAG, "Actual payload size: %d bytes", len - DATA_HEADER_SIZE);
-    
-    // Validate chunk parameters
-    if (chunk_id >= expected_chunks_) {
-        ESP_LOGE(TAG, "❌ INVALID CHUNK ID: %d (max: %lu)", chunk_id, expected_chunks_ - 1);
-        send_transfer_error(ErrorCode::INVALID_CHUNK_ID);
-        return;
+    uint32_t queued_end = queued_msg.param1 + queued_msg.param2;
+    uint32_t incoming_end = incoming_msg.param1 + incoming_msg.param2;
+    if (incoming_msg.param1 >= queued_msg.param1 && incoming_end <= queued_end) {
+        return true;  // Already covered by the queued request
     }
-    
-    // Check if chunk is within current request range (conditional detailed logging)
-    if (chunk_id < current_request_start_ || chunk_id > current_request_end_) {
-        CHUNK_LOG(TAG, "⚠️ Chunk %d is outside current request range [%d-%d]", 
-                 chunk_id, current_request_start_, current_request_end_);
-        CHUNK_LOG(TAG, "This might indicate out-of-order delivery or client error");
-    } else {
-        CHUNK_LOG(TAG, "✅ Chunk %d is within current request range [%d-%d]", 
-                 chunk_id, current_request_start_, current_request_end_);
+    if (incoming_msg.param1 != queued_end || incoming_end - queued_msg.param1 > UINT16_MAX) {
+        return false;
     }
     
-    // The data_length field should match the actual payload size
-    uint16_t actual_payload_size = len - DATA_HEADER_SIZE;
-    
-    // Size validation (conditional detailed logging)
-    if (data_length != actual_payload_size) {
-        CHUNK_LOG(TAG, "Data length mismatch: header=%d, actual_payload=%d, total_len=%d", 
-                 data_length, actual_payload_size, len);
-        CHUNK_LOG(TAG, "Expected: header.data_length == (total_len - %d)", DATA_HEADER_SIZE);
-        CHUNK_LOG(TAG, "iOS may need to adjust data_length to match actual payload sent");
-        
-        // For now, use the actual received payload size to avoid blocking data
-        CHUNK_LOG(TAG, "Using actual payload size (%d) instead of header value (%d)", 
-                 actual_payload_size, data_length);
-        data_length = actual_payload_size;
+    // Contiguous: one request for both ranges, with the newer batch size and sequence number
+    queued_msg.param2 = incoming_end - queued_msg.param1;
+    queued_msg.param3 = incoming_msg.param3;
+    queued_msg.sequence_number = incoming_msg.sequence_number;
+    memcpy(queued, &queued_msg, sizeof(queued_msg));
+    return true;
+}
+
+ImageService::Status ImageService::get_status() const { return primary_session_->get_status(); }
+uint32_t ImageService::get_received_size() const { return primary_session_->get_received_size(); }
+uint32_t ImageService::get_total_size() const { return primary_session_->get_total_size(); }
+uint32_t ImageService::get_expected_chunks() const { return primary_session_->get_expected_chunks(); }
+const uint8_t* ImageService::get_image_buffer() const { return primary_session_->get_image_buffer(); }
+const ChunkBitmap& ImageService::get_chunk_map() const { return primary_session_->get_chunk_map(); }
+uint32_t ImageService::get_transfer_crc() const { return primary_session_->get_transfer_crc(); }
+const TransferMetrics& ImageService::get_transfer_metrics() const { return primary_session_->get_metrics(); }
+uint32_t ImageService::get_contiguous_chunks() const { return primary_session_->get_contiguous_chunks(); }
+ImageService::TransferType ImageService::get_transfer_type() const { return primary_session_->get_transfer_type(); }
+uint16_t ImageService::get_connection_id() const { return primary_session_->get_connection_id(); }
+uint16_t ImageService::get_mtu() const { return primary_session_->get_mtu(); }
+uint16_t ImageService::get_active_chunks_per_request() const { return primary_session_->get_active_chunks_per_request(); }
+uint32_t ImageService::get_chunks_in_flight() const { return primary_session_->get_chunks_in_flight(); }
+
+// ==================== INGEST TASK ====================
+
+esp_err_t ImageService::enable_ingest_task(const IngestConfig& config) {
+    if (ingest_enabled_.load(std::memory_order_acquire)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // A task that missed the stop timeout still owns the ring until it has exited
+    if (ingest_task_ && !reap_ingest_task(0)) {
+        return ESP_ERR_INVALID_STATE;
     }
     
-    CHUNK_LOG(TAG, "✅ Size validation completed - using payload size: %d bytes", data_length);
+    if (!ingest_ring_.init(config.queue_depth > 0 ? config.queue_depth : 1)) {
+        ESP_LOGE(TAG, "Failed to allocate ingest ring (%d slots)", config.queue_depth);
+        return ESP_ERR_NO_MEM;
+    }
+    ingest_exited_ = xSemaphoreCreateBinary();
+    if (!ingest_exited_) {
+        ESP_LOGE(TAG, "Failed to create ingest exit semaphore");
+        ingest_ring_.release();
+        return ESP_ERR_NO_MEM;
+    }
     
-    if (chunk_received_map_[chunk_id]) {
-        CHUNK_LOG(TAG, "🔄 DUPLICATE CHUNK: %d (already received)", chunk_id);
-        CHUNK_LOG(TAG, "This might indicate retransmission or client error");
-        send_transfer_error(ErrorCode::DUPLICATE_CHUNK);
-        return;
+    // Single-core targets cannot pin to core 1
+    BaseType_t core_id = (config.core_id < portNUM_PROCESSORS) ? config.core_id : tskNO_AFFINITY;
+    
+    ingest_stop_.store(false, std::memory_order_release);
+    BaseType_t ret = xTaskCreatePinnedToCore(&ImageService::ingest_task_entry, "tf_ingest",
+                                             config.stack_size, this, config.priority,
+                                             &ingest_task_, core_id);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create ingest task");
+        vSemaphoreDelete(ingest_exited_);
+        ingest_exited_ = nullptr;
+        ingest_task_ = nullptr;
+        ingest_ring_.release();
+        return ESP_ERR_NO_MEM;
     }
     
-    // Minimal always-on logging: single line per chunk received
-    ESP_LOGI(TAG, "Chunk %d received", chunk_id);
+    ingest_dropped_chunks_.store(0, std::memory_order_relaxed);
+    {
+        StateLock lock(ingest_mutex_);
+        ingest_enabled_.store(true, std::memory_order_release);
+    }
+    ESP_LOGI(TAG, "Ingest task started (core %d, priority %d, %lu ring slots)",
+             (int)core_id, (int)config.priority, ingest_ring_.capacity());
+    return ESP_OK;
+}
+
+void ImageService::disable_ingest_task() {
+    {
+        // Once this lock is released no data write touches the ring or the task handle anymore
+        StateLock lock(ingest_mutex_);
+        if (!ingest_enabled_.exchange(false, std::memory_order_acq_rel)) {
+            return;
+        }
+    }
     
-    // Calculate offset in buffer
-    uint32_t offset = chunk_id * chunk_size_;
-    if (offset + data_length > total_size_) {
-        ESP_LOGE(TAG, "❌ BUFFER OVERFLOW: chunk %d would exceed buffer", chunk_id);
-        ESP_LOGE(TAG, "Offset: %lu, data_length: %d, total_size: %lu", 
-                 offset, data_length, total_size_);
-        send_transfer_error(ErrorCode::BUFFER_OVERFLOW);
+    // Wake the task so it observes the stop flag (it finishes the chunk in hand), then wait for it to exit
+    ingest_stop_.store(true, std::memory_order_release);
+    xTaskNotifyGive(ingest_task_);
+    if (!reap_ingest_task(pdMS_TO_TICKS(INGEST_STOP_TIMEOUT_MS))) {
+        // Still blocked in a chunk (e.g. a stalled sink): it is reaped by the next enable or the destructor
+        ESP_LOGE(TAG, "Ingest task did not stop within %lu ms", INGEST_STOP_TIMEOUT_MS);
         return;
     }
+    ESP_LOGI(TAG, "Ingest task stopped (%lu chunks dropped on full ring)",
+             ingest_dropped_chunks_.load(std::memory_order_relaxed));
+}
+
+bool ImageService::reap_ingest_task(TickType_t wait_ticks) {
+    if (xSemaphoreTake(ingest_exited_, wait_ticks) != pdTRUE) {
+        return false;
+    }
+    // The task is gone: nothing references the ring or the semaphore anymore
+    vSemaphoreDelete(ingest_exited_);
+    ingest_exited_ = nullptr;
+    ingest_task_ = nullptr;
+    ingest_ring_.release();
+    return true;
+}
+
+bool ImageService::enqueue_data_chunk(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param) {
+    // Held for the memcpy only: never contended by the ingest task, just by enable/disable
+    StateLock lock(ingest_mutex_);
+    if (!ingest_enabled_.load(std::memory_order_relaxed)) {
+        return false;  // Disabled since the unlocked check - take the regular path
+    }
     
-    CHUNK_LOG(TAG, "💾 Writing chunk %d to buffer offset %lu (%d bytes)", 
-             chunk_id, offset, data_length);
-    
-    // Copy data to buffer
-    memcpy(image_buffer_ + offset, data + DATA_HEADER_SIZE, data_length);
-    chunk_received_map_[chunk_id] = true;
-    received_size_ += data_length;
+    if (param->write.need_rsp) {
+        esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, 
+                                  ESP_GATT_OK, nullptr);
+    }
     
-    // Performance optimization: increment counters instead of iterating arrays
-    total_chunks_received_++;
-    if (chunk_id >= current_request_start_ && chunk_id <= current_request_end_) {
-        current_batch_received_++;
+    IngestSlot* slot = (param->write.len <= MAX_ATT_PAYLOAD) ? ingest_ring_.try_produce() : nullptr;
+    if (!slot) {
+        // Ring full (or oversized write): selective repeat re-requests the chunk later
+        ingest_dropped_chunks_.fetch_add(1, std::memory_order_relaxed);
+        CHUNK_LOG(TAG, "Ingest ring full - dropped data write (%d bytes)", param->write.len);
+        return true;
     }
     
-    CHUNK_LOG(TAG, "✅ Chunk %d stored successfully. Total received: %lu bytes", 
-             chunk_id, received_size_);
+    slot->generation = transfer_generation_.load(std::memory_order_relaxed);
+    slot->conn_id = param->write.conn_id;
+    slot->len = param->write.len;
+    memcpy(slot->data, param->write.value, param->write.len);
+    ingest_ring_.produce_commit();
     
-    status_ = Status::RECEIVING;
+    xTaskNotifyGive(ingest_task_);
+    return true;
+}
+
+void ImageService::ingest_task_entry(void* arg) {
+    ImageService* service = static_cast<ImageService*>(arg);
     
-    // Fast transfer completion check using counter
-    if (total_chunks_received_ >= expected_chunks_) {
-        ESP_LOGI(TAG, "🎉 TRANSFER COMPLETE! Received all %lu chunks (%lu bytes)", 
-                 expected_chunks_, received_size_);
-        
-        // Validate JPEG header
-        if (validate_jpeg_header()) {
-            ESP_LOGI(TAG, "✅ Valid JPEG header detected");
-        } else {
-            ESP_LOGW(TAG, "⚠️ Warning: Data does not appear to be JPEG format");
-        }
-        
-        status_ = Status::COMPLETE;
-        
-        // Send completion acknowledgment
-        if (send_transfer_complete_ack(received_size_)) {
-            ESP_LOGI(TAG, "✅ Transfer complete ACK sent");
-        } else {
-            ESP_LOGE(TAG, "❌ Failed to send TRANSFER_COMPLETE_ACK");
-        }
-        
-        // Invoke callback if registered
-        if (image_callback_) {
-            bool is_valid_jpeg = validate_jpeg_header();
-            ESP_LOGI(TAG, "🔄 Invoking image transfer callback with %lu bytes", received_size_);
-            image_callback_(image_buffer_, received_size_, is_valid_jpeg);
-            ESP_LOGI(TAG, "✅ Image transfer callback completed");
-        } else {
-            ESP_LOGI(TAG, "ℹ️ No image transfer callback registered");
-        }
-        
-        // Disconnect client after successful transfer to allow new connections
-        ESP_LOGI(TAG, "🔌 Disconnecting client after successful transfer to allow new connections");
-        esp_err_t disconnect_ret = esp_ble_gatts_close(get_gatts_if(), conn_id_);
-        if (disconnect_ret == ESP_OK) {
-            ESP_LOGI(TAG, "✅ Client disconnect initiated successfully");
-        } else {
-            ESP_LOGE(TAG, "❌ Failed to disconnect client: %s", esp_err_to_name(disconnect_ret));
-        }
+    while (!service->ingest_stop_.load(std::memory_order_acquire)) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        service->drain_ingest_ring();
     }
-    else {
-        // Fast batch completion check using counter
-        uint16_t expected_batch_size = (current_request_end_ >= expected_chunks_) ? 
-                                     (expected_chunks_ - current_request_start_) : 
-                                     (current_request_end_ - current_request_start_ + 1);
-        
-        bool current_batch_complete = (current_batch_received_ >= expected_batch_size);
-        
-#ifdef CHUNK_LOGGING
-        // Detailed batch progress reporting (now using fast counters)
-        CHUNK_LOG(TAG, "=== BATCH PROGRESS ===");
-        CHUNK_LOG(TAG, "Current batch: chunks %d-%d (%d chunks)", 
-                 current_request_start_, current_request_end_, expected_batch_size);
-        CHUNK_LOG(TAG, "Current batch progress: %d/%d received", 
-                 current_batch_received_, expected_batch_size);
-        CHUNK_LOG(TAG, "Current batch complete: %s", current_batch_complete ? "YES" : "NO");
-        
-        // Report overall progress (now using fast counter - no loop!)
-        CHUNK_LOG(TAG, "Overall progress: %lu/%lu chunks (%.1f%%)", 
-                 total_chunks_received_, expected_chunks_, 
-                 (float)total_chunks_received_ / expected_chunks_ * 100.0f);
-#endif
-        
-        // If current batch is complete, request next batch
-        if (current_batch_complete && current_request_end_ + 1 < expected_chunks_) {
-            uint16_t next_start = current_request_end_ + 1;
-            uint16_t remaining_chunks = expected_chunks_ - next_start;
-            uint16_t next_request_size = (remaining_chunks < chunks_per_request_) ? 
-                                       remaining_chunks : chunks_per_request_;
-            
-            CHUNK_LOG(TAG, "🔄 Current batch complete, requesting next batch...");
-            CHUNK_LOG(TAG, "Next request: chunks %d-%d (%d chunks)", 
-                     next_start, next_start + next_request_size - 1, next_request_size);
-            
-            if (send_chunk_request(next_start, next_request_size)) {
-                // Minimal always-on logging: next chunk request sent
-                ESP_LOGI(TAG, "CHUNK_REQUEST sent: chunks %d-%d", next_start, next_start + next_request_size - 1);
-            } else {
-                ESP_LOGE(TAG, "❌ Failed to send next chunk request");
-                send_transfer_error(ErrorCode::NOTIFICATION_SEND_FAILED);
-                status_ = Status::ERROR;
+    
+    // The service may release the ring and the semaphore as soon as this returns
+    xSemaphoreGive(service->ingest_exited_);
+    vTaskDelete(nullptr);
+}
+
+void ImageService::drain_ingest_ring() {
+    IngestSlot* slot;
+    while (!ingest_stop_.load(std::memory_order_acquire) && (slot = ingest_ring_.try_consume()) != nullptr) {
+        {
+            StateLock lock(state_mutex_);
+            // Chunks queued before the session's last TRANSFER_INIT or disconnect belong to the old transfer
+            TransferSession* session = find_session(slot->conn_id);
+            if (session && static_cast<int32_t>(slot->generation - session->get_epoch()) >= 0) {
+                session->handle_data_chunk(slot->data, slot->len);
             }
         }
+        ingest_ring_.consume_commit();
     }
 }
 
-bool ImageService::send_control_notification(const ControlMessage& msg) {
-    ESP_LOGI(TAG, "Attempting to send control notification: handle=%d, conn_id=%d, enabled=%d",
-             control_char_handle_, conn_id_, control_notifications_enabled_);
-    
-    if (control_char_handle_ == 0) {
-        ESP_LOGE(TAG, "Cannot send notification: control characteristic handle not set");
-        return false;
+// ==================== DELTA BASE ====================
+
+void ImageService::update_delta_base(const TransferSession* completing, TransferBuffer&& image, uint32_t crc) {
+    // A delta transfer is still reading the current base
+    for (const auto& session : sessions_) {
+        if (session.get() != completing && session->is_patching()) {
+            ESP_LOGW(TAG, "Delta base in use by another connection - keeping the previous base");
+            image.reset();
+            return;
+        }
     }
     
-    if (!control_notifications_enabled_) {
-        ESP_LOGW(TAG, "Cannot send notification: notifications not enabled by client (control_notify_handle_=%d)", 
-                 control_notify_handle_);
-        return false;
+    // Streamed to a sink (or released by the callback): the retained base no longer is the latest image
+    base_image_ = std::move(image);
+    base_crc_ = base_image_ ? crc : 0;
+    if (base_image_) {
+        ESP_LOGI(TAG, "Delta base updated: %lu bytes, CRC32 0x%08lX", base_image_.size(), base_crc_);
+    }
+}
+
+// ==================== COMPLETION WORKER ====================
+
+esp_err_t ImageService::enable_completion_worker(const CompletionConfig& config) {
+    if (completion_task_ && !reap_completion_task(0)) {
+        return ESP_ERR_INVALID_STATE;  // A worker that missed the stop timeout is still running
     }
     
-    ESP_LOGI(TAG, "Sending control notification: cmd=0x%02X, seq=%d", 
-             static_cast<uint8_t>(msg.command), msg.sequence_number);
-    
-    esp_err_t ret = esp_ble_gatts_send_indicate(get_gatts_if(), conn_id_, control_char_handle_,
-                                              sizeof(msg), const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(&msg)),
-                                              false);  // Use notification, not indication
+    uint8_t depth = config.queue_depth > 0 ? config.queue_depth : 1;
+    QueueHandle_t queue = xQueueCreate(depth + 1, sizeof(CompletionJob));  // The stop job never waits for space
+    if (!queue) {
+        ESP_LOGE(TAG, "Failed to create completion queue");
+        return ESP_ERR_NO_MEM;
+    }
+    completion_exited_ = xSemaphoreCreateBinary();
+    if (!completion_exited_) {
+        ESP_LOGE(TAG, "Failed to create completion exit semaphore");
+        vQueueDelete(queue);
+        return ESP_ERR_NO_MEM;
+    }
     
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to send control notification: %s", esp_err_to_name(ret));
-        return false;
+    BaseType_t core_id = (config.core_id < portNUM_PROCESSORS) ? config.core_id : tskNO_AFFINITY;
+    
+    completion_queue_ = queue;
+    completion_depth_ = depth;
+    BaseType_t ret = xTaskCreatePinnedToCore(&ImageService::completion_task_entry, "tf_complete",
+                                             config.stack_size, this, config.priority,
+                                             &completion_task_, core_id);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create completion worker task");
+        vSemaphoreDelete(completion_exited_);
+        completion_exited_ = nullptr;
+        completion_queue_ = nullptr;
+        completion_task_ = nullptr;
+        vQueueDelete(queue);
+        return ESP_ERR_NO_MEM;
     }
     
-    ESP_LOGI(TAG, "Control notification sent successfully");
-    return true;
+    {
+        StateLock lock(state_mutex_);
+        completion_enabled_ = true;
+    }
+    ESP_LOGI(TAG, "Completion worker started (core %d, priority %d, stack %lu)",
+             (int)core_id, (int)config.priority, config.stack_size);
+    return ESP_OK;
 }
 
-
-bool ImageService::send_chunk_request(uint16_t start_chunk, uint16_t num_chunks) {
-    CHUNK_LOG(TAG, "=== CHUNK REQUEST ===");
-    CHUNK_LOG(TAG, "Requesting chunks %d to %d (%d chunks total)", 
-             start_chunk, start_chunk + num_chunks - 1, num_chunks);
-    CHUNK_LOG(TAG, "Expected total chunks: %lu", expected_chunks_);
-    
-    ControlMessage msg = {};
-    msg.command = static_cast<uint8_t>(CommandType::CHUNK_REQUEST);
-    msg.sequence_number = ++sequence_number_;
-    msg.param1 = (uint32_t)start_chunk;  // Explicit cast to ensure clean 32-bit value
-    msg.param2 = (uint32_t)num_chunks;   // Explicit cast to ensure clean 32-bit value  
-    msg.param3 = 0;
-    
-#ifdef CHUNK_LOGGING
-    // Debug: Log the exact bytes being sent (conditional - performance intensive)
-    CHUNK_LOG(TAG, "📤 CHUNK_REQUEST message details:");
-    CHUNK_LOG(TAG, "   command: 0x%02X", static_cast<uint8_t>(msg.command));
-    CHUNK_LOG(TAG, "   sequence: %d", msg.sequence_number);
-    CHUNK_LOG(TAG, "   param1 (start_chunk): %lu (0x%08lX)", msg.param1, msg.param1);
-    CHUNK_LOG(TAG, "   param2 (num_chunks): %lu (0x%08lX)", msg.param2, msg.param2);
-    CHUNK_LOG(TAG, "   param3: %lu (0x%08lX)", msg.param3, msg.param3);
-    
-    // Debug: Dump the actual message bytes (very expensive - loop with formatting)
-    uint8_t* msg_bytes = (uint8_t*)&msg;
-    CHUNK_LOG(TAG, "📋 Raw message bytes (%d bytes):", sizeof(msg));
-    for (size_t i = 0; i < sizeof(msg); i += 4) {
-        if (i + 3 < sizeof(msg)) {
-            CHUNK_LOG(TAG, "   [%02d-%02d]: 0x%02X 0x%02X 0x%02X 0x%02X", 
-                     i, i+3, msg_bytes[i], msg_bytes[i+1], msg_bytes[i+2], msg_bytes[i+3]);
-        } else {
-            // Handle remaining bytes
-            CHUNK_LOG(TAG, "   [%02d+]: remaining bytes", i);
+void ImageService::disable_completion_worker() {
+    {
+        // Once this lock is released no session queues another image
+        StateLock lock(state_mutex_);
+        if (!completion_enabled_) {
+            return;
         }
+        completion_enabled_ = false;
     }
-#endif
-    
-    // Update request tracking
-    current_request_start_ = start_chunk;
-    current_request_end_ = start_chunk + num_chunks - 1;
-    current_batch_received_ = 0;  // Reset batch counter for new request
-    
-    CHUNK_LOG(TAG, "Current request range: %d - %d", current_request_start_, current_request_end_);
     
-    bool success = send_control_notification(msg);
-    if (success) {
-        status_ = Status::REQUESTING_CHUNKS;
-        CHUNK_LOG(TAG, "✅ Chunk request sent successfully");
-    } else {
-        ESP_LOGE(TAG, "❌ Failed to send chunk request");
+    // The stop job queues behind pending images, so they are still delivered
+    CompletionJob stop_job = { nullptr, 0, nullptr, false, false, 0, true };
+    xQueueSend(completion_queue_, &stop_job, 0);
+    if (!reap_completion_task(pdMS_TO_TICKS(COMPLETION_STOP_TIMEOUT_MS))) {
+        // Still inside the image callback: it is reaped by the next enable or the destructor
+        ESP_LOGE(TAG, "Completion worker did not stop within %lu ms", COMPLETION_STOP_TIMEOUT_MS);
+        return;
     }
-    
-    return success;
+    ESP_LOGI(TAG, "Completion worker stopped");
 }
 
-bool ImageService::send_transfer_complete_ack(uint32_t received_size) {
-    ControlMessage msg = {};
-    msg.command = static_cast<uint8_t>(CommandType::TRANSFER_COMPLETE_ACK);
-    msg.sequence_number = ++sequence_number_;
-    msg.param1 = received_size;
-    msg.param2 = 0;
-    msg.param3 = 0;
-    
-    return send_control_notification(msg);
+bool ImageService::reap_completion_task(TickType_t wait_ticks) {
+    if (xSemaphoreTake(completion_exited_, wait_ticks) != pdTRUE) {
+        return false;
+    }
+    // The worker is gone: nothing references the queue or the semaphore anymore
+    vSemaphoreDelete(completion_exited_);
+    completion_exited_ = nullptr;
+    vQueueDelete(completion_queue_);
+    completion_queue_ = nullptr;
+    completion_task_ = nullptr;
+    return true;
 }
 
-bool ImageService::send_device_info() {
-    ESP_LOGI(TAG, "=== SENDING DEVICE_INFO ===");
-    ESP_LOGI(TAG, "Device type: %d, Battery: %d%%, Display: %dx%d", 
-             device_type_, battery_level_, width_, height_);
-    
-    ControlMessage msg = {};
-    msg.command = static_cast<uint8_t>(CommandType::DEVICE_INFO);
-    msg.sequence_number = ++sequence_number_;
-    
-    // Pack device info into parameters according to specification
-    // Parameter 1: uint8_t device_type, uint8_t battery_level, uint16_t reserved
-    msg.param1 = static_cast<uint32_t>(device_type_) | 
-                 (static_cast<uint32_t>(battery_level_) << 8) | 
-                 (static_cast<uint32_t>(0) << 16);  // reserved
-    
-    // Parameter 2: uint16_t width, uint16_t height
-    msg.param2 = static_cast<uint32_t>(width_) | 
-                 (static_cast<uint32_t>(height_) << 16);
-    
-    // Parameter 3: Reserved
-    msg.param3 = 0;
-    
-    ESP_LOGI(TAG, "DEVICE_INFO message: cmd=0x%02X, seq=%d, p1=0x%08lX, p2=0x%08lX, p3=0x%08lX",
-             msg.command, msg.sequence_number, msg.param1, msg.param2, msg.param3);
+bool ImageService::has_completion_capacity() const {
+    return uxQueueMessagesWaiting(completion_queue_) < completion_depth_;
+}
+
+void ImageService::completion_task_entry(void* arg) {
+    ImageService* service = static_cast<ImageService*>(arg);
+    CompletionJob job;
     
-    bool success = send_control_notification(msg);
-    if (success) {
-        ESP_LOGI(TAG, "✅ DEVICE_INFO sent successfully");
-    } else {
-        ESP_LOGE(TAG, "❌ DEVICE_INFO send failed");
+    while (xQueueReceive(service->completion_queue_, &job, portMAX_DELAY) == pdTRUE) {
+        if (job.stop) {
+            break;
+        }
+        
+        // Returned to its allocator when this iteration ends, unless it becomes the delta base
+        TransferBuffer buffer(job.allocator, job.buffer, job.size);
+        if (service->image_callback_) {
+            ESP_LOGI(TAG, "🔄 Completion worker invoking image callback with %lu bytes", job.size);
+            service->image_callback_(buffer.data(), job.size, job.is_valid_jpeg);
+            ESP_LOGI(TAG, "✅ Image transfer callback completed");
+        }
+        if (job.delta_base) {
+            StateLock lock(service->state_mutex_);
+            service->pending_base_updates_--;
+            if (service->delta_base_enabled_) {
+                service->update_delta_base(nullptr, std::move(buffer), job.crc);
+            }
+        }
     }
     
-    return success;
+    // The service may delete the queue and the semaphore as soon as this returns
+    xSemaphoreGive(service->completion_exited_);
+    vTaskDelete(nullptr);
 }
 
-bool ImageService::send_transfer_error(ErrorCode error_code) {
-    ControlMessage msg = {};
-    msg.command = static_cast<uint8_t>(CommandType::TRANSFER_ERROR);
-    msg.sequence_number = ++sequence_number_;
-    msg.param1 = static_cast<uint32_t>(error_code);
-    msg.param2 = 0;
-    msg.param3 = 0;
-    
-    ESP_LOGE(TAG, "Sending TRANSFER_ERROR: code=0x%02X", static_cast<uint32_t>(error_code));
+void ImageService::stop_download_crc_tasks() {
+    {
+        StateLock lock(state_mutex_);
+        // Aborting the downloads makes the workers exit at their next slice
+        for (auto& session : sessions_) {
+            if (session->get_status() == Status::PREPARING) {
+                session->reset_transfer();
+            }
+        }
+        if (download_crc_tasks_ == 0) {
+            return;
+        }
+        download_crc_waiter_ = xTaskGetCurrentTaskHandle();
+    }
     
-    return send_control_notification(msg);
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DOWNLOAD_CRC_STOP_TIMEOUT_MS)) == 0) {
+        // Stuck in a slow source read: it still uses its session and source, so nothing may be freed yet
+        ESP_LOGE(TAG, "Download CRC worker did not stop within %lu ms - waiting for it", DOWNLOAD_CRC_STOP_TIMEOUT_MS);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    StateLock lock(state_mutex_);
+    download_crc_waiter_ = nullptr;
 }
 
 uint32_t ImageService::get_available_memory() const {
     return heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
 }
 
-bool ImageService::is_transfer_complete() const {
-    // Fast implementation using counter instead of array iteration
-    return (total_chunks_received_ >= expected_chunks_) && (expected_chunks_ > 0);
-}
 
-void ImageService::create_data_characteristic() {
+void ImageService::create_data_characteristic(uint8_t channel) {
     /**
-     * Create Data Channel 0 Characteristic (6E400010)
+     * Create Data Channel Characteristic (6E400010 + channel)
      * 
      * High-throughput data transmission for image chunks.
-     * - UUID: CHAR_UUID_DATA_CHANNEL_0 - 128-bit UUID from specs
+     * - UUID: CHAR_UUID_DATA_CHANNEL_0 with the channel added - 128-bit UUID from specs
      * - Properties: WRITE_NO_RESPONSE | NOTIFY (high-speed transfer)
      * - Permissions: WRITE
      * - Usage: Image data chunks with [ChunkID][Length][Payload] format
      */
-    ESP_LOGI(TAG, "Creating DATA characteristic...");
+    ESP_LOGI(TAG, "Creating DATA characteristic %d...", channel);
     esp_bt_uuid_t data_uuid;
     data_uuid.len = ESP_UUID_LEN_128;
     memcpy(data_uuid.uuid.uuid128, CHAR_UUID_DATA_CHANNEL_0, ESP_UUID_LEN_128);
+    data_uuid.uuid.uuid128[DATA_CHANNEL_UUID_INDEX] += channel;
     
     esp_gatt_char_prop_t data_props = ESP_GATT_CHAR_PROP_BIT_WRITE_NR | 
                                      ESP_GATT_CHAR_PROP_BIT_NOTIFY;
@@ -917,4 +1083,30 @@ void ImageService::create_data_characteristic() {
         return;
     }
     ESP_LOGI(TAG, "Data characteristic creation initiated successfully");
-}
\ No newline at end of file
+}
+
+bool ImageService::add_notify_descriptor(const char* char_name) {
+    // CCCD for the characteristic just added (notifications disabled initially)
+    ESP_LOGI(TAG, "Creating CCCD descriptor for %s characteristic...", char_name);
+    
+    esp_bt_uuid_t notify_descr_uuid;
+    notify_descr_uuid.len = ESP_UUID_LEN_16;
+    notify_descr_uuid.uuid.uuid16 = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
+    
+    uint8_t cccd_value[2] = {0x00, 0x00};
+    esp_attr_value_t cccd_val = {
+        .attr_max_len = 2,
+        .attr_len = 2,
+        .attr_value = cccd_value
+    };
+    
+    esp_err_t ret = esp_ble_gatts_add_char_descr(get_service_handle(), &notify_descr_uuid,
+                                               ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+                                               &cccd_val, nullptr);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "CRITICAL: Failed to add %s CCCD descriptor: %s (0x%x)", char_name, esp_err_to_name(ret), ret);
+        return false;
+    }
+    ESP_LOGI(TAG, "CCCD descriptor creation initiated - waiting for add event...");
+    return true;
+}
@@ -6,9 +6,27 @@
 #pragma once
 
 #include "gatt_service.h"
+#include "chunk_rate_controller.h"
+#include "chunk_bitmap.h"
+#include "spsc_ring.h"
+#include "transfer_buffer.h"
+#include "transfer_sink.h"
+#include "transfer_source.h"
+#include "ota_sink.h"
+#include "lz4_block_decoder.h"
+#include "delta_patcher.h"
+#include "notification_scheduler.h"
+#include "transfer_transport.h"
+#include "transfer_metrics.h"
 #include "esp_log.h"
 #include "esp_gatts_api.h"
-#include "esp_gap_ble_api.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <atomic>
+#include <memory>
 #include <cinttypes>
 
 /**
@@ -30,6 +48,75 @@
  * 4. ESP → iOS: CHUNK_REQUEST (next batch) - repeat until all chunks received
  * 5. ESP → iOS: TRANSFER_COMPLETE_ACK (received size)
  * 
+ * Loss Recovery:
+ * - Duplicate chunks are dropped silently
+ * - If no chunk arrives for RETRANSMIT_TIMEOUT_MS, the server re-requests only the
+ *   missing ranges of the requested chunks (selective repeat)
+ * 
+ * Streaming (optional, see set_transfer_sink()):
+ * - Chunks are reordered in a small window and written in order to a TransferSink
+ *   (flash partition, file, user stream) instead of a RAM buffer
+ * - Chunk requests never reach beyond the reorder window
+ * 
+ * Firmware Updates (optional, see set_firmware_sink()):
+ * - TRANSFER_INIT with transfer type FIRMWARE streams through the same chunk engine
+ *   into the firmware sink (OtaSink: esp_ota_write as chunks arrive)
+ * 
+ * Compression (optional, TRANSFER_FLAG_LZ4):
+ * - The client sends the file as independently compressed LZ4 blocks of up to 4KB;
+ *   chunks pass through the reorder window and are decompressed in order straight into
+ *   the RAM buffer or the sink, so fewer chunks cross the air for compressible data
+ * 
+ * Delta Updates (optional, see set_delta_base_enabled()):
+ * - The buffer of the last image received into RAM is kept as base once its callback
+ *   returned (no copy), identified by its CRC32
+ * - TRANSFER_FLAG_DELTA transfers carry a DeltaPatcher patch against that base; the new
+ *   image is rebuilt in order from base ranges and literal data
+ * 
+ * Ingest Task (optional, see enable_ingest_task()):
+ * - The GATTS callback only copies data writes into a lock-free SPSC ring
+ * - A task pinned to the other core drains the ring and runs the chunk bookkeeping
+ * 
+ * Progressive Decoding (optional, see set_image_progress_callback()):
+ * - Chunks land out of order; the chunk map tracks the in-order prefix, and every time it
+ *   grows the application is told how many leading bytes of the RAM buffer are final
+ * 
+ * Integrity:
+ * - TRANSFER_INIT may carry a CRC32 (reserved[0..3], flag TRANSFER_FLAG_CRC32)
+ * - The CRC is computed incrementally over the in-order prefix as chunks land and
+ *   returned in TRANSFER_COMPLETE_ACK param2
+ * 
+ * Multiple Connections (see set_max_sessions()):
+ * - Each connection gets its own TransferSession (buffer, chunk map, reorder window,
+ *   sequence number, timers), so several clients can transfer at the same time
+ * - Sessions share the configuration, sinks and buffer allocator; a sink serves one
+ *   transfer at a time and set_session_memory_budget() caps the RAM of all sessions
+ * 
+ * Downloads (optional, see set_download_request_callback()):
+ * - iOS → ESP: REQUEST_DOWNLOAD (download ID); the application returns a TransferSource
+ *   (RAM buffer, flash partition) that is read in place, without staging a copy
+ * - ESP → iOS: TRANSFER_INIT describing the download, then data chunks as notifications on
+ *   the data characteristic, paced by the notification scheduler (congestion events)
+ * - iOS → ESP: CHUNK_REQUEST for ranges it missed, TRANSFER_COMPLETE_ACK (size, CRC32)
+ * 
+ * Link Benchmark:
+ * - iOS → ESP: BENCHMARK (chunk count, chunk size); ESP → iOS: BENCHMARK ready page
+ * - iOS → ESP: the data chunks back to back; they are counted in the chunk map and discarded
+ * - ESP → iOS: BENCHMARK result pages (rate, loss, connection parameters) once all chunks
+ *   arrived, on BENCHMARK with chunk count 0, or after BENCHMARK_IDLE_TIMEOUT_MS of silence
+ * 
+ * Batched Transfers:
+ * - iOS → ESP: MANIFEST (file count, total bytes); ESP → iOS: MANIFEST echoing both
+ * - The files follow as ordinary TRANSFER_INIT uploads; TRANSFER_COMPLETE_ACK param3 counts
+ *   the files still to come and the connection is only closed after the last one
+ * - Chunk map and reorder window storage are kept between the files of a batch
+ * 
+ * Resume:
+ * - A transfer with CRC that is interrupted by a disconnect is retained (buffer or sink,
+ *   chunk map) for RESUME_GRACE_PERIOD_MS
+ * - A TRANSFER_INIT with the same size, chunk layout, type and CRC resumes it: the server
+ *   answers with CHUNK_REQUESTs for the missing ranges only
+ * 
  * Error Handling:
  * - ESP → iOS: TRANSFER_ERROR (error code) - sent when any error occurs
  * 
@@ -40,13 +127,32 @@
 class ImageService : public GATTService {
 public:
     static constexpr uint16_t APP_ID = 0;
-    static constexpr uint16_t NUM_HANDLES = 15;
+    static constexpr uint8_t MAX_DATA_CHANNELS = 4;
+    // Service, control characteristic + CCCD, 3 per data channel (characteristic + CCCD)
+    static constexpr uint16_t NUM_HANDLES = 4 + 3 * MAX_DATA_CHANNELS;
     
     // Image transfer completion callback
-    // IMPORTANT: User must call release_image_buffer() when done processing image_data
-    // to prevent memory leaks and use-after-free conditions
+    // image_data is only valid until the callback returns; the buffer is then returned to
+    // the transfer-buffer allocator automatically (release_image_buffer() is optional).
+    // In streaming mode image_data is nullptr - the data is in the transfer sink.
     typedef void (*ImageTransferCallback)(const uint8_t* image_data, uint32_t size, bool is_valid_jpeg);
     
+    // Received prefix callback (RAM transfers): the first prefix_size bytes of the image are in
+    // place and will not change, so a decoder (e.g. JPEG) can start before the rest arrives.
+    // image_data stays valid until the image callback for this transfer returns. Called with the
+    // service state held from the receive path: hand the range to a task, do not decode inline.
+    // image_data == nullptr: the transfer failed, stop reading the buffer.
+    typedef void (*ImageProgressCallback)(const uint8_t* image_data, uint32_t prefix_size, uint32_t total_size);
+    
+    // Firmware update completion callback (new image is set as boot partition; restart to apply)
+    typedef void (*FirmwareUpdateCallback)(uint32_t size);
+    
+    // Download source for a REQUEST_DOWNLOAD (nullptr = no such download). The source must
+    // stay valid until the download complete callback for it has run.
+    typedef TransferSource* (*DownloadRequestCallback)(uint32_t download_id);
+    // Download finished (success = client acknowledged size and CRC32) or aborted
+    typedef void (*DownloadCompleteCallback)(uint32_t download_id, TransferSource* source, bool success);
+    
     // ==================== GATT CHARACTERISTIC DEFINITIONS ====================
     // Protocol-compliant characteristic UUIDs as specified in specs.md
     
@@ -67,21 +173,30 @@ public:
     /**
      * @brief Data Channel 0 Characteristic UUID (6E400010)
      * 
+     * Additional data channels (set_data_channel_count()) use 6E400011 ... 6E400013.
+     * 
      * Properties: WRITE_NO_RESPONSE, NOTIFY
      * Permissions: WRITE
      * Purpose: High-throughput data transmission
      * Max Length: 512 bytes (ESP32S3 MTU support)
-     * Usage: Image data chunks with header [ChunkID][Length][Payload]
+     * Usage: Image data chunks with header [ChunkID][Length][Payload] (writes for uploads,
+     *        notifications for downloads)
      */
     static constexpr uint8_t CHAR_UUID_DATA_CHANNEL_0[ESP_UUID_LEN_128] = {
         0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0,
         0x93, 0xf3, 0xa3, 0xb5, 0x10, 0x00, 0x40, 0x6e
     };
+    static constexpr uint8_t DATA_CHANNEL_UUID_INDEX = 12;  // UUID byte that holds 0x10 + channel
     // ========================================================================
     
     static constexpr uint32_t MAX_TRANSFER_SIZE = (1024 * 1024);  // 1MB max transfer
+    static constexpr uint8_t DEFAULT_BUFFER_SLOTS = 2;            // Arena slots: one being consumed, one receiving
+    static constexpr uint32_t MAX_CHUNKS = 0x10000;               // Chunk IDs are 16 bit
+    static constexpr uint32_t MAX_CHUNKS_PER_REQUEST = 0xFFFF;    // CHUNK_REQUEST counts stay 16 bit like the IDs
+    static constexpr uint16_t DEFAULT_REORDER_WINDOW_CHUNKS = 64; // Streaming: out-of-order chunks held in RAM
     static constexpr uint16_t MAX_MTU_SIZE = 512;                    // Total MTU size
     static constexpr uint8_t ATT_HEADER_SIZE = 3;                   // BLE ATT protocol header
+    static constexpr uint8_t L2CAP_HEADER_SIZE = 4;                 // Basic L2CAP header in the first LL PDU
     static constexpr uint16_t MAX_ATT_PAYLOAD = MAX_MTU_SIZE - ATT_HEADER_SIZE; // 509 bytes
     static constexpr uint8_t CONTROL_MSG_SIZE = 20;
     static constexpr uint8_t DATA_HEADER_SIZE = 4;
@@ -89,16 +204,108 @@ public:
     
     // Chunk request configuration
     static constexpr uint16_t DEFAULT_CHUNKS_PER_REQUEST = 40;
+    static constexpr uint16_t WINDOW_REFILL_DIVISOR = 2;  // Sliding window refills once 1/2 of the window has landed
+    
+    // Selective-repeat retransmission
+    static constexpr uint32_t RETRANSMIT_TICK_MS = 100;         // Period of the retransmission check
+    static constexpr uint32_t RETRANSMIT_TIMEOUT_MS = 500;      // No progress for this long → re-request gaps
+    static constexpr uint8_t MAX_RETRANSMIT_ATTEMPTS = 5;       // Consecutive timeouts before giving up
+    static constexpr uint8_t MAX_RETRANSMIT_REQUESTS = 8;       // Missing ranges re-requested per timeout
+    
+    // Resume after disconnect
+    static constexpr uint32_t RESUME_GRACE_PERIOD_MS = 60000;   // Interrupted transfers are kept this long
+    
+    // Downloads (server → client)
+    static constexpr uint32_t DOWNLOAD_IDLE_TIMEOUT_MS = 5000;  // Everything sent, no ACK or CHUNK_REQUEST → abort
+    static constexpr uint32_t DOWNLOAD_CRC_SLICE_SIZE = 4096;   // Bytes the CRC worker reads per state lock
+    static constexpr uint32_t DOWNLOAD_CRC_TASK_STACK = 3072;
+    static constexpr UBaseType_t DOWNLOAD_CRC_TASK_PRIORITY = 1; // Below Bluedroid: yields the lock between slices
+    static constexpr uint32_t DOWNLOAD_CRC_STOP_TIMEOUT_MS = 1000;  // Then the destructor logs and keeps waiting
+    
+    // Link benchmark
+    static constexpr uint32_t BENCHMARK_IDLE_TIMEOUT_MS = 2000; // No chunk for this long → report the result
+    
+    // Received prefix reporting
+    static constexpr uint32_t DEFAULT_PROGRESS_STEP = 4096;     // Prefix growth between progress callbacks
+    
+    // STATS response: STATS_PAGE_COUNT notifications, page layout in README
+    static constexpr uint8_t STATS_PAGE_COUNT = 10;
+    static constexpr uint8_t STATS_PAGE_INDEX = 0;         // reserved[0]: page number
+    static constexpr uint8_t STATS_PAGE_COUNT_INDEX = 1;   // reserved[1]: number of pages
+    static constexpr uint8_t STATS_OUTCOME_INDEX = 2;      // reserved[2]: TransferMetrics::Outcome
+    static constexpr uint8_t STATS_PAGE_THROUGHPUT = 0;
+    static constexpr uint8_t STATS_PAGE_PROGRESS = 1;
+    static constexpr uint8_t STATS_PAGE_LOSS = 2;
+    static constexpr uint8_t STATS_PAGE_HEAP = 3;
+    static constexpr uint8_t STATS_PAGE_BATCH_RTT = 4;
+    static constexpr uint8_t STATS_PAGE_CHUNK_GAP = 5;
+    static constexpr uint8_t STATS_PAGE_RTT_HISTOGRAM = 6;  // Pages 6-7: batch RTT buckets 0-5, 6-11
+    static constexpr uint8_t STATS_PAGE_GAP_HISTOGRAM = 8;  // Pages 8-9: chunk gap buckets 0-5, 6-11
+    // BENCHMARK response: a READY page, then the result pages (layout in README)
+    static constexpr uint8_t BENCHMARK_PAGE_COUNT = 4;
+    static constexpr uint8_t BENCHMARK_PAGE_INDEX = 0;        // reserved[0]: page number
+    static constexpr uint8_t BENCHMARK_PAGE_COUNT_INDEX = 1;  // reserved[1]: number of pages
+    static constexpr uint8_t BENCHMARK_CHANNELS_INDEX = 2;    // reserved[2]: data channels (ready page)
+    static constexpr uint8_t BENCHMARK_PAGE_READY = 0;
+    static constexpr uint8_t BENCHMARK_PAGE_THROUGHPUT = 1;
+    static constexpr uint8_t BENCHMARK_PAGE_LOSS = 2;
+    static constexpr uint8_t BENCHMARK_PAGE_LINK = 3;
+    
+    // Concurrent connections (Bluedroid default: CONFIG_BT_ACL_CONNECTIONS = 4)
+    static constexpr uint8_t MAX_SESSIONS = 4;
+    static constexpr uint8_t DEFAULT_MAX_SESSIONS = 1;
+    
+    // Ingest task configuration (data writes processed outside the Bluedroid task)
+    struct IngestConfig {
+        uint16_t queue_depth;   // Data writes buffered for the ingest task (rounded up to a power of two)
+        BaseType_t core_id;     // Core to pin the ingest task to (Bluedroid runs on core 0 by default)
+        UBaseType_t priority;
+        uint32_t stack_size;
+    };
+    static constexpr IngestConfig DEFAULT_INGEST_CONFIG = {32, 1, 18, 4096};
+    static constexpr uint32_t INGEST_STOP_TIMEOUT_MS = 1000;  // disable_ingest_task() waits this long for the task to exit
+    
+    // Completion worker configuration (image callback runs outside the BLE path)
+    struct CompletionConfig {
+        uint8_t queue_depth;    // Finished images waiting for the callback
+        BaseType_t core_id;     // Core to pin the worker to
+        UBaseType_t priority;   // Keep below the Bluedroid and ingest tasks
+        uint32_t stack_size;    // Sized for the application callback (e.g. JPEG decoding)
+    };
+    static constexpr CompletionConfig DEFAULT_COMPLETION_CONFIG = {2, 1, 5, 8192};
+    static constexpr uint32_t COMPLETION_STOP_TIMEOUT_MS = 5000;  // Queued images are still delivered (JPEG decoding)
+    
+    // TRANSFER_INIT flags byte (ControlMessage::reserved[TRANSFER_FLAGS_INDEX])
+    static constexpr uint8_t TRANSFER_FLAGS_INDEX = 4;
+    static constexpr uint8_t TRANSFER_TYPE_MASK = 0x0F;   // Low nibble: TransferType
+    static constexpr uint8_t TRANSFER_FLAG_DELTA = 0x20;  // Chunks carry a DeltaPatcher patch against the delta base
+    static constexpr uint8_t TRANSFER_FLAG_LZ4 = 0x40;    // Chunks carry an Lz4BlockDecoder stream; param1 is the decompressed size
+    static constexpr uint8_t TRANSFER_FLAG_CRC32 = 0x80;  // reserved[0..3] holds the expected CRC32
+    
+    enum class TransferType : uint8_t {
+        ASSET = 0x00,      // Image/asset (RAM buffer or transfer sink) - default for older clients
+        FIRMWARE = 0x01    // Firmware image for the firmware sink
+    };
+    
+    // Chunk request flow control
+    enum class FlowMode {
+        STOP_AND_WAIT = 0,   // Request the next batch only after the current batch has fully arrived
+        SLIDING_WINDOW = 1   // Keep up to chunks_per_request_ chunks in flight, top up at half window
+    };
     
     // Protocol Command Types
     enum class CommandType : uint8_t {
         // From iOS to ESP32
         TRANSFER_INIT = 0x01,
+        REQUEST_DOWNLOAD = 0x03,
+        STATS = 0x04,                   // Answered with STATS_PAGE_COUNT STATS notifications
+        BENCHMARK = 0x05,               // Link throughput test, answered with BENCHMARK pages
+        MANIFEST = 0x06,                // Announces a batch of files, echoed back as acknowledgment
         
         // From ESP32 to iOS
         DEVICE_INFO = 0x02,
-        CHUNK_REQUEST = 0x82,
-        TRANSFER_COMPLETE_ACK = 0x83,
+        CHUNK_REQUEST = 0x82,           // Also iOS → ESP32 during a download
+        TRANSFER_COMPLETE_ACK = 0x83,   // Also iOS → ESP32 during a download
         TRANSFER_ERROR = 0x84
     };
     
@@ -114,7 +321,15 @@ public:
         CONTROL_MESSAGE_TOO_SHORT = 0x08,
         DATA_CHUNK_TOO_SHORT = 0x09,
         NOTIFICATION_SEND_FAILED = 0x0A,
-        INVALID_COMMAND = 0x0B
+        INVALID_COMMAND = 0x0B,
+        TRANSFER_TIMEOUT = 0x0C,
+        RECEIVER_BUSY = 0x0D,
+        STORAGE_ERROR = 0x0E,
+        INVALID_CONTENT = 0x0F,
+        UNSUPPORTED_TRANSFER_TYPE = 0x10,
+        CRC_MISMATCH = 0x11,
+        BASE_MISMATCH = 0x12,
+        DOWNLOAD_UNAVAILABLE = 0x13
     };
     
     // Transfer status
@@ -124,7 +339,11 @@ public:
         REQUESTING_CHUNKS = 2,
         RECEIVING = 3,
         COMPLETE = 4,
-        ERROR = 5
+        ERROR = 5,
+        SUSPENDED = 6,    // Interrupted by a disconnect, waiting to be resumed
+        SENDING = 7,      // Download in progress
+        BENCHMARKING = 8, // Link benchmark: chunks are counted and discarded
+        PREPARING = 9     // Download accepted, CRC32 being computed on a worker task
     };
     
     // Protocol Message Structures
@@ -148,26 +367,145 @@ public:
     // GATTService interface
     void handle_event(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param) override;
     void init(esp_gatt_if_t gatts_if) override;
+    void on_link_update(uint16_t conn_id) override;
+    
+    // Per-connection protocol state (defined in transfer_session.h)
+    class TransferSession;
     
     // Protocol methods
-    void reset_transfer();
-    Status get_status() const { return status_; }
-    uint32_t get_received_size() const { return received_size_; }
-    uint32_t get_total_size() const { return total_size_; }
-    uint32_t get_expected_chunks() const { return expected_chunks_; }
-    const uint8_t* get_image_buffer() const { return image_buffer_; }
+    void reset_transfer();  // Aborts the transfers of all sessions
+    
+    // Transfer state of the most recently active session (single-client applications)
+    Status get_status() const;
+    uint32_t get_received_size() const;
+    uint32_t get_total_size() const;
+    uint32_t get_expected_chunks() const;
+    const uint8_t* get_image_buffer() const;
+    const ChunkBitmap& get_chunk_map() const;
+    uint32_t get_transfer_crc() const;  // CRC32 of the in-order prefix received so far
+    uint32_t get_contiguous_chunks() const;
+    TransferType get_transfer_type() const;
+    uint16_t get_connection_id() const;
+    uint16_t get_mtu() const;
     
     // Connection management
-    void set_connection_id(uint16_t conn_id) { conn_id_ = conn_id; }
-    uint16_t get_connection_id() const { return conn_id_; }
-    void set_mtu(uint16_t mtu) { mtu_ = mtu; }
-    uint16_t get_mtu() const { return mtu_; }
+    // Sessions (= concurrently served connections), 1..MAX_SESSIONS. Advertising continues
+    // while sessions are free; lowering the limit does not drop connected clients.
+    void set_max_sessions(uint8_t max_sessions);
+    uint8_t get_max_sessions() const { return max_sessions_; }
+    uint8_t get_active_session_count() const;
+    // Session of a connection (nullptr if the connection has none)
+    const TransferSession* get_session(uint16_t conn_id) const;
+    // Transport: outgoing notifications go through transport (nullptr = GATT server). The
+    // on_client_*() calls feed client events in without Bluedroid, e.g. from a loopback
+    // transport that plays the client; GATT events take the same path internally.
+    void set_transport(TransferTransport* transport);
+    TransferTransport* get_transport() const { return transport_; }
+    void on_client_connected(uint16_t conn_id);
+    void on_client_disconnected(uint16_t conn_id);
+    void on_client_mtu(uint16_t conn_id, uint16_t mtu);
+    void on_client_write(uint16_t conn_id, uint16_t handle, const uint8_t* value, uint16_t len);
+    // Attribute handles (valid once the service has been created)
+    uint16_t get_control_char_handle() const { return control_char_handle_; }
+    uint16_t get_data_char_handle(uint8_t channel = 0) const {
+        return (channel < MAX_DATA_CHANNELS) ? data_char_handles_[channel] : 0;
+    }
+    uint16_t get_control_notify_handle() const { return control_notify_handle_; }
+    uint16_t get_data_notify_handle(uint8_t channel = 0) const {
+        return (channel < MAX_DATA_CHANNELS) ? data_notify_handles_[channel] : 0;
+    }
+    // Data channels: 1 (default) to MAX_DATA_CHANNELS data characteristics, all feeding the
+    // same transfers. Chunk IDs place the chunks, so clients that queue writes per
+    // characteristic may spread them freely; downloads use channel 0. Applies when the
+    // service is created (call before BLEServer::start()).
+    void set_data_channel_count(uint8_t count);
+    uint8_t get_data_channel_count() const { return data_channel_count_; }
+    // Queue of outgoing notifications (coalesced / retried / dropped counters)
+    const NotificationScheduler& get_tx_scheduler() const { return tx_scheduler_; }
+    // Instrumentation: running or last upload of the most recently active session, and the
+    // last finished upload of any session (also reported to clients via STATS)
+    const TransferMetrics& get_transfer_metrics() const;
+    const TransferMetrics& get_last_transfer_metrics() const { return last_metrics_; }
+    // RAM of all sessions (receive buffers + reorder windows); a TRANSFER_INIT that would
+    // exceed it is answered with RECEIVER_BUSY. 0 = unlimited.
+    void set_session_memory_budget(uint32_t max_bytes) { session_memory_budget_ = max_bytes; }
+    uint32_t get_session_memory_budget() const { return session_memory_budget_; }
+    uint32_t get_session_memory_usage() const;
+    
+    // Flow control configuration
+    void set_flow_mode(FlowMode mode) { flow_mode_ = mode; }
+    FlowMode get_flow_mode() const { return flow_mode_; }
+    void set_chunks_per_request(uint16_t num_chunks) { chunks_per_request_ = (num_chunks > 0) ? num_chunks : 1; }
+    uint16_t get_chunks_per_request() const { return chunks_per_request_; }
+    uint16_t get_active_chunks_per_request() const;
+    uint32_t get_chunks_in_flight() const;
+    
+    // Adaptive batch sizing: grow/shrink the batch per round from measured latency and loss.
+    // chunks_per_request_ is used as the starting point of every transfer.
+    void set_adaptive_batching(bool enabled) { adaptive_batching_ = enabled; }
+    bool get_adaptive_batching() const { return adaptive_batching_; }
+    void set_rate_controller_config(const ChunkRateController::Config& config) { rate_config_ = config; }
+    
+    // Ingest task: move chunk processing off the GATTS callback. Enable before clients
+    // connect; disabling while a transfer is running drops the queued chunks. A task that
+    // does not stop within INGEST_STOP_TIMEOUT_MS is reaped by the next enable (which fails
+    // with ESP_ERR_INVALID_STATE until then) or waited for by the destructor.
+    esp_err_t enable_ingest_task(const IngestConfig& config = DEFAULT_INGEST_CONFIG);
+    void disable_ingest_task();
+    bool is_ingest_task_enabled() const { return ingest_enabled_.load(std::memory_order_acquire); }
+    uint32_t get_ingest_dropped_chunks() const { return ingest_dropped_chunks_.load(std::memory_order_relaxed); }
+    
+    // Completion worker: TRANSFER_COMPLETE_ACK and the disconnect are sent first, then the
+    // buffer is handed to a worker task that invokes the callback and frees the buffer.
+    // The callback never runs on the BLE path: while queue_depth images are still waiting,
+    // asset transfers are answered with RECEIVER_BUSY (at TRANSFER_INIT, or instead of the ACK
+    // if the queue filled up during the transfer). Disabling delivers the queued images first;
+    // a worker that does not stop within COMPLETION_STOP_TIMEOUT_MS is reaped like the ingest task.
+    esp_err_t enable_completion_worker(const CompletionConfig& config = DEFAULT_COMPLETION_CONFIG);
+    void disable_completion_worker();
+    bool is_completion_worker_enabled() const { return completion_enabled_; }
     
     // Callback management
     void set_image_transfer_callback(ImageTransferCallback callback) { image_callback_ = callback; }
-    
-    // Buffer management - MUST be called by user after processing image in callback
-    void release_image_buffer();
+    void set_firmware_update_callback(FirmwareUpdateCallback callback) { firmware_callback_ = callback; }
+    void set_download_request_callback(DownloadRequestCallback callback) { download_request_callback_ = callback; }
+    void set_download_complete_callback(DownloadCompleteCallback callback) { download_complete_callback_ = callback; }
+    // Called whenever the in-order prefix has grown by step_bytes (and once it is complete)
+    void set_image_progress_callback(ImageProgressCallback callback, uint32_t step_bytes = DEFAULT_PROGRESS_STEP) {
+        progress_callback_ = callback;
+        progress_step_ = step_bytes ? step_bytes : 1;
+    }
+    
+    // Buffer management
+    // Receive buffers come from a preallocated PSRAM arena of DEFAULT_BUFFER_SLOTS slots of
+    // MAX_TRANSFER_SIZE bytes by default (heap_caps_malloc if no slot could be allocated).
+    // With the completion worker, one slot is consumed while the next transfer fills another.
+    // A custom allocator must outlive the service.
+    void set_buffer_allocator(TransferBufferAllocator* allocator);
+    TransferBufferAllocator* get_buffer_allocator() const { return allocator_; }
+    void release_image_buffer();  // Early release of the most recently active session's buffer (kept for compatibility)
+    
+    // Streaming: write transfers to a sink instead of RAM (nullptr = RAM buffer). Transfers
+    // may then be as large as the sink allows (max_size(), up to MAX_CHUNKS chunks). The sink
+    // must outlive the service. Slow sinks (flash erase) should be paired with the ingest task.
+    void set_transfer_sink(TransferSink* sink);
+    TransferSink* get_transfer_sink() const { return sink_; }
+    // Firmware updates: sink for TRANSFER_INIT with TransferType::FIRMWARE (typically an
+    // OtaSink); nullptr rejects firmware transfers with UNSUPPORTED_TRANSFER_TYPE
+    void set_firmware_sink(TransferSink* sink);
+    TransferSink* get_firmware_sink() const { return firmware_sink_; }
+    // Resume: keep interrupted transfers for this long (0 disables resume)
+    void set_resume_grace_period(uint32_t grace_ms) { resume_grace_ms_ = grace_ms; }
+    uint32_t get_resume_grace_period() const { return resume_grace_ms_; }
+    // Delta updates: keep the buffer of the last RAM image as patch base, so it occupies one
+    // receive buffer (arena slot). Transfers into a sink, or releasing the buffer inside the
+    // callback, do not update the base and invalidate it.
+    void set_delta_base_enabled(bool enabled);
+    bool is_delta_base_enabled() const { return delta_base_enabled_; }
+    bool has_delta_base() const { return static_cast<bool>(base_image_); }
+    uint32_t get_delta_base_crc() const { return base_crc_; }
+    void set_reorder_window(uint16_t num_chunks) { reorder_window_chunks_ = (num_chunks > 0) ? num_chunks : 1; }
+    uint16_t get_reorder_window() const { return reorder_window_chunks_; }
     
     // Device info management
     void set_device_type(uint8_t device_type) { device_type_ = device_type; }
@@ -178,65 +516,114 @@ public:
     uint16_t get_width() const { return width_; }
     uint16_t get_height() const { return height_; }
     
-    // Notification methods
-    bool send_control_notification(const ControlMessage& msg);
-    bool send_device_info();
-    bool send_chunk_request(uint16_t start_chunk, uint16_t num_chunks);
-    bool send_transfer_complete_ack(uint32_t received_size);
-    bool send_transfer_error(ErrorCode error_code);
-    
 private:
     // Service configuration
     uint16_t control_char_handle_;
-    uint16_t data_char_handle_;
+    uint16_t data_char_handles_[MAX_DATA_CHANNELS];  // 0 = channel not created
     uint16_t control_notify_handle_;
-    uint16_t data_notify_handle_;
-    uint16_t conn_id_;
-    uint16_t mtu_;
-    
-    // Notification state
-    bool control_notifications_enabled_;
-    bool data_notifications_enabled_;
+    uint16_t data_notify_handles_[MAX_DATA_CHANNELS];  // CCCD per data channel
     
     // Handle assignment tracking
     int char_count_;
     int descr_count_;
+    uint8_t data_channel_count_;
+    uint8_t data_channels_created_;
     
     // Characteristic creation state tracking
     enum class CharCreationState {
         WAITING_FOR_CONTROL = 0,
         WAITING_FOR_CONTROL_CCCD = 1,
-        WAITING_FOR_DATA = 2,
-        BOTH_CREATED = 3
+        WAITING_FOR_DATA = 2,         // Until all data channels are created
+        WAITING_FOR_DATA_CCCD = 3,    // CCCD of the data channel just created
+        BOTH_CREATED = 4
     };
     CharCreationState char_creation_state_;
     
-    // Protocol state
-    Status status_;
-    uint16_t sequence_number_;
+    // Transfer buffer allocation (allocators are declared before the sessions and base_image_ so they outlive their buffers)
+    ArenaAllocator default_arena_;
+    HeapCapsAllocator heap_allocator_;
+    TransferBufferAllocator* allocator_;
+    
+    // Link the notifications go out on (GATTS unless replaced via set_transport())
+    GattsTransport gatts_transport_;
+    TransferTransport* transport_;
     
-    // Transfer parameters (from TRANSFER_INIT)
-    uint32_t total_size_;
-    uint32_t chunk_size_;
-    uint32_t expected_chunks_;
+    // Outgoing notifications of all sessions (declared before the sessions so it outlives them)
+    NotificationScheduler tx_scheduler_;
     
-    // Transfer state
-    uint8_t* image_buffer_;
-    uint32_t received_size_;
-    uint16_t next_expected_chunk_;
-    bool* chunk_received_map_;  // Track which chunks have been received
+    // Metrics of the last finished upload (written by the sessions, so declared before them)
+    TransferMetrics last_metrics_;
     
-    // Chunk request state
-    uint16_t current_request_start_;  // First chunk ID in current request
-    uint16_t current_request_end_;    // Last chunk ID in current request
-    uint16_t chunks_per_request_;     // Number of chunks to request at once
+    // Sessions (one per connection, plus suspended ones waiting for their client)
+    std::unique_ptr<TransferSession> sessions_[MAX_SESSIONS];
+    uint8_t max_sessions_;
+    uint32_t session_memory_budget_;
+    TransferSession* primary_session_;  // Most recently active session (compatibility getters)
     
-    // Performance optimization counters
-    uint32_t total_chunks_received_;  // Fast counter instead of array iteration
-    uint16_t current_batch_received_; // Fast counter for current batch
+    // Streaming configuration
+    TransferSink* sink_;              // Asset sink (nullptr = RAM buffer)
+    TransferSink* firmware_sink_;
+    uint16_t reorder_window_chunks_;
+    
+    // Delta base: last image received into RAM
+    bool delta_base_enabled_;
+    TransferBuffer base_image_;       // Buffer of that image, kept after its callback returned
+    uint32_t base_crc_;
+    uint8_t pending_base_updates_;    // Images still with the completion worker that become the base afterwards
+    
+    // Chunk request configuration
+    uint16_t chunks_per_request_;     // Configured batch size (stop-and-wait) or window size (sliding window)
+    FlowMode flow_mode_;
+    bool adaptive_batching_;
+    ChunkRateController::Config rate_config_;
+    uint32_t resume_grace_ms_;
+    
+    // Serializes the GATTS callback context against the session timers and ingest task
+    SemaphoreHandle_t state_mutex_;
+    
+    // Ingest task state (producer: GATTS callback, consumer: ingest task)
+    struct IngestSlot {
+        uint32_t generation;              // transfer_generation_ at enqueue time
+        uint16_t conn_id;
+        uint16_t len;
+        uint8_t data[MAX_ATT_PAYLOAD];
+    };
+    SpscRing<IngestSlot> ingest_ring_;
+    TaskHandle_t ingest_task_;        // Set until the task has exited and been reaped (may outlive a disable)
+    std::atomic<bool> ingest_enabled_;
+    std::atomic<bool> ingest_stop_;
+    SemaphoreHandle_t ingest_mutex_;  // Producer: enabled check and produce; enable/disable: flipping ingest_enabled_
+    SemaphoreHandle_t ingest_exited_;  // Given by the ingest task right before it deletes itself
+    std::atomic<uint32_t> transfer_generation_;  // Bumped on session reset so queued chunks of an old transfer are dropped
+    std::atomic<uint32_t> ingest_dropped_chunks_;  // Data writes dropped because the ring was full
+    
+    // Completion worker state
+    struct CompletionJob {
+        uint8_t* buffer;                  // Owned by the worker once queued (nullptr when streamed)
+        uint32_t size;
+        TransferBufferAllocator* allocator;
+        bool is_valid_jpeg;
+        bool delta_base;                  // Becomes the delta base once the callback returned
+        uint32_t crc;
+        bool stop;
+    };
+    bool completion_enabled_;             // Changed under the state mutex: sessions hand their images to the worker
+    uint8_t completion_depth_;            // Images allowed to wait in the queue
+    QueueHandle_t completion_queue_;      // completion_depth_ images plus room for the stop job
+    SemaphoreHandle_t completion_exited_; // Given by the worker right before it deletes itself
+    TaskHandle_t completion_task_;        // Set until the worker has exited and been reaped
+    
+    // Download CRC workers (state mutex held): they reference sessions, so the destructor waits for them
+    uint8_t download_crc_tasks_;
+    TaskHandle_t download_crc_waiter_;
     
     // Callback for image transfer completion
     ImageTransferCallback image_callback_;
+    FirmwareUpdateCallback firmware_callback_;
+    DownloadRequestCallback download_request_callback_;
+    DownloadCompleteCallback download_complete_callback_;
+    ImageProgressCallback progress_callback_;
+    uint32_t progress_step_;
     
     // Device info parameters
     uint8_t device_type_;
@@ -253,16 +640,45 @@ private:
     void handle_connect_event(esp_ble_gatts_cb_param_t *param);
     void handle_disconnect_event(esp_ble_gatts_cb_param_t *param);
     void handle_mtu_event(esp_ble_gatts_cb_param_t *param);
-    
-    // Protocol message handlers
-    void handle_control_message(esp_gatt_if_t gatts_if, const uint8_t* data, uint16_t len);
-    void handle_data_chunk(const uint8_t* data, uint16_t len);
-    void handle_transfer_init(const ControlMessage& msg);
-    void handle_device_info_request(const ControlMessage& msg);
+    bool is_data_char_handle(uint16_t handle) const;
+    // Data channel whose CCCD has this handle, or -1
+    int data_notify_channel(uint16_t handle) const;
+    
+    // Transport independent part of the handlers above (state mutex held)
+    void process_write(uint16_t conn_id, uint16_t handle, const uint8_t* value, uint16_t len);
+    void process_connect(uint16_t conn_id);
+    void process_disconnect(uint16_t conn_id);
+    void process_mtu(uint16_t conn_id, uint16_t mtu);
+    
+    // Session management
+    TransferSession* find_session(uint16_t conn_id) const;
+    TransferSession* acquire_session(uint16_t conn_id);
+    TransferSession* find_resumable_session(const ControlMessage& msg) const;
+    bool is_sink_busy(const TransferSink* sink) const;
+    bool is_source_busy(const TransferSource* source) const;
+    bool fits_memory_budget(uint32_t required_bytes) const;
+    // State mutex held: the image becomes the base (ownership moves, no copy); an empty one drops the base
+    void update_delta_base(const TransferSession* completing, TransferBuffer&& image, uint32_t crc);
+    void restart_advertising(bool fast = false);
+    static bool coalesce_control_message(uint8_t* queued, const uint8_t* incoming, uint16_t len);
     
     // Helper methods
-    bool validate_jpeg_header() const;
     uint32_t get_available_memory() const;
-    bool is_transfer_complete() const;
-    void create_data_characteristic();
+    
+    // Ingest task helpers
+    bool enqueue_data_chunk(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
+    static void ingest_task_entry(void* arg);
+    void drain_ingest_ring();
+    bool reap_ingest_task(TickType_t wait_ticks);
+    
+    // Completion helpers
+    static void completion_task_entry(void* arg);
+    bool reap_completion_task(TickType_t wait_ticks);
+    // State mutex held: another image fits the completion queue
+    bool has_completion_capacity() const;
+    void stop_download_crc_tasks();  // Returns only once every CRC worker has exited
+    
+    // Characteristic setup
+    void create_data_characteristic(uint8_t channel);
+    bool add_notify_descriptor(const char* char_name);
 };
\ No newline at end of file
@@ -0,0 +1,186 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "lz4_block_decoder.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include <cstring>
+
+static const char* TAG = "Lz4BlockDecoder";
+
+constexpr uint16_t Lz4BlockDecoder::MAX_BLOCK_SIZE;
+constexpr uint16_t Lz4BlockDecoder::MAX_STORED_SIZE;
+constexpr uint8_t Lz4BlockDecoder::BLOCK_HEADER_SIZE;
+constexpr uint16_t Lz4BlockDecoder::BLOCK_FLAG_STORED;
+
+static constexpr uint8_t LZ4_MIN_MATCH = 4;
+
+Lz4BlockDecoder::Lz4BlockDecoder()
+    : input_(nullptr), output_(nullptr), header_(), header_fill_(0),
+      raw_len_(0), stored_len_(0), stored_(false), input_fill_(0), failed_(false) {
+}
+
+Lz4BlockDecoder::~Lz4BlockDecoder() {
+    release();
+}
+
+bool Lz4BlockDecoder::init() {
+    release();
+    // Both buffers are touched for every byte, so keep them out of PSRAM
+    input_ = static_cast<uint8_t*>(heap_caps_malloc(MAX_STORED_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    output_ = static_cast<uint8_t*>(heap_caps_malloc(MAX_BLOCK_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    if (!input_ || !output_) {
+        ESP_LOGE(TAG, "Failed to allocate %d bytes of block buffers", MAX_STORED_SIZE + MAX_BLOCK_SIZE);
+        release();
+        return false;
+    }
+    header_fill_ = 0;
+    input_fill_ = 0;
+    failed_ = false;
+    return true;
+}
+
+void Lz4BlockDecoder::release() {
+    heap_caps_free(input_);
+    heap_caps_free(output_);
+    input_ = nullptr;
+    output_ = nullptr;
+}
+
+bool Lz4BlockDecoder::feed(const uint8_t* data, uint32_t len, OutputCallback output, void* ctx) {
+    if (failed_ || !input_) {
+        return false;
+    }
+    
+    while (len > 0) {
+        if (header_fill_ < BLOCK_HEADER_SIZE) {
+            header_[header_fill_++] = *data++;
+            len--;
+            if (header_fill_ == BLOCK_HEADER_SIZE && !parse_header()) {
+                failed_ = true;
+                return false;
+            }
+            continue;
+        }
+        
+        uint32_t take = stored_len_ - input_fill_;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(input_ + input_fill_, data, take);
+        input_fill_ += take;
+        data += take;
+        len -= take;
+        
+        if (input_fill_ == stored_len_ && !finish_block(output, ctx)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Lz4BlockDecoder::parse_header() {
+    raw_len_ = static_cast<uint16_t>(header_[0] | (header_[1] << 8));
+    uint16_t stored_field = static_cast<uint16_t>(header_[2] | (header_[3] << 8));
+    stored_ = (stored_field & BLOCK_FLAG_STORED) != 0;
+    stored_len_ = stored_field & ~BLOCK_FLAG_STORED;
+    input_fill_ = 0;
+    
+    if (raw_len_ == 0 || raw_len_ > MAX_BLOCK_SIZE || stored_len_ == 0 || stored_len_ > MAX_STORED_SIZE ||
+        (stored_ && stored_len_ != raw_len_)) {
+        ESP_LOGE(TAG, "Invalid block header: raw %d, stored %d%s", raw_len_, stored_len_, stored_ ? " (uncompressed)" : "");
+        return false;
+    }
+    return true;
+}
+
+bool Lz4BlockDecoder::finish_block(OutputCallback output, void* ctx) {
+    header_fill_ = 0;
+    
+    if (stored_) {
+        return output(ctx, input_, raw_len_);
+    }
+    
+    int32_t decoded = decompress_block(input_, stored_len_, output_, MAX_BLOCK_SIZE);
+    if (decoded != raw_len_) {
+        ESP_LOGE(TAG, "Corrupt LZ4 block: decoded %d of %d bytes", static_cast<int>(decoded), raw_len_);
+        failed_ = true;
+        return false;
+    }
+    return output(ctx, output_, raw_len_);
+}
+
+int32_t Lz4BlockDecoder::decompress_block(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_capacity) {
+    const uint8_t* ip = src;
+    const uint8_t* const iend = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* const oend = dst + dst_capacity;
+    
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        
+        // Literals
+        uint32_t literal_len = token >> 4;
+        if (literal_len == 15) {
+            uint8_t extra;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                extra = *ip++;
+                literal_len += extra;
+            } while (extra == 255);
+        }
+        if (literal_len > static_cast<uint32_t>(iend - ip) || literal_len > static_cast<uint32_t>(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        
+        if (ip == iend) {
+            break;  // The last sequence carries literals only
+        }
+        
+        // Match
+        if (iend - ip < 2) {
+            return -1;
+        }
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<uint32_t>(op - dst)) {
+            return -1;
+        }
+        
+        uint32_t match_len = token & 0x0F;
+        if (match_len == 15) {
+            uint8_t extra;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                extra = *ip++;
+                match_len += extra;
+            } while (extra == 255);
+        }
+        match_len += LZ4_MIN_MATCH;
+        if (match_len > static_cast<uint32_t>(oend - op)) {
+            return -1;
+        }
+        
+        const uint8_t* match = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, match, match_len);
+            op += match_len;
+        } else {
+            // Overlapping match repeats the last 'offset' bytes
+            for (uint32_t i = 0; i < match_len; i++) {
+                *op++ = *match++;
+            }
+        }
+    }
+    
+    return static_cast<int32_t>(op - dst);
+}
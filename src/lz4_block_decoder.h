@@ -0,0 +1,73 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief Lz4BlockDecoder - Streaming decoder for block-framed LZ4
+ *
+ * Compressed transfers are a sequence of independently compressed blocks of at
+ * most MAX_BLOCK_SIZE bytes, so the decoder never needs more history than one
+ * block (~8KB of RAM in total, unlike the 64KB window of an LZ4 frame).
+ *
+ * Block format (little-endian):
+ *   [raw_len u16][stored_len u16][payload]
+ * - raw_len:    decompressed size of the block (1..MAX_BLOCK_SIZE)
+ * - stored_len: payload size; BLOCK_FLAG_STORED set = payload is uncompressed
+ * - payload:    raw LZ4 block (as produced by LZ4_compress_default or Apple's
+ *               COMPRESSION_LZ4_RAW), or the block bytes themselves
+ *
+ * Input may be fed in arbitrary pieces (one chunk at a time). Each completed
+ * block is passed to the output callback.
+ */
+class Lz4BlockDecoder {
+public:
+    static constexpr uint16_t MAX_BLOCK_SIZE = 4096;
+    static constexpr uint16_t MAX_STORED_SIZE = MAX_BLOCK_SIZE + MAX_BLOCK_SIZE / 255 + 16;  // LZ4 worst case
+    static constexpr uint8_t BLOCK_HEADER_SIZE = 4;
+    static constexpr uint16_t BLOCK_FLAG_STORED = 0x8000;
+    
+    // Receives each decoded block; returning false stops decoding
+    typedef bool (*OutputCallback)(void* ctx, const uint8_t* data, uint32_t len);
+    
+    Lz4BlockDecoder();
+    ~Lz4BlockDecoder();
+    
+    Lz4BlockDecoder(const Lz4BlockDecoder&) = delete;
+    Lz4BlockDecoder& operator=(const Lz4BlockDecoder&) = delete;
+    
+    // Allocate the block buffers (internal RAM) and reset the stream state
+    bool init();
+    void release();
+    bool is_initialized() const { return input_ != nullptr; }
+    
+    // Decode the next piece of the stream; false on malformed input or callback failure
+    bool feed(const uint8_t* data, uint32_t len, OutputCallback output, void* ctx);
+    
+    // True between blocks, i.e. the stream so far ended on a block boundary
+    bool is_idle() const { return header_fill_ == 0; }
+    // True if feed() failed because of malformed input (not because of the callback)
+    bool has_failed() const { return failed_; }
+    
+    // Decode one raw LZ4 block; returns the decoded size or -1 if the block is malformed
+    static int32_t decompress_block(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_capacity);
+
+private:
+    uint8_t* input_;                  // Payload of the current block
+    uint8_t* output_;                 // Decoded block
+    uint8_t header_[BLOCK_HEADER_SIZE];
+    uint8_t header_fill_;             // Header bytes of the current block seen so far
+    uint16_t raw_len_;
+    uint16_t stored_len_;             // Payload size (without BLOCK_FLAG_STORED)
+    bool stored_;
+    uint16_t input_fill_;
+    bool failed_;
+    
+    bool parse_header();
+    bool finish_block(OutputCallback output, void* ctx);
+};
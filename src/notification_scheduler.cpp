@@ -0,0 +1,304 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "notification_scheduler.h"
+#include "state_lock.h"
+#include "transfer_log.h"
+#include "esp_log.h"
+#include <cstring>
+
+static const char* TAG = "NotificationScheduler";
+
+constexpr uint8_t NotificationScheduler::MAX_CONNECTIONS;
+constexpr uint8_t NotificationScheduler::CONTROL_QUEUE_DEPTH;
+constexpr uint8_t NotificationScheduler::MAX_CONTROL_SIZE;
+constexpr uint8_t NotificationScheduler::BURST_LIMIT;
+constexpr uint32_t NotificationScheduler::BURST_DELAY_MS;
+constexpr uint32_t NotificationScheduler::RETRY_DELAY_MS;
+constexpr uint8_t NotificationScheduler::MAX_SEND_ATTEMPTS;
+
+NotificationScheduler::NotificationScheduler()
+    : next_lane_(0), transport_(nullptr), coalesce_(nullptr), mutex_(nullptr), retry_timer_(nullptr),
+      coalesced_count_(0), retry_count_(0), dropped_count_(0) {
+    for (auto& lane : lanes_) {
+        clear_lane(lane);
+    }
+}
+
+NotificationScheduler::~NotificationScheduler() {
+    release();
+}
+
+bool NotificationScheduler::init(SemaphoreHandle_t mutex) {
+    release();
+    mutex_ = mutex;
+    
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = &NotificationScheduler::retry_timer_callback;
+    timer_args.arg = this;
+    timer_args.dispatch_method = ESP_TIMER_TASK;
+    timer_args.name = "tf_tx";
+    esp_err_t ret = esp_timer_create(&timer_args, &retry_timer_);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create TX retry timer: %s", esp_err_to_name(ret));
+        retry_timer_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void NotificationScheduler::release() {
+    if (retry_timer_) {
+        esp_timer_stop(retry_timer_);
+        esp_timer_delete(retry_timer_);
+        retry_timer_ = nullptr;
+    }
+    for (auto& lane : lanes_) {
+        clear_lane(lane);
+    }
+}
+
+bool NotificationScheduler::send_control(uint16_t conn_id, uint16_t handle, const uint8_t* data, uint16_t len) {
+    if (len > MAX_CONTROL_SIZE) {
+        ESP_LOGE(TAG, "Control message of %d bytes exceeds %d", len, MAX_CONTROL_SIZE);
+        return false;
+    }
+    Lane* lane = find_lane(conn_id, true);
+    if (!lane) {
+        ESP_LOGE(TAG, "No TX lane for conn_id %d", conn_id);
+        return false;
+    }
+    
+    // Only the last queued message is merged into, so the message order is kept
+    if (lane->count > 0 && coalesce_) {
+        ControlEntry& tail = lane->control[(lane->head + lane->count - 1) % CONTROL_QUEUE_DEPTH];
+        if (tail.handle == handle && tail.len == len && coalesce_(tail.data, data, len)) {
+            coalesced_count_++;
+            return true;
+        }
+    }
+    
+    if (lane->count >= CONTROL_QUEUE_DEPTH) {
+        ESP_LOGE(TAG, "TX queue of conn_id %d full", conn_id);
+        return false;
+    }
+    
+    ControlEntry& entry = lane->control[(lane->head + lane->count) % CONTROL_QUEUE_DEPTH];
+    entry.handle = handle;
+    entry.len = static_cast<uint8_t>(len);
+    entry.attempts = 0;
+    memcpy(entry.data, data, len);
+    lane->count++;
+    
+    pump();
+    return true;
+}
+
+void NotificationScheduler::set_data_source(uint16_t conn_id, DataSource source, void* ctx) {
+    Lane* lane = find_lane(conn_id, source != nullptr);
+    if (!lane) {
+        return;
+    }
+    lane->data_source = source;
+    lane->data_ctx = ctx;
+    lane->data_pending = false;
+    if (source) {
+        pump();
+    }
+}
+
+void NotificationScheduler::close_after_drain(uint16_t conn_id) {
+    Lane* lane = find_lane(conn_id, false);
+    if (lane && lane->count > 0) {
+        lane->close_pending = true;
+        return;
+    }
+    close_connection(conn_id);
+}
+
+void NotificationScheduler::on_congestion(uint16_t conn_id, bool congested) {
+    Lane* lane = find_lane(conn_id, false);
+    if (!lane) {
+        return;
+    }
+    lane->congested = congested;
+    TRANSFER_TRACE(CONGESTION, conn_id, congested ? 1 : 0, 0);
+    if (!congested) {
+        pump();
+    }
+}
+
+void NotificationScheduler::remove_connection(uint16_t conn_id) {
+    Lane* lane = find_lane(conn_id, false);
+    if (lane) {
+        if (lane->count > 0) {
+            ESP_LOGW(TAG, "Dropping %d queued notifications of conn_id %d", lane->count, conn_id);
+        }
+        clear_lane(*lane);
+    }
+}
+
+void NotificationScheduler::pump() {
+    if (!transport_) {
+        return;
+    }
+    
+    uint8_t sent = 0;
+    bool failed = false;
+    
+    // Control messages first, one per connection per round
+    bool progress = true;
+    while (progress && sent < BURST_LIMIT) {
+        progress = false;
+        for (uint8_t i = 0; i < MAX_CONNECTIONS && sent < BURST_LIMIT; i++) {
+            Lane& lane = lanes_[(next_lane_ + i) % MAX_CONNECTIONS];
+            if (send_next_control(lane, &failed)) {
+                sent++;
+                progress = true;
+            }
+        }
+    }
+    
+    // Data only on connections without pending control messages
+    progress = true;
+    while (progress && sent < BURST_LIMIT) {
+        progress = false;
+        for (uint8_t i = 0; i < MAX_CONNECTIONS && sent < BURST_LIMIT; i++) {
+            Lane& lane = lanes_[(next_lane_ + i) % MAX_CONNECTIONS];
+            if (send_next_data(lane, &failed)) {
+                sent++;
+                progress = true;
+            }
+        }
+    }
+    
+    next_lane_ = (next_lane_ + 1) % MAX_CONNECTIONS;
+    
+    if (failed) {
+        retry_count_++;
+        schedule(RETRY_DELAY_MS);
+    } else if (sent >= BURST_LIMIT) {
+        schedule(BURST_DELAY_MS);
+    }
+}
+
+bool NotificationScheduler::send_next_control(Lane& lane, bool* failed) {
+    if (!lane.in_use || lane.congested || lane.count == 0) {
+        return false;
+    }
+    
+    ControlEntry& entry = lane.control[lane.head];
+    if (transmit(lane.conn_id, entry.handle, entry.data, entry.len)) {
+        pop_control(lane);
+        return true;
+    }
+    
+    *failed = true;
+    if (++entry.attempts >= MAX_SEND_ATTEMPTS) {
+        ESP_LOGE(TAG, "Dropping control message for conn_id %d after %d failed sends", lane.conn_id, entry.attempts);
+        dropped_count_++;
+        pop_control(lane);
+    }
+    return false;
+}
+
+bool NotificationScheduler::send_next_data(Lane& lane, bool* failed) {
+    if (!lane.in_use || lane.congested || lane.count > 0 || lane.close_pending || !lane.data_source) {
+        return false;
+    }
+    
+    if (!lane.data_pending) {
+        if (!lane.data_source(lane.data_ctx, lane.conn_id, &lane.data_handle, &lane.data, &lane.data_len)) {
+            return false;
+        }
+        lane.data_pending = true;
+    }
+    
+    // Data is retried until it goes out; the source's own timeouts end a stuck stream
+    if (!transmit(lane.conn_id, lane.data_handle, lane.data, lane.data_len)) {
+        *failed = true;
+        return false;
+    }
+    lane.data_pending = false;
+    return true;
+}
+
+void NotificationScheduler::pop_control(Lane& lane) {
+    lane.head = (lane.head + 1) % CONTROL_QUEUE_DEPTH;
+    lane.count--;
+    
+    if (lane.count == 0 && lane.close_pending) {
+        // Last message (e.g. TRANSFER_COMPLETE_ACK) is out - now the client may be disconnected
+        lane.close_pending = false;
+        close_connection(lane.conn_id);
+    }
+}
+
+bool NotificationScheduler::transmit(uint16_t conn_id, uint16_t handle, const uint8_t* data, uint16_t len) {
+    esp_err_t ret = transport_->notify(conn_id, handle, data, len);
+    if (ret != ESP_OK) {
+        TRANSFER_TRACE(NOTIFY_DEFERRED, conn_id, handle, static_cast<uint32_t>(ret));
+        ESP_LOGD(TAG, "Notification to conn_id %d deferred: %s", conn_id, esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
+
+void NotificationScheduler::close_connection(uint16_t conn_id) {
+    esp_err_t ret = transport_ ? transport_->close(conn_id) : ESP_ERR_INVALID_STATE;
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to close conn_id %d: %s", conn_id, esp_err_to_name(ret));
+    }
+}
+
+NotificationScheduler::Lane* NotificationScheduler::find_lane(uint16_t conn_id, bool create) {
+    Lane* free_lane = nullptr;
+    for (auto& lane : lanes_) {
+        if (lane.in_use && lane.conn_id == conn_id) {
+            return &lane;
+        }
+        if (!lane.in_use && !free_lane) {
+            free_lane = &lane;
+        }
+    }
+    if (!create || !free_lane) {
+        return nullptr;
+    }
+    clear_lane(*free_lane);
+    free_lane->in_use = true;
+    free_lane->conn_id = conn_id;
+    return free_lane;
+}
+
+void NotificationScheduler::clear_lane(Lane& lane) {
+    lane.in_use = false;
+    lane.conn_id = 0;
+    lane.congested = false;
+    lane.close_pending = false;
+    lane.head = 0;
+    lane.count = 0;
+    lane.data_source = nullptr;
+    lane.data_ctx = nullptr;
+    lane.data_pending = false;
+    lane.data_handle = 0;
+    lane.data = nullptr;
+    lane.data_len = 0;
+}
+
+void NotificationScheduler::schedule(uint32_t delay_ms) {
+    if (!retry_timer_ || esp_timer_is_active(retry_timer_)) {
+        return;
+    }
+    esp_err_t ret = esp_timer_start_once(retry_timer_, static_cast<uint64_t>(delay_ms) * 1000ULL);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start TX retry timer: %s", esp_err_to_name(ret));
+    }
+}
+
+void NotificationScheduler::retry_timer_callback(void* arg) {
+    NotificationScheduler* scheduler = static_cast<NotificationScheduler*>(arg);
+    StateLock lock(scheduler->mutex_);
+    scheduler->pump();
+}
@@ -0,0 +1,127 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <cstdint>
+#include "transfer_transport.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/**
+ * @brief NotificationScheduler - Queued, fair GATT notification sender
+ *
+ * Outgoing notifications go through one queue per connection instead of straight to
+ * the transport (esp_ble_gatts_send_indicate()), so a busy or congested link delays
+ * messages instead of failing the transfer:
+ * - Control messages are sent before data notifications (a CHUNK_REQUEST is never stuck
+ *   behind reverse-direction data)
+ * - Connections are served round-robin, at most one message per connection per round
+ * - A connection reported congested (ESP_GATTS_CONGEST_EVT) is skipped until it clears;
+ *   failed sends stay queued and are retried from a timer
+ * - A message may be merged into the last queued message of its connection (coalesce
+ *   callback), e.g. redundant or contiguous CHUNK_REQUESTs
+ * - Data notifications are pulled from a per-connection DataSource when the connection
+ *   has nothing else to send, so data is never copied into the queue
+ *
+ * At most BURST_LIMIT notifications are sent per pump() so the BLE stack can report
+ * congestion in between; the rest follows from the timer. pump() and all other
+ * methods must be called with the mutex passed to init() held.
+ */
+class NotificationScheduler {
+public:
+    static constexpr uint8_t MAX_CONNECTIONS = 4;
+    static constexpr uint8_t CONTROL_QUEUE_DEPTH = 16;    // Control messages queued per connection
+    static constexpr uint8_t MAX_CONTROL_SIZE = 20;
+    static constexpr uint8_t BURST_LIMIT = 8;             // Notifications per pump() before yielding to the stack
+    static constexpr uint32_t BURST_DELAY_MS = 1;         // Pause after a full burst
+    static constexpr uint32_t RETRY_DELAY_MS = 5;         // Pause after a failed send
+    static constexpr uint8_t MAX_SEND_ATTEMPTS = 50;      // Failed sends before a control message is dropped
+    
+    // Merge 'incoming' into the last queued message; true = incoming needs no entry of its own
+    typedef bool (*CoalesceCallback)(uint8_t* queued, const uint8_t* incoming, uint16_t len);
+    
+    // Next data notification of a connection; false = nothing to send right now.
+    // *data must stay valid until the source is called again or removed.
+    typedef bool (*DataSource)(void* ctx, uint16_t conn_id, uint16_t* handle, const uint8_t** data, uint16_t* len);
+    
+    NotificationScheduler();
+    ~NotificationScheduler();
+    
+    NotificationScheduler(const NotificationScheduler&) = delete;
+    NotificationScheduler& operator=(const NotificationScheduler&) = delete;
+    
+    // Create the retry timer; its callback takes 'mutex' before pumping
+    bool init(SemaphoreHandle_t mutex);
+    void release();
+    // Link the notifications go out on (nullptr = nothing is sent)
+    void set_transport(TransferTransport* transport) { transport_ = transport; }
+    void set_coalesce_callback(CoalesceCallback callback) { coalesce_ = callback; }
+    
+    // Queue a control notification and start sending; false if the queue of the connection is full
+    bool send_control(uint16_t conn_id, uint16_t handle, const uint8_t* data, uint16_t len);
+    // Pull data notifications for a connection from 'source' (nullptr stops)
+    void set_data_source(uint16_t conn_id, DataSource source, void* ctx);
+    // Close the connection once its queued control messages are sent
+    void close_after_drain(uint16_t conn_id);
+    
+    // ESP_GATTS_CONGEST_EVT
+    void on_congestion(uint16_t conn_id, bool congested);
+    // Drop everything queued for a connection (disconnect)
+    void remove_connection(uint16_t conn_id);
+    
+    // Send what the links accept now
+    void pump();
+    
+    uint32_t get_coalesced_count() const { return coalesced_count_; }
+    uint32_t get_retry_count() const { return retry_count_; }
+    uint32_t get_dropped_count() const { return dropped_count_; }
+
+private:
+    struct ControlEntry {
+        uint16_t handle;
+        uint8_t len;
+        uint8_t attempts;
+        uint8_t data[MAX_CONTROL_SIZE];
+    };
+    
+    struct Lane {
+        bool in_use;
+        uint16_t conn_id;
+        bool congested;
+        bool close_pending;
+        ControlEntry control[CONTROL_QUEUE_DEPTH];
+        uint8_t head;
+        uint8_t count;
+        DataSource data_source;
+        void* data_ctx;
+        bool data_pending;                // Pulled from the source but not sent yet
+        uint16_t data_handle;
+        const uint8_t* data;
+        uint16_t data_len;
+    };
+    
+    Lane lanes_[MAX_CONNECTIONS];
+    uint8_t next_lane_;                   // First lane served in the next round
+    TransferTransport* transport_;
+    CoalesceCallback coalesce_;
+    SemaphoreHandle_t mutex_;
+    esp_timer_handle_t retry_timer_;
+    
+    uint32_t coalesced_count_;
+    uint32_t retry_count_;
+    uint32_t dropped_count_;
+    
+    Lane* find_lane(uint16_t conn_id, bool create);
+    static void clear_lane(Lane& lane);
+    bool transmit(uint16_t conn_id, uint16_t handle, const uint8_t* data, uint16_t len);
+    void close_connection(uint16_t conn_id);
+    bool send_next_control(Lane& lane, bool* failed);
+    bool send_next_data(Lane& lane, bool* failed);
+    void pop_control(Lane& lane);
+    void schedule(uint32_t delay_ms);
+    static void retry_timer_callback(void* arg);
+};
@@ -0,0 +1,139 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "ota_sink.h"
+#include <cstring>
+#include "esp_log.h"
+#include "esp_app_format.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "OtaSink";
+
+OtaSink::OtaSink(const esp_partition_t* partition)
+    : BlockSink(DEFAULT_BLOCK_SIZE), partition_(partition), update_partition_(nullptr),
+      ota_handle_(0), ota_started_(false), content_rejected_(false), image_version_() {
+}
+
+OtaSink::~OtaSink() {
+    if (ota_started_) {
+        esp_ota_abort(ota_handle_);
+        ota_started_ = false;
+    }
+}
+
+const esp_partition_t* OtaSink::resolve_partition() const {
+    return partition_ ? partition_ : esp_ota_get_next_update_partition(nullptr);
+}
+
+uint32_t OtaSink::max_size() const {
+    const esp_partition_t* partition = resolve_partition();
+    return partition ? partition->size : 0;
+}
+
+bool OtaSink::on_begin(uint32_t total_size) {
+    content_rejected_ = false;
+    image_version_[0] = '\0';
+    
+    if (ota_started_) {
+        esp_ota_abort(ota_handle_);
+        ota_started_ = false;
+    }
+    
+    update_partition_ = resolve_partition();
+    if (!update_partition_) {
+        ESP_LOGE(TAG, "No OTA update partition available");
+        return false;
+    }
+    if (total_size > update_partition_->size) {
+        ESP_LOGE(TAG, "Firmware of %lu bytes exceeds partition '%s' (%lu bytes)",
+                 total_size, update_partition_->label, update_partition_->size);
+        return false;
+    }
+    
+    // Sequential writes: erase happens per sector as data arrives instead of up front
+    esp_err_t ret = esp_ota_begin(update_partition_, OTA_WITH_SEQUENTIAL_WRITES, &ota_handle_);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+    ota_started_ = true;
+    
+    ESP_LOGI(TAG, "OTA update started: %lu bytes into '%s' at 0x%lx",
+             total_size, update_partition_->label, update_partition_->address);
+    return true;
+}
+
+bool OtaSink::validate_image_header(const uint8_t* data, uint32_t len) {
+    const uint32_t desc_offset = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t);
+    if (len < desc_offset + sizeof(esp_app_desc_t)) {
+        ESP_LOGE(TAG, "First block too short for an image header (%lu bytes)", len);
+        return false;
+    }
+    
+    esp_image_header_t header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != ESP_IMAGE_HEADER_MAGIC) {
+        ESP_LOGE(TAG, "Invalid image magic 0x%02X", header.magic);
+        return false;
+    }
+    if (header.chip_id != CONFIG_IDF_FIRMWARE_CHIP_ID) {
+        ESP_LOGE(TAG, "Image built for chip ID 0x%04X, this chip is 0x%04X",
+                 header.chip_id, CONFIG_IDF_FIRMWARE_CHIP_ID);
+        return false;
+    }
+    
+    esp_app_desc_t app_desc;
+    memcpy(&app_desc, data + desc_offset, sizeof(app_desc));
+    if (app_desc.magic_word != ESP_APP_DESC_MAGIC_WORD) {
+        ESP_LOGE(TAG, "Missing app descriptor in image");
+        return false;
+    }
+    
+    memcpy(image_version_, app_desc.version, sizeof(image_version_) - 1);
+    image_version_[sizeof(image_version_) - 1] = '\0';
+    ESP_LOGI(TAG, "Firmware image: %.32s %s (IDF %.32s)", app_desc.project_name, image_version_, app_desc.idf_ver);
+    return true;
+}
+
+bool OtaSink::write_block(uint32_t offset, const uint8_t* data, uint32_t len) {
+    // Reject foreign images before the first byte hits the OTA slot
+    if (offset == 0 && !validate_image_header(data, len)) {
+        content_rejected_ = true;
+        return false;
+    }
+    
+    esp_err_t ret = esp_ota_write(ota_handle_, data, len);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_write at %lu failed: %s", offset, esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
+
+bool OtaSink::on_finish() {
+    ota_started_ = false;
+    esp_err_t ret = esp_ota_end(ota_handle_);
+    if (ret != ESP_OK) {
+        content_rejected_ = (ret == ESP_ERR_OTA_VALIDATE_FAILED);
+        ESP_LOGE(TAG, "esp_ota_end failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+    
+    ret = esp_ota_set_boot_partition(update_partition_);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_set_boot_partition failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+    
+    ESP_LOGI(TAG, "✅ Firmware %s written to '%s' - active after restart", image_version_, update_partition_->label);
+    return true;
+}
+
+void OtaSink::on_abort() {
+    if (ota_started_) {
+        esp_ota_abort(ota_handle_);
+        ota_started_ = false;
+    }
+}
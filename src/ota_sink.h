@@ -0,0 +1,49 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include "transfer_sink.h"
+#include "esp_ota_ops.h"
+
+/**
+ * @brief OtaSink - Streams a firmware image into the next OTA slot
+ * 
+ * Uses esp_ota_begin(OTA_WITH_SEQUENTIAL_WRITES) so flash is erased sector by
+ * sector while the image arrives. Verification overlaps with the transfer:
+ * the image header (magic, chip ID) and app descriptor are checked in the first
+ * block, before anything is written, and esp_ota_end() validates the complete
+ * image. On success the new slot becomes the boot partition; the application
+ * decides when to restart.
+ */
+class OtaSink : public BlockSink {
+public:
+    // nullptr selects the next update partition after the running one
+    explicit OtaSink(const esp_partition_t* partition = nullptr);
+    ~OtaSink() override;
+    
+    uint32_t max_size() const override;
+    bool content_rejected() const override { return content_rejected_; }
+    
+    const esp_partition_t* get_update_partition() const { return update_partition_; }
+    const char* get_image_version() const { return image_version_; }
+    
+protected:
+    bool on_begin(uint32_t total_size) override;
+    bool write_block(uint32_t offset, const uint8_t* data, uint32_t len) override;
+    bool on_finish() override;
+    void on_abort() override;
+    
+private:
+    const esp_partition_t* partition_;          // As configured (may be nullptr)
+    const esp_partition_t* update_partition_;   // Partition of the running update
+    esp_ota_handle_t ota_handle_;
+    bool ota_started_;
+    bool content_rejected_;
+    char image_version_[32];
+    
+    bool validate_image_header(const uint8_t* data, uint32_t len);
+    const esp_partition_t* resolve_partition() const;
+};
@@ -0,0 +1,99 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <type_traits>
+
+/**
+ * @brief SpscRing - Lock-free single-producer/single-consumer ring of fixed slots
+ * 
+ * The producer fills a slot in place (no intermediate copy) and publishes it with
+ * produce_commit(); the consumer reads the oldest slot in place and frees it with
+ * consume_commit(). Exactly one thread may produce and one thread may consume.
+ * 
+ * Capacity is rounded up to a power of two so indices wrap with a mask.
+ */
+template <typename T>
+class SpscRing {
+    static_assert(std::is_trivially_copyable<T>::value, "SpscRing slots must be trivially copyable");
+    
+public:
+    SpscRing() : slots_(nullptr), capacity_(0), mask_(0), head_(0), tail_(0) {}
+    ~SpscRing() { release(); }
+    
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+    
+    bool init(uint32_t min_capacity) {
+        release();
+        
+        uint32_t capacity = 1;
+        while (capacity < min_capacity) {
+            capacity <<= 1;
+        }
+        
+        slots_ = static_cast<T*>(calloc(capacity, sizeof(T)));
+        if (!slots_) {
+            return false;
+        }
+        capacity_ = capacity;
+        mask_ = capacity - 1;
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+        return true;
+    }
+    
+    void release() {
+        if (slots_) {
+            free(slots_);
+            slots_ = nullptr;
+        }
+        capacity_ = 0;
+        mask_ = 0;
+    }
+    
+    bool is_initialized() const { return slots_ != nullptr; }
+    uint32_t capacity() const { return capacity_; }
+    uint32_t size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+    
+    // Producer side: free slot to fill, or nullptr if the ring is full
+    T* try_produce() {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= capacity_) {
+            return nullptr;
+        }
+        return &slots_[head & mask_];
+    }
+    
+    void produce_commit() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    
+    // Consumer side: oldest filled slot, or nullptr if the ring is empty
+    T* try_consume() {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots_[tail & mask_];
+    }
+    
+    void consume_commit() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    
+private:
+    T* slots_;
+    uint32_t capacity_;
+    uint32_t mask_;
+    std::atomic<uint32_t> head_;   // Written by the producer only
+    std::atomic<uint32_t> tail_;   // Written by the consumer only
+};
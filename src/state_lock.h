@@ -0,0 +1,29 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// Scoped lock for the service state mutex (tolerates a failed mutex allocation)
+class StateLock {
+public:
+    explicit StateLock(SemaphoreHandle_t mutex) : mutex_(mutex) {
+        if (mutex_) {
+            xSemaphoreTake(mutex_, portMAX_DELAY);
+        }
+    }
+    ~StateLock() {
+        if (mutex_) {
+            xSemaphoreGive(mutex_);
+        }
+    }
+    StateLock(const StateLock&) = delete;
+    StateLock& operator=(const StateLock&) = delete;
+    
+private:
+    SemaphoreHandle_t mutex_;
+};
@@ -0,0 +1,109 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "transfer_buffer.h"
+#include "esp_log.h"
+
+static const char* TAG = "TransferBuffer";
+
+constexpr uint32_t HeapCapsAllocator::DEFAULT_CAPS;
+constexpr uint32_t HeapCapsAllocator::DEFAULT_FALLBACK_CAPS;
+
+// ==================== HEAP CAPS ALLOCATOR ====================
+
+uint8_t* HeapCapsAllocator::allocate(uint32_t size) {
+    uint8_t* buffer = static_cast<uint8_t*>(heap_caps_malloc(size, caps_));
+    if (!buffer && fallback_caps_ != 0) {
+        ESP_LOGW(TAG, "Preferred region cannot hold %lu bytes - falling back", size);
+        buffer = static_cast<uint8_t*>(heap_caps_malloc(size, fallback_caps_));
+    }
+    return buffer;
+}
+
+void HeapCapsAllocator::release(uint8_t* buffer) {
+    heap_caps_free(buffer);
+}
+
+// ==================== ARENA ALLOCATOR ====================
+
+constexpr uint8_t ArenaAllocator::MAX_SLOTS;
+
+ArenaAllocator::ArenaAllocator(uint32_t slot_capacity, uint8_t num_slots, uint32_t caps)
+    : slots_(), num_slots_(0),
+      requested_slots_((num_slots == 0) ? 1 : (num_slots > MAX_SLOTS ? MAX_SLOTS : num_slots)),
+      slot_capacity_(slot_capacity), caps_(caps), in_use_mask_(0) {
+}
+
+ArenaAllocator::~ArenaAllocator() {
+    if (get_slots_in_use() > 0) {
+        ESP_LOGW(TAG, "Arena destroyed while %d slot(s) are still in use", get_slots_in_use());
+    }
+    for (uint8_t i = 0; i < num_slots_; i++) {
+        heap_caps_free(slots_[i]);
+        slots_[i] = nullptr;
+    }
+    num_slots_ = 0;
+}
+
+bool ArenaAllocator::init() {
+    if (num_slots_ > 0) {
+        return true;
+    }
+    
+    // Separate blocks per slot: easier to place than one large region
+    while (num_slots_ < requested_slots_) {
+        uint8_t* slot = static_cast<uint8_t*>(heap_caps_malloc(slot_capacity_, caps_));
+        if (!slot) {
+            break;
+        }
+        slots_[num_slots_++] = slot;
+    }
+    
+    if (num_slots_ == 0) {
+        ESP_LOGW(TAG, "Failed to allocate %lu byte arena slot (caps 0x%08lX)", slot_capacity_, caps_);
+        return false;
+    }
+    if (num_slots_ < requested_slots_) {
+        ESP_LOGW(TAG, "Only %d of %d arena slots could be allocated", num_slots_, requested_slots_);
+    }
+    ESP_LOGI(TAG, "Transfer arena ready: %d slot(s) of %lu bytes", num_slots_, slot_capacity_);
+    return true;
+}
+
+uint8_t ArenaAllocator::get_slots_in_use() const {
+    return static_cast<uint8_t>(__builtin_popcount(in_use_mask_.load(std::memory_order_acquire)));
+}
+
+uint8_t* ArenaAllocator::allocate(uint32_t size) {
+    if (num_slots_ == 0 || size > slot_capacity_) {
+        return nullptr;
+    }
+    
+    uint32_t mask = in_use_mask_.load(std::memory_order_acquire);
+    for (;;) {
+        uint8_t slot = 0;
+        while (slot < num_slots_ && (mask & (1u << slot))) {
+            slot++;
+        }
+        if (slot == num_slots_) {
+            ESP_LOGW(TAG, "All %d arena slots in use", num_slots_);
+            return nullptr;
+        }
+        // On contention 'mask' is refreshed and the search restarts
+        if (in_use_mask_.compare_exchange_weak(mask, mask | (1u << slot), std::memory_order_acq_rel)) {
+            return slots_[slot];
+        }
+    }
+}
+
+void ArenaAllocator::release(uint8_t* buffer) {
+    for (uint8_t i = 0; i < num_slots_; i++) {
+        if (slots_[i] == buffer) {
+            in_use_mask_.fetch_and(~(1u << i), std::memory_order_release);
+            return;
+        }
+    }
+    ESP_LOGE(TAG, "Released buffer does not belong to the arena");
+}
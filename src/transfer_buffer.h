@@ -0,0 +1,149 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "esp_heap_caps.h"
+
+/**
+ * @brief TransferBufferAllocator - Source of receive buffers for ImageService
+ * 
+ * Implementations must allow release() to be called from a different task than
+ * allocate() (the completion worker frees buffers the BLE path allocated).
+ */
+class TransferBufferAllocator {
+public:
+    virtual ~TransferBufferAllocator() = default;
+    
+    // Returns nullptr if no buffer of 'size' bytes is available
+    virtual uint8_t* allocate(uint32_t size) = 0;
+    virtual void release(uint8_t* buffer) = 0;
+};
+
+/**
+ * @brief HeapCapsAllocator - Per-transfer heap_caps_malloc with placement hints
+ * 
+ * Tries 'caps' first (PSRAM by default) and falls back to 'fallback_caps'
+ * (pass 0 to disable the fallback).
+ */
+class HeapCapsAllocator : public TransferBufferAllocator {
+public:
+    static constexpr uint32_t DEFAULT_CAPS = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+    static constexpr uint32_t DEFAULT_FALLBACK_CAPS = MALLOC_CAP_DEFAULT;
+    
+    explicit HeapCapsAllocator(uint32_t caps = DEFAULT_CAPS, uint32_t fallback_caps = DEFAULT_FALLBACK_CAPS)
+        : caps_(caps), fallback_caps_(fallback_caps) {}
+    
+    uint8_t* allocate(uint32_t size) override;
+    void release(uint8_t* buffer) override;
+    
+private:
+    uint32_t caps_;
+    uint32_t fallback_caps_;
+};
+
+/**
+ * @brief ArenaAllocator - Preallocated slots reused across transfers
+ * 
+ * Allocates num_slots blocks of slot_capacity bytes once in init() and hands out one
+ * slot per transfer, so repeated transfers never fragment the heap. With two or more
+ * slots a new transfer can be received while a previous image is still held by its
+ * consumer. allocate() fails while every slot is in use or if the request exceeds
+ * slot_capacity.
+ */
+class ArenaAllocator : public TransferBufferAllocator {
+public:
+    static constexpr uint8_t MAX_SLOTS = 32;  // Slot usage is tracked in a 32-bit mask
+    
+    explicit ArenaAllocator(uint32_t slot_capacity, uint8_t num_slots = 1,
+                            uint32_t caps = HeapCapsAllocator::DEFAULT_CAPS);
+    ~ArenaAllocator() override;
+    
+    ArenaAllocator(const ArenaAllocator&) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+    
+    // Allocate the slots; keeps as many as fit and returns false only if none did
+    bool init();
+    bool is_initialized() const { return num_slots_ > 0; }
+    uint32_t capacity() const { return slot_capacity_; }
+    uint8_t get_slot_count() const { return num_slots_; }
+    uint8_t get_slots_in_use() const;
+    bool is_exhausted() const { return is_initialized() && get_slots_in_use() == num_slots_; }
+    
+    uint8_t* allocate(uint32_t size) override;
+    void release(uint8_t* buffer) override;
+    
+private:
+    uint8_t* slots_[MAX_SLOTS];
+    uint8_t num_slots_;        // Slots actually allocated
+    uint8_t requested_slots_;
+    uint32_t slot_capacity_;
+    uint32_t caps_;
+    std::atomic<uint32_t> in_use_mask_;
+};
+
+/**
+ * @brief TransferBuffer - Move-only handle that returns its memory to the allocator
+ */
+class TransferBuffer {
+public:
+    TransferBuffer() : allocator_(nullptr), data_(nullptr), size_(0) {}
+    TransferBuffer(TransferBufferAllocator* allocator, uint8_t* data, uint32_t size)
+        : allocator_(allocator), data_(data), size_(size) {}
+    ~TransferBuffer() { reset(); }
+    
+    TransferBuffer(TransferBuffer&& other)
+        : allocator_(other.allocator_), data_(other.data_), size_(other.size_) {
+        other.detach();
+    }
+    TransferBuffer& operator=(TransferBuffer&& other) {
+        if (this != &other) {
+            reset();
+            allocator_ = other.allocator_;
+            data_ = other.data_;
+            size_ = other.size_;
+            other.detach();
+        }
+        return *this;
+    }
+    
+    TransferBuffer(const TransferBuffer&) = delete;
+    TransferBuffer& operator=(const TransferBuffer&) = delete;
+    
+    // Returns an empty handle if the allocator has no buffer available
+    static TransferBuffer allocate(TransferBufferAllocator* allocator, uint32_t size) {
+        uint8_t* data = allocator ? allocator->allocate(size) : nullptr;
+        return data ? TransferBuffer(allocator, data, size) : TransferBuffer();
+    }
+    
+    uint8_t* data() const { return data_; }
+    uint32_t size() const { return size_; }
+    TransferBufferAllocator* allocator() const { return allocator_; }
+    explicit operator bool() const { return data_ != nullptr; }
+    
+    // Return the memory to the allocator
+    void reset() {
+        if (data_ && allocator_) {
+            allocator_->release(data_);
+        }
+        detach();
+    }
+    
+    // Give up ownership without releasing (caller must rebuild a handle or release manually)
+    uint8_t* detach() {
+        uint8_t* data = data_;
+        allocator_ = nullptr;
+        data_ = nullptr;
+        size_ = 0;
+        return data;
+    }
+    
+private:
+    TransferBufferAllocator* allocator_;
+    uint8_t* data_;
+    uint32_t size_;
+};
@@ -0,0 +1,71 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "transfer_log.h"
+#include "esp_timer.h"
+
+static const char* TAG = "TransferTrace";
+
+#ifdef CONFIG_TINYFLOW_TRACE
+static TransferTrace::Entry trace_entries[TRANSFER_TRACE_ENTRIES];
+static std::atomic<uint32_t> trace_next(0);
+#endif
+
+void TransferTrace::record(Event event, uint16_t conn_id, uint16_t a, uint32_t b) {
+#ifdef CONFIG_TINYFLOW_TRACE
+    uint32_t index = trace_next.fetch_add(1, std::memory_order_relaxed);
+    Entry& entry = trace_entries[index % TRANSFER_TRACE_ENTRIES];
+    entry.timestamp_us = static_cast<uint32_t>(esp_timer_get_time());
+    entry.event = static_cast<uint8_t>(event);
+    entry.conn_id = static_cast<uint8_t>(conn_id);
+    entry.a = a;
+    entry.b = b;
+#endif
+}
+
+void TransferTrace::dump() {
+#ifdef CONFIG_TINYFLOW_TRACE
+    uint32_t count = trace_next.load(std::memory_order_relaxed);
+    uint32_t first = (count > TRANSFER_TRACE_ENTRIES) ? count - TRANSFER_TRACE_ENTRIES : 0;
+    ESP_LOGI(TAG, "=== TRACE: %lu events, showing last %lu ===", count, count - first);
+    
+    for (uint32_t i = first; i < count; i++) {
+        const Entry& entry = trace_entries[i % TRANSFER_TRACE_ENTRIES];
+        ESP_LOGI(TAG, "%10lu us  conn %d  %-18s %5d %lu", entry.timestamp_us, entry.conn_id,
+                 get_event_name(static_cast<Event>(entry.event)), entry.a, entry.b);
+    }
+#else
+    ESP_LOGW(TAG, "Trace disabled (CONFIG_TINYFLOW_TRACE)");
+#endif
+}
+
+void TransferTrace::clear() {
+#ifdef CONFIG_TINYFLOW_TRACE
+    trace_next.store(0, std::memory_order_relaxed);
+#endif
+}
+
+uint32_t TransferTrace::get_count() {
+#ifdef CONFIG_TINYFLOW_TRACE
+    return trace_next.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+const char* TransferTrace::get_event_name(Event event) {
+    switch (event) {
+    case Event::GATT_WRITE: return "GATT_WRITE";
+    case Event::CHUNK_RECEIVED: return "CHUNK_RECEIVED";
+    case Event::CHUNK_DUPLICATE: return "CHUNK_DUPLICATE";
+    case Event::CHUNK_REQUEST: return "CHUNK_REQUEST";
+    case Event::RETRANSMIT_REQUEST: return "RETRANSMIT_REQUEST";
+    case Event::CONTROL_SENT: return "CONTROL_SENT";
+    case Event::NOTIFY_DEFERRED: return "NOTIFY_DEFERRED";
+    case Event::CONGESTION: return "CONGESTION";
+    case Event::TRANSFER_ERROR: return "TRANSFER_ERROR";
+    }
+    return "?";
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+// ==================== COMPILE-TIME SWITCHES ====================
+// Set in menuconfig ("BLETinyFlow"); disabled categories compile to nothing
+
+#ifdef CONFIG_TINYFLOW_HOT_PATH_LOG
+constexpr bool HOT_PATH_LOG_ENABLED = true;
+#else
+constexpr bool HOT_PATH_LOG_ENABLED = false;
+#endif
+
+#ifdef CONFIG_TINYFLOW_TRACE
+constexpr bool TRANSFER_TRACE_ENABLED = true;
+constexpr uint32_t TRANSFER_TRACE_ENTRIES = CONFIG_TINYFLOW_TRACE_ENTRIES;
+#else
+constexpr bool TRANSFER_TRACE_ENABLED = false;
+constexpr uint32_t TRANSFER_TRACE_ENTRIES = 0;
+#endif
+
+#if defined(CONFIG_TINYFLOW_CHUNK_LOGGING) && !defined(CHUNK_LOGGING)
+#define CHUNK_LOGGING
+#endif
+
+// Per-chunk / per-request logging (GATT writes, received chunks, CHUNK_REQUESTs).
+// The arguments are still type-checked, but no code is generated unless enabled.
+#define HOT_PATH_LOG(tag, format, ...) do { \
+        if constexpr (HOT_PATH_LOG_ENABLED) { ESP_LOGI(tag, format, ##__VA_ARGS__); } \
+    } while (0)
+
+// Detailed chunk diagnostics (uses #ifdef CHUNK_LOGGING blocks for the expensive parts)
+#ifdef CHUNK_LOGGING
+    #define CHUNK_LOG(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+#else
+    #define CHUNK_LOG(tag, format, ...) do {} while(0)
+#endif
+
+// Binary trace entry, see TransferTrace
+#define TRANSFER_TRACE(event, conn_id, a, b) do { \
+        if constexpr (TRANSFER_TRACE_ENABLED) { TransferTrace::record(TransferTrace::Event::event, conn_id, a, b); } \
+    } while (0)
+
+/**
+ * @brief TransferTrace - Binary ring of hot path events for field debugging
+ *
+ * record() stores a 12-byte entry (timestamp, event, conn_id, two arguments) and
+ * formats nothing, so tracing can stay enabled at full transfer speed where the
+ * equivalent ESP_LOGI lines would throttle the link. dump() prints the ring once the
+ * interesting part is over, e.g. from a console command or after a failed transfer.
+ * The oldest entries are overwritten.
+ *
+ * record() is safe to call from any task; an entry overwritten while dump() runs may
+ * be printed torn.
+ */
+class TransferTrace {
+public:
+    enum class Event : uint8_t {
+        GATT_WRITE = 1,        // a = attribute handle, b = length
+        CHUNK_RECEIVED,        // a = chunk_id, b = payload length
+        CHUNK_DUPLICATE,       // a = chunk_id
+        CHUNK_REQUEST,         // a = first chunk, b = chunk count
+        RETRANSMIT_REQUEST,    // a = first chunk, b = chunk count
+        CONTROL_SENT,          // a = command, b = sequence number
+        NOTIFY_DEFERRED,       // a = attribute handle, b = esp_err_t (stack refused the notification)
+        CONGESTION,            // a = 1 congested, 0 cleared
+        TRANSFER_ERROR,        // a = error code, b = info
+    };
+    
+    struct Entry {
+        uint32_t timestamp_us;  // esp_timer time, wraps after ~71 minutes
+        uint8_t event;
+        uint8_t conn_id;
+        uint16_t a;
+        uint32_t b;
+    };
+    
+    static void record(Event event, uint16_t conn_id, uint16_t a, uint32_t b);
+    // Print the ring, oldest entry first
+    static void dump();
+    static void clear();
+    // Entries recorded since the last clear() (including overwritten ones)
+    static uint32_t get_count();
+    
+    static const char* get_event_name(Event event);
+};
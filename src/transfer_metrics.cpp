@@ -0,0 +1,133 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "transfer_metrics.h"
+#include <cstring>
+
+constexpr uint8_t LatencyHistogram::BUCKETS;
+constexpr uint32_t LatencyHistogram::BASE_US;
+
+// ==================== LATENCY HISTOGRAM ====================
+
+void LatencyHistogram::reset() {
+    memset(counts, 0, sizeof(counts));
+    samples = 0;
+    min_us = 0;
+    max_us = 0;
+    total_us = 0;
+}
+
+void LatencyHistogram::add(uint32_t duration_us) {
+    uint32_t steps = duration_us / BASE_US;
+    uint8_t bucket = steps ? static_cast<uint8_t>(32 - __builtin_clz(steps)) : 0;
+    if (bucket >= BUCKETS) {
+        bucket = BUCKETS - 1;
+    }
+    counts[bucket]++;
+    
+    if (samples == 0 || duration_us < min_us) {
+        min_us = duration_us;
+    }
+    if (duration_us > max_us) {
+        max_us = duration_us;
+    }
+    samples++;
+    total_us += duration_us;
+}
+
+uint32_t LatencyHistogram::get_bucket_limit_us(uint8_t bucket) {
+    return (bucket + 1 >= BUCKETS) ? UINT32_MAX : BASE_US << bucket;
+}
+
+// ==================== TRANSFER METRICS ====================
+
+void TransferMetrics::clear() {
+    outcome = Outcome::NONE;
+    total_size = 0;
+    chunk_size = 0;
+    expected_chunks = 0;
+    chunks_received = 0;
+    bytes_received = 0;
+    start_us = 0;
+    first_chunk_us = 0;
+    last_chunk_us = 0;
+    end_us = 0;
+    out_of_range_chunks = 0;
+    duplicate_chunks = 0;
+    retransmit_requests = 0;
+    timeouts = 0;
+    notification_failures = 0;
+    heap_free_at_start = 0;
+    heap_free_min = 0;
+    batch_rtt.reset();
+    chunk_gap.reset();
+    batch_pending = false;
+    batch_first_chunk = 0;
+    batch_end_chunk = 0;
+    batch_request_us = 0;
+}
+
+void TransferMetrics::begin(int64_t now_us, uint32_t size, uint32_t chunk, uint32_t chunks, uint32_t free_heap) {
+    clear();
+    outcome = Outcome::RUNNING;
+    total_size = size;
+    chunk_size = chunk;
+    expected_chunks = chunks;
+    start_us = now_us;
+    heap_free_at_start = free_heap;
+    heap_free_min = free_heap;
+}
+
+void TransferMetrics::on_batch_request(int64_t now_us, uint32_t first_chunk, uint32_t num_chunks) {
+    // With a sliding window requests overlap; the oldest unanswered one is measured
+    if (batch_pending) {
+        return;
+    }
+    batch_pending = true;
+    batch_first_chunk = first_chunk;
+    batch_end_chunk = first_chunk + num_chunks;
+    batch_request_us = now_us;
+}
+
+void TransferMetrics::on_chunk(int64_t now_us, uint32_t chunk_id, uint32_t len) {
+    if (first_chunk_us == 0) {
+        first_chunk_us = now_us;
+    } else {
+        chunk_gap.add(static_cast<uint32_t>(now_us - last_chunk_us));
+    }
+    last_chunk_us = now_us;
+    chunks_received++;
+    bytes_received += len;
+    
+    if (batch_pending && chunk_id >= batch_first_chunk && chunk_id < batch_end_chunk) {
+        batch_rtt.add(static_cast<uint32_t>(now_us - batch_request_us));
+        batch_pending = false;
+    }
+}
+
+void TransferMetrics::sample_heap(uint32_t free_heap) {
+    if (free_heap < heap_free_min) {
+        heap_free_min = free_heap;
+    }
+}
+
+void TransferMetrics::finish(int64_t now_us, bool success) {
+    outcome = success ? Outcome::COMPLETE : Outcome::FAILED;
+    end_us = now_us;
+    batch_pending = false;
+}
+
+uint32_t TransferMetrics::get_duration_us(int64_t now_us) const {
+    if (outcome == Outcome::NONE) {
+        return 0;
+    }
+    int64_t end = end_us ? end_us : now_us;
+    return (end > start_us) ? static_cast<uint32_t>(end - start_us) : 0;
+}
+
+uint32_t TransferMetrics::get_throughput(int64_t now_us) const {
+    uint32_t duration_us = get_duration_us(now_us);
+    return duration_us ? static_cast<uint32_t>(static_cast<uint64_t>(bytes_received) * 1000000ULL / duration_us) : 0;
+}
@@ -0,0 +1,102 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief LatencyHistogram - Log2 histogram of durations
+ *
+ * Bucket 0 counts durations below BASE_US, bucket i durations below BASE_US << i, the
+ * last bucket everything above (0.5 ms ... 512 ms with the defaults). Adding a sample
+ * is a shift and an increment, so it can run for every chunk.
+ */
+struct LatencyHistogram {
+    static constexpr uint8_t BUCKETS = 12;
+    static constexpr uint32_t BASE_US = 500;
+    
+    uint32_t counts[BUCKETS];
+    uint32_t samples;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    
+    void reset();
+    void add(uint32_t duration_us);
+    uint32_t get_mean_us() const { return samples ? static_cast<uint32_t>(total_us / samples) : 0; }
+    // Exclusive upper bound of a bucket (UINT32_MAX for the last one)
+    static uint32_t get_bucket_limit_us(uint8_t bucket);
+};
+
+/**
+ * @brief TransferMetrics - Timing and loss figures of one upload
+ *
+ * Collected by the transfer session from TRANSFER_INIT until the transfer completes or
+ * fails; available from ImageService::get_transfer_metrics() and, remotely, through the
+ * STATS control command. Like ChunkRateController it is platform independent: timestamps
+ * (esp_timer_get_time() on target) and free heap readings are passed in by the caller.
+ */
+struct TransferMetrics {
+    enum class Outcome : uint8_t {
+        NONE = 0,         // No transfer yet
+        RUNNING = 1,
+        COMPLETE = 2,
+        FAILED = 3,
+    };
+    
+    Outcome outcome;
+    uint32_t total_size;
+    uint32_t chunk_size;
+    uint32_t expected_chunks;
+    uint32_t chunks_received;          // Stored chunks, duplicates excluded
+    uint32_t bytes_received;
+    
+    int64_t start_us;                  // TRANSFER_INIT
+    int64_t first_chunk_us;            // First stored chunk (0 = none yet)
+    int64_t last_chunk_us;
+    int64_t end_us;                    // Completion or failure (0 = running)
+    
+    // Loss and recovery
+    uint32_t out_of_range_chunks;      // Arrived before they were requested
+    uint32_t duplicate_chunks;
+    uint32_t retransmit_requests;      // CHUNK_REQUESTs for missing ranges
+    uint32_t timeouts;                 // Retransmission timer expiries without progress
+    uint32_t notification_failures;    // Control notifications that could not be queued
+    
+    // Heap (MALLOC_CAP_DEFAULT), sampled at TRANSFER_INIT and at every new chunk request
+    uint32_t heap_free_at_start;
+    uint32_t heap_free_min;
+    
+    LatencyHistogram batch_rtt;        // CHUNK_REQUEST for a new range → first chunk of that range
+    LatencyHistogram chunk_gap;        // Between consecutive stored chunks
+    
+    // Oldest new-range request still waiting for its first chunk
+    bool batch_pending;
+    uint32_t batch_first_chunk;
+    uint32_t batch_end_chunk;
+    int64_t batch_request_us;
+    
+    TransferMetrics() { clear(); }
+    
+    void clear();
+    void begin(int64_t now_us, uint32_t size, uint32_t chunk, uint32_t chunks, uint32_t free_heap);
+    void on_batch_request(int64_t now_us, uint32_t first_chunk, uint32_t num_chunks);
+    void on_chunk(int64_t now_us, uint32_t chunk_id, uint32_t len);
+    void sample_heap(uint32_t free_heap);
+    void finish(int64_t now_us, bool success);
+    
+    bool is_running() const { return outcome == Outcome::RUNNING; }
+    // TRANSFER_INIT until the end (or until now_us while running)
+    uint32_t get_duration_us(int64_t now_us) const;
+    // Received bytes per second over get_duration_us()
+    uint32_t get_throughput(int64_t now_us) const;
+    uint32_t get_time_to_first_chunk_us() const {
+        return first_chunk_us ? static_cast<uint32_t>(first_chunk_us - start_us) : 0;
+    }
+    uint32_t get_peak_heap_use() const {
+        return (heap_free_at_start > heap_free_min) ? heap_free_at_start - heap_free_min : 0;
+    }
+};
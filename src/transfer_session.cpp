@@ -0,0 +1,2033 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "transfer_session.h"
+#include "state_lock.h"
+#include "transfer_log.h"
+#include <cstring>
+#include <utility>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+
+static const char* TAG = "TransferSession";
+
+ImageService::TransferSession::TransferSession(ImageService& service)
+    : service_(service),
+      connected_(false), conn_id_(0), mtu_(23),
+      control_notifications_enabled_(false), data_notifications_enabled_(false), epoch_(0), link_bulk_(false),
+      status_(Status::IDLE), sequence_number_(0),
+      total_size_(0), chunk_size_(0), expected_chunks_(0),
+      received_size_(0), next_expected_chunk_(0),
+      active_sink_(nullptr), transfer_type_(TransferType::ASSET), reorder_window_chunks_(0),
+      reorder_window_(nullptr), reorder_lengths_(nullptr), reorder_window_bytes_(0), stream_next_chunk_(0),
+      stream_jpeg_header_(false),
+      output_offset_(0), output_spans_(0), output_spans_consumed_(0),
+      stream_content_invalid_(false), transfer_flags_(0), compressed_(false), delta_(false),
+      crc_expected_(false), expected_crc_(0), running_crc_(0), crc_next_chunk_(0), prefix_reported_(0),
+      current_request_start_(0), current_request_end_(0),
+      active_chunks_per_request_(DEFAULT_CHUNKS_PER_REQUEST),
+      next_request_chunk_(0), chunks_in_flight_(0), round_chunks_received_(0),
+      retransmit_timer_(nullptr), last_progress_us_(0), retransmit_attempts_(0),
+      resume_timer_(nullptr), download_source_(nullptr), download_id_(0), download_crc_(0),
+      download_cursor_(0), download_chunks_sent_(0), download_activity_us_(0),
+      benchmark_first_us_(0), benchmark_last_us_(0), benchmark_first_size_(0),
+      benchmark_duplicates_(0), benchmark_out_of_range_(0), manifest_files_(0), manifest_files_remaining_(0),
+      manifest_bytes_(0), manifest_bytes_received_(0), manifest_start_us_(0), spare_window_(nullptr),
+      spare_window_bytes_(0), total_chunks_received_(0) {
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = &TransferSession::retransmit_timer_callback;
+    timer_args.arg = this;
+    timer_args.dispatch_method = ESP_TIMER_TASK;
+    timer_args.name = "tf_retransmit";
+    esp_err_t ret = esp_timer_create(&timer_args, &retransmit_timer_);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create retransmit timer: %s", esp_err_to_name(ret));
+        retransmit_timer_ = nullptr;
+    }
+    
+    esp_timer_create_args_t resume_args = {};
+    resume_args.callback = &TransferSession::resume_timer_callback;
+    resume_args.arg = this;
+    resume_args.dispatch_method = ESP_TIMER_TASK;
+    resume_args.name = "tf_resume";
+    ret = esp_timer_create(&resume_args, &resume_timer_);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create resume timer: %s", esp_err_to_name(ret));
+        resume_timer_ = nullptr;
+    }
+}
+
+ImageService::TransferSession::~TransferSession() {
+    reset_transfer();
+    end_manifest();
+    
+    if (retransmit_timer_) {
+        esp_timer_delete(retransmit_timer_);
+        retransmit_timer_ = nullptr;
+    }
+    if (resume_timer_) {
+        esp_timer_delete(resume_timer_);
+        resume_timer_ = nullptr;
+    }
+}
+
+// ==================== CONNECTION ====================
+
+void ImageService::TransferSession::bind(uint16_t conn_id) {
+    connected_ = true;
+    conn_id_ = conn_id;
+    mtu_ = 23;
+    control_notifications_enabled_ = false;
+    data_notifications_enabled_ = false;
+    sequence_number_ = 0;
+    link_bulk_ = true;  // The link layer (BLEServer) starts every connection with the bulk parameters
+    epoch_ = service_.transfer_generation_.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void ImageService::TransferSession::unbind() {
+    end_manifest();  // A reconnecting client announces the rest of its batch again
+    connected_ = false;
+    control_notifications_enabled_ = false;
+    data_notifications_enabled_ = false;
+    mtu_ = 23;
+}
+
+void ImageService::TransferSession::adopt_connection(TransferSession& other) {
+    connected_ = true;
+    conn_id_ = other.conn_id_;
+    mtu_ = other.mtu_;
+    control_notifications_enabled_ = other.control_notifications_enabled_;
+    data_notifications_enabled_ = other.data_notifications_enabled_;
+    sequence_number_ = other.sequence_number_;
+    link_bulk_ = other.link_bulk_;
+    // Chunks the client queued before the TRANSFER_INIT must not land in the resumed transfer
+    epoch_ = service_.transfer_generation_.fetch_add(1, std::memory_order_relaxed) + 1;
+    
+    other.reset_transfer();
+    other.unbind();
+    service_.primary_session_ = this;
+}
+
+void ImageService::TransferSession::set_control_notifications(bool enabled) {
+    bool was_enabled = control_notifications_enabled_;
+    control_notifications_enabled_ = enabled;
+    ESP_LOGI(TAG, "Control notifications %s (conn_id %d)", enabled ? "enabled" : "disabled", conn_id_);
+    
+    // Send device info automatically when notifications are first enabled
+    if (enabled && !was_enabled) {
+        ESP_LOGI(TAG, "Control notifications just enabled - sending device info");
+        if (send_device_info()) {
+            ESP_LOGI(TAG, "✅ Device info sent successfully after notification enablement");
+        } else {
+            ESP_LOGE(TAG, "❌ Failed to send device info after notification enablement");
+        }
+    }
+}
+
+void ImageService::TransferSession::on_link_update() {
+    // A running transfer keeps the chunk layout it started with
+    if (connected_ && control_notifications_enabled_ && !is_active()) {
+        send_device_info();
+    }
+}
+
+uint16_t ImageService::TransferSession::get_max_chunk_size() const {
+    uint16_t att_payload = (mtu_ > MAX_MTU_SIZE ? MAX_MTU_SIZE : mtu_) - ATT_HEADER_SIZE;
+    return (att_payload > DATA_HEADER_SIZE) ? att_payload - DATA_HEADER_SIZE : 0;
+}
+
+uint16_t ImageService::TransferSession::get_optimal_chunk_size(bool server_to_client) const {
+    uint16_t max_chunk = get_max_chunk_size();
+    
+    TransferTransport::LinkInfo link = {};
+    if (!service_.transport_->get_link_info(conn_id_, &link)) {
+        return max_chunk;
+    }
+    
+    // One LL PDU carries the L2CAP header, the ATT header and the data chunk header
+    uint16_t ll_length = server_to_client ? link.tx_data_length : link.rx_data_length;
+    uint16_t overhead = L2CAP_HEADER_SIZE + ATT_HEADER_SIZE + DATA_HEADER_SIZE;
+    if (ll_length <= overhead) {
+        return max_chunk;
+    }
+    uint16_t unfragmented = ll_length - overhead;
+    return (unfragmented < max_chunk) ? unfragmented : max_chunk;
+}
+
+void ImageService::TransferSession::update_link_mode() {
+    // Bulk parameters from TRANSFER_INIT / REQUEST_DOWNLOAD until the transfer (or the batch) ends
+    bool bulk = is_active() || is_manifest_active();
+    if (!connected_ || bulk == link_bulk_) {
+        return;
+    }
+    TransferTransport::LinkMode mode = bulk ? TransferTransport::LinkMode::BULK : TransferTransport::LinkMode::IDLE;
+    if (service_.transport_->set_link_mode(conn_id_, mode) == ESP_OK) {
+        link_bulk_ = bulk;
+    }
+}
+
+void ImageService::TransferSession::update_metrics() {
+    // An upload that stopped without completing has failed (unless it waits for a resume)
+    if (metrics_.is_running() && !is_active() && status_ != Status::SUSPENDED) {
+        finish_metrics(status_ == Status::COMPLETE);
+    }
+}
+
+void ImageService::TransferSession::finish_metrics(bool success) {
+    if (!metrics_.is_running()) {
+        return;
+    }
+    int64_t now_us = esp_timer_get_time();
+    metrics_.finish(now_us, success);
+    service_.last_metrics_ = metrics_;
+    
+    ESP_LOGI(TAG, "📊 Transfer %s: %lu bytes in %lu ms (%lu B/s), first chunk after %lu ms, batch RTT %lu ms, "
+             "%lu retransmit requests, peak heap use %lu bytes",
+             success ? "complete" : "failed", metrics_.bytes_received, metrics_.get_duration_us(now_us) / 1000,
+             metrics_.get_throughput(now_us), metrics_.get_time_to_first_chunk_us() / 1000,
+             metrics_.batch_rtt.get_mean_us() / 1000, metrics_.retransmit_requests, metrics_.get_peak_heap_use());
+}
+
+uint32_t ImageService::TransferSession::get_memory_usage() const {
+    uint32_t usage = image_buffer_.size();
+    if (reorder_window_) {
+        usage += reorder_window_chunks_ * (chunk_size_ + sizeof(uint16_t));
+    }
+    usage += spare_window_bytes_;
+    return usage;
+}
+
+void ImageService::TransferSession::release_image_buffer() {
+    if (image_buffer_) {
+        ESP_LOGI(TAG, "Releasing image buffer (%lu bytes)", image_buffer_.size());
+        image_buffer_.reset();
+    }
+}
+
+void ImageService::TransferSession::reset_transfer() {
+    finish_metrics(false);  // Aborted while running (disconnect, new TRANSFER_INIT, expired resume)
+    
+    // A completed image has already been released or handed to the completion worker,
+    // so anything left here belongs to an aborted transfer
+    report_prefix_abort();
+    image_buffer_.reset();
+    end_streaming();
+    end_download(false);
+    
+    stop_retransmit_timer();
+    if (resume_timer_ && esp_timer_is_active(resume_timer_)) {
+        esp_timer_stop(resume_timer_);
+    }
+    
+    // Between the files of a batch the map keeps its storage for the next TRANSFER_INIT
+    if (is_manifest_active()) {
+        chunk_received_map_.discard();
+    } else {
+        chunk_received_map_.release();
+    }
+    
+    total_size_ = 0;
+    chunk_size_ = 0;
+    expected_chunks_ = 0;
+    received_size_ = 0;
+    next_expected_chunk_ = 0;
+    current_request_start_ = 0;
+    current_request_end_ = 0;
+    next_request_chunk_ = 0;
+    chunks_in_flight_ = 0;
+    round_chunks_received_ = 0;
+    total_chunks_received_ = 0;
+    last_progress_us_ = 0;
+    retransmit_attempts_ = 0;
+    benchmark_first_us_ = 0;
+    benchmark_last_us_ = 0;
+    benchmark_first_size_ = 0;
+    benchmark_duplicates_ = 0;
+    benchmark_out_of_range_ = 0;
+    status_ = Status::IDLE;
+    epoch_ = service_.transfer_generation_.fetch_add(1, std::memory_order_relaxed) + 1;
+    
+    transfer_type_ = TransferType::ASSET;
+    crc_expected_ = false;
+    expected_crc_ = 0;
+    running_crc_ = 0;
+    crc_next_chunk_ = 0;
+    transfer_flags_ = 0;
+    compressed_ = false;
+    delta_ = false;
+    
+    ESP_LOGI(TAG, "Image transfer reset");
+}
+
+bool ImageService::TransferSession::validate_jpeg_header() const {
+    if (!image_buffer_) {
+        return stream_jpeg_header_;  // Streamed transfers are checked as chunk 0 passes through
+    }
+    return received_size_ >= 2 && image_buffer_.data()[0] == 0xFF && image_buffer_.data()[1] == 0xD8;
+}
+
+// ==================== PROTOCOL IMPLEMENTATION ====================
+
+void ImageService::TransferSession::handle_control_message(const uint8_t* data, uint16_t len) {
+    if (len < sizeof(ControlMessage)) {
+        ESP_LOGE(TAG, "Control message too short: %d bytes", len);
+        send_transfer_error(ErrorCode::CONTROL_MESSAGE_TOO_SHORT);
+        return;
+    }
+    
+    const ControlMessage* msg = reinterpret_cast<const ControlMessage*>(data);
+    ESP_LOGI(TAG, "Control message: cmd=0x%02X, seq=%d, p1=%lu, p2=%lu, p3=%lu",
+             msg->command, msg->sequence_number, 
+             msg->param1, msg->param2, msg->param3);
+    
+    switch (msg->command) {
+        case static_cast<uint8_t>(CommandType::TRANSFER_INIT):
+            handle_transfer_init(*msg);
+            break;
+        case static_cast<uint8_t>(CommandType::DEVICE_INFO):
+            handle_device_info_request(*msg);
+            break;
+        case static_cast<uint8_t>(CommandType::REQUEST_DOWNLOAD):
+            handle_request_download(*msg);
+            break;
+        case static_cast<uint8_t>(CommandType::STATS):
+            handle_stats_request(*msg);
+            break;
+        case static_cast<uint8_t>(CommandType::BENCHMARK):
+            handle_benchmark_request(*msg);
+            break;
+        case static_cast<uint8_t>(CommandType::MANIFEST):
+            handle_manifest(*msg);
+            break;
+        case static_cast<uint8_t>(CommandType::CHUNK_REQUEST):
+        case static_cast<uint8_t>(CommandType::TRANSFER_COMPLETE_ACK):
+            // Sent by the client only while it receives a download
+            if (status_ != Status::SENDING) {
+                ESP_LOGW(TAG, "Control command 0x%02X without a running download", msg->command);
+                send_transfer_error(ErrorCode::INVALID_COMMAND);
+            } else if (msg->command == static_cast<uint8_t>(CommandType::CHUNK_REQUEST)) {
+                handle_download_chunk_request(*msg);
+            } else {
+                handle_download_ack(*msg);
+            }
+            break;
+        default:
+            ESP_LOGW(TAG, "Unknown control command: 0x%02X", msg->command);
+            send_transfer_error(ErrorCode::INVALID_COMMAND);
+            break;
+    }
+    
+    update_metrics();
+    update_link_mode();
+}
+
+void ImageService::TransferSession::handle_device_info_request(const ControlMessage& msg) {
+    ESP_LOGI(TAG, "DEVICE_INFO received from client (ignoring param1=%lu, param2=%lu, param3=%lu)", 
+             msg.param1, msg.param2, msg.param3);
+    
+    // Send our device info in response to client's device info
+    ESP_LOGI(TAG, "Responding with server device info");
+    if (send_device_info()) {
+        ESP_LOGI(TAG, "✅ Device info response sent successfully");
+    } else {
+        ESP_LOGE(TAG, "❌ Failed to send device info response");
+    }
+}
+
+void ImageService::TransferSession::handle_transfer_init(const ControlMessage& msg) {
+    uint8_t flags = msg.reserved[TRANSFER_FLAGS_INDEX];
+    ESP_LOGI(TAG, "TRANSFER_INIT: size=%lu, chunk_size=%lu, chunks=%lu%s%s", 
+             msg.param1, msg.param2, msg.param3,
+             (flags & TRANSFER_FLAG_DELTA) ? " (delta)" : "", (flags & TRANSFER_FLAG_LZ4) ? " (LZ4)" : "");
+    
+    // Transfer type from the flags byte (0 = asset for clients that leave it zeroed)
+    uint8_t type_bits = msg.reserved[TRANSFER_FLAGS_INDEX] & TRANSFER_TYPE_MASK;
+    TransferSink* sink = nullptr;
+    if (type_bits == static_cast<uint8_t>(TransferType::ASSET)) {
+        sink = service_.sink_;
+    } else if (type_bits == static_cast<uint8_t>(TransferType::FIRMWARE) && service_.firmware_sink_) {
+        sink = service_.firmware_sink_;
+    } else {
+        ESP_LOGE(TAG, "Unsupported transfer type 0x%X", type_bits);
+        send_transfer_error(ErrorCode::UNSUPPORTED_TRANSFER_TYPE);
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    // Same transfer as one interrupted by a disconnect: that session takes over this connection
+    TransferSession* suspended = service_.find_resumable_session(msg);
+    if (suspended) {
+        suspended->adopt_connection(*this);
+        suspended->resume_transfer();
+        return;
+    }
+    
+    // Validate parameters (a streaming sink defines its own size limit)
+    uint32_t max_transfer_size = sink ? sink->max_size() : MAX_TRANSFER_SIZE;
+    if (msg.param1 > max_transfer_size || msg.param3 > MAX_CHUNKS) {
+        ESP_LOGE(TAG, "Transfer too large: %lu bytes in %lu chunks (max: %lu bytes)",
+                 msg.param1, msg.param3, max_transfer_size);
+        send_transfer_error(ErrorCode::TRANSFER_TOO_LARGE);
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    // Chunks must fit one ATT write at this connection's MTU, otherwise they arrive truncated
+    uint16_t max_chunk_size = get_max_chunk_size();
+    if (msg.param2 == 0 || msg.param2 > max_chunk_size) {
+        ESP_LOGE(TAG, "Chunk size %lu bytes invalid for MTU %d (max: %d bytes)", msg.param2, mtu_, max_chunk_size);
+        send_transfer_error(ErrorCode::CHUNK_SIZE_TOO_LARGE, max_chunk_size);
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    // Reset any previous transfer
+    reset_transfer();
+    metrics_.begin(esp_timer_get_time(), msg.param1, msg.param2, msg.param3,
+                   heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+    
+    // Store transfer parameters
+    total_size_ = msg.param1;
+    chunk_size_ = msg.param2;
+    expected_chunks_ = msg.param3;
+    transfer_type_ = static_cast<TransferType>(type_bits);
+    transfer_flags_ = flags;
+    compressed_ = (flags & TRANSFER_FLAG_LZ4) != 0;
+    delta_ = (flags & TRANSFER_FLAG_DELTA) != 0;
+    crc_expected_ = (msg.reserved[TRANSFER_FLAGS_INDEX] & TRANSFER_FLAG_CRC32) != 0;
+    if (crc_expected_) {
+        memcpy(&expected_crc_, msg.reserved, sizeof(expected_crc_));  // Little-endian on the wire and on ESP32
+        ESP_LOGI(TAG, "Expected CRC32: 0x%08lX", expected_crc_);
+    }
+    
+    // The completion worker still has every queue slot filled with images for the callback
+    if (transfer_type_ == TransferType::ASSET && service_.completion_enabled_ && !service_.has_completion_capacity()) {
+        ESP_LOGW(TAG, "Completion queue full - client should retry later");
+        send_transfer_error(ErrorCode::RECEIVER_BUSY);
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    // The image the patch was made against only becomes the base once its callback returned
+    if (delta_ && service_.pending_base_updates_ > 0) {
+        ESP_LOGW(TAG, "Delta base still with the completion worker - client should retry later");
+        send_transfer_error(ErrorCode::RECEIVER_BUSY);
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    // Another client is streaming into the same sink
+    if (sink && service_.is_sink_busy(sink)) {
+        ESP_LOGW(TAG, "Transfer sink in use by another connection - client should retry later");
+        send_transfer_error(ErrorCode::RECEIVER_BUSY);
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    // Receive buffer plus reorder window must fit next to the other sessions
+    uint32_t required_memory = sink ? 0 : total_size_;
+    if (sink || is_encoded()) {
+        size_t window_bytes = service_.reorder_window_chunks_ * (chunk_size_ + sizeof(uint16_t));
+        // A window kept from the previous file of a batch is reused and already counted
+        required_memory += (spare_window_bytes_ >= window_bytes) ? 0 : window_bytes;
+    }
+    if (!service_.fits_memory_budget(required_memory)) {
+        ESP_LOGW(TAG, "Session memory budget of %lu bytes exhausted - client should retry later",
+                 service_.session_memory_budget_);
+        send_transfer_error(ErrorCode::RECEIVER_BUSY);
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    // Allocate chunk tracking map
+    if (!chunk_received_map_.allocate(expected_chunks_)) {
+        ESP_LOGE(TAG, "Failed to allocate chunk tracking map");
+        send_transfer_error(ErrorCode::MEMORY_ALLOCATION_FAILED);
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    if (!sink) {
+        // Allocate buffer for image data (decompressed size for compressed transfers)
+        image_buffer_ = TransferBuffer::allocate(service_.allocator_, total_size_);
+        if (!image_buffer_) {
+            chunk_received_map_.release();
+            if (service_.allocator_ == &service_.default_arena_ && service_.default_arena_.is_exhausted()) {
+                // Every slot still holds an image the application (or another connection) is using
+                ESP_LOGW(TAG, "All %d receive buffers busy - client should retry later",
+                         service_.default_arena_.get_slot_count());
+                send_transfer_error(ErrorCode::RECEIVER_BUSY);
+                status_ = Status::ERROR;
+                return;
+            }
+            ESP_LOGE(TAG, "Failed to allocate %lu bytes for image buffer", total_size_);
+            send_transfer_error(ErrorCode::MEMORY_ALLOCATION_FAILED);
+            status_ = Status::ERROR;
+            return;
+        }
+    }
+    
+    // Sinks, the decompressor and the patcher consume chunks in order
+    if ((sink || is_encoded()) && !begin_streaming(sink)) {
+        image_buffer_.reset();
+        chunk_received_map_.release();
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    status_ = Status::INIT_RECEIVED;
+    metrics_.sample_heap(heap_caps_get_free_size(MALLOC_CAP_DEFAULT));  // Receive buffer, map, window allocated
+    
+    // Every transfer starts from the configured batch size
+    active_chunks_per_request_ = service_.chunks_per_request_;
+    if (service_.adaptive_batching_) {
+        rate_controller_.set_config(service_.rate_config_);
+        rate_controller_.reset(service_.chunks_per_request_, esp_timer_get_time());
+        active_chunks_per_request_ = rate_controller_.get_batch_size();
+    }
+    
+    // Immediately send first chunk request (no TRANSFER_READY per specs)
+    CHUNK_LOG(TAG, "Sending first chunk request (%s, window %d%s, %lu chunks total)", 
+             (service_.flow_mode_ == FlowMode::SLIDING_WINDOW) ? "sliding window" : "stop-and-wait",
+             active_chunks_per_request_, service_.adaptive_batching_ ? " adaptive" : "", expected_chunks_);
+    request_next_chunks();
+    
+    // Watch for stalled ranges so lost chunks get re-requested
+    if (status_ != Status::ERROR) {
+        last_progress_us_ = esp_timer_get_time();
+        start_retransmit_timer();
+    }
+}
+
+void ImageService::TransferSession::handle_data_chunk(const uint8_t* data, uint16_t len) {
+    if (status_ == Status::BENCHMARKING) {
+        receive_benchmark_chunk(data, len);
+    } else {
+        receive_data_chunk(data, len);
+    }
+    update_metrics();
+    update_link_mode();  // The last chunk completes the transfer
+}
+
+void ImageService::TransferSession::receive_data_chunk(const uint8_t* data, uint16_t len) {
+    if (status_ != Status::REQUESTING_CHUNKS && status_ != Status::RECEIVING) {
+        ESP_LOGW(TAG, "Data chunk received in wrong state: %d", static_cast<int>(status_));
+        return;
+    }
+    
+    // Comprehensive size logging for debugging (conditional)
+    CHUNK_LOG(TAG, "=== DATA CHUNK RECEIVED ===");
+    CHUNK_LOG(TAG, "Total received length: %d bytes", len);
+    CHUNK_LOG(TAG, "Transfer state: %s", 
+             (status_ == Status::REQUESTING_CHUNKS) ? "REQUESTING_CHUNKS" : "RECEIVING");
+    CHUNK_LOG(TAG, "Current request range: %lu-%lu", current_request_start_, current_request_end_);
+    CHUNK_LOG(TAG, "Current negotiated MTU: %d bytes", mtu_);
+    CHUNK_LOG(TAG, "ATT header overhead: %d bytes", ATT_HEADER_SIZE);
+    CHUNK_LOG(TAG, "Expected ATT payload: %d bytes (MTU - ATT header)", MAX_ATT_PAYLOAD);
+    CHUNK_LOG(TAG, "Data header size: %d bytes", DATA_HEADER_SIZE);
+    CHUNK_LOG(TAG, "Maximum data payload: %d bytes", MAX_DATA_PAYLOAD);
+    CHUNK_LOG(TAG, "Actual received vs expected ATT payload: %d vs %d (%s)", 
+             len, MAX_ATT_PAYLOAD, (len == MAX_ATT_PAYLOAD) ? "MATCH" : "MISMATCH");
+    CHUNK_LOG(TAG, "Payload size after removing data header: %d bytes", len - DATA_HEADER_SIZE);
+    
+    if (len < DATA_HEADER_SIZE) {
+        ESP_LOGE(TAG, "Data chunk too short: %d bytes (minimum: %d)", len, DATA_HEADER_SIZE);
+        send_transfer_error(ErrorCode::DATA_CHUNK_TOO_SHORT);
+        return;
+    }
+    
+    // Header is decoded in place; the payload stays in the write buffer until it is stored
+    ByteSpan frame(data, len);
+    uint16_t chunk_id = frame.read_u16(0);
+    uint16_t data_length = frame.read_u16(2);  // This should be payload size only
+    
+    CHUNK_LOG(TAG, "Header - Chunk ID: %d", chunk_id);
+    CHUNK_LOG(TAG, "Header - Data Length: %d bytes (payload only)", data_length);
+    CHUNK_LOG(TAG, "Actual payload size: %d bytes", len - DATA_HEADER_SIZE);
+    
+    // Validate chunk parameters
+    if (chunk_id >= expected_chunks_) {
+        ESP_LOGE(TAG, "❌ INVALID CHUNK ID: %d (max: %lu)", chunk_id, expected_chunks_ - 1);
+        send_transfer_error(ErrorCode::INVALID_CHUNK_ID);
+        return;
+    }
+    
+    // Check if chunk has been requested yet (conditional detailed logging)
+    bool was_requested = (chunk_id < next_request_chunk_);
+    if (!was_requested) {
+        rate_controller_.on_out_of_range_chunk();
+        metrics_.out_of_range_chunks++;
+        CHUNK_LOG(TAG, "⚠️ Chunk %d has not been requested yet (next unrequested: %lu)", 
+                 chunk_id, next_request_chunk_);
+        CHUNK_LOG(TAG, "This might indicate out-of-order delivery or client error");
+    } else {
+        CHUNK_LOG(TAG, "✅ Chunk %d is within requested range [0-%lu]", 
+                 chunk_id, next_request_chunk_ - 1);
+    }
+    
+    // The data_length field should match the actual payload size
+    uint16_t actual_payload_size = len - DATA_HEADER_SIZE;
+    
+    // Size validation (conditional detailed logging)
+    if (data_length != actual_payload_size) {
+        CHUNK_LOG(TAG, "Data length mismatch: header=%d, actual_payload=%d, total_len=%d", 
+                 data_length, actual_payload_size, len);
+        CHUNK_LOG(TAG, "Expected: header.data_length == (total_len - %d)", DATA_HEADER_SIZE);
+        CHUNK_LOG(TAG, "iOS may need to adjust data_length to match actual payload sent");
+        
+        // For now, use the actual received payload size to avoid blocking data
+        CHUNK_LOG(TAG, "Using actual payload size (%d) instead of header value (%d)", 
+                 actual_payload_size, data_length);
+        data_length = actual_payload_size;
+    }
+    
+    CHUNK_LOG(TAG, "✅ Size validation completed - using payload size: %d bytes", data_length);
+    
+    if (chunk_received_map_.test(chunk_id)) {
+        // Duplicates are expected after a retransmission request raced the original chunk
+        rate_controller_.on_duplicate_chunk();
+        metrics_.duplicate_chunks++;
+        TRANSFER_TRACE(CHUNK_DUPLICATE, conn_id_, chunk_id, 0);
+        CHUNK_LOG(TAG, "🔄 DUPLICATE CHUNK: %d (already received) - dropped", chunk_id);
+        return;
+    }
+    
+    TRANSFER_TRACE(CHUNK_RECEIVED, conn_id_, chunk_id, data_length);
+    HOT_PATH_LOG(TAG, "Chunk %d received", chunk_id);
+    
+    // Calculate offset in buffer (encoded chunks only have to fit the chunk grid)
+    uint32_t offset = chunk_id * chunk_size_;
+    uint32_t wire_size = is_encoded() ? expected_chunks_ * chunk_size_ : total_size_;
+    if (offset + data_length > wire_size) {
+        ESP_LOGE(TAG, "❌ BUFFER OVERFLOW: chunk %d would exceed buffer", chunk_id);
+        ESP_LOGE(TAG, "Offset: %lu, data_length: %d, total_size: %lu", 
+                 offset, data_length, wire_size);
+        send_transfer_error(ErrorCode::BUFFER_OVERFLOW);
+        return;
+    }
+    
+    CHUNK_LOG(TAG, "💾 Writing chunk %d to buffer offset %lu (%d bytes)", 
+             chunk_id, offset, data_length);
+    
+    if (is_streaming()) {
+        // Reorder and forward in-order runs to the sink or decompressor
+        if (!store_streamed_chunk(chunk_id, frame.subspan(DATA_HEADER_SIZE, data_length))) {
+            return;
+        }
+    } else {
+        // Copy data to buffer
+        memcpy(image_buffer_.data() + offset, data + DATA_HEADER_SIZE, data_length);
+    }
+    chunk_received_map_.set(chunk_id);
+    if (!is_streaming()) {
+        advance_crc();  // Streamed chunks are checksummed as they are delivered
+    }
+    report_prefix();  // Before complete_transfer(): the last report covers the whole image
+    received_size_ += data_length;
+    
+    // Performance optimization: increment counters instead of iterating arrays
+    total_chunks_received_++;
+    round_chunks_received_++;
+    last_progress_us_ = esp_timer_get_time();
+    metrics_.on_chunk(last_progress_us_, chunk_id, data_length);
+    retransmit_attempts_ = 0;
+    if (was_requested && chunks_in_flight_ > 0) {
+        chunks_in_flight_--;
+    }
+    
+    CHUNK_LOG(TAG, "✅ Chunk %d stored successfully. Total received: %lu bytes", 
+             chunk_id, received_size_);
+    
+    status_ = Status::RECEIVING;
+    
+    // Fast transfer completion check using counter
+    if (total_chunks_received_ >= expected_chunks_) {
+        complete_transfer();
+    }
+    else {
+#ifdef CHUNK_LOGGING
+        // Detailed window progress reporting (using fast counters)
+        CHUNK_LOG(TAG, "=== WINDOW PROGRESS ===");
+        CHUNK_LOG(TAG, "Chunks in flight: %lu (window %d), next unrequested chunk: %lu", 
+                 chunks_in_flight_, active_chunks_per_request_, next_request_chunk_);
+        
+        // Report overall progress (now using fast counter - no loop!)
+        CHUNK_LOG(TAG, "Overall progress: %lu/%lu chunks (%.1f%%)", 
+                 total_chunks_received_, expected_chunks_, 
+                 (float)total_chunks_received_ / expected_chunks_ * 100.0f);
+#endif
+        
+        // Top up the request window if the flow mode allows it
+        request_next_chunks();
+    }
+}
+
+void ImageService::TransferSession::complete_transfer() {
+    ESP_LOGI(TAG, "🎉 TRANSFER COMPLETE! Received all %lu chunks (%lu bytes)", 
+             expected_chunks_, received_size_);
+    
+    // Validate JPEG header
+    bool is_valid_jpeg = false;
+    if (transfer_type_ == TransferType::ASSET) {
+        is_valid_jpeg = validate_jpeg_header();
+        if (is_valid_jpeg) {
+            ESP_LOGI(TAG, "✅ Valid JPEG header detected");
+        } else {
+            ESP_LOGW(TAG, "⚠️ Warning: Data does not appear to be JPEG format");
+        }
+    }
+    
+    stop_retransmit_timer();
+    
+    // An encoded stream must end on a block/op boundary with exactly the announced size
+    uint32_t image_size = is_encoded() ? output_offset_ : received_size_;
+    if (is_encoded() && ((compressed_ && !decompressor_.is_idle()) || (delta_ && !patcher_.is_idle()) ||
+                         output_offset_ != total_size_)) {
+        ESP_LOGE(TAG, "❌ Encoded stream truncated: %lu of %lu bytes decoded", output_offset_, total_size_);
+        end_streaming();
+        report_prefix_abort();
+        image_buffer_.reset();
+        send_transfer_error(ErrorCode::INVALID_CONTENT);
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    // The CRC already covers everything, so this is a compare, not a second pass over the data
+    if (crc_expected_ && running_crc_ != expected_crc_) {
+        ESP_LOGE(TAG, "❌ CRC32 mismatch: expected 0x%08lX, computed 0x%08lX", expected_crc_, running_crc_);
+        end_streaming();  // Aborts the sink (e.g. the OTA slot is not activated)
+        report_prefix_abort();  // The decoder has been reading data that does not match the CRC
+        image_buffer_.reset();
+        send_transfer_error(ErrorCode::CRC_MISMATCH, running_crc_);
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    // The queue filled up during the transfer: refuse the image rather than run the callback here
+    if (transfer_type_ == TransferType::ASSET && service_.completion_enabled_ && !service_.has_completion_capacity()) {
+        ESP_LOGW(TAG, "⚠️ Completion queue full - dropping image, client should retry later");
+        send_transfer_error(ErrorCode::RECEIVER_BUSY);
+        reset_transfer();  // Aborts the sink before anything is committed
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    if (active_sink_) {
+        // Flush the last partial block (and verify firmware) before acknowledging
+        TransferSink* sink = active_sink_;
+        active_sink_ = nullptr;
+        if (!sink->finish()) {
+            ESP_LOGE(TAG, "❌ Transfer sink failed to finish");
+            send_transfer_error(sink->content_rejected() ? ErrorCode::INVALID_CONTENT : ErrorCode::STORAGE_ERROR);
+            status_ = Status::ERROR;
+            return;
+        }
+        ESP_LOGI(TAG, "Sink consumed %lu of %lu writes in place", output_spans_consumed_, output_spans_);
+    }
+    
+    status_ = Status::COMPLETE;
+    finish_metrics(true);
+    
+    if (is_manifest_active()) {
+        // One file of a batch done - the ACK tells the client how many are still to come
+        manifest_files_remaining_--;
+        manifest_bytes_received_ += image_size;
+        if (manifest_files_remaining_ == 0 || transfer_type_ == TransferType::FIRMWARE) {
+            end_manifest();  // A firmware image always ends the batch (the application may restart)
+        }
+    }
+    
+    // Send completion acknowledgment
+    if (send_transfer_complete_ack(image_size, running_crc_)) {
+        ESP_LOGI(TAG, "✅ Transfer complete ACK sent");
+    } else {
+        ESP_LOGE(TAG, "❌ Failed to send TRANSFER_COMPLETE_ACK");
+    }
+    
+    if (transfer_type_ == TransferType::FIRMWARE) {
+        // The new image is the boot partition now - the application decides when to restart
+        disconnect_client();
+        if (service_.firmware_callback_) {
+            service_.firmware_callback_(image_size);
+        }
+        return;
+    }
+    
+    if (service_.completion_enabled_) {
+        // ACK and disconnect go out before any application processing
+        disconnect_client();
+        
+        // The worker turns a RAM image into the delta base after its callback
+        bool delta_base = service_.delta_base_enabled_ && image_buffer_;
+        if (service_.delta_base_enabled_ && !image_buffer_) {
+            service_.update_delta_base(this, TransferBuffer(), 0);
+        }
+        
+        // Room was checked above under the same lock, and only the worker takes jobs out
+        CompletionJob job = { image_buffer_.data(), image_size, image_buffer_.allocator(), is_valid_jpeg,
+                              delta_base, running_crc_, false };
+        xQueueSend(service_.completion_queue_, &job, 0);
+        image_buffer_.detach();  // Ownership moved to the completion worker
+        if (delta_base) {
+            service_.pending_base_updates_++;
+        }
+        ESP_LOGI(TAG, "🔄 Image handed to completion worker (%lu bytes)", image_size);
+        return;
+    }
+    
+    // Invoke callback if registered
+    if (service_.image_callback_) {
+        ESP_LOGI(TAG, "🔄 Invoking image transfer callback with %lu bytes", image_size);
+        service_.image_callback_(image_buffer_.data(), image_size, is_valid_jpeg);
+        ESP_LOGI(TAG, "✅ Image transfer callback completed");
+    } else {
+        ESP_LOGI(TAG, "ℹ️ No image transfer callback registered");
+    }
+    if (service_.delta_base_enabled_) {
+        // The buffer itself becomes the base (empty if streamed or released by the callback)
+        service_.update_delta_base(this, std::move(image_buffer_), running_crc_);
+    }
+    image_buffer_.reset();  // No-op if the callback already called release_image_buffer()
+    
+    disconnect_client();
+}
+
+void ImageService::TransferSession::disconnect_client() {
+    if (is_manifest_active()) {
+        ESP_LOGI(TAG, "📦 %lu of %lu batched files still to come - keeping the connection",
+                 manifest_files_remaining_, manifest_files_);
+        return;
+    }
+    
+    // Disconnect client after successful transfer to allow new connections
+    // The close waits until the queued TRANSFER_COMPLETE_ACK has been sent
+    ESP_LOGI(TAG, "🔌 Disconnecting client after successful transfer to allow new connections");
+    service_.tx_scheduler_.close_after_drain(conn_id_);
+}
+
+void ImageService::TransferSession::request_next_chunks() {
+    if (next_request_chunk_ >= expected_chunks_) {
+        return;  // Everything has been requested already
+    }
+    
+    /**
+     * Stop-and-wait: the next batch is only requested once every requested chunk arrived,
+     * which leaves the link idle for a full notification round trip per batch.
+     * 
+     * Sliding window: keep up to active_chunks_per_request_ chunks in flight and top the
+     * window up as soon as half of it has landed, so the client always has chunks queued.
+     */
+    bool should_request = (service_.flow_mode_ == FlowMode::SLIDING_WINDOW) ?
+                          (chunks_in_flight_ <= active_chunks_per_request_ / WINDOW_REFILL_DIVISOR) :
+                          (chunks_in_flight_ == 0);
+    if (!should_request) {
+        return;
+    }
+    
+    // A new range is due: close the adaptive round and pick the next batch size
+    if (service_.adaptive_batching_ && next_request_chunk_ > 0) {
+        uint16_t previous_size = active_chunks_per_request_;
+        active_chunks_per_request_ = rate_controller_.end_round(esp_timer_get_time(), round_chunks_received_);
+        round_chunks_received_ = 0;
+        if (active_chunks_per_request_ != previous_size) {
+            CHUNK_LOG(TAG, "Adaptive batch size: %d -> %d chunks", previous_size, active_chunks_per_request_);
+        }
+    }
+    
+    if (chunks_in_flight_ >= active_chunks_per_request_) {
+        return;  // Window shrank below what is still in flight
+    }
+    
+    uint32_t start_chunk = next_request_chunk_;
+    uint32_t remaining_chunks = expected_chunks_ - start_chunk;
+    uint32_t window_space = active_chunks_per_request_ - chunks_in_flight_;
+    if (is_streaming()) {
+        // Only request chunks that fit into the reorder window
+        uint32_t reorder_end = stream_next_chunk_ + reorder_window_chunks_;
+        if (start_chunk >= reorder_end) {
+            return;
+        }
+        if (reorder_end - start_chunk < window_space) {
+            window_space = reorder_end - start_chunk;
+        }
+    }
+    uint32_t num_chunks = (remaining_chunks < window_space) ? remaining_chunks : window_space;
+    
+    CHUNK_LOG(TAG, "🔄 Requesting chunks %lu-%lu (%lu chunks, %lu already in flight)", 
+             start_chunk, start_chunk + num_chunks - 1, num_chunks, chunks_in_flight_);
+    
+    if (!send_chunk_request(start_chunk, num_chunks)) {
+        ESP_LOGE(TAG, "❌ Failed to send chunk request");
+        send_transfer_error(ErrorCode::NOTIFICATION_SEND_FAILED);
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    TRANSFER_TRACE(CHUNK_REQUEST, conn_id_, start_chunk, num_chunks);
+    metrics_.on_batch_request(esp_timer_get_time(), start_chunk, num_chunks);
+    metrics_.sample_heap(heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+    HOT_PATH_LOG(TAG, "CHUNK_REQUEST sent: chunks %lu-%lu", start_chunk, start_chunk + num_chunks - 1);
+    
+    // Chunks that arrived ahead of their request are not in flight anymore
+    uint32_t already_received = chunk_received_map_.count_set(start_chunk, start_chunk + num_chunks);
+    
+    next_request_chunk_ = start_chunk + num_chunks;
+    chunks_in_flight_ += num_chunks - already_received;
+}
+
+// ==================== STATS ====================
+
+void ImageService::TransferSession::handle_stats_request(const ControlMessage& msg) {
+    // A client that just connected gets the last transfer of any connection
+    const TransferMetrics& metrics = (metrics_.outcome != TransferMetrics::Outcome::NONE) ? metrics_
+                                                                                          : service_.last_metrics_;
+    ESP_LOGI(TAG, "STATS requested - sending %d pages", STATS_PAGE_COUNT);
+    
+    int64_t now_us = esp_timer_get_time();
+    for (uint8_t page = 0; page < STATS_PAGE_COUNT; page++) {
+        if (!send_stats_page(metrics, page, now_us)) {
+            ESP_LOGE(TAG, "❌ Failed to send STATS page %d", page);
+            return;
+        }
+    }
+}
+
+bool ImageService::TransferSession::send_stats_page(const TransferMetrics& metrics, uint8_t page, int64_t now_us) {
+    ControlMessage msg = {};
+    msg.command = static_cast<uint8_t>(CommandType::STATS);
+    msg.sequence_number = ++sequence_number_;
+    msg.reserved[STATS_PAGE_INDEX] = page;
+    msg.reserved[STATS_PAGE_COUNT_INDEX] = STATS_PAGE_COUNT;
+    msg.reserved[STATS_OUTCOME_INDEX] = static_cast<uint8_t>(metrics.outcome);
+    
+    // 16-bit fields saturate instead of wrapping
+    auto pack16 = [](uint32_t low, uint32_t high) {
+        return (low > 0xFFFF ? 0xFFFFu : low) | ((high > 0xFFFF ? 0xFFFFu : high) << 16);
+    };
+    const LatencyHistogram& histogram = (page < STATS_PAGE_GAP_HISTOGRAM) ? metrics.batch_rtt : metrics.chunk_gap;
+    uint8_t first_bucket = (page % 2 == 0) ? 0 : LatencyHistogram::BUCKETS / 2;
+    
+    switch (page) {
+    case STATS_PAGE_THROUGHPUT:
+        msg.param1 = metrics.bytes_received;
+        msg.param2 = metrics.get_duration_us(now_us) / 1000;
+        msg.param3 = metrics.get_throughput(now_us);
+        break;
+    case STATS_PAGE_PROGRESS:
+        msg.param1 = metrics.get_time_to_first_chunk_us();
+        msg.param2 = metrics.chunks_received;
+        msg.param3 = metrics.expected_chunks;
+        break;
+    case STATS_PAGE_LOSS:
+        msg.param1 = pack16(metrics.out_of_range_chunks, metrics.duplicate_chunks);
+        msg.param2 = pack16(metrics.retransmit_requests, metrics.timeouts);
+        msg.param3 = metrics.notification_failures;
+        break;
+    case STATS_PAGE_HEAP:
+        msg.param1 = metrics.get_peak_heap_use();
+        msg.param2 = metrics.heap_free_min;
+        msg.param3 = metrics.heap_free_at_start;
+        break;
+    case STATS_PAGE_BATCH_RTT:
+        msg.param1 = metrics.batch_rtt.min_us;
+        msg.param2 = metrics.batch_rtt.get_mean_us();
+        msg.param3 = metrics.batch_rtt.max_us;
+        break;
+    case STATS_PAGE_CHUNK_GAP:
+        msg.param1 = metrics.chunk_gap.min_us;
+        msg.param2 = metrics.chunk_gap.get_mean_us();
+        msg.param3 = metrics.chunk_gap.max_us;
+        break;
+    default:
+        // Histogram pages: six bucket counts each, lower half on even pages
+        msg.param1 = pack16(histogram.counts[first_bucket], histogram.counts[first_bucket + 1]);
+        msg.param2 = pack16(histogram.counts[first_bucket + 2], histogram.counts[first_bucket + 3]);
+        msg.param3 = pack16(histogram.counts[first_bucket + 4], histogram.counts[first_bucket + 5]);
+        break;
+    }
+    
+    return send_control_notification(msg);
+}
+
+// ==================== BENCHMARK ====================
+
+void ImageService::TransferSession::handle_benchmark_request(const ControlMessage& msg) {
+    // Parameter 1 = 0 ends a running benchmark early (the client has sent everything)
+    if (msg.param1 == 0) {
+        if (status_ == Status::BENCHMARKING) {
+            finish_benchmark();
+        } else {
+            ESP_LOGW(TAG, "BENCHMARK finish without a running benchmark");
+            send_transfer_error(ErrorCode::INVALID_COMMAND);
+        }
+        return;
+    }
+    
+    uint32_t chunk_size = msg.param2 ? msg.param2 : get_optimal_chunk_size(false);
+    uint16_t max_chunk_size = get_max_chunk_size();
+    ESP_LOGI(TAG, "BENCHMARK: %lu chunks of %lu bytes", msg.param1, chunk_size);
+    
+    if (msg.param1 > MAX_CHUNKS) {
+        ESP_LOGE(TAG, "Benchmark too long: %lu chunks (max: %lu)", msg.param1, MAX_CHUNKS);
+        send_transfer_error(ErrorCode::TRANSFER_TOO_LARGE);
+        return;
+    }
+    if (chunk_size == 0 || chunk_size > max_chunk_size) {
+        ESP_LOGE(TAG, "Chunk size %lu bytes invalid for MTU %d (max: %d bytes)", chunk_size, mtu_, max_chunk_size);
+        send_transfer_error(ErrorCode::CHUNK_SIZE_TOO_LARGE, max_chunk_size);
+        return;
+    }
+    
+    // Like TRANSFER_INIT, a benchmark replaces whatever the connection was doing
+    reset_transfer();
+    expected_chunks_ = msg.param1;
+    chunk_size_ = chunk_size;
+    
+    // Only the chunk map is allocated (1 bit per chunk) - payloads are discarded
+    if (!chunk_received_map_.allocate(expected_chunks_)) {
+        ESP_LOGE(TAG, "Failed to allocate chunk tracking map");
+        send_transfer_error(ErrorCode::MEMORY_ALLOCATION_FAILED);
+        reset_transfer();
+        return;
+    }
+    
+    status_ = Status::BENCHMARKING;
+    if (!send_benchmark_page(BENCHMARK_PAGE_READY)) {
+        ESP_LOGE(TAG, "❌ Failed to send BENCHMARK ready page");
+        reset_transfer();
+        return;
+    }
+    last_progress_us_ = esp_timer_get_time();
+    start_retransmit_timer();
+}
+
+void ImageService::TransferSession::receive_benchmark_chunk(const uint8_t* data, uint16_t len) {
+    if (len < DATA_HEADER_SIZE) {
+        return;
+    }
+    
+    uint16_t chunk_id = ByteSpan(data, len).read_u16(0);
+    uint16_t payload_size = len - DATA_HEADER_SIZE;
+    int64_t now_us = esp_timer_get_time();
+    last_progress_us_ = now_us;
+    
+    if (chunk_id >= expected_chunks_) {
+        benchmark_out_of_range_++;
+        return;
+    }
+    if (chunk_received_map_.test(chunk_id)) {
+        benchmark_duplicates_++;
+        return;
+    }
+    chunk_received_map_.set(chunk_id);
+    total_chunks_received_++;
+    received_size_ += payload_size;
+    TRANSFER_TRACE(CHUNK_RECEIVED, conn_id_, chunk_id, payload_size);
+    
+    // The rate is measured from the first chunk on, so the client's start-up does not count
+    if (benchmark_first_us_ == 0) {
+        benchmark_first_us_ = now_us;
+        benchmark_first_size_ = payload_size;
+    }
+    benchmark_last_us_ = now_us;
+    
+    if (total_chunks_received_ == expected_chunks_) {
+        finish_benchmark();
+    }
+}
+
+void ImageService::TransferSession::finish_benchmark() {
+    stop_retransmit_timer();
+    
+    uint32_t duration_us = static_cast<uint32_t>(benchmark_last_us_ - benchmark_first_us_);
+    uint32_t rate_bytes = received_size_ - benchmark_first_size_;
+    ESP_LOGI(TAG, "📊 Benchmark: %lu/%lu chunks (%lu bytes) in %lu ms (%lu B/s), %lu duplicates",
+             total_chunks_received_, expected_chunks_, received_size_, duration_us / 1000,
+             duration_us ? static_cast<uint32_t>(static_cast<uint64_t>(rate_bytes) * 1000000ULL / duration_us) : 0,
+             benchmark_duplicates_);
+    
+    for (uint8_t page = BENCHMARK_PAGE_THROUGHPUT; page < BENCHMARK_PAGE_COUNT; page++) {
+        if (!send_benchmark_page(page)) {
+            ESP_LOGE(TAG, "❌ Failed to send BENCHMARK page %d", page);
+            break;
+        }
+    }
+    reset_transfer();
+}
+
+bool ImageService::TransferSession::send_benchmark_page(uint8_t page) {
+    ControlMessage msg = {};
+    msg.command = static_cast<uint8_t>(CommandType::BENCHMARK);
+    msg.sequence_number = ++sequence_number_;
+    msg.reserved[BENCHMARK_PAGE_INDEX] = page;
+    msg.reserved[BENCHMARK_PAGE_COUNT_INDEX] = BENCHMARK_PAGE_COUNT;
+    
+    auto pack16 = [](uint32_t low, uint32_t high) {
+        return (low > 0xFFFF ? 0xFFFFu : low) | ((high > 0xFFFF ? 0xFFFFu : high) << 16);
+    };
+    uint32_t duration_us = static_cast<uint32_t>(benchmark_last_us_ - benchmark_first_us_);
+    TransferTransport::LinkInfo link = {};
+    service_.transport_->get_link_info(conn_id_, &link);
+    
+    switch (page) {
+    case BENCHMARK_PAGE_READY:
+        msg.reserved[BENCHMARK_CHANNELS_INDEX] = service_.data_channels_created_;  // Client may spread chunks over these
+        msg.param1 = expected_chunks_;
+        msg.param2 = chunk_size_;
+        msg.param3 = get_max_chunk_size();
+        break;
+    case BENCHMARK_PAGE_THROUGHPUT:
+        msg.param1 = received_size_;
+        msg.param2 = duration_us;
+        msg.param3 = duration_us ? static_cast<uint32_t>(static_cast<uint64_t>(received_size_ - benchmark_first_size_) *
+                                                         1000000ULL / duration_us) : 0;
+        break;
+    case BENCHMARK_PAGE_LOSS:
+        msg.param1 = total_chunks_received_;
+        msg.param2 = expected_chunks_;
+        msg.param3 = pack16(benchmark_duplicates_, benchmark_out_of_range_);
+        break;
+    case BENCHMARK_PAGE_LINK:
+        msg.param1 = pack16(link.interval, link.latency);
+        msg.param2 = pack16(link.timeout, mtu_);
+        msg.param3 = static_cast<uint32_t>(link.tx_phy) | (static_cast<uint32_t>(link.rx_phy) << 8) |
+                     (static_cast<uint32_t>(link.rx_data_length) << 16);
+        break;
+    default:
+        return false;
+    }
+    
+    return send_control_notification(msg);
+}
+
+// ==================== BATCHED TRANSFERS ====================
+
+void ImageService::TransferSession::handle_manifest(const ControlMessage& msg) {
+    // Parameter 1 = file count (0 cancels a batch), Parameter 2 = total bytes of all files
+    if (is_active()) {
+        ESP_LOGW(TAG, "MANIFEST while a transfer is running");
+        send_transfer_error(ErrorCode::INVALID_COMMAND);
+        return;
+    }
+    
+    end_manifest();  // A new manifest replaces the previous one
+    if (msg.param1 > 0) {
+        manifest_files_ = msg.param1;
+        manifest_files_remaining_ = msg.param1;
+        manifest_bytes_ = msg.param2;
+        manifest_start_us_ = esp_timer_get_time();
+        ESP_LOGI(TAG, "📦 MANIFEST: %lu files, %lu bytes on one connection", manifest_files_, manifest_bytes_);
+    }
+    
+    ControlMessage ack = {};
+    ack.command = static_cast<uint8_t>(CommandType::MANIFEST);
+    ack.sequence_number = ++sequence_number_;
+    ack.param1 = manifest_files_;
+    ack.param2 = manifest_bytes_;
+    if (!send_control_notification(ack)) {
+        ESP_LOGE(TAG, "❌ Failed to send MANIFEST acknowledgment");
+    }
+}
+
+void ImageService::TransferSession::end_manifest() {
+    if (manifest_files_ == 0) {
+        return;
+    }
+    
+    uint32_t duration_ms = static_cast<uint32_t>((esp_timer_get_time() - manifest_start_us_) / 1000);
+    if (manifest_files_remaining_ == 0) {
+        ESP_LOGI(TAG, "📦 Batch complete: %lu files, %lu bytes in %lu ms",
+                 manifest_files_, manifest_bytes_received_, duration_ms);
+    } else {
+        ESP_LOGW(TAG, "📦 Batch ended after %lu of %lu files (%lu ms)",
+                 manifest_files_ - manifest_files_remaining_, manifest_files_, duration_ms);
+    }
+    
+    manifest_files_ = 0;
+    manifest_files_remaining_ = 0;
+    manifest_bytes_ = 0;
+    manifest_bytes_received_ = 0;
+    manifest_start_us_ = 0;
+    
+    if (spare_window_) {
+        heap_caps_free(spare_window_);
+        spare_window_ = nullptr;
+        spare_window_bytes_ = 0;
+    }
+    if (!chunk_received_map_.is_allocated()) {
+        chunk_received_map_.release();  // Storage kept by discard()
+    }
+}
+
+// ==================== DOWNLOAD ====================
+
+void ImageService::TransferSession::handle_request_download(const ControlMessage& msg) {
+    ESP_LOGI(TAG, "REQUEST_DOWNLOAD: id=%lu, max_chunk_size=%lu", msg.param1, msg.param2);
+    
+    if (!data_notifications_enabled_) {
+        ESP_LOGE(TAG, "Download needs data notifications - client has not enabled them");
+        send_transfer_error(ErrorCode::NOTIFICATION_SEND_FAILED);
+        return;
+    }
+    
+    // A download replaces whatever this session was doing
+    reset_transfer();
+    
+    TransferSource* source = service_.download_request_callback_ ?
+                             service_.download_request_callback_(msg.param1) : nullptr;
+    if (!source) {
+        ESP_LOGW(TAG, "No download with id %lu", msg.param1);
+        send_transfer_error(ErrorCode::DOWNLOAD_UNAVAILABLE, msg.param1);
+        status_ = Status::ERROR;
+        return;
+    }
+    if (service_.is_source_busy(source)) {
+        ESP_LOGW(TAG, "Download %lu is being sent to another connection - client should retry later", msg.param1);
+        send_transfer_error(ErrorCode::RECEIVER_BUSY);
+        status_ = Status::ERROR;
+        return;
+    }
+    if (!source->begin()) {
+        ESP_LOGE(TAG, "Download source %lu rejected the download", msg.param1);
+        if (service_.download_complete_callback_) {
+            service_.download_complete_callback_(msg.param1, source, false);
+        }
+        send_transfer_error(ErrorCode::STORAGE_ERROR);
+        status_ = Status::ERROR;
+        return;
+    }
+    download_source_ = source;
+    download_id_ = msg.param1;
+    
+    // One chunk per unfragmented notification (or smaller if the client asks)
+    uint32_t chunk_size = get_optimal_chunk_size(true);
+    if (chunk_size == 0) {
+        chunk_size = 1;
+    }
+    if (msg.param2 > 0 && msg.param2 < chunk_size) {
+        chunk_size = msg.param2;
+    }
+    
+    uint32_t size = source->size();
+    uint32_t chunks = (size + chunk_size - 1) / chunk_size;
+    if (size == 0 || chunks > MAX_CHUNKS) {
+        ESP_LOGE(TAG, "Download of %lu bytes cannot be sent in %lu byte chunks", size, chunk_size);
+        reset_transfer();
+        if (size == 0) {
+            send_transfer_error(ErrorCode::DOWNLOAD_UNAVAILABLE, msg.param1);
+        } else {
+            send_transfer_error(ErrorCode::TRANSFER_TOO_LARGE, size);
+        }
+        status_ = Status::ERROR;
+        return;
+    }
+    total_size_ = size;
+    chunk_size_ = chunk_size;
+    expected_chunks_ = chunks;
+    
+    uint32_t crc;
+    if (source->get_crc32(&crc)) {
+        start_download(crc);
+        return;
+    }
+    
+    // Reading the whole source here would block the BLE stack (seconds for a large partition)
+    status_ = Status::PREPARING;
+    if (!start_download_crc_task()) {
+        reset_transfer();
+        send_transfer_error(ErrorCode::MEMORY_ALLOCATION_FAILED);
+        status_ = Status::ERROR;
+        return;
+    }
+    ESP_LOGI(TAG, "Download %lu: computing CRC32 of %lu bytes on a worker task", download_id_, total_size_);
+}
+
+void ImageService::TransferSession::start_download(uint32_t crc) {
+    download_crc_ = crc;
+    
+    // Everything is pending at first; the client only asks again for what it missed
+    if (!download_pending_.allocate(expected_chunks_)) {
+        ESP_LOGE(TAG, "Failed to allocate download chunk map");
+        reset_transfer();
+        send_transfer_error(ErrorCode::MEMORY_ALLOCATION_FAILED);
+        status_ = Status::ERROR;
+        return;
+    }
+    for (uint32_t chunk = 0; chunk < expected_chunks_; chunk++) {
+        download_pending_.set(chunk);
+    }
+    download_cursor_ = 0;
+    download_chunks_sent_ = 0;
+    
+    // Describe the download the same way a client describes an upload
+    ControlMessage init = {};
+    init.command = static_cast<uint8_t>(CommandType::TRANSFER_INIT);
+    init.sequence_number = ++sequence_number_;
+    init.param1 = total_size_;
+    init.param2 = chunk_size_;
+    init.param3 = expected_chunks_;
+    memcpy(init.reserved, &download_crc_, sizeof(download_crc_));
+    init.reserved[TRANSFER_FLAGS_INDEX] = TRANSFER_FLAG_CRC32 | static_cast<uint8_t>(TransferType::ASSET);
+    if (!send_control_notification(init)) {
+        reset_transfer();
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    status_ = Status::SENDING;
+    download_activity_us_ = esp_timer_get_time();
+    ESP_LOGI(TAG, "📤 Download %lu: %lu bytes in %lu chunks of %lu bytes, CRC32 0x%08lX",
+             download_id_, total_size_, expected_chunks_, chunk_size_, download_crc_);
+    
+    // The scheduler pulls chunks whenever the link has room, behind any queued control messages
+    service_.tx_scheduler_.set_data_source(conn_id_, &TransferSession::download_data_source, this);
+    start_retransmit_timer();
+}
+
+void ImageService::TransferSession::handle_download_chunk_request(const ControlMessage& msg) {
+    uint32_t start = msg.param1;
+    uint32_t end = msg.param1 + msg.param2;
+    if (msg.param2 == 0 || start >= expected_chunks_ || end > expected_chunks_ || end < start) {
+        ESP_LOGW(TAG, "Download CHUNK_REQUEST out of range: %lu+%lu (%lu chunks)", msg.param1, msg.param2, expected_chunks_);
+        send_transfer_error(ErrorCode::INVALID_CHUNK_ID, msg.param1);
+        return;
+    }
+    
+    CHUNK_LOG(TAG, "Download CHUNK_REQUEST: chunks %lu-%lu", start, end - 1);
+    for (uint32_t chunk = start; chunk < end; chunk++) {
+        download_pending_.set(chunk);
+    }
+    // Re-requested chunks go out in order before the rest
+    if (start < download_cursor_) {
+        download_cursor_ = start;
+    }
+    download_activity_us_ = esp_timer_get_time();
+    service_.tx_scheduler_.pump();
+}
+
+void ImageService::TransferSession::handle_download_ack(const ControlMessage& msg) {
+    bool success = msg.param1 == total_size_ && msg.param2 == download_crc_;
+    if (success) {
+        ESP_LOGI(TAG, "✅ Download %lu acknowledged: %lu bytes, CRC32 0x%08lX (%lu chunk notifications)",
+                 download_id_, msg.param1, msg.param2, download_chunks_sent_);
+    } else {
+        ESP_LOGE(TAG, "❌ Download %lu acknowledged with %lu bytes, CRC32 0x%08lX (expected %lu bytes, 0x%08lX)",
+                 download_id_, msg.param1, msg.param2, total_size_, download_crc_);
+    }
+    
+    stop_retransmit_timer();
+    end_download(success);
+    status_ = success ? Status::COMPLETE : Status::ERROR;
+}
+
+bool ImageService::TransferSession::start_download_crc_task() {
+    DownloadCrcJob* job = new DownloadCrcJob{this, epoch_};
+    service_.download_crc_tasks_++;
+    BaseType_t ret = xTaskCreatePinnedToCore(&TransferSession::download_crc_task_entry, "tf_dl_crc",
+                                             DOWNLOAD_CRC_TASK_STACK, job, DOWNLOAD_CRC_TASK_PRIORITY,
+                                             nullptr, tskNO_AFFINITY);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create download CRC task");
+        service_.download_crc_tasks_--;
+        delete job;
+        return false;
+    }
+    return true;
+}
+
+void ImageService::TransferSession::download_crc_task_entry(void* arg) {
+    DownloadCrcJob* job = static_cast<DownloadCrcJob*>(arg);
+    TransferSession* session = job->session;
+    ImageService& service = session->service_;
+    uint32_t epoch = job->epoch;
+    delete job;
+    
+    // Sources are random access and cheap to read (RAM, flash cache); one pass, a slice per
+    // lock, so the BLE stack and the other sessions run in between
+    uint32_t crc = 0;
+    uint32_t offset = 0;
+    TaskHandle_t waiter = nullptr;
+    for (bool running = true; running; taskYIELD()) {
+        StateLock lock(service.state_mutex_);
+        // A reset (disconnect, new request, service shutdown) ended the download and its source
+        if (session->status_ != Status::PREPARING || session->epoch_ != epoch) {
+            running = false;
+        }
+        
+        uint32_t slice_end = offset + DOWNLOAD_CRC_SLICE_SIZE;
+        while (running && offset < session->total_size_ && offset < slice_end) {
+            uint32_t remaining = session->total_size_ - offset;
+            uint32_t len = (remaining < session->chunk_size_) ? remaining : session->chunk_size_;
+            const uint8_t* data = session->download_source_->read(offset, len, session->download_frame_ + DATA_HEADER_SIZE);
+            if (!data) {
+                ESP_LOGE(TAG, "Download source read failed at offset %lu", offset);
+                session->reset_transfer();
+                session->send_transfer_error(ErrorCode::STORAGE_ERROR);
+                session->status_ = Status::ERROR;
+                running = false;
+                break;
+            }
+            crc = esp_rom_crc32_le(crc, data, len);
+            offset += len;
+        }
+        if (running && offset >= session->total_size_) {
+            session->start_download(crc);
+            running = false;
+        }
+        
+        if (!running && --service.download_crc_tasks_ == 0) {
+            waiter = service.download_crc_waiter_;
+        }
+    }
+    
+    // The service may be gone once the waiter runs again
+    if (waiter) {
+        xTaskNotifyGive(waiter);
+    }
+    vTaskDelete(nullptr);
+}
+
+void ImageService::TransferSession::end_download(bool success) {
+    if (!download_source_) {
+        return;
+    }
+    TransferSource* source = download_source_;
+    download_source_ = nullptr;
+    
+    // Drops a notification the scheduler still holds from download_frame_
+    service_.tx_scheduler_.set_data_source(conn_id_, nullptr, nullptr);
+    download_pending_.release();
+    
+    source->end(success);
+    if (service_.download_complete_callback_) {
+        service_.download_complete_callback_(download_id_, source, success);
+    }
+}
+
+void ImageService::TransferSession::handle_download_tick() {
+    // Chunks still pending are waiting for the link, not for the client
+    if (download_pending_.next_set(0) < download_pending_.size()) {
+        return;
+    }
+    
+    int64_t now_us = esp_timer_get_time();
+    if (now_us - download_activity_us_ < static_cast<int64_t>(DOWNLOAD_IDLE_TIMEOUT_MS) * 1000) {
+        return;
+    }
+    
+    ESP_LOGE(TAG, "❌ Download %lu stalled: no acknowledgment %lu ms after the last chunk",
+             download_id_, DOWNLOAD_IDLE_TIMEOUT_MS);
+    stop_retransmit_timer();
+    end_download(false);
+    send_transfer_error(ErrorCode::TRANSFER_TIMEOUT);
+    status_ = Status::ERROR;
+}
+
+bool ImageService::TransferSession::download_data_source(void* ctx, uint16_t conn_id, uint16_t* handle,
+                                                         const uint8_t** data, uint16_t* len) {
+    TransferSession* session = static_cast<TransferSession*>(ctx);
+    if (session->status_ != Status::SENDING || !session->download_source_) {
+        return false;
+    }
+    
+    // Lowest pending chunk from the cursor on, wrapping around for late re-requests
+    uint32_t chunk = session->download_pending_.next_set(session->download_cursor_);
+    if (chunk >= session->download_pending_.size()) {
+        chunk = session->download_pending_.next_set(0);
+        if (chunk >= session->download_pending_.size()) {
+            return false;
+        }
+    }
+    
+    uint32_t offset = chunk * session->chunk_size_;
+    uint32_t payload_len = session->total_size_ - offset;
+    if (payload_len > session->chunk_size_) {
+        payload_len = session->chunk_size_;
+    }
+    uint8_t* payload = session->download_frame_ + DATA_HEADER_SIZE;
+    const uint8_t* source_data = session->download_source_->read(offset, payload_len, payload);
+    if (!source_data) {
+        ESP_LOGE(TAG, "Download source read failed at offset %lu", offset);
+        session->stop_retransmit_timer();
+        session->end_download(false);
+        session->send_transfer_error(ErrorCode::STORAGE_ERROR, offset);
+        session->status_ = Status::ERROR;
+        return false;
+    }
+    if (source_data != payload) {
+        memcpy(payload, source_data, payload_len);  // Header and payload must form one notification
+    }
+    
+    DataChunkHeader header;
+    header.chunk_id = static_cast<uint16_t>(chunk);
+    header.data_length = static_cast<uint16_t>(payload_len);
+    memcpy(session->download_frame_, &header, sizeof(header));
+    
+    session->download_pending_.clear(chunk);
+    session->download_cursor_ = chunk + 1;
+    session->download_chunks_sent_++;
+    session->download_activity_us_ = esp_timer_get_time();
+    
+    *handle = session->service_.data_char_handles_[0];
+    *data = session->download_frame_;
+    *len = static_cast<uint16_t>(DATA_HEADER_SIZE + payload_len);
+    return true;
+}
+
+// ==================== RESUME ====================
+
+bool ImageService::TransferSession::can_suspend_transfer() const {
+    // The CRC identifies the transfer on reconnect, so only CRC-tagged transfers are kept
+    return service_.resume_grace_ms_ > 0 && resume_timer_ && crc_expected_ &&
+           (status_ == Status::REQUESTING_CHUNKS || status_ == Status::RECEIVING);
+}
+
+void ImageService::TransferSession::suspend_transfer() {
+    stop_retransmit_timer();
+    status_ = Status::SUSPENDED;
+    
+    esp_err_t ret = esp_timer_start_once(resume_timer_, static_cast<uint64_t>(service_.resume_grace_ms_) * 1000ULL);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start resume timer: %s", esp_err_to_name(ret));
+        reset_transfer();
+        return;
+    }
+    
+    ESP_LOGI(TAG, "⏸️ Transfer suspended at %lu/%lu chunks - resumable for %lu ms",
+             total_chunks_received_, expected_chunks_, service_.resume_grace_ms_);
+}
+
+bool ImageService::TransferSession::is_resumable(const ControlMessage& msg) const {
+    if (!(msg.reserved[TRANSFER_FLAGS_INDEX] & TRANSFER_FLAG_CRC32)) {
+        return false;
+    }
+    uint32_t crc;
+    memcpy(&crc, msg.reserved, sizeof(crc));
+    return crc == expected_crc_ && msg.param1 == total_size_ && msg.param2 == chunk_size_ &&
+           msg.param3 == expected_chunks_ && msg.reserved[TRANSFER_FLAGS_INDEX] == transfer_flags_;
+}
+
+void ImageService::TransferSession::resume_transfer() {
+    if (esp_timer_is_active(resume_timer_)) {
+        esp_timer_stop(resume_timer_);
+    }
+    
+    // Everything requested but not received is outstanding again
+    uint32_t received_requested = chunk_received_map_.count_set(0, next_request_chunk_);
+    chunks_in_flight_ = next_request_chunk_ - received_requested;
+    round_chunks_received_ = 0;
+    retransmit_attempts_ = 0;
+    metrics_.batch_pending = false;  // Its answer was lost with the connection
+    status_ = Status::RECEIVING;
+    if (service_.adaptive_batching_) {
+        rate_controller_.reset(active_chunks_per_request_, esp_timer_get_time());
+    }
+    
+    ESP_LOGI(TAG, "▶️ Resuming transfer: %lu/%lu chunks already received, %lu requested chunks missing",
+             total_chunks_received_, expected_chunks_, chunks_in_flight_);
+    
+    // Missing ranges first, then continue with unrequested chunks
+    request_missing_chunks();
+    request_next_chunks();
+    
+    if (status_ != Status::ERROR) {
+        last_progress_us_ = esp_timer_get_time();
+        start_retransmit_timer();
+    }
+}
+
+void ImageService::TransferSession::resume_timer_callback(void* arg) {
+    TransferSession* session = static_cast<TransferSession*>(arg);
+    StateLock lock(session->service_.state_mutex_);
+    if (session->status_ == Status::SUSPENDED) {
+        ESP_LOGW(TAG, "Resume grace period expired - discarding interrupted transfer");
+        session->reset_transfer();
+    }
+}
+
+// ==================== STREAMING ====================
+
+bool ImageService::TransferSession::begin_streaming(TransferSink* sink) {
+    reorder_window_chunks_ = service_.reorder_window_chunks_;
+    
+    // One allocation for the chunk slots followed by their lengths
+    size_t slots_size = static_cast<size_t>(reorder_window_chunks_) * chunk_size_;
+    size_t window_bytes = slots_size + reorder_window_chunks_ * sizeof(uint16_t);
+    if (spare_window_ && spare_window_bytes_ >= window_bytes) {
+        // Kept from the previous file of the batch
+        reorder_window_ = spare_window_;
+        reorder_window_bytes_ = spare_window_bytes_;
+        spare_window_ = nullptr;
+        spare_window_bytes_ = 0;
+    } else {
+        if (spare_window_) {
+            heap_caps_free(spare_window_);
+            spare_window_ = nullptr;
+            spare_window_bytes_ = 0;
+        }
+        reorder_window_ = static_cast<uint8_t*>(heap_caps_malloc(window_bytes, MALLOC_CAP_DEFAULT));
+        reorder_window_bytes_ = window_bytes;
+    }
+    if (!reorder_window_) {
+        ESP_LOGE(TAG, "Failed to allocate %d-chunk reorder window", reorder_window_chunks_);
+        send_transfer_error(ErrorCode::MEMORY_ALLOCATION_FAILED);
+        return false;
+    }
+    reorder_lengths_ = reinterpret_cast<uint16_t*>(reorder_window_ + slots_size);
+    stream_next_chunk_ = 0;
+    stream_jpeg_header_ = false;
+    output_offset_ = 0;
+    output_spans_ = 0;
+    output_spans_consumed_ = 0;
+    stream_content_invalid_ = false;
+    
+    if (delta_) {
+        patcher_.begin(service_.base_image_.data(), service_.base_image_.size(), service_.base_crc_);
+    }
+    if (compressed_ && !decompressor_.init()) {
+        release_reorder_window();
+        send_transfer_error(ErrorCode::MEMORY_ALLOCATION_FAILED);
+        return false;
+    }
+    
+    if (!sink) {
+        // Encoded transfer into the RAM buffer
+        ESP_LOGI(TAG, "Decoding %lu bytes into RAM (reorder window %d chunks)", total_size_, reorder_window_chunks_);
+        return true;
+    }
+    
+    if (!sink->begin(total_size_)) {
+        ESP_LOGE(TAG, "Transfer sink rejected %lu byte transfer", total_size_);
+        decompressor_.release();
+        release_reorder_window();
+        send_transfer_error(ErrorCode::STORAGE_ERROR);
+        return false;
+    }
+    
+    active_sink_ = sink;
+    ESP_LOGI(TAG, "Streaming %lu bytes to sink (reorder window %d chunks, %u bytes%s)",
+             total_size_, reorder_window_chunks_, (unsigned)slots_size, compressed_ ? ", LZ4" : "");
+    return true;
+}
+
+void ImageService::TransferSession::end_streaming() {
+    if (active_sink_) {
+        active_sink_->abort();
+        active_sink_ = nullptr;
+    }
+    release_reorder_window();
+    decompressor_.release();
+}
+
+void ImageService::TransferSession::release_reorder_window() {
+    if (!reorder_window_) {
+        return;
+    }
+    if (is_manifest_active() && !spare_window_) {
+        // The next file of the batch most likely needs the same window
+        spare_window_ = reorder_window_;
+        spare_window_bytes_ = reorder_window_bytes_;
+    } else {
+        heap_caps_free(reorder_window_);
+    }
+    reorder_window_ = nullptr;
+    reorder_lengths_ = nullptr;
+    reorder_window_bytes_ = 0;
+}
+
+bool ImageService::TransferSession::store_streamed_chunk(uint16_t chunk_id, ByteSpan payload) {
+    if (chunk_id >= stream_next_chunk_ + reorder_window_chunks_) {
+        // Never requested this far ahead - it will be requested again when the window gets there
+        CHUNK_LOG(TAG, "Chunk %d beyond reorder window (next in-order: %lu) - dropped", chunk_id, stream_next_chunk_);
+        return false;
+    }
+    
+    if (chunk_id != stream_next_chunk_) {
+        // Park the chunk until the gap in front of it is filled - the only copy of a streamed chunk
+        uint16_t slot = chunk_id % reorder_window_chunks_;
+        memcpy(reorder_window_ + slot * chunk_size_, payload.data, payload.size);
+        reorder_lengths_[slot] = static_cast<uint16_t>(payload.size);
+        return true;
+    }
+    
+    // In-order chunk is delivered straight from the write buffer, followed by parked successors
+    if (!deliver_chunk(chunk_id, payload)) {
+        return false;
+    }
+    
+    while (stream_next_chunk_ < expected_chunks_ && chunk_received_map_.test(stream_next_chunk_)) {
+        uint16_t slot = stream_next_chunk_ % reorder_window_chunks_;
+        if (!deliver_chunk(stream_next_chunk_, ByteSpan(reorder_window_ + slot * chunk_size_, reorder_lengths_[slot]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ImageService::TransferSession::deliver_chunk(uint32_t chunk_id, ByteSpan payload) {
+    bool delivered = compressed_
+        ? decompressor_.feed(payload.data, payload.size, &TransferSession::decompressed_output, this)
+        : write_decoded(payload.data, payload.size);
+    if (!delivered) {
+        if ((compressed_ && decompressor_.has_failed()) || (delta_ && patcher_.has_failed())) {
+            stream_content_invalid_ = true;
+        }
+        fail_streaming();
+        return false;
+    }
+    stream_next_chunk_ = chunk_id + 1;
+    return true;
+}
+
+bool ImageService::TransferSession::write_decoded(const uint8_t* data, uint32_t len) {
+    // Decompressed data of a delta transfer is the patch, not the image
+    return delta_ ? patcher_.feed(data, len, &TransferSession::patched_output, this) : write_output(data, len);
+}
+
+bool ImageService::TransferSession::write_output(const uint8_t* data, uint32_t len) {
+    if (len > total_size_ - output_offset_) {
+        ESP_LOGE(TAG, "❌ Data exceeds announced size of %lu bytes", total_size_);
+        stream_content_invalid_ = true;
+        return false;
+    }
+    if (output_offset_ == 0) {
+        stream_jpeg_header_ = (len >= 2 && data[0] == 0xFF && data[1] == 0xD8);
+    }
+    
+    if (active_sink_) {
+        TransferSink::SpanUse use = active_sink_->write_span(output_offset_, ByteSpan(data, len));
+        if (use == TransferSink::SpanUse::FAILED) {
+            return false;
+        }
+        output_spans_++;
+        if (use == TransferSink::SpanUse::CONSUMED) {
+            output_spans_consumed_++;
+        }
+    } else {
+        memcpy(image_buffer_.data() + output_offset_, data, len);
+    }
+    running_crc_ = esp_rom_crc32_le(running_crc_, data, len);
+    output_offset_ += len;
+    return true;
+}
+
+bool ImageService::TransferSession::decompressed_output(void* ctx, const uint8_t* data, uint32_t len) {
+    return static_cast<TransferSession*>(ctx)->write_decoded(data, len);
+}
+
+bool ImageService::TransferSession::patched_output(void* ctx, const uint8_t* data, uint32_t len) {
+    return static_cast<TransferSession*>(ctx)->write_output(data, len);
+}
+
+void ImageService::TransferSession::advance_crc() {
+    // Extend the CRC over the newly contiguous prefix; stops at the first gap
+    while (crc_next_chunk_ < expected_chunks_ && chunk_received_map_.test(crc_next_chunk_)) {
+        uint32_t offset = crc_next_chunk_ * chunk_size_;
+        uint32_t len = (total_size_ - offset < chunk_size_) ? (total_size_ - offset) : chunk_size_;
+        running_crc_ = esp_rom_crc32_le(running_crc_, image_buffer_.data() + offset, len);
+        crc_next_chunk_++;
+    }
+}
+
+void ImageService::TransferSession::report_prefix() {
+    // RAM transfers only: a sink is written in order anyway
+    if (!service_.progress_callback_ || active_sink_ || !image_buffer_) {
+        return;
+    }
+    
+    // Decoded output for encoded transfers, else the chunks covered by the running CRC
+    uint32_t prefix = is_streaming() ? output_offset_ : crc_next_chunk_ * chunk_size_;
+    if (prefix > total_size_) {
+        prefix = total_size_;
+    }
+    if (prefix == prefix_reported_ || (prefix < total_size_ && prefix - prefix_reported_ < service_.progress_step_)) {
+        return;
+    }
+    prefix_reported_ = prefix;
+    service_.progress_callback_(image_buffer_.data(), prefix, total_size_);
+}
+
+void ImageService::TransferSession::report_prefix_abort() {
+    if (prefix_reported_ > 0 && image_buffer_ && service_.progress_callback_) {
+        service_.progress_callback_(nullptr, 0, total_size_);
+    }
+    prefix_reported_ = 0;
+}
+
+void ImageService::TransferSession::fail_streaming() {
+    ESP_LOGE(TAG, "❌ In-order delivery failed at chunk %lu", stream_next_chunk_);
+    bool rejected = stream_content_invalid_ || (active_sink_ && active_sink_->content_rejected());
+    bool base_mismatch = delta_ && patcher_.base_mismatch();
+    stop_retransmit_timer();
+    end_streaming();
+    report_prefix_abort();
+    if (base_mismatch) {
+        // Tell the client which base this device holds so it can send the full image instead
+        send_transfer_error(ErrorCode::BASE_MISMATCH, service_.base_crc_);
+    } else {
+        send_transfer_error(rejected ? ErrorCode::INVALID_CONTENT : ErrorCode::STORAGE_ERROR);
+    }
+    status_ = Status::ERROR;
+}
+
+// ==================== SELECTIVE-REPEAT RETRANSMISSION ====================
+
+void ImageService::TransferSession::retransmit_timer_callback(void* arg) {
+    TransferSession* session = static_cast<TransferSession*>(arg);
+    StateLock lock(session->service_.state_mutex_);
+    session->handle_retransmit_tick();
+    session->update_metrics();
+    session->update_link_mode();
+}
+
+void ImageService::TransferSession::start_retransmit_timer() {
+    if (!retransmit_timer_ || esp_timer_is_active(retransmit_timer_)) {
+        return;
+    }
+    esp_err_t ret = esp_timer_start_periodic(retransmit_timer_, RETRANSMIT_TICK_MS * 1000ULL);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start retransmit timer: %s", esp_err_to_name(ret));
+    }
+}
+
+void ImageService::TransferSession::stop_retransmit_timer() {
+    if (retransmit_timer_ && esp_timer_is_active(retransmit_timer_)) {
+        esp_timer_stop(retransmit_timer_);
+    }
+}
+
+void ImageService::TransferSession::handle_retransmit_tick() {
+    if (status_ == Status::SENDING) {
+        handle_download_tick();
+        return;
+    }
+    if (status_ == Status::BENCHMARKING) {
+        // The client streams without waiting for requests: silence means it is done
+        if (esp_timer_get_time() - last_progress_us_ >= static_cast<int64_t>(BENCHMARK_IDLE_TIMEOUT_MS) * 1000) {
+            finish_benchmark();
+        }
+        return;
+    }
+    if (status_ != Status::REQUESTING_CHUNKS && status_ != Status::RECEIVING) {
+        stop_retransmit_timer();
+        return;
+    }
+    
+    int64_t now_us = esp_timer_get_time();
+    if (now_us - last_progress_us_ < static_cast<int64_t>(RETRANSMIT_TIMEOUT_MS) * 1000) {
+        return;
+    }
+    
+    last_progress_us_ = now_us;
+    retransmit_attempts_++;
+    rate_controller_.on_timeout();
+    metrics_.timeouts++;
+    
+    if (retransmit_attempts_ > MAX_RETRANSMIT_ATTEMPTS) {
+        ESP_LOGE(TAG, "❌ Transfer stalled: no progress after %d retransmission attempts", MAX_RETRANSMIT_ATTEMPTS);
+        stop_retransmit_timer();
+        report_prefix_abort();
+        send_transfer_error(ErrorCode::TRANSFER_TIMEOUT);
+        status_ = Status::ERROR;
+        return;
+    }
+    
+    ESP_LOGW(TAG, "No chunk received for %lu ms (%lu/%lu chunks) - re-requesting missing ranges (attempt %d/%d)",
+             RETRANSMIT_TIMEOUT_MS, total_chunks_received_, expected_chunks_,
+             retransmit_attempts_, MAX_RETRANSMIT_ATTEMPTS);
+    
+    if (request_missing_chunks() == 0) {
+        // Nothing missing in the requested range - make sure the window keeps moving
+        request_next_chunks();
+    }
+}
+
+uint8_t ImageService::TransferSession::request_missing_chunks() {
+    uint8_t requests_sent = 0;
+    uint32_t search_from = 0;
+    uint32_t run_start = 0;
+    uint32_t run_length = 0;
+    
+    // Re-request each run of missing chunks below the requested boundary (word-wise bitmap search)
+    while (requests_sent < MAX_RETRANSMIT_REQUESTS &&
+           chunk_received_map_.find_missing_run(search_from, next_request_chunk_, &run_start, &run_length)) {
+        // One request covers at most 65535 chunks; the rest of the run goes into the next one
+        if (run_length > MAX_CHUNKS_PER_REQUEST) {
+            run_length = MAX_CHUNKS_PER_REQUEST;
+        }
+        if (!send_chunk_request(run_start, run_length)) {
+            ESP_LOGE(TAG, "❌ Failed to send retransmission request");
+            break;
+        }
+        TRANSFER_TRACE(RETRANSMIT_REQUEST, conn_id_, run_start, run_length);
+        metrics_.retransmit_requests++;
+        HOT_PATH_LOG(TAG, "CHUNK_REQUEST (retransmit) sent: chunks %lu-%lu", run_start, run_start + run_length - 1);
+        requests_sent++;
+        search_from = run_start + run_length;
+    }
+    
+    return requests_sent;
+}
+
+bool ImageService::TransferSession::send_control_notification(const ControlMessage& msg) {
+    HOT_PATH_LOG(TAG, "Attempting to send control notification: handle=%d, conn_id=%d, enabled=%d",
+                 service_.control_char_handle_, conn_id_, control_notifications_enabled_);
+    
+    if (service_.control_char_handle_ == 0) {
+        ESP_LOGE(TAG, "Cannot send notification: control characteristic handle not set");
+        metrics_.notification_failures++;
+        return false;
+    }
+    
+    if (!control_notifications_enabled_) {
+        ESP_LOGW(TAG, "Cannot send notification: notifications not enabled by client (control_notify_handle_=%d)", 
+                 service_.control_notify_handle_);
+        metrics_.notification_failures++;
+        return false;
+    }
+    
+    TRANSFER_TRACE(CONTROL_SENT, conn_id_, msg.command, msg.sequence_number);
+    HOT_PATH_LOG(TAG, "Sending control notification: cmd=0x%02X, seq=%d", 
+                 static_cast<uint8_t>(msg.command), msg.sequence_number);
+    
+    // Queued: the scheduler retries while the link is congested and may merge CHUNK_REQUESTs
+    if (!service_.tx_scheduler_.send_control(conn_id_, service_.control_char_handle_,
+                                             reinterpret_cast<const uint8_t*>(&msg), sizeof(msg))) {
+        ESP_LOGE(TAG, "Failed to queue control notification");
+        metrics_.notification_failures++;
+        return false;
+    }
+    
+    return true;
+}
+
+bool ImageService::TransferSession::send_chunk_request(uint32_t start_chunk, uint32_t num_chunks) {
+    CHUNK_LOG(TAG, "=== CHUNK REQUEST ===");
+    CHUNK_LOG(TAG, "Requesting chunks %lu to %lu (%lu chunks total)", 
+             start_chunk, start_chunk + num_chunks - 1, num_chunks);
+    CHUNK_LOG(TAG, "Expected total chunks: %lu", expected_chunks_);
+    
+    ControlMessage msg = {};
+    msg.command = static_cast<uint8_t>(CommandType::CHUNK_REQUEST);
+    msg.sequence_number = ++sequence_number_;
+    msg.param1 = start_chunk;
+    msg.param2 = num_chunks;
+    msg.param3 = (uint32_t)active_chunks_per_request_;  // Current batch/window size
+    
+#ifdef CHUNK_LOGGING
+    // Debug: Log the exact bytes being sent (conditional - performance intensive)
+    CHUNK_LOG(TAG, "📤 CHUNK_REQUEST message details:");
+    CHUNK_LOG(TAG, "   command: 0x%02X", static_cast<uint8_t>(msg.command));
+    CHUNK_LOG(TAG, "   sequence: %d", msg.sequence_number);
+    CHUNK_LOG(TAG, "   param1 (start_chunk): %lu (0x%08lX)", msg.param1, msg.param1);
+    CHUNK_LOG(TAG, "   param2 (num_chunks): %lu (0x%08lX)", msg.param2, msg.param2);
+    CHUNK_LOG(TAG, "   param3 (batch_size): %lu (0x%08lX)", msg.param3, msg.param3);
+    
+    // Debug: Dump the actual message bytes (very expensive - loop with formatting)
+    uint8_t* msg_bytes = (uint8_t*)&msg;
+    CHUNK_LOG(TAG, "📋 Raw message bytes (%d bytes):", sizeof(msg));
+    for (size_t i = 0; i < sizeof(msg); i += 4) {
+        if (i + 3 < sizeof(msg)) {
+            CHUNK_LOG(TAG, "   [%02d-%02d]: 0x%02X 0x%02X 0x%02X 0x%02X", 
+                     i, i+3, msg_bytes[i], msg_bytes[i+1], msg_bytes[i+2], msg_bytes[i+3]);
+        } else {
+            // Handle remaining bytes
+            CHUNK_LOG(TAG, "   [%02d+]: remaining bytes", i);
+        }
+    }
+#endif
+    
+    // Update request tracking
+    current_request_start_ = start_chunk;
+    current_request_end_ = start_chunk + num_chunks - 1;
+    
+    CHUNK_LOG(TAG, "Current request range: %lu - %lu", current_request_start_, current_request_end_);
+    
+    bool success = send_control_notification(msg);
+    if (success) {
+        status_ = Status::REQUESTING_CHUNKS;
+        CHUNK_LOG(TAG, "✅ Chunk request sent successfully");
+    } else {
+        ESP_LOGE(TAG, "❌ Failed to send chunk request");
+    }
+    
+    return success;
+}
+
+bool ImageService::TransferSession::send_transfer_complete_ack(uint32_t received_size, uint32_t crc32) {
+    ControlMessage msg = {};
+    msg.command = static_cast<uint8_t>(CommandType::TRANSFER_COMPLETE_ACK);
+    msg.sequence_number = ++sequence_number_;
+    msg.param1 = received_size;
+    msg.param2 = crc32;
+    msg.param3 = manifest_files_remaining_;  // Batched files still to come (0 = the connection closes)
+    
+    return send_control_notification(msg);
+}
+
+bool ImageService::TransferSession::send_device_info() {
+    ESP_LOGI(TAG, "=== SENDING DEVICE_INFO ===");
+    ESP_LOGI(TAG, "Device type: %d, Battery: %d%%, Display: %dx%d", 
+             service_.device_type_, service_.battery_level_, service_.width_, service_.height_);
+    
+    ControlMessage msg = {};
+    msg.command = static_cast<uint8_t>(CommandType::DEVICE_INFO);
+    msg.sequence_number = ++sequence_number_;
+    
+    // Negotiated link values (zero if the server does not know the connection)
+    TransferTransport::LinkInfo link = {};
+    service_.transport_->get_link_info(conn_id_, &link);
+    
+    // Pack device info into parameters according to specification
+    // Parameter 1: uint8_t device_type, uint8_t battery_level, uint16_t connection interval (1.25ms units)
+    msg.param1 = static_cast<uint32_t>(service_.device_type_) | 
+                 (static_cast<uint32_t>(service_.battery_level_) << 8) | 
+                 (static_cast<uint32_t>(link.interval) << 16);
+    
+    // Parameter 2: uint16_t width, uint16_t height
+    msg.param2 = static_cast<uint32_t>(service_.width_) | 
+                 (static_cast<uint32_t>(service_.height_) << 16);
+    
+    // Parameter 3: uint8_t tx PHY, uint8_t rx PHY, uint16_t LL data length (tx)
+    msg.param3 = static_cast<uint32_t>(link.tx_phy) |
+                 (static_cast<uint32_t>(link.rx_phy) << 8) |
+                 (static_cast<uint32_t>(link.tx_data_length) << 16);
+    
+    // Reserved bytes 0-1: chunk size for TRANSFER_INIT that fits one LL PDU at this MTU
+    uint16_t optimal_chunk_size = get_optimal_chunk_size(false);
+    memcpy(msg.reserved, &optimal_chunk_size, sizeof(optimal_chunk_size));
+    
+    ESP_LOGI(TAG, "DEVICE_INFO message: cmd=0x%02X, seq=%d, p1=0x%08lX, p2=0x%08lX, p3=0x%08lX, chunk size %d (MTU %d)",
+             msg.command, msg.sequence_number, msg.param1, msg.param2, msg.param3, optimal_chunk_size, mtu_);
+    
+    bool success = send_control_notification(msg);
+    if (success) {
+        ESP_LOGI(TAG, "✅ DEVICE_INFO sent successfully");
+    } else {
+        ESP_LOGE(TAG, "❌ DEVICE_INFO send failed");
+    }
+    
+    return success;
+}
+
+bool ImageService::TransferSession::send_transfer_error(ErrorCode error_code, uint32_t error_info) {
+    ControlMessage msg = {};
+    msg.command = static_cast<uint8_t>(CommandType::TRANSFER_ERROR);
+    msg.sequence_number = ++sequence_number_;
+    msg.param1 = static_cast<uint32_t>(error_code);
+    msg.param2 = error_info;
+    msg.param3 = 0;
+    
+    ESP_LOGE(TAG, "Sending TRANSFER_ERROR: code=0x%02X", static_cast<uint32_t>(error_code));
+    TRANSFER_TRACE(TRANSFER_ERROR, conn_id_, static_cast<uint16_t>(error_code), error_info);
+    
+    return send_control_notification(msg);
+}
+
+bool ImageService::TransferSession::is_transfer_complete() const {
+    // Fast implementation using counter instead of array iteration
+    return (total_chunks_received_ >= expected_chunks_) && (expected_chunks_ > 0);
+}
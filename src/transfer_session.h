@@ -0,0 +1,288 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include "image_service.h"
+
+/**
+ * @brief TransferSession - Protocol state of one connection
+ *
+ * ImageService owns a small pool of sessions and routes each client's GATT writes to
+ * the session bound to its conn_id, so several clients can transfer at the same time.
+ * A session holds everything that belongs to one transfer: receive buffer, chunk map,
+ * reorder window, decoder state, request window, sequence number and timers.
+ *
+ * Configuration (flow mode, batch size, sinks, allocator, callbacks) and the delta base
+ * stay with the service and are shared by all sessions. All session methods run with
+ * the service state mutex held.
+ *
+ * Lifecycle:
+ * - bind() on connect, unbind() on disconnect
+ * - A REQUEST_DOWNLOAD turns the session around: it sends a TransferSource to the client
+ *   (status SENDING) until the client acknowledges it or the session is reset
+ * - A MANIFEST keeps the connection (and the chunk map and reorder window storage) across
+ *   the announced number of uploads; unbind() ends the batch
+ * - A BENCHMARK counts and discards the client's chunks (status BENCHMARKING) and reports
+ *   the achieved rate, loss and link parameters
+ * - An interrupted CRC-tagged transfer stays SUSPENDED while unbound; a reconnecting
+ *   client adopts it with adopt_connection() and continues where it stopped
+ */
+class ImageService::TransferSession {
+public:
+    explicit TransferSession(ImageService& service);
+    ~TransferSession();
+    
+    TransferSession(const TransferSession&) = delete;
+    TransferSession& operator=(const TransferSession&) = delete;
+    
+    // Connection binding
+    void bind(uint16_t conn_id);
+    void unbind();
+    bool is_bound() const { return connected_; }
+    bool is_free() const { return !connected_ && status_ != Status::SUSPENDED; }
+    // Take over the connection of a fresh session (the other session is unbound)
+    void adopt_connection(TransferSession& other);
+    
+    uint16_t get_connection_id() const { return conn_id_; }
+    void set_mtu(uint16_t mtu) { mtu_ = mtu; }
+    uint16_t get_mtu() const { return mtu_; }
+    // Largest chunk payload one ATT write/notification can carry at the negotiated MTU
+    uint16_t get_max_chunk_size() const;
+    // Largest chunk payload that also fits one link layer PDU (no L2CAP fragmentation)
+    uint16_t get_optimal_chunk_size(bool server_to_client) const;
+    void set_control_notifications(bool enabled);
+    void set_data_notifications(bool enabled) { data_notifications_enabled_ = enabled; }
+    // Ingest generation this session accepts queued chunks from
+    uint32_t get_epoch() const { return epoch_; }
+    // Negotiated PHY / data length / interval changed: tell an idle client via DEVICE_INFO
+    void on_link_update();
+    
+    // Protocol
+    void reset_transfer();
+    void handle_control_message(const uint8_t* data, uint16_t len);
+    void handle_data_chunk(const uint8_t* data, uint16_t len);
+    
+    // Resume
+    bool can_suspend_transfer() const;
+    void suspend_transfer();
+    bool is_resumable(const ControlMessage& msg) const;
+    void resume_transfer();
+    
+    // Resources held by the running transfer (counted against the session memory budget)
+    uint32_t get_memory_usage() const;
+    bool uses_sink(const TransferSink* sink) const { return active_sink_ && active_sink_ == sink; }
+    bool uses_source(const TransferSource* source) const { return download_source_ && download_source_ == source; }
+    bool is_streaming() const { return reorder_window_ != nullptr; }  // Chunks are delivered in order
+    bool is_patching() const { return delta_ && is_streaming(); }    // Reads the delta base
+    bool is_active() const {                                          // Upload or download running
+        return status_ == Status::INIT_RECEIVED || status_ == Status::REQUESTING_CHUNKS ||
+               status_ == Status::RECEIVING || status_ == Status::SENDING || status_ == Status::BENCHMARKING ||
+               status_ == Status::PREPARING;
+    }
+    void release_image_buffer();
+    
+    // Transfer state
+    Status get_status() const { return status_; }
+    uint32_t get_received_size() const { return received_size_; }
+    uint32_t get_total_size() const { return total_size_; }
+    uint32_t get_expected_chunks() const { return expected_chunks_; }
+    const uint8_t* get_image_buffer() const { return image_buffer_.data(); }
+    const ChunkBitmap& get_chunk_map() const { return chunk_received_map_; }
+    uint32_t get_transfer_crc() const { return running_crc_; }
+    uint32_t get_contiguous_chunks() const {
+        return chunk_received_map_.is_allocated() ? chunk_received_map_.next_missing(0) : 0;
+    }
+    TransferType get_transfer_type() const { return transfer_type_; }
+    uint16_t get_active_chunks_per_request() const { return active_chunks_per_request_; }
+    uint32_t get_chunks_in_flight() const { return chunks_in_flight_; }
+    // Running upload, or the last one of this session
+    const TransferMetrics& get_metrics() const { return metrics_; }
+    
+    // Notifications
+    bool send_control_notification(const ControlMessage& msg);
+    bool send_device_info();
+    bool send_chunk_request(uint32_t start_chunk, uint32_t num_chunks);
+    bool send_transfer_complete_ack(uint32_t received_size, uint32_t crc32);
+    bool send_transfer_error(ErrorCode error_code, uint32_t error_info = 0);
+
+private:
+    ImageService& service_;
+    
+    // Connection state
+    bool connected_;
+    uint16_t conn_id_;
+    uint16_t mtu_;
+    bool control_notifications_enabled_;
+    bool data_notifications_enabled_;
+    uint32_t epoch_;                  // Service ingest generation at the last reset/bind
+    bool link_bulk_;                  // Bulk connection parameters requested through the transport
+    
+    // Protocol state
+    Status status_;
+    uint16_t sequence_number_;
+    
+    // Transfer parameters (from TRANSFER_INIT)
+    uint32_t total_size_;
+    uint32_t chunk_size_;
+    uint32_t expected_chunks_;
+    
+    // Transfer state
+    TransferBuffer image_buffer_;
+    uint32_t received_size_;
+    uint32_t next_expected_chunk_;
+    ChunkBitmap chunk_received_map_;  // Track which chunks have been received (1 bit per chunk)
+    
+    // Streaming state
+    TransferSink* active_sink_;       // Sink of the running transfer: begin() succeeded, no finish()/abort() yet
+    TransferType transfer_type_;
+    uint16_t reorder_window_chunks_;  // Service setting at begin_streaming()
+    uint8_t* reorder_window_;         // reorder_window_chunks_ chunk slots, indexed by chunk_id % window
+    uint16_t* reorder_lengths_;       // Payload length per slot
+    size_t reorder_window_bytes_;     // Allocation size of reorder_window_ (a reused one may be larger)
+    uint32_t stream_next_chunk_;      // First chunk not yet written to the sink
+    bool stream_jpeg_header_;         // JPEG SOI marker seen at the start of the output
+    uint32_t output_offset_;          // In-order delivery: bytes written to the sink or RAM buffer
+    uint32_t output_spans_;           // Sink writes of this transfer
+    uint32_t output_spans_consumed_;  // ... the sink wrote in place without staging a copy
+    bool stream_content_invalid_;     // In-order delivery failed on the data, not the storage
+    
+    // Encoded transfers (TRANSFER_FLAG_LZ4 / TRANSFER_FLAG_DELTA): wire chunks decode to total_size_ bytes
+    uint8_t transfer_flags_;          // TRANSFER_INIT flags byte, identifies the transfer on resume
+    bool compressed_;
+    Lz4BlockDecoder decompressor_;
+    bool delta_;
+    DeltaPatcher patcher_;
+    
+    // Incremental CRC32 (IEEE 802.3, zlib-compatible) over the in-order prefix
+    bool crc_expected_;               // Client sent a CRC in TRANSFER_INIT
+    uint32_t expected_crc_;
+    uint32_t running_crc_;
+    uint32_t crc_next_chunk_;         // RAM mode: first chunk not yet covered by running_crc_
+    uint32_t prefix_reported_;        // In-order bytes last passed to the progress callback
+    
+    // Chunk request state
+    uint32_t current_request_start_;  // First chunk ID in current request
+    uint32_t current_request_end_;    // Last chunk ID in current request
+    uint16_t active_chunks_per_request_; // Batch/window size in use for the current transfer
+    uint32_t next_request_chunk_;     // First chunk ID that has not been requested yet (reaches MAX_CHUNKS)
+    uint32_t chunks_in_flight_;       // Requested chunks that have not arrived yet
+    
+    // Adaptive batch sizing
+    ChunkRateController rate_controller_;
+    uint32_t round_chunks_received_;  // Chunks stored since the last CHUNK_REQUEST that opened a new range
+    
+    // Selective-repeat retransmission state
+    esp_timer_handle_t retransmit_timer_;
+    int64_t last_progress_us_;        // Time of the last stored chunk or chunk request
+    uint8_t retransmit_attempts_;     // Consecutive timeouts without progress
+    
+    // Resume state
+    esp_timer_handle_t resume_timer_;
+    
+    // Download state (total_size_, chunk_size_ and expected_chunks_ describe the download)
+    TransferSource* download_source_; // Source of the running download: begin() succeeded, no end() yet
+    uint32_t download_id_;
+    uint32_t download_crc_;
+    ChunkBitmap download_pending_;    // Chunks still to be sent (initially all, then re-requested ranges)
+    uint32_t download_cursor_;        // Next chunk ID to look at in download_pending_
+    uint32_t download_chunks_sent_;
+    int64_t download_activity_us_;    // Last chunk sent or control message from the client
+    uint8_t download_frame_[MAX_ATT_PAYLOAD]; // Notification being sent: [ChunkID][Length][Payload]
+    
+    // Benchmark state (expected_chunks_, chunk_size_, received_size_, total_chunks_received_
+    // and the chunk map describe the run; no receive buffer is allocated)
+    int64_t benchmark_first_us_;      // First chunk (0 = none yet)
+    int64_t benchmark_last_us_;       // Last new chunk
+    uint32_t benchmark_first_size_;   // Payload of the first chunk, not counted in the rate
+    uint32_t benchmark_duplicates_;
+    uint32_t benchmark_out_of_range_; // Chunk IDs beyond the announced count
+    
+    // Batch state (MANIFEST)
+    uint32_t manifest_files_;         // Announced file count (0 = no batch)
+    uint32_t manifest_files_remaining_; // Files not completed yet - the connection stays open while > 0
+    uint32_t manifest_bytes_;         // Announced total
+    uint32_t manifest_bytes_received_;
+    int64_t manifest_start_us_;
+    uint8_t* spare_window_;           // Reorder window of the previous file, reused by begin_streaming()
+    size_t spare_window_bytes_;
+    
+    // Performance optimization counters
+    uint32_t total_chunks_received_;  // Fast counter instead of array iteration
+    
+    // Instrumentation (STATS)
+    TransferMetrics metrics_;
+    
+    // Protocol message handlers
+    void handle_transfer_init(const ControlMessage& msg);
+    void handle_device_info_request(const ControlMessage& msg);
+    void handle_request_download(const ControlMessage& msg);
+    void handle_download_chunk_request(const ControlMessage& msg);
+    void handle_download_ack(const ControlMessage& msg);
+    void handle_stats_request(const ControlMessage& msg);
+    void handle_benchmark_request(const ControlMessage& msg);
+    void handle_manifest(const ControlMessage& msg);
+    
+    // Helper methods
+    void receive_data_chunk(const uint8_t* data, uint16_t len);
+    void update_link_mode();
+    void update_metrics();
+    void finish_metrics(bool success);
+    bool send_stats_page(const TransferMetrics& metrics, uint8_t page, int64_t now_us);
+    
+    // Benchmark helpers
+    void receive_benchmark_chunk(const uint8_t* data, uint16_t len);
+    void finish_benchmark();
+    bool send_benchmark_page(uint8_t page);
+    
+    // Batch helpers
+    bool is_manifest_active() const { return manifest_files_remaining_ > 0; }
+    void end_manifest();
+    bool validate_jpeg_header() const;
+    bool is_transfer_complete() const;
+    void request_next_chunks();
+    
+    // Streaming helpers
+    bool begin_streaming(TransferSink* sink);
+    void end_streaming();
+    void release_reorder_window();
+    bool store_streamed_chunk(uint16_t chunk_id, ByteSpan payload);
+    void fail_streaming();
+    bool deliver_chunk(uint32_t chunk_id, ByteSpan payload);
+    bool write_decoded(const uint8_t* data, uint32_t len);
+    bool write_output(const uint8_t* data, uint32_t len);
+    static bool decompressed_output(void* ctx, const uint8_t* data, uint32_t len);
+    static bool patched_output(void* ctx, const uint8_t* data, uint32_t len);
+    bool is_encoded() const { return compressed_ || delta_; }
+    void advance_crc();
+    void report_prefix();
+    void report_prefix_abort();
+    
+    // Download helpers
+    struct DownloadCrcJob {
+        TransferSession* session;
+        uint32_t epoch;                   // Session epoch the job was started for
+    };
+    bool start_download_crc_task();
+    static void download_crc_task_entry(void* arg);
+    void start_download(uint32_t crc);
+    void end_download(bool success);
+    void handle_download_tick();
+    static bool download_data_source(void* ctx, uint16_t conn_id, uint16_t* handle, const uint8_t** data, uint16_t* len);
+    
+    // Resume helpers
+    static void resume_timer_callback(void* arg);
+    
+    // Completion helpers
+    void complete_transfer();
+    void disconnect_client();
+    
+    // Retransmission helpers
+    static void retransmit_timer_callback(void* arg);
+    void handle_retransmit_tick();
+    void start_retransmit_timer();
+    void stop_retransmit_timer();
+    uint8_t request_missing_chunks();
+};
@@ -0,0 +1,256 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "transfer_sink.h"
+#include <cstring>
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+
+static const char* TAG = "TransferSink";
+
+constexpr uint32_t BlockSink::DEFAULT_BLOCK_SIZE;
+constexpr uint32_t PartitionSink::ERASE_SIZE;
+constexpr uint32_t FileSink::MAX_PATH_LENGTH;
+
+// ==================== BLOCK SINK ====================
+
+BlockSink::BlockSink(uint32_t block_size)
+    : block_size_(block_size), block_(nullptr), block_fill_(0), block_offset_(0), written_(0), staged_(0) {
+}
+
+BlockSink::~BlockSink() {
+    release_block();
+}
+
+bool BlockSink::begin(uint32_t total_size) {
+    release_block();
+    block_fill_ = 0;
+    block_offset_ = 0;
+    written_ = 0;
+    staged_ = 0;
+    
+    if (block_size_ > 0) {
+        block_ = static_cast<uint8_t*>(heap_caps_malloc(block_size_, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+        if (!block_) {
+            ESP_LOGE(TAG, "Failed to allocate %lu byte block buffer", block_size_);
+            return false;
+        }
+    }
+    
+    if (!on_begin(total_size)) {
+        release_block();
+        return false;
+    }
+    return true;
+}
+
+bool BlockSink::write(uint32_t offset, const uint8_t* data, uint32_t len) {
+    return write_span(offset, ByteSpan(data, len)) != SpanUse::FAILED;
+}
+
+TransferSink::SpanUse BlockSink::write_span(uint32_t offset, ByteSpan data) {
+    if (offset != written_) {
+        ESP_LOGE(TAG, "Non-contiguous write at %lu (expected %lu)", offset, written_);
+        return SpanUse::FAILED;
+    }
+    written_ += data.size;
+    
+    if (block_size_ == 0) {
+        return write_block(offset, data.data, data.size) ? SpanUse::CONSUMED : SpanUse::FAILED;
+    }
+    
+    const uint8_t* src = data.data;
+    uint32_t len = data.size;
+    bool staged = false;
+    while (len > 0) {
+        if (block_fill_ == 0 && len >= block_size_) {
+            // Whole block in the caller's buffer - no need to stage it
+            if (!write_block(block_offset_, src, block_size_)) {
+                return SpanUse::FAILED;
+            }
+            block_offset_ += block_size_;
+            src += block_size_;
+            len -= block_size_;
+            continue;
+        }
+        
+        uint32_t space = block_size_ - block_fill_;
+        uint32_t n = (len < space) ? len : space;
+        memcpy(block_ + block_fill_, src, n);
+        block_fill_ += n;
+        staged_ += n;
+        staged = true;
+        src += n;
+        len -= n;
+        
+        if (block_fill_ == block_size_ && !flush_block()) {
+            return SpanUse::FAILED;
+        }
+    }
+    return staged ? SpanUse::RETAINED : SpanUse::CONSUMED;
+}
+
+bool BlockSink::finish() {
+    bool ok = (block_fill_ == 0) || flush_block();
+    ok = ok && on_finish();
+    release_block();
+    return ok;
+}
+
+void BlockSink::abort() {
+    release_block();
+    on_abort();
+}
+
+bool BlockSink::flush_block() {
+    bool ok = write_block(block_offset_, block_, block_fill_);
+    block_offset_ += block_fill_;
+    block_fill_ = 0;
+    return ok;
+}
+
+void BlockSink::release_block() {
+    if (block_) {
+        heap_caps_free(block_);
+        block_ = nullptr;
+    }
+    block_fill_ = 0;
+}
+
+// ==================== PARTITION SINK ====================
+
+PartitionSink::PartitionSink(const esp_partition_t* partition)
+    : BlockSink(DEFAULT_BLOCK_SIZE), partition_(partition), erased_until_(0) {
+}
+
+const esp_partition_t* PartitionSink::find_data_partition(const char* label) {
+    return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+}
+
+bool PartitionSink::on_begin(uint32_t total_size) {
+    if (!partition_) {
+        ESP_LOGE(TAG, "No partition configured");
+        return false;
+    }
+    if (total_size > partition_->size) {
+        ESP_LOGE(TAG, "Transfer of %lu bytes exceeds partition '%s' (%lu bytes)",
+                 total_size, partition_->label, partition_->size);
+        return false;
+    }
+    erased_until_ = 0;
+    return true;
+}
+
+bool PartitionSink::write_block(uint32_t offset, const uint8_t* data, uint32_t len) {
+    // Erase ahead so each block write lands on erased flash
+    while (erased_until_ < offset + len) {
+        uint32_t erase_len = partition_->size - erased_until_;
+        if (erase_len > ERASE_SIZE) {
+            erase_len = ERASE_SIZE;
+        }
+        esp_err_t ret = esp_partition_erase_range(partition_, erased_until_, erase_len);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Erase at 0x%lx failed: %s", erased_until_, esp_err_to_name(ret));
+            return false;
+        }
+        erased_until_ += erase_len;
+    }
+    
+    esp_err_t ret = esp_partition_write(partition_, offset, data, len);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Write at 0x%lx (%lu bytes) failed: %s", offset, len, esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
+
+// ==================== FILE SINK ====================
+
+FileSink::FileSink(const char* path, uint32_t block_size)
+    : BlockSink(block_size), file_(nullptr) {
+    snprintf(path_, sizeof(path_), "%s", path);
+    snprintf(temp_path_, sizeof(temp_path_), "%s.part", path_);
+}
+
+FileSink::~FileSink() {
+    close_file();
+}
+
+bool FileSink::on_begin(uint32_t total_size) {
+    close_file();
+    file_ = fopen(temp_path_, "wb");
+    if (!file_) {
+        ESP_LOGE(TAG, "Failed to open %s", temp_path_);
+        return false;
+    }
+    // Blocks are already coalesced - bypass stdio buffering
+    setvbuf(file_, nullptr, _IONBF, 0);
+    return true;
+}
+
+bool FileSink::write_block(uint32_t offset, const uint8_t* data, uint32_t len) {
+    if (fwrite(data, 1, len, file_) != len) {
+        ESP_LOGE(TAG, "Write to %s failed at offset %lu", temp_path_, offset);
+        return false;
+    }
+    return true;
+}
+
+bool FileSink::on_finish() {
+    bool ok = (fclose(file_) == 0);
+    file_ = nullptr;
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to close %s", temp_path_);
+        remove(temp_path_);
+        return false;
+    }
+    
+    remove(path_);  // rename() does not replace existing files on every VFS
+    if (rename(temp_path_, path_) != 0) {
+        ESP_LOGE(TAG, "Failed to rename %s to %s", temp_path_, path_);
+        return false;
+    }
+    return true;
+}
+
+void FileSink::on_abort() {
+    close_file();
+    remove(temp_path_);
+}
+
+void FileSink::close_file() {
+    if (file_) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+// ==================== CALLBACK SINK ====================
+
+CallbackSink::CallbackSink(WriteCallback write_cb, void* context, uint32_t block_size,
+                           BeginCallback begin_cb, EndCallback end_cb)
+    : BlockSink(block_size), write_cb_(write_cb), begin_cb_(begin_cb), end_cb_(end_cb), context_(context) {
+}
+
+bool CallbackSink::on_begin(uint32_t total_size) {
+    return write_cb_ && (!begin_cb_ || begin_cb_(context_, total_size));
+}
+
+bool CallbackSink::write_block(uint32_t offset, const uint8_t* data, uint32_t len) {
+    return write_cb_(context_, offset, data, len);
+}
+
+bool CallbackSink::on_finish() {
+    if (end_cb_) {
+        end_cb_(context_, true);
+    }
+    return true;
+}
+
+void CallbackSink::on_abort() {
+    if (end_cb_) {
+        end_cb_(context_, false);
+    }
+}
@@ -0,0 +1,184 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "byte_span.h"
+
+/**
+ * @brief TransferSink - Destination for streamed transfers
+ * 
+ * ImageService reorders incoming chunks and calls write() only with in-order,
+ * contiguous data (offset always equals the number of bytes written so far), so
+ * a sink never has to buffer the whole transfer.
+ * 
+ * Data reaches the sink through write_span() as a view into the buffer it arrived in
+ * (the BLE stack's write buffer, a reorder slot or the decoder window), valid only for
+ * the duration of the call. The sink either consumes the bytes before returning or
+ * copies what it still needs and reports them as retained; it never keeps the pointer.
+ * 
+ * Call sequence: begin() → write_span()* → finish(), or abort() at any point after begin().
+ */
+class TransferSink {
+public:
+    // What write_span() did with the span
+    enum class SpanUse : uint8_t {
+        CONSUMED,   // Written out in place; no byte was copied
+        RETAINED,   // Accepted, at least part of it copied into the sink's own buffer
+        FAILED,
+    };
+    
+    virtual ~TransferSink() = default;
+    
+    // New transfer of total_size bytes; return false to reject it
+    virtual bool begin(uint32_t total_size) = 0;
+    // Contiguous data starting at offset
+    virtual bool write(uint32_t offset, const uint8_t* data, uint32_t len) = 0;
+    // Contiguous data starting at offset; the span is only valid during the call.
+    // Sinks that can write from the caller's buffer override this and report CONSUMED.
+    virtual SpanUse write_span(uint32_t offset, ByteSpan data) {
+        return write(offset, data.data, data.size) ? SpanUse::RETAINED : SpanUse::FAILED;
+    }
+    // All data written - flush anything still buffered
+    virtual bool finish() = 0;
+    // Transfer aborted (error, disconnect, new TRANSFER_INIT)
+    virtual void abort() = 0;
+    
+    // Largest transfer the sink can store
+    virtual uint32_t max_size() const { return UINT32_MAX; }
+    
+    // True if the last failure was caused by the data itself (e.g. an invalid firmware
+    // image) rather than by the storage backend
+    virtual bool content_rejected() const { return false; }
+};
+
+/**
+ * @brief BlockSink - Coalesces the contiguous stream into fixed-size block writes
+ * 
+ * Chunks (~500 bytes) are gathered into block_size buffers so the backend only sees
+ * aligned writes of full blocks (plus one partial block at the end). Only the bytes
+ * that do not complete a block are staged: whole blocks inside a span (e.g. decoder
+ * output) are written straight from the caller's buffer. A block_size of 0 passes
+ * writes straight through.
+ */
+class BlockSink : public TransferSink {
+public:
+    static constexpr uint32_t DEFAULT_BLOCK_SIZE = 4096;  // One flash sector
+    
+    explicit BlockSink(uint32_t block_size = DEFAULT_BLOCK_SIZE);
+    ~BlockSink() override;
+    
+    BlockSink(const BlockSink&) = delete;
+    BlockSink& operator=(const BlockSink&) = delete;
+    
+    bool begin(uint32_t total_size) override;
+    bool write(uint32_t offset, const uint8_t* data, uint32_t len) override;
+    SpanUse write_span(uint32_t offset, ByteSpan data) override;
+    bool finish() override;
+    void abort() override;
+    
+    uint32_t get_bytes_written() const { return written_; }
+    // Bytes copied into the block buffer (the rest went to write_block() in place)
+    uint32_t get_bytes_staged() const { return staged_; }
+    
+protected:
+    virtual bool on_begin(uint32_t total_size) = 0;
+    virtual bool write_block(uint32_t offset, const uint8_t* data, uint32_t len) = 0;
+    virtual bool on_finish() { return true; }
+    virtual void on_abort() {}
+    
+private:
+    uint32_t block_size_;
+    uint8_t* block_;
+    uint32_t block_fill_;
+    uint32_t block_offset_;   // Stream offset of block_[0]
+    uint32_t written_;        // Bytes accepted through write()
+    uint32_t staged_;         // Bytes copied into block_
+    
+    bool flush_block();
+    void release_block();
+};
+
+/**
+ * @brief PartitionSink - Streams into a raw flash partition (e.g. the "storage" partition)
+ * 
+ * Erases ahead in ERASE_SIZE steps and writes whole sectors.
+ */
+class PartitionSink : public BlockSink {
+public:
+    static constexpr uint32_t ERASE_SIZE = 64 * 1024;  // Block erase is much faster per byte than sector erase
+    
+    explicit PartitionSink(const esp_partition_t* partition);
+    
+    // First data partition with the given label, or nullptr
+    static const esp_partition_t* find_data_partition(const char* label);
+    
+    uint32_t max_size() const override { return partition_ ? partition_->size : 0; }
+    const esp_partition_t* get_partition() const { return partition_; }
+    
+protected:
+    bool on_begin(uint32_t total_size) override;
+    bool write_block(uint32_t offset, const uint8_t* data, uint32_t len) override;
+    
+private:
+    const esp_partition_t* partition_;
+    uint32_t erased_until_;
+};
+
+/**
+ * @brief FileSink - Streams into a file on a mounted VFS (SPIFFS, LittleFS, FAT)
+ * 
+ * The file is written under path + ".part" and renamed on finish(), so an aborted
+ * transfer never replaces a complete file.
+ */
+class FileSink : public BlockSink {
+public:
+    static constexpr uint32_t MAX_PATH_LENGTH = 64;
+    
+    explicit FileSink(const char* path, uint32_t block_size = DEFAULT_BLOCK_SIZE);
+    ~FileSink() override;
+    
+protected:
+    bool on_begin(uint32_t total_size) override;
+    bool write_block(uint32_t offset, const uint8_t* data, uint32_t len) override;
+    bool on_finish() override;
+    void on_abort() override;
+    
+private:
+    char path_[MAX_PATH_LENGTH];
+    char temp_path_[MAX_PATH_LENGTH + 5];
+    FILE* file_;
+    
+    void close_file();
+};
+
+/**
+ * @brief CallbackSink - Forwards coalesced blocks to a user stream
+ */
+class CallbackSink : public BlockSink {
+public:
+    typedef bool (*BeginCallback)(void* context, uint32_t total_size);
+    typedef bool (*WriteCallback)(void* context, uint32_t offset, const uint8_t* data, uint32_t len);
+    typedef void (*EndCallback)(void* context, bool success);
+    
+    CallbackSink(WriteCallback write_cb, void* context, uint32_t block_size = DEFAULT_BLOCK_SIZE,
+                 BeginCallback begin_cb = nullptr, EndCallback end_cb = nullptr);
+    
+protected:
+    bool on_begin(uint32_t total_size) override;
+    bool write_block(uint32_t offset, const uint8_t* data, uint32_t len) override;
+    bool on_finish() override;
+    void on_abort() override;
+    
+private:
+    WriteCallback write_cb_;
+    BeginCallback begin_cb_;
+    EndCallback end_cb_;
+    void* context_;
+};
@@ -0,0 +1,87 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "transfer_source.h"
+#include "esp_log.h"
+
+static const char* TAG = "TransferSource";
+
+// ==================== BUFFER SOURCE ====================
+
+const uint8_t* BufferSource::read(uint32_t offset, uint32_t len, uint8_t* scratch) {
+    if (!data_ || offset > size_ || len > size_ - offset) {
+        return nullptr;
+    }
+    return data_ + offset;
+}
+
+// ==================== PARTITION SOURCE ====================
+
+PartitionSource::PartitionSource(const esp_partition_t* partition, uint32_t offset, uint32_t size)
+    : partition_(partition), offset_(offset), size_(size), mapped_(nullptr), mmap_handle_(0) {
+    set_range(offset, size);
+}
+
+PartitionSource::~PartitionSource() {
+    unmap();
+}
+
+void PartitionSource::set_range(uint32_t offset, uint32_t size) {
+    offset_ = offset;
+    size_ = size;
+    clear_crc32();
+    if (partition_ && size_ == 0 && offset_ < partition_->size) {
+        size_ = partition_->size - offset_;
+    }
+}
+
+bool PartitionSource::begin() {
+    unmap();
+    if (!partition_) {
+        ESP_LOGE(TAG, "No partition configured");
+        return false;
+    }
+    if (offset_ > partition_->size || size_ > partition_->size - offset_) {
+        ESP_LOGE(TAG, "Range 0x%lx+%lu exceeds partition '%s' (%lu bytes)",
+                 offset_, size_, partition_->label, partition_->size);
+        return false;
+    }
+    
+    const void* ptr = nullptr;
+    esp_err_t ret = esp_partition_mmap(partition_, offset_, size_, ESP_PARTITION_MMAP_DATA, &ptr, &mmap_handle_);
+    if (ret == ESP_OK) {
+        mapped_ = static_cast<const uint8_t*>(ptr);
+    } else {
+        ESP_LOGW(TAG, "Mapping partition '%s' failed (%s) - reading chunk by chunk",
+                 partition_->label, esp_err_to_name(ret));
+    }
+    return true;
+}
+
+const uint8_t* PartitionSource::read(uint32_t offset, uint32_t len, uint8_t* scratch) {
+    if (offset > size_ || len > size_ - offset) {
+        return nullptr;
+    }
+    if (mapped_) {
+        return mapped_ + offset;
+    }
+    esp_err_t ret = esp_partition_read(partition_, offset_ + offset, scratch, len);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Read at 0x%lx failed: %s", offset_ + offset, esp_err_to_name(ret));
+        return nullptr;
+    }
+    return scratch;
+}
+
+void PartitionSource::end(bool success) {
+    unmap();
+}
+
+void PartitionSource::unmap() {
+    if (mapped_) {
+        esp_partition_munmap(mmap_handle_);
+        mapped_ = nullptr;
+    }
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <cstdint>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+/**
+ * @brief TransferSource - Origin of a download (server → client transfer)
+ *
+ * ImageService reads the download chunk by chunk while it sends, in any order (the
+ * client may re-request ranges), so a source never has to stage the whole file.
+ * read() fills 'scratch', which is the notification frame right behind the chunk header,
+ * or returns a pointer into the source's own memory where it has one (RAM buffer,
+ * memory-mapped flash). A notification is one contiguous buffer, so such a payload is
+ * copied once behind the header; a full-file staging copy is never made.
+ *
+ * Call sequence: begin() → read()* → end().
+ *
+ * TRANSFER_INIT announces the CRC32 of the whole download. A source that knows it
+ * (stored with the data, computed when it was written) passes it with set_crc32();
+ * otherwise ImageService computes it on a worker task before the download starts.
+ */
+class TransferSource {
+public:
+    virtual ~TransferSource() = default;
+    
+    // Download starting; return false to reject it
+    virtual bool begin() { return true; }
+    // Total size in bytes (valid after begin())
+    virtual uint32_t size() const = 0;
+    // len bytes at offset: a pointer into the source, or 'scratch' (at least len bytes) filled
+    // with the data. Valid until the next read() or end(); nullptr on a read error.
+    virtual const uint8_t* read(uint32_t offset, uint32_t len, uint8_t* scratch) = 0;
+    // Download finished (success = client acknowledged size and CRC) or aborted
+    virtual void end(bool success) {}
+    
+    // Precomputed CRC32 of the whole download (cleared when the range or buffer changes)
+    void set_crc32(uint32_t crc) { crc_ = crc; crc_known_ = true; }
+    void clear_crc32() { crc_known_ = false; }
+    bool get_crc32(uint32_t* crc) const {
+        if (crc_known_) {
+            *crc = crc_;
+        }
+        return crc_known_;
+    }
+
+private:
+    uint32_t crc_ = 0;
+    bool crc_known_ = false;
+};
+
+/**
+ * @brief BufferSource - Serves a download from memory (e.g. a camera frame buffer)
+ *
+ * The buffer is not copied and must stay unchanged until end().
+ */
+class BufferSource : public TransferSource {
+public:
+    BufferSource(const uint8_t* data = nullptr, uint32_t size = 0) : data_(data), size_(size) {}
+    
+    void set_buffer(const uint8_t* data, uint32_t size) { data_ = data; size_ = size; clear_crc32(); }
+    
+    bool begin() override { return data_ != nullptr; }
+    uint32_t size() const override { return size_; }
+    const uint8_t* read(uint32_t offset, uint32_t len, uint8_t* scratch) override;
+
+private:
+    const uint8_t* data_;
+    uint32_t size_;
+};
+
+/**
+ * @brief PartitionSource - Serves a download from a raw flash partition (e.g. stored logs)
+ *
+ * The range is memory-mapped for the duration of the download, so chunks are read
+ * straight from the flash cache; if the mapping fails, chunks are read with
+ * esp_partition_read() instead.
+ */
+class PartitionSource : public TransferSource {
+public:
+    // size 0 = up to the end of the partition
+    explicit PartitionSource(const esp_partition_t* partition, uint32_t offset = 0, uint32_t size = 0);
+    ~PartitionSource() override;
+    
+    PartitionSource(const PartitionSource&) = delete;
+    PartitionSource& operator=(const PartitionSource&) = delete;
+    
+    // Range of the next download (e.g. the used part of a log partition)
+    void set_range(uint32_t offset, uint32_t size);
+    
+    bool begin() override;
+    uint32_t size() const override { return size_; }
+    const uint8_t* read(uint32_t offset, uint32_t len, uint8_t* scratch) override;
+    void end(bool success) override;
+
+private:
+    const esp_partition_t* partition_;
+    uint32_t offset_;
+    uint32_t size_;
+    const uint8_t* mapped_;
+    esp_partition_mmap_handle_t mmap_handle_;
+    
+    void unmap();
+};
@@ -0,0 +1,33 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "transfer_transport.h"
+
+esp_err_t GattsTransport::notify(uint16_t conn_id, uint16_t handle, const uint8_t* data, uint16_t len) {
+    if (gatts_if_ == ESP_GATT_IF_NONE) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return esp_ble_gatts_send_indicate(gatts_if_, conn_id, handle, len, const_cast<uint8_t*>(data),
+                                       false);  // Notification, not indication
+}
+
+esp_err_t GattsTransport::close(uint16_t conn_id) {
+    if (gatts_if_ == ESP_GATT_IF_NONE) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return esp_ble_gatts_close(gatts_if_, conn_id);
+}
+
+bool GattsTransport::get_link_info(uint16_t conn_id, LinkInfo* info) const {
+    return link_control_ && link_control_->get_link_info(conn_id, info);
+}
+
+esp_err_t GattsTransport::set_link_mode(uint16_t conn_id, LinkMode mode) {
+    return link_control_ ? link_control_->set_link_mode(conn_id, mode) : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t GattsTransport::restart_advertising(bool fast) {
+    return link_control_ ? link_control_->restart_advertising(fast) : ESP_ERR_INVALID_STATE;
+}
@@ -0,0 +1,99 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+#include <cstdint>
+#include "esp_err.h"
+#include "esp_gatts_api.h"
+
+/**
+ * @brief LinkControl - Link layer of the local BLE stack (implemented by BLEServer)
+ *
+ * Negotiated PHY, data length and connection parameters per connection, the switch
+ * between the bulk and idle connection parameters, and advertising. GattsTransport
+ * forwards its link queries here, so the transfer engine never calls BLEServer itself.
+ */
+class LinkControl {
+public:
+    enum class LinkMode {
+        BULK = 0,
+        IDLE = 1
+    };
+    
+    // Negotiated state of a connection
+    struct LinkInfo {
+        uint8_t tx_phy;             // 1 = 1M, 2 = 2M, 3 = Coded
+        uint8_t rx_phy;
+        uint16_t tx_data_length;    // LL PDU payload
+        uint16_t rx_data_length;
+        uint16_t interval;          // 1.25ms units
+        uint16_t latency;
+        uint16_t timeout;           // 10ms units
+        LinkMode mode;              // Parameter set requested last
+        bool encrypted;             // Paired or re-encrypted with a stored bond
+    };
+    
+    virtual ~LinkControl() = default;
+    
+    // Request the bulk or idle connection parameters for a connection
+    virtual esp_err_t set_link_mode(uint16_t conn_id, LinkMode mode) = 0;
+    // Negotiated PHY, data length and interval; false if conn_id is not connected
+    virtual bool get_link_info(uint16_t conn_id, LinkInfo* info) const = 0;
+    // Advertise again (fast: start with a short fast-advertising burst)
+    virtual esp_err_t restart_advertising(bool fast) = 0;
+};
+
+/**
+ * @brief TransferTransport - Outgoing side of the link the protocol engine talks over
+ *
+ * Everything ImageService sends to a client (control and data notifications, closing
+ * the connection) and everything it asks about the link (data length, connection
+ * parameters, advertising) goes through this interface, so the transfer engine is not
+ * tied to Bluedroid. GattsTransport is the default; a loopback implementation can replay a
+ * client in-process (together with the ImageService::on_client_*() entry points).
+ *
+ * Methods are called with the service state mutex held and must not block.
+ */
+class TransferTransport {
+public:
+    using LinkMode = LinkControl::LinkMode;
+    using LinkInfo = LinkControl::LinkInfo;
+    
+    virtual ~TransferTransport() = default;
+    
+    // Send one notification. An error leaves it queued: the scheduler retries it later.
+    virtual esp_err_t notify(uint16_t conn_id, uint16_t handle, const uint8_t* data, uint16_t len) = 0;
+    // Disconnect the client (the disconnect is reported back through the normal path)
+    virtual esp_err_t close(uint16_t conn_id) = 0;
+    
+    // Link queries: a transport without a link layer keeps the defaults (chunks are then
+    // sized from the ATT MTU alone)
+    virtual bool get_link_info(uint16_t conn_id, LinkInfo* info) const { return false; }
+    virtual esp_err_t set_link_mode(uint16_t conn_id, LinkMode mode) { return ESP_ERR_NOT_SUPPORTED; }
+    virtual esp_err_t restart_advertising(bool fast) { return ESP_ERR_NOT_SUPPORTED; }
+};
+
+/**
+ * @brief GattsTransport - TransferTransport over the Bluedroid GATT server
+ */
+class GattsTransport : public TransferTransport {
+public:
+    GattsTransport() : gatts_if_(ESP_GATT_IF_NONE), link_control_(nullptr) {}
+    
+    void set_gatts_if(esp_gatt_if_t gatts_if) { gatts_if_ = gatts_if; }
+    // Link queries are answered by the server the service was added to (nullptr = none)
+    void set_link_control(LinkControl* link_control) { link_control_ = link_control; }
+    
+    esp_err_t notify(uint16_t conn_id, uint16_t handle, const uint8_t* data, uint16_t len) override;
+    esp_err_t close(uint16_t conn_id) override;
+    bool get_link_info(uint16_t conn_id, LinkInfo* info) const override;
+    esp_err_t set_link_mode(uint16_t conn_id, LinkMode mode) override;
+    esp_err_t restart_advertising(bool fast) override;
+
+private:
+    esp_gatt_if_t gatts_if_;
+    LinkControl* link_control_;
+};
@@ -0,0 +1,607 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#include "host_idf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ==================== ERRORS AND LOGGING ====================
+
+static std::atomic<int> log_level(-1);
+
+const char* esp_err_to_name(esp_err_t code) {
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    default: return "ESP_ERR_UNKNOWN";
+    }
+}
+
+void host_log_set_level(esp_log_level_t level) {
+    log_level.store(level);
+}
+
+void host_log(esp_log_level_t level, const char* tag, const char* format, ...) {
+    if (log_level.load() < 0) {
+        const char* env = getenv("TINYFLOW_HOST_LOG");
+        log_level.store(env ? atoi(env) : ESP_LOG_WARN);
+    }
+    if (level > log_level.load()) {
+        return;
+    }
+    
+    // The component formats uint32_t with %lu (unsigned long on Xtensa/RISC-V)
+    std::string host_format;
+    for (const char* p = format; *p; p++) {
+        host_format += *p;
+        if (*p != '%') {
+            continue;
+        }
+        for (p++; *p && strchr("-+ #0123456789.", *p); p++) {
+            host_format += *p;
+        }
+        if (*p == 'l' && p[1] != 'l') {
+            p++;
+        } else if (*p == 'l') {
+            host_format += *p++;
+            host_format += *p++;
+        }
+        if (!*p) {
+            break;
+        }
+        host_format += *p;
+    }
+    
+    static const char letters[] = "NEWIDV";
+    static std::mutex output_mutex;
+    std::lock_guard<std::mutex> guard(output_mutex);
+    fprintf(stderr, "%c (%lld) %s: ", letters[level], static_cast<long long>(esp_timer_get_time() / 1000), tag);
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, host_format.c_str(), args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+// ==================== HEAP ====================
+
+static constexpr size_t HOST_HEAP_SIZE = 8 * 1024 * 1024;  // Reported free heap (PSRAM-sized)
+static std::atomic<uint32_t> host_heap_allocation_count{0};
+
+void* heap_caps_malloc(size_t size, uint32_t caps) {
+    host_heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size);
+}
+
+void* heap_caps_calloc(size_t count, size_t size, uint32_t caps) {
+    host_heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return calloc(count, size);
+}
+
+void heap_caps_free(void* ptr) {
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    return HOST_HEAP_SIZE;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    return HOST_HEAP_SIZE;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    return HOST_HEAP_SIZE;
+}
+
+uint32_t host_heap_allocations(void) {
+    return host_heap_allocation_count.load(std::memory_order_relaxed);
+}
+
+// ==================== TIMER ====================
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    bool active;
+    int64_t expiry_us;
+    uint64_t period_us;   // 0 = one-shot
+    uint64_t sequence;    // Start order, keeps timers due at the same time in order
+};
+
+static std::mutex timer_mutex;
+static std::vector<esp_timer*> timers;
+static std::atomic<int64_t> now_us(1000000);
+static uint64_t timer_sequence = 0;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle) {
+    if (!args || !args->callback || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_timer* timer = new esp_timer{args->callback, args->arg, false, 0, 0, 0};
+    std::lock_guard<std::mutex> guard(timer_mutex);
+    timers.push_back(timer);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t start_timer(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us) {
+    std::lock_guard<std::mutex> guard(timer_mutex);
+    if (!timer || timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->active = true;
+    timer->expiry_us = now_us.load() + static_cast<int64_t>(timeout_us);
+    timer->period_us = period_us;
+    timer->sequence = timer_sequence++;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return start_timer(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    return start_timer(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    std::lock_guard<std::mutex> guard(timer_mutex);
+    if (!timer || !timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->active = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    std::lock_guard<std::mutex> guard(timer_mutex);
+    auto it = std::find(timers.begin(), timers.end(), timer);
+    if (it == timers.end()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    timers.erase(it);
+    delete timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+    std::lock_guard<std::mutex> guard(timer_mutex);
+    return timer && timer->active;
+}
+
+int64_t esp_timer_get_time(void) {
+    return now_us.load();
+}
+
+void host_advance_time_us(int64_t us) {
+    int64_t target = now_us.load() + us;
+    for (;;) {
+        esp_timer_cb_t callback = nullptr;
+        void* arg = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(timer_mutex);
+            esp_timer* next = nullptr;
+            for (esp_timer* timer : timers) {
+                if (timer->active && timer->expiry_us <= target &&
+                    (!next || timer->expiry_us < next->expiry_us ||
+                     (timer->expiry_us == next->expiry_us && timer->sequence < next->sequence))) {
+                    next = timer;
+                }
+            }
+            if (!next) {
+                break;
+            }
+            now_us.store(std::max(now_us.load(), next->expiry_us));
+            if (next->period_us > 0) {
+                next->expiry_us += static_cast<int64_t>(next->period_us);
+                next->sequence = timer_sequence++;
+            } else {
+                next->active = false;
+            }
+            callback = next->callback;
+            arg = next->arg;
+        }
+        // Like the esp_timer task: callbacks run without the timer lock and may restart timers
+        callback(arg);
+    }
+    now_us.store(target);
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const* buf, uint32_t len) {
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+// ==================== FREERTOS ====================
+
+namespace {
+
+struct HostTask {
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t notifications = 0;
+};
+
+struct HostSemaphore {
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t count;
+    explicit HostSemaphore(uint32_t initial) : count(initial) {}
+};
+
+struct HostQueue {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>> items;
+    size_t length;
+    size_t item_size;
+};
+
+thread_local HostTask* current_task = nullptr;
+
+// portMAX_DELAY waits forever, everything else in 1 ms ticks
+template <typename Predicate>
+bool wait_for(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TickType_t ticks, Predicate ready) {
+    if (ticks == portMAX_DELAY) {
+        cv.wait(lock, ready);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+}
+
+}  // namespace
+
+BaseType_t xTaskCreatePinnedToCore(void (*function)(void*), const char* name, uint32_t stack_size,
+                                   void* arg, UBaseType_t priority, TaskHandle_t* out_handle,
+                                   BaseType_t core_id) {
+    // Tasks are never freed: a late xTaskNotifyGive() to a finished task stays harmless
+    HostTask* task = new HostTask();
+    if (out_handle) {
+        *out_handle = task;
+    }
+    std::thread([task, function, arg]() {
+        current_task = task;
+        function(arg);
+    }).detach();
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    // The task function returns right after vTaskDelete(nullptr), which ends the thread
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+void host_task_yield(void) {
+    std::this_thread::yield();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    if (!current_task) {
+        current_task = new HostTask();  // Test thread
+    }
+    return current_task;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+    HostTask* task = static_cast<HostTask*>(xTaskGetCurrentTaskHandle());
+    std::unique_lock<std::mutex> lock(task->mutex);
+    if (!wait_for(task->cv, lock, ticks, [task] { return task->notifications > 0; })) {
+        return 0;
+    }
+    uint32_t value = task->notifications;
+    task->notifications = clear_on_exit ? 0 : value - 1;
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle) {
+    HostTask* task = static_cast<HostTask*>(handle);
+    if (!task) {
+        return pdFAIL;
+    }
+    {
+        std::lock_guard<std::mutex> guard(task->mutex);
+        task->notifications++;
+    }
+    task->cv.notify_all();
+    return pdPASS;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    HostQueue* queue = new HostQueue();
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void* item, TickType_t ticks) {
+    HostQueue* queue = static_cast<HostQueue*>(handle);
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!wait_for(queue->cv, lock, ticks, [queue] { return queue->items.size() < queue->length; })) {
+        return pdFAIL;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(item);
+    queue->items.emplace_back(bytes, bytes + queue->item_size);
+    lock.unlock();
+    queue->cv.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void* item, TickType_t ticks) {
+    HostQueue* queue = static_cast<HostQueue*>(handle);
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!wait_for(queue->cv, lock, ticks, [queue] { return !queue->items.empty(); })) {
+        return pdFAIL;
+    }
+    memcpy(item, queue->items.front().data(), queue->item_size);
+    queue->items.pop_front();
+    lock.unlock();
+    queue->cv.notify_all();
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t handle) {
+    HostQueue* queue = static_cast<HostQueue*>(handle);
+    std::lock_guard<std::mutex> guard(queue->mutex);
+    return static_cast<UBaseType_t>(queue->items.size());
+}
+
+void vQueueDelete(QueueHandle_t handle) {
+    delete static_cast<HostQueue*>(handle);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return new HostSemaphore(1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return new HostSemaphore(0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t ticks) {
+    HostSemaphore* semaphore = static_cast<HostSemaphore*>(handle);
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    if (!wait_for(semaphore->cv, lock, ticks, [semaphore] { return semaphore->count > 0; })) {
+        return pdFAIL;
+    }
+    semaphore->count--;
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t handle) {
+    HostSemaphore* semaphore = static_cast<HostSemaphore*>(handle);
+    {
+        std::lock_guard<std::mutex> guard(semaphore->mutex);
+        if (semaphore->count > 0) {
+            return pdFAIL;  // Binary semaphore / mutex already available
+        }
+        semaphore->count++;
+    }
+    semaphore->cv.notify_one();
+    return pdPASS;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t handle) {
+    delete static_cast<HostSemaphore*>(handle);
+}
+
+// ==================== BLUETOOTH ====================
+
+// Fake GATT server: handles are handed out in creation order, events wait for host_gatts_next_event()
+struct HostGattsEvent {
+    esp_gatts_cb_event_t event;
+    esp_ble_gatts_cb_param_t param;
+};
+static std::mutex gatts_mutex;
+static std::deque<HostGattsEvent> gatts_events;
+static uint16_t gatts_next_handle = 40;
+
+static void queue_gatts_event(esp_gatts_cb_event_t event, const esp_ble_gatts_cb_param_t& param) {
+    std::lock_guard<std::mutex> guard(gatts_mutex);
+    gatts_events.push_back({event, param});
+}
+
+bool host_gatts_next_event(esp_gatts_cb_event_t* event, esp_ble_gatts_cb_param_t* param) {
+    std::lock_guard<std::mutex> guard(gatts_mutex);
+    if (gatts_events.empty()) {
+        return false;
+    }
+    *event = gatts_events.front().event;
+    *param = gatts_events.front().param;
+    gatts_events.pop_front();
+    return true;
+}
+
+esp_err_t esp_ble_gatts_create_service(esp_gatt_if_t gatts_if, esp_gatt_srvc_id_t* service_id, uint16_t num_handle) {
+    esp_ble_gatts_cb_param_t param = {};
+    param.create.status = ESP_GATT_OK;
+    param.create.service_handle = gatts_next_handle++;
+    param.create.service_id = *service_id;
+    queue_gatts_event(ESP_GATTS_CREATE_EVT, param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_start_service(uint16_t service_handle) {
+    esp_ble_gatts_cb_param_t param = {};
+    param.start.status = ESP_GATT_OK;
+    param.start.service_handle = service_handle;
+    queue_gatts_event(ESP_GATTS_START_EVT, param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_add_char(uint16_t service_handle, esp_bt_uuid_t* char_uuid, esp_gatt_perm_t perm,
+                                 esp_gatt_char_prop_t property, esp_attr_value_t* char_val,
+                                 esp_attr_control_t* control) {
+    esp_ble_gatts_cb_param_t param = {};
+    param.add_char.status = ESP_GATT_OK;
+    gatts_next_handle++;  // Characteristic declaration
+    param.add_char.attr_handle = gatts_next_handle++;
+    param.add_char.service_handle = service_handle;
+    param.add_char.char_uuid = *char_uuid;
+    queue_gatts_event(ESP_GATTS_ADD_CHAR_EVT, param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_add_char_descr(uint16_t service_handle, esp_bt_uuid_t* descr_uuid, esp_gatt_perm_t perm,
+                                       esp_attr_value_t* char_descr_val, esp_attr_control_t* control) {
+    esp_ble_gatts_cb_param_t param = {};
+    param.add_char_descr.status = ESP_GATT_OK;
+    param.add_char_descr.attr_handle = gatts_next_handle++;
+    param.add_char_descr.service_handle = service_handle;
+    param.add_char_descr.descr_uuid = *descr_uuid;
+    queue_gatts_event(ESP_GATTS_ADD_CHAR_DESCR_EVT, param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t attr_handle,
+                                      uint16_t value_len, uint8_t* value, bool need_confirm) {
+    return ESP_ERR_NOT_SUPPORTED;  // Tests install a TransferTransport instead
+}
+
+esp_err_t esp_ble_gatts_send_response(esp_gatt_if_t gatts_if, uint16_t conn_id, uint32_t trans_id,
+                                      esp_gatt_status_t status, void* rsp) {
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_close(esp_gatt_if_t gatts_if, uint16_t conn_id) { return ESP_ERR_NOT_SUPPORTED; }
+
+// ==================== PARTITIONS AND OTA ====================
+
+struct HostPartition {
+    esp_partition_t partition;
+    std::vector<uint8_t> data;
+};
+static std::mutex partition_mutex;
+static std::vector<std::unique_ptr<HostPartition>> partitions;
+
+const esp_partition_t* host_partition_add(const char* label, uint32_t size) {
+    std::unique_ptr<HostPartition> entry(new HostPartition());
+    entry->partition.type = ESP_PARTITION_TYPE_DATA;
+    entry->partition.subtype = ESP_PARTITION_SUBTYPE_DATA_SPIFFS;
+    entry->partition.size = size;
+    entry->partition.erase_size = SPI_FLASH_SEC_SIZE;
+    strncpy(entry->partition.label, label, sizeof(entry->partition.label) - 1);
+    entry->data.assign(size, 0xFF);
+    
+    std::lock_guard<std::mutex> guard(partition_mutex);
+    entry->partition.address = 0x110000 + static_cast<uint32_t>(partitions.size()) * 0x100000;
+    partitions.push_back(std::move(entry));
+    return &partitions.back()->partition;
+}
+
+static HostPartition* find_partition(const esp_partition_t* partition) {
+    for (auto& entry : partitions) {
+        if (&entry->partition == partition) {
+            return entry.get();
+        }
+    }
+    return nullptr;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+    std::lock_guard<std::mutex> guard(partition_mutex);
+    for (auto& entry : partitions) {
+        if ((type == ESP_PARTITION_TYPE_ANY || entry->partition.type == type) &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || entry->partition.subtype == subtype) &&
+            (!label || strcmp(entry->partition.label, label) == 0)) {
+            return &entry->partition;
+        }
+    }
+    return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+    std::lock_guard<std::mutex> guard(partition_mutex);
+    HostPartition* entry = find_partition(partition);
+    if (!entry || src_offset > entry->data.size() || size > entry->data.size() - src_offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(dst, entry->data.data() + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size) {
+    std::lock_guard<std::mutex> guard(partition_mutex);
+    HostPartition* entry = find_partition(partition);
+    if (!entry || dst_offset > entry->data.size() || size > entry->data.size() - dst_offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // NOR flash only clears bits
+    const uint8_t* bytes = static_cast<const uint8_t*>(src);
+    for (size_t i = 0; i < size; i++) {
+        entry->data[dst_offset + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    std::lock_guard<std::mutex> guard(partition_mutex);
+    HostPartition* entry = find_partition(partition);
+    if (!entry || offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0 ||
+        offset > entry->data.size() || size > entry->data.size() - offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(entry->data.data() + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void** out_ptr,
+                             esp_partition_mmap_handle_t* out_handle) {
+    std::lock_guard<std::mutex> guard(partition_mutex);
+    HostPartition* entry = find_partition(partition);
+    if (!entry || offset > entry->data.size() || size > entry->data.size() - offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_ptr = entry->data.data() + offset;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {}
+
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from) { return nullptr; }
+const esp_partition_t* esp_ota_get_running_partition(void) { return nullptr; }
+esp_err_t esp_ota_begin(const esp_partition_t* partition, size_t image_size, esp_ota_handle_t* out_handle) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void* data, size_t size) { return ESP_ERR_NOT_SUPPORTED; }
+esp_err_t esp_ota_end(esp_ota_handle_t handle) { return ESP_ERR_NOT_SUPPORTED; }
+esp_err_t esp_ota_abort(esp_ota_handle_t handle) { return ESP_OK; }
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition) { return ESP_ERR_NOT_SUPPORTED; }
+
+void esp_restart(void) {
+    abort();
+}
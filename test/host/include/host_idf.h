@@ -0,0 +1,274 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+/**
+ * @brief Host (Linux) stand-ins for the ESP-IDF APIs the component uses
+ *
+ * The per-header files next to this one (esp_timer.h, freertos/semphr.h, ...) all
+ * include it, so src/ compiles unchanged off-target. Types carry only the fields the
+ * component touches.
+ *
+ * - esp_timer runs on a virtual clock: time only moves with host_advance_time_us(),
+ *   which fires the due timers in the calling thread
+ * - FreeRTOS tasks are threads; mutexes, semaphores, queues and task notifications
+ *   block for real (1 tick = 1 ms)
+ * - The GATT server hands out attribute handles and queues the matching events for
+ *   host_gatts_next_event(); every other Bluetooth call succeeds without effect
+ * - Partitions live in RAM (host_partition_add()), OTA is not supported
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+// ==================== ERRORS AND LOGGING ====================
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_OTA_VALIDATE_FAILED 0x1503
+const char* esp_err_to_name(esp_err_t code);
+
+typedef enum {
+    ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE
+} esp_log_level_t;
+// Formats like ESP_LOGx; uint32_t is unsigned int here, so 'l' length modifiers are dropped
+void host_log(esp_log_level_t level, const char* tag, const char* format, ...);
+#define ESP_LOGE(tag, format, ...) host_log(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) host_log(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) host_log(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) host_log(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) host_log(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+#define ESP_ERROR_CHECK(x) (void)(x)
+
+// ==================== HEAP ====================
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+void* heap_caps_malloc(size_t size, uint32_t caps);
+void* heap_caps_calloc(size_t count, size_t size, uint32_t caps);
+void heap_caps_free(void* ptr);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+
+// ==================== TIMER ====================
+
+typedef struct esp_timer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+typedef enum { ESP_TIMER_TASK, ESP_TIMER_ISR } esp_timer_dispatch_t;
+typedef struct {
+    esp_timer_cb_t callback;
+    void* arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+bool esp_timer_is_active(esp_timer_handle_t timer);
+int64_t esp_timer_get_time(void);
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const* buf, uint32_t len);
+
+// ==================== FREERTOS ====================
+
+typedef void* TaskHandle_t;
+typedef void* QueueHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffu
+#define portNUM_PROCESSORS 2
+#define tskNO_AFFINITY 0x7fffffff
+#define configMAX_PRIORITIES 25
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+// Tasks are threads; a task function returns right after vTaskDelete(nullptr)
+BaseType_t xTaskCreatePinnedToCore(void (*function)(void*), const char* name, uint32_t stack_size,
+                                   void* arg, UBaseType_t priority, TaskHandle_t* out_handle,
+                                   BaseType_t core_id);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+void host_task_yield(void);
+#define taskYIELD() host_task_yield()
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+void vQueueDelete(QueueHandle_t queue);
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+
+// ==================== BLUETOOTH ====================
+
+#define ESP_UUID_LEN_16 2
+#define ESP_UUID_LEN_32 4
+#define ESP_UUID_LEN_128 16
+#define ESP_BD_ADDR_LEN 6
+typedef uint8_t esp_bd_addr_t[ESP_BD_ADDR_LEN];
+#define ESP_BD_ADDR_STR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define ESP_BD_ADDR_HEX(addr) addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]
+typedef struct {
+    uint16_t len;
+    union { uint16_t uuid16; uint32_t uuid32; uint8_t uuid128[ESP_UUID_LEN_128]; } uuid;
+} __attribute__((packed)) esp_bt_uuid_t;
+typedef enum { BLE_ADDR_TYPE_PUBLIC = 0, BLE_ADDR_TYPE_RANDOM } esp_ble_addr_type_t;
+
+// GATT server
+typedef uint8_t esp_gatt_if_t;
+#define ESP_GATT_IF_NONE 0xff
+typedef uint16_t esp_gatt_perm_t;
+typedef uint8_t esp_gatt_char_prop_t;
+#define ESP_GATT_PERM_READ (1 << 0)
+#define ESP_GATT_PERM_READ_ENCRYPTED (1 << 1)
+#define ESP_GATT_PERM_WRITE (1 << 4)
+#define ESP_GATT_PERM_WRITE_ENCRYPTED (1 << 5)
+#define ESP_GATT_CHAR_PROP_BIT_READ (1 << 1)
+#define ESP_GATT_CHAR_PROP_BIT_WRITE_NR (1 << 2)
+#define ESP_GATT_CHAR_PROP_BIT_WRITE (1 << 3)
+#define ESP_GATT_CHAR_PROP_BIT_NOTIFY (1 << 4)
+#define ESP_GATT_CHAR_PROP_BIT_INDICATE (1 << 5)
+#define ESP_GATT_UUID_CHAR_CLIENT_CONFIG 0x2902
+typedef enum { ESP_GATT_OK = 0, ESP_GATT_NO_RESOURCES = 0x80, ESP_GATT_CONGESTED = 0x8f } esp_gatt_status_t;
+typedef struct { esp_bt_uuid_t uuid; uint8_t inst_id; } __attribute__((packed)) esp_gatt_id_t;
+typedef struct { esp_gatt_id_t id; bool is_primary; } __attribute__((packed)) esp_gatt_srvc_id_t;
+typedef struct { uint16_t attr_max_len; uint16_t attr_len; uint8_t* attr_value; } esp_attr_value_t;
+typedef struct { uint8_t auto_rsp; } esp_attr_control_t;
+typedef struct { uint16_t interval; uint16_t latency; uint16_t timeout; } esp_gatt_conn_params_t;
+typedef enum {
+    ESP_GATTS_REG_EVT = 0, ESP_GATTS_READ_EVT = 1, ESP_GATTS_WRITE_EVT = 2, ESP_GATTS_EXEC_WRITE_EVT = 3,
+    ESP_GATTS_MTU_EVT = 4, ESP_GATTS_CONF_EVT = 5, ESP_GATTS_UNREG_EVT = 6, ESP_GATTS_CREATE_EVT = 7,
+    ESP_GATTS_ADD_INCL_SRVC_EVT = 8, ESP_GATTS_ADD_CHAR_EVT = 9, ESP_GATTS_ADD_CHAR_DESCR_EVT = 10,
+    ESP_GATTS_DELETE_EVT = 11, ESP_GATTS_START_EVT = 12, ESP_GATTS_STOP_EVT = 13, ESP_GATTS_CONNECT_EVT = 14,
+    ESP_GATTS_DISCONNECT_EVT = 15, ESP_GATTS_OPEN_EVT = 16, ESP_GATTS_CANCEL_OPEN_EVT = 17,
+    ESP_GATTS_CLOSE_EVT = 18, ESP_GATTS_LISTEN_EVT = 19, ESP_GATTS_CONGEST_EVT = 20, ESP_GATTS_RESPONSE_EVT = 21
+} esp_gatts_cb_event_t;
+typedef union {
+    struct { esp_gatt_status_t status; uint16_t app_id; } reg;
+    struct {
+        uint16_t conn_id; uint32_t trans_id; esp_bd_addr_t bda; uint16_t handle; uint16_t offset;
+        bool need_rsp; bool is_prep; uint16_t len; uint8_t* value;
+    } write;
+    struct { uint16_t conn_id; uint16_t mtu; } mtu;
+    struct { esp_gatt_status_t status; uint16_t conn_id; uint16_t handle; uint16_t len; uint8_t* value; } conf;
+    struct { esp_gatt_status_t status; uint16_t service_handle; esp_gatt_srvc_id_t service_id; } create;
+    struct { esp_gatt_status_t status; uint16_t attr_handle; uint16_t service_handle; esp_bt_uuid_t char_uuid; } add_char;
+    struct { esp_gatt_status_t status; uint16_t attr_handle; uint16_t service_handle; esp_bt_uuid_t descr_uuid; } add_char_descr;
+    struct { esp_gatt_status_t status; uint16_t service_handle; } start;
+    struct {
+        uint16_t conn_id; uint8_t link_role; esp_bd_addr_t remote_bda; esp_gatt_conn_params_t conn_params;
+        esp_ble_addr_type_t ble_addr_type; uint16_t conn_handle;
+    } connect;
+    struct { uint16_t conn_id; esp_bd_addr_t remote_bda; int reason; } disconnect;
+    struct { uint16_t conn_id; bool congested; } congest;
+} esp_ble_gatts_cb_param_t;
+esp_err_t esp_ble_gatts_create_service(esp_gatt_if_t gatts_if, esp_gatt_srvc_id_t* service_id, uint16_t num_handle);
+esp_err_t esp_ble_gatts_start_service(uint16_t service_handle);
+esp_err_t esp_ble_gatts_add_char(uint16_t service_handle, esp_bt_uuid_t* char_uuid, esp_gatt_perm_t perm,
+                                 esp_gatt_char_prop_t property, esp_attr_value_t* char_val,
+                                 esp_attr_control_t* control);
+esp_err_t esp_ble_gatts_add_char_descr(uint16_t service_handle, esp_bt_uuid_t* descr_uuid, esp_gatt_perm_t perm,
+                                       esp_attr_value_t* char_descr_val, esp_attr_control_t* control);
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t attr_handle,
+                                      uint16_t value_len, uint8_t* value, bool need_confirm);
+esp_err_t esp_ble_gatts_send_response(esp_gatt_if_t gatts_if, uint16_t conn_id, uint32_t trans_id,
+                                      esp_gatt_status_t status, void* rsp);
+esp_err_t esp_ble_gatts_close(esp_gatt_if_t gatts_if, uint16_t conn_id);
+
+
+// ==================== PARTITIONS AND OTA ====================
+
+typedef enum { ESP_PARTITION_TYPE_APP = 0, ESP_PARTITION_TYPE_DATA = 1, ESP_PARTITION_TYPE_ANY = 0xff } esp_partition_type_t;
+typedef enum { ESP_PARTITION_SUBTYPE_DATA_SPIFFS = 0x82, ESP_PARTITION_SUBTYPE_ANY = 0xff } esp_partition_subtype_t;
+typedef struct {
+    void* flash_chip; esp_partition_type_t type; esp_partition_subtype_t subtype; uint32_t address;
+    uint32_t size; uint32_t erase_size; char label[17]; bool encrypted;
+} esp_partition_t;
+typedef uint32_t esp_partition_mmap_handle_t;
+typedef enum { ESP_PARTITION_MMAP_DATA, ESP_PARTITION_MMAP_INST } esp_partition_mmap_memory_t;
+#define SPI_FLASH_SEC_SIZE 4096
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label);
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size);
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void** out_ptr,
+                             esp_partition_mmap_handle_t* out_handle);
+void esp_partition_munmap(esp_partition_mmap_handle_t handle);
+
+typedef uint32_t esp_ota_handle_t;
+#define OTA_SIZE_UNKNOWN 0xffffffff
+#define OTA_WITH_SEQUENTIAL_WRITES 0xfffffffe
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from);
+const esp_partition_t* esp_ota_get_running_partition(void);
+esp_err_t esp_ota_begin(const esp_partition_t* partition, size_t image_size, esp_ota_handle_t* out_handle);
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void* data, size_t size);
+esp_err_t esp_ota_end(esp_ota_handle_t handle);
+esp_err_t esp_ota_abort(esp_ota_handle_t handle);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition);
+
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+typedef struct {
+    uint8_t magic; uint8_t segment_count; uint8_t spi_mode; uint8_t spi_speed : 4; uint8_t spi_size : 4;
+    uint32_t entry_addr; uint8_t wp_pin; uint8_t spi_pin_drv[3]; uint16_t chip_id; uint8_t min_chip_rev;
+    uint16_t min_chip_rev_full; uint16_t max_chip_rev_full; uint8_t reserved[4]; uint8_t hash_appended;
+} __attribute__((packed)) esp_image_header_t;
+typedef struct { uint32_t load_addr; uint32_t data_len; } esp_image_segment_header_t;
+typedef struct {
+    uint32_t magic_word; uint32_t secure_version; uint32_t reserv1[2]; char version[32]; char project_name[32];
+    char time[16]; char date[16]; char idf_ver[32]; uint8_t app_elf_sha256[32]; uint32_t reserv2[20];
+} esp_app_desc_t;
+#define ESP_APP_DESC_MAGIC_WORD 0xABCD5432
+
+void esp_restart(void);
+
+// ==================== TEST CONTROLS ====================
+
+// Messages below this level are dropped (default ESP_LOG_WARN, or TINYFLOW_HOST_LOG=0-5)
+void host_log_set_level(esp_log_level_t level);
+
+// heap_caps_malloc() and heap_caps_calloc() calls so far (all tasks)
+uint32_t host_heap_allocations(void);
+
+// Virtual clock: advances esp_timer_get_time() and runs every timer due on the way
+void host_advance_time_us(int64_t us);
+
+// Next event the fake GATT server produced for the calls so far (service, attributes)
+bool host_gatts_next_event(esp_gatts_cb_event_t* event, esp_ble_gatts_cb_param_t* param);
+
+// RAM-backed data partition (erased to 0xFF), found by esp_partition_find_first()
+const esp_partition_t* host_partition_add(const char* label, uint32_t size);
@@ -0,0 +1,10 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+#pragma once
+
+// Host configuration: 1M PHY only (no BLE 5.0 features), logging and tracing at their defaults
+#define CONFIG_BT_ACL_CONNECTIONS 4
+#define CONFIG_IDF_FIRMWARE_CHIP_ID 0x0009
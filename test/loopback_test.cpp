@@ -0,0 +1,1111 @@
+// Copyright (c) 2025 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+// created with the help of Claude AI
+
+/**
+ * Loopback tests: ImageService with a TransferTransport that plays the client in-process
+ *
+ * The client replays uploads over an impaired link (lost, duplicated and reordered
+ * chunks) at several MTUs, downloads with dropped notifications, and random writes
+ * (fuzz). Time is virtual: it only advances while the client waits, so the selective
+ * repeat timers fire deterministically. Every scenario prints its figures (benchmark);
+ * the process exits non-zero if any check failed.
+ *
+ * TINYFLOW_HOST_LOG=0-5 shows the engine's log (default: none).
+ */
+
+#include "image_service.h"
+#include "transfer_sink.h"
+#include "transfer_source.h"
+#include "host_idf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+int checks = 0;
+
+#define CHECK(cond) do { \
+        checks++; \
+        if (!(cond)) { \
+            failures++; \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) do { \
+        checks++; \
+        auto check_a_ = (a); \
+        auto check_b_ = (b); \
+        if (!(check_a_ == check_b_)) { \
+            failures++; \
+            fprintf(stderr, "%s:%d: CHECK failed: %s == %s (%lld vs %lld)\n", __FILE__, __LINE__, #a, #b, \
+                    static_cast<long long>(check_a_), static_cast<long long>(check_b_)); \
+        } \
+    } while (0)
+
+using ControlMessage = ImageService::ControlMessage;
+using CommandType = ImageService::CommandType;
+
+constexpr uint16_t CONN_ID = 0;
+constexpr int64_t TRANSFER_DEADLINE_US = 300LL * 1000 * 1000;  // Virtual time per transfer
+constexpr int64_t IDLE_STEP_US = 1000;
+constexpr int64_t DOWNLOAD_GAP_TIMEOUT_US = 50 * 1000;         // Silence before re-requesting missed chunks
+
+uint32_t crc32(const uint8_t* data, size_t len) {
+    return esp_rom_crc32_le(0, data, static_cast<uint32_t>(len));
+}
+
+std::vector<uint8_t> make_payload(uint32_t size, uint32_t seed) {
+    std::vector<uint8_t> data(size);
+    std::mt19937 rng(seed);
+    for (auto& byte : data) {
+        byte = static_cast<uint8_t>(rng());
+    }
+    return data;
+}
+
+// ==================== LOOPBACK TRANSPORT ====================
+
+struct Packet {
+    uint16_t conn_id;
+    uint16_t handle;
+    std::vector<uint8_t> data;
+};
+
+// Called with the service state held (also from timers and the CRC worker): only queue
+class LoopbackTransport : public TransferTransport {
+public:
+    esp_err_t notify(uint16_t conn_id, uint16_t handle, const uint8_t* data, uint16_t len) override {
+        std::lock_guard<std::mutex> guard(mutex_);
+        packets_.push_back({conn_id, handle, std::vector<uint8_t>(data, data + len)});
+        return ESP_OK;
+    }
+    
+    esp_err_t close(uint16_t conn_id) override {
+        std::lock_guard<std::mutex> guard(mutex_);
+        closed_.push_back(conn_id);
+        return ESP_OK;
+    }
+    
+    bool next(uint16_t conn_id, Packet* packet) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto it = std::find_if(packets_.begin(), packets_.end(),
+                               [conn_id](const Packet& p) { return p.conn_id == conn_id; });
+        if (it == packets_.end()) {
+            return false;
+        }
+        *packet = std::move(*it);
+        packets_.erase(it);
+        return true;
+    }
+    
+    bool take_close(uint16_t conn_id) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto it = std::find(closed_.begin(), closed_.end(), conn_id);
+        if (it == closed_.end()) {
+            return false;
+        }
+        closed_.erase(it);
+        return true;
+    }
+    
+    void clear() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        packets_.clear();
+        closed_.clear();
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<Packet> packets_;
+    std::vector<uint16_t> closed_;
+};
+
+// ==================== SERVICE FIXTURE ====================
+
+std::vector<uint8_t> received_image;
+int image_callbacks = 0;
+
+void on_image(const uint8_t* image_data, uint32_t size, bool is_valid_jpeg) {
+    received_image.assign(image_data ? image_data : nullptr, image_data ? image_data + size : nullptr);
+    image_callbacks++;
+}
+
+TransferSource* download_sources[4] = {};
+int download_completions = 0;
+bool download_success = false;
+
+TransferSource* on_download_request(uint32_t download_id) {
+    return (download_id < 4) ? download_sources[download_id] : nullptr;
+}
+
+void on_download_complete(uint32_t download_id, TransferSource* source, bool success) {
+    download_completions++;
+    download_success = success;
+}
+
+// Plays Bluedroid's part in creating the service: REG, then the attribute events
+void create_service(ImageService& service) {
+    constexpr esp_gatt_if_t GATTS_IF = 3;
+    service.init(GATTS_IF);
+    esp_ble_gatts_cb_param_t param = {};
+    param.reg.status = ESP_GATT_OK;
+    param.reg.app_id = ImageService::APP_ID;
+    service.handle_event(ESP_GATTS_REG_EVT, GATTS_IF, &param);
+    
+    esp_gatts_cb_event_t event;
+    while (host_gatts_next_event(&event, &param)) {
+        service.handle_event(event, GATTS_IF, &param);
+    }
+}
+
+struct Fixture {
+    LoopbackTransport link;
+    ImageService service;
+    
+    explicit Fixture(uint8_t data_channels = 1) {
+        service.set_data_channel_count(data_channels);
+        service.set_transport(&link);
+        service.set_image_transfer_callback(&on_image);
+        service.set_download_request_callback(&on_download_request);
+        service.set_download_complete_callback(&on_download_complete);
+        create_service(service);
+        received_image.clear();
+        image_callbacks = 0;
+        download_completions = 0;
+        download_success = false;
+    }
+};
+
+// ==================== LOOPBACK CLIENT ====================
+
+struct LinkImpairment {
+    const char* name;
+    double loss;        // Chunk (upload) or notification (download) dropped
+    double duplicate;   // Chunk sent twice
+    bool reorder;       // Chunks of a batch sent in random order
+};
+
+constexpr LinkImpairment CLEAN_LINK = {"clean", 0.0, 0.0, false};
+constexpr LinkImpairment IMPAIRMENTS[] = {
+    CLEAN_LINK,
+    {"reordered", 0.0, 0.0, true},
+    {"lossy", 0.08, 0.0, false},
+    {"duplicated", 0.0, 0.10, false},
+    {"hostile", 0.10, 0.10, true},
+};
+
+struct TransferStats {
+    uint32_t chunks_sent = 0;
+    uint32_t chunks_dropped = 0;
+    uint32_t duplicates_sent = 0;
+    uint32_t chunk_requests = 0;
+    uint32_t ack_size = 0;
+    uint32_t ack_crc = 0;
+    uint32_t error_code = 0;
+    bool acknowledged = false;
+    bool closed = false;
+    int64_t virtual_us = 0;
+    int64_t wall_us = 0;
+    uint32_t allocations = 0;  // heap_caps_malloc()/heap_caps_calloc() calls during the transfer
+};
+
+class LoopbackClient {
+public:
+    LoopbackClient(Fixture& fixture, uint32_t seed, uint16_t conn_id = CONN_ID)
+        : service_(fixture.service), link_(fixture.link), conn_id_(conn_id), rng_(seed), mtu_(23), sequence_(0),
+          gatts_writes_(false) {}
+    
+    void connect(uint16_t mtu, bool data_notifications = false) {
+        mtu_ = mtu;
+        service_.on_client_connected(conn_id_);
+        service_.on_client_mtu(conn_id_, mtu);
+        write_descriptor(service_.get_control_notify_handle(), true);
+        if (data_notifications) {
+            write_descriptor(service_.get_data_notify_handle(0), true);
+        }
+        Packet packet;
+        CHECK(next_control(&packet));  // DEVICE_INFO once notifications are on
+        CHECK_EQ(packet.data[0], static_cast<uint8_t>(CommandType::DEVICE_INFO));
+    }
+    
+    void disconnect() {
+        service_.on_client_disconnected(conn_id_);
+        link_.clear();
+    }
+    
+    uint16_t max_chunk_size() const { return mtu_ - ImageService::ATT_HEADER_SIZE - ImageService::DATA_HEADER_SIZE; }
+    
+    void write_descriptor(uint16_t handle, bool enabled) {
+        uint8_t value[2] = {static_cast<uint8_t>(enabled ? 0x01 : 0x00), 0x00};
+        service_.on_client_write(conn_id_, handle, value, sizeof(value));
+    }
+    
+    void write_control(ControlMessage msg) {
+        msg.sequence_number = ++sequence_;
+        service_.on_client_write(conn_id_, service_.get_control_char_handle(),
+                                 reinterpret_cast<const uint8_t*>(&msg), sizeof(msg));
+    }
+    
+    void write_data(const uint8_t* data, uint16_t len, uint8_t channel = 0) {
+        if (!gatts_writes_) {
+            service_.on_client_write(conn_id_, service_.get_data_char_handle(channel), data, len);
+            return;
+        }
+        // Through the GATTS callback, like Bluedroid: takes the ingest fast path when enabled
+        esp_ble_gatts_cb_param_t param = {};
+        param.write.conn_id = conn_id_;
+        param.write.handle = service_.get_data_char_handle(channel);
+        param.write.len = len;
+        param.write.value = const_cast<uint8_t*>(data);
+        service_.handle_event(ESP_GATTS_WRITE_EVT, service_.get_gatts_if(), &param);
+    }
+    
+    // Data writes as GATTS write events instead of on_client_write()
+    void set_gatts_writes(bool enabled) { gatts_writes_ = enabled; }
+    
+    bool next_packet(Packet* packet) { return link_.next(conn_id_, packet); }
+    
+    // Next control notification, waiting (virtual time) for up to timeout_us
+    bool next_control(Packet* packet, int64_t timeout_us = 0) {
+        int64_t deadline = esp_timer_get_time() + timeout_us;
+        for (;;) {
+            if (next_packet(packet)) {
+                if (packet->handle == service_.get_control_char_handle() && packet->data.size() == sizeof(ControlMessage)) {
+                    return true;
+                }
+                continue;
+            }
+            if (esp_timer_get_time() >= deadline) {
+                return false;
+            }
+            idle_step();
+        }
+    }
+    
+    // Nothing to do: let the worker tasks run, then move the virtual clock
+    static void idle_step() {
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        host_advance_time_us(IDLE_STEP_US);
+    }
+    
+    // Upload with the server driving the chunk requests; true = acknowledged and closed
+    bool upload(const std::vector<uint8_t>& data, const LinkImpairment& impairment, TransferStats* stats,
+                uint8_t channels = 1, int64_t deadline_us = TRANSFER_DEADLINE_US) {
+        auto wall_start = std::chrono::steady_clock::now();
+        uint32_t allocations_start = host_heap_allocations();
+        int64_t start_us = esp_timer_get_time();
+        uint16_t chunk_size = max_chunk_size();
+        uint32_t chunks = static_cast<uint32_t>((data.size() + chunk_size - 1) / chunk_size);
+        uint32_t crc = crc32(data.data(), data.size());
+        
+        ControlMessage init = {};
+        init.command = static_cast<uint8_t>(CommandType::TRANSFER_INIT);
+        init.param1 = static_cast<uint32_t>(data.size());
+        init.param2 = chunk_size;
+        init.param3 = chunks;
+        memcpy(init.reserved, &crc, sizeof(crc));
+        init.reserved[ImageService::TRANSFER_FLAGS_INDEX] = ImageService::TRANSFER_FLAG_CRC32;
+        write_control(init);
+        
+        std::vector<uint8_t> frame(ImageService::DATA_HEADER_SIZE + chunk_size);
+        while (esp_timer_get_time() - start_us < deadline_us) {
+            Packet packet;
+            if (!next_packet(&packet)) {
+                if (link_.take_close(conn_id_)) {
+                    stats->closed = true;
+                    service_.on_client_disconnected(conn_id_);
+                    break;
+                }
+                idle_step();
+                continue;
+            }
+            if (packet.handle != service_.get_control_char_handle() || packet.data.size() != sizeof(ControlMessage)) {
+                continue;
+            }
+            ControlMessage msg;
+            memcpy(&msg, packet.data.data(), sizeof(msg));
+            
+            if (msg.command == static_cast<uint8_t>(CommandType::CHUNK_REQUEST)) {
+                stats->chunk_requests++;
+                CHECK(msg.param2 > 0 && msg.param1 + msg.param2 <= chunks);
+                
+                // The batch as it crosses the impaired link
+                std::vector<uint32_t> batch;
+                for (uint32_t chunk = msg.param1; chunk < msg.param1 + msg.param2 && chunk < chunks; chunk++) {
+                    if (chance(impairment.loss)) {
+                        stats->chunks_dropped++;
+                        continue;
+                    }
+                    batch.push_back(chunk);
+                    if (chance(impairment.duplicate)) {
+                        batch.push_back(chunk);
+                        stats->duplicates_sent++;
+                    }
+                }
+                if (impairment.reorder) {
+                    std::shuffle(batch.begin(), batch.end(), rng_);
+                }
+                
+                for (uint32_t chunk : batch) {
+                    uint32_t offset = chunk * chunk_size;
+                    uint16_t len = static_cast<uint16_t>(std::min<size_t>(chunk_size, data.size() - offset));
+                    ImageService::DataChunkHeader header = {static_cast<uint16_t>(chunk), len};
+                    memcpy(frame.data(), &header, sizeof(header));
+                    memcpy(frame.data() + sizeof(header), data.data() + offset, len);
+                    write_data(frame.data(), static_cast<uint16_t>(sizeof(header) + len), chunk % channels);
+                    stats->chunks_sent++;
+                }
+            } else if (msg.command == static_cast<uint8_t>(CommandType::TRANSFER_COMPLETE_ACK)) {
+                stats->acknowledged = true;
+                stats->ack_size = msg.param1;
+                stats->ack_crc = msg.param2;
+            } else if (msg.command == static_cast<uint8_t>(CommandType::TRANSFER_ERROR)) {
+                stats->error_code = msg.param1;
+                break;
+            }
+        }
+        
+        stats->virtual_us = esp_timer_get_time() - start_us;
+        stats->wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - wall_start).count();
+        stats->allocations = host_heap_allocations() - allocations_start;
+        return stats->acknowledged && stats->closed;
+    }
+    
+    // Download: collect the notified chunks, re-request the gaps, acknowledge size and CRC
+    bool download(uint32_t download_id, const LinkImpairment& impairment, std::vector<uint8_t>* out,
+                  TransferStats* stats) {
+        auto wall_start = std::chrono::steady_clock::now();
+        uint32_t allocations_start = host_heap_allocations();
+        int64_t start_us = esp_timer_get_time();
+        
+        ControlMessage request = {};
+        request.command = static_cast<uint8_t>(CommandType::REQUEST_DOWNLOAD);
+        request.param1 = download_id;
+        write_control(request);
+        
+        // TRANSFER_INIT may take a while: the CRC32 is computed on a worker task
+        Packet packet;
+        bool have_init = false;
+        ControlMessage init = {};
+        auto wall_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!have_init && std::chrono::steady_clock::now() < wall_deadline) {
+            if (!next_packet(&packet)) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                continue;
+            }
+            if (packet.handle == service_.get_control_char_handle() && packet.data.size() == sizeof(ControlMessage)) {
+                memcpy(&init, packet.data.data(), sizeof(init));
+                if (init.command == static_cast<uint8_t>(CommandType::TRANSFER_ERROR)) {
+                    stats->error_code = init.param1;
+                    return false;
+                }
+                have_init = init.command == static_cast<uint8_t>(CommandType::TRANSFER_INIT);
+            }
+        }
+        if (!have_init) {
+            return false;
+        }
+        
+        uint32_t total_size = init.param1;
+        uint32_t chunk_size = init.param2;
+        uint32_t chunks = init.param3;
+        uint32_t announced_crc;
+        memcpy(&announced_crc, init.reserved, sizeof(announced_crc));
+        CHECK(init.reserved[ImageService::TRANSFER_FLAGS_INDEX] & ImageService::TRANSFER_FLAG_CRC32);
+        CHECK(chunk_size > 0 && chunk_size <= max_chunk_size());
+        CHECK_EQ(chunks, (total_size + chunk_size - 1) / chunk_size);
+        
+        out->assign(total_size, 0);
+        std::vector<bool> have(chunks, false);
+        uint32_t missing = chunks;
+        int64_t last_activity_us = esp_timer_get_time();
+        
+        while (missing > 0 && esp_timer_get_time() - start_us < TRANSFER_DEADLINE_US) {
+            if (!next_packet(&packet)) {
+                if (esp_timer_get_time() - last_activity_us >= DOWNLOAD_GAP_TIMEOUT_US) {
+                    request_missing(have);
+                    stats->chunk_requests++;
+                    last_activity_us = esp_timer_get_time();
+                }
+                idle_step();
+                continue;
+            }
+            if (packet.handle == service_.get_control_char_handle()) {
+                ControlMessage msg;
+                memcpy(&msg, packet.data.data(), sizeof(msg));
+                if (msg.command == static_cast<uint8_t>(CommandType::TRANSFER_ERROR)) {
+                    stats->error_code = msg.param1;
+                    return false;
+                }
+                continue;
+            }
+            CHECK_EQ(packet.handle, service_.get_data_char_handle(0));
+            ImageService::DataChunkHeader header;
+            CHECK(packet.data.size() >= sizeof(header));
+            memcpy(&header, packet.data.data(), sizeof(header));
+            CHECK_EQ(header.data_length + sizeof(header), packet.data.size());
+            CHECK(header.chunk_id < chunks);
+            if (header.chunk_id >= chunks || header.data_length + sizeof(header) != packet.data.size()) {
+                continue;
+            }
+            last_activity_us = esp_timer_get_time();
+            if (chance(impairment.loss)) {
+                stats->chunks_dropped++;
+                continue;
+            }
+            stats->chunks_sent++;
+            if (have[header.chunk_id]) {
+                stats->duplicates_sent++;
+                continue;
+            }
+            uint32_t offset = header.chunk_id * chunk_size;
+            CHECK(offset + header.data_length <= total_size);
+            memcpy(out->data() + offset, packet.data.data() + sizeof(header), header.data_length);
+            have[header.chunk_id] = true;
+            missing--;
+        }
+        if (missing > 0) {
+            return false;
+        }
+        
+        uint32_t crc = crc32(out->data(), out->size());
+        CHECK_EQ(crc, announced_crc);
+        ControlMessage ack = {};
+        ack.command = static_cast<uint8_t>(CommandType::TRANSFER_COMPLETE_ACK);
+        ack.param1 = total_size;
+        ack.param2 = crc;
+        write_control(ack);
+        stats->acknowledged = true;
+        stats->ack_size = total_size;
+        stats->ack_crc = crc;
+        
+        stats->virtual_us = esp_timer_get_time() - start_us;
+        stats->wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - wall_start).count();
+        stats->allocations = host_heap_allocations() - allocations_start;
+        return true;
+    }
+    
+    bool chance(double probability) {
+        return probability > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(rng_) < probability;
+    }
+    
+    std::mt19937& rng() { return rng_; }
+
+private:
+    ImageService& service_;
+    LoopbackTransport& link_;
+    uint16_t conn_id_;
+    std::mt19937 rng_;
+    uint16_t mtu_;
+    uint16_t sequence_;
+    bool gatts_writes_;
+    
+    // One CHUNK_REQUEST per missing run
+    void request_missing(const std::vector<bool>& have) {
+        for (uint32_t start = 0; start < have.size();) {
+            if (have[start]) {
+                start++;
+                continue;
+            }
+            uint32_t end = start;
+            while (end < have.size() && !have[end]) {
+                end++;
+            }
+            ControlMessage msg = {};
+            msg.command = static_cast<uint8_t>(CommandType::CHUNK_REQUEST);
+            msg.param1 = start;
+            msg.param2 = end - start;
+            write_control(msg);
+            start = end;
+        }
+    }
+};
+
+void print_stats(const char* scenario, const char* link, uint16_t mtu, size_t size, const TransferStats& stats) {
+    double wall_s = stats.wall_us / 1e6;
+    printf("%-22s %-10s MTU %3u %7zu B  %5u sent %4u lost %4u dup %4u req  %7.1f ms virtual  %6.1f ms wall  "
+           "%7.2f MB/s  %8.0f chunks/s  %3u allocs\n",
+           scenario, link, mtu, size, stats.chunks_sent, stats.chunks_dropped, stats.duplicates_sent,
+           stats.chunk_requests, stats.virtual_us / 1000.0, stats.wall_us / 1000.0,
+           wall_s > 0 ? size / wall_s / 1e6 : 0.0, wall_s > 0 ? stats.chunks_sent / wall_s : 0.0,
+           stats.allocations);
+}
+
+// ==================== SCENARIOS ====================
+
+constexpr uint16_t MTUS[] = {23, 185, 247, 512};
+
+void test_upload(ImageService::FlowMode flow_mode, bool adaptive, const char* scenario) {
+    uint32_t seed = 1;
+    for (uint16_t mtu : MTUS) {
+        for (const LinkImpairment& impairment : IMPAIRMENTS) {
+            Fixture fixture;
+            fixture.service.set_flow_mode(flow_mode);
+            fixture.service.set_adaptive_batching(adaptive);
+            LoopbackClient client(fixture, seed);
+            std::vector<uint8_t> data = make_payload(mtu == 23 ? 12000 : 96000 + seed, seed);
+            seed++;
+            
+            client.connect(mtu);
+            TransferStats stats;
+            bool ok = client.upload(data, impairment, &stats);
+            print_stats(scenario, impairment.name, mtu, data.size(), stats);
+            
+            CHECK(ok);
+            CHECK_EQ(stats.error_code, 0u);
+            CHECK_EQ(stats.ack_size, data.size());
+            CHECK_EQ(stats.ack_crc, crc32(data.data(), data.size()));
+            CHECK_EQ(image_callbacks, 1);
+            CHECK(received_image == data);
+            
+            const TransferMetrics& metrics = fixture.service.get_last_transfer_metrics();
+            CHECK(metrics.outcome == TransferMetrics::Outcome::COMPLETE);
+            CHECK_EQ(metrics.bytes_received, data.size());
+            // Duplicates behind the completing chunk of the last batch arrive after the transfer
+            CHECK(metrics.duplicate_chunks <= stats.duplicates_sent);
+            CHECK(metrics.duplicate_chunks + 4 >= stats.duplicates_sent);
+            if (stats.chunks_dropped > 0) {
+                CHECK(metrics.retransmit_requests > 0);
+            }
+        }
+    }
+}
+
+void test_upload_channels() {
+    // Chunks spread over all data characteristics arrive in any order
+    Fixture fixture(ImageService::MAX_DATA_CHANNELS);
+    fixture.service.set_flow_mode(ImageService::FlowMode::SLIDING_WINDOW);
+    for (uint8_t channel = 0; channel < ImageService::MAX_DATA_CHANNELS; channel++) {
+        CHECK(fixture.service.get_data_char_handle(channel) != 0);
+        CHECK(fixture.service.get_data_notify_handle(channel) != 0);
+    }
+    
+    LoopbackClient client(fixture, 77);
+    std::vector<uint8_t> data = make_payload(64000, 77);
+    client.connect(247);
+    TransferStats stats;
+    bool ok = client.upload(data, IMPAIRMENTS[4], &stats, ImageService::MAX_DATA_CHANNELS);
+    print_stats("upload/4 channels", IMPAIRMENTS[4].name, 247, data.size(), stats);
+    CHECK(ok);
+    CHECK(received_image == data);
+}
+
+void test_upload_max_chunks() {
+    // Every chunk ID in use: 1 MB in 16-byte chunks at the minimum MTU over a lossy link
+    constexpr int64_t MAX_CHUNKS_DEADLINE_US = 3600LL * 1000 * 1000;
+    Fixture fixture;
+    fixture.service.set_flow_mode(ImageService::FlowMode::SLIDING_WINDOW);
+    LoopbackClient client(fixture, 650);
+    client.connect(23);
+    std::vector<uint8_t> data = make_payload(ImageService::MAX_CHUNKS * client.max_chunk_size(), 650);
+    CHECK_EQ(data.size(), static_cast<size_t>(ImageService::MAX_TRANSFER_SIZE));
+    
+    TransferStats stats;
+    bool ok = client.upload(data, IMPAIRMENTS[2], &stats, 1, MAX_CHUNKS_DEADLINE_US);
+    print_stats("upload/65536 chunks", IMPAIRMENTS[2].name, 23, data.size(), stats);
+    CHECK(ok);
+    CHECK_EQ(stats.error_code, 0u);
+    CHECK(stats.chunks_dropped > 0);
+    CHECK_EQ(stats.ack_crc, crc32(data.data(), data.size()));
+    CHECK(received_image == data);
+}
+
+void test_ingest_task() {
+    // Data writes go through the ring and are processed on the ingest task
+    constexpr ImageService::IngestConfig INGEST_CONFIG = {64, 1, 5, 4096};
+    Fixture fixture;
+    fixture.service.set_flow_mode(ImageService::FlowMode::SLIDING_WINDOW);
+    CHECK_EQ(fixture.service.enable_ingest_task(INGEST_CONFIG), ESP_OK);
+    CHECK_EQ(fixture.service.enable_ingest_task(INGEST_CONFIG), ESP_ERR_INVALID_STATE);
+    
+    uint32_t seed = 700;
+    for (uint16_t mtu : {185, 512}) {
+        LoopbackClient client(fixture, seed);
+        client.set_gatts_writes(true);
+        std::vector<uint8_t> data = make_payload(80000, seed++);
+        image_callbacks = 0;
+        client.connect(mtu);
+        TransferStats stats;
+        bool ok = client.upload(data, IMPAIRMENTS[4], &stats);
+        print_stats("upload/ingest task", IMPAIRMENTS[4].name, mtu, data.size(), stats);
+        CHECK(ok);
+        CHECK_EQ(image_callbacks, 1);
+        CHECK(received_image == data);
+    }
+    
+    // Stopping with chunks still queued returns once the task has exited, well before the timeout
+    LoopbackClient client(fixture, seed);
+    client.set_gatts_writes(true);
+    client.connect(247);
+    ControlMessage init = {};
+    init.command = static_cast<uint8_t>(CommandType::TRANSFER_INIT);
+    init.param1 = 500 * client.max_chunk_size();
+    init.param2 = client.max_chunk_size();
+    init.param3 = 500;
+    client.write_control(init);
+    std::vector<uint8_t> frame(ImageService::DATA_HEADER_SIZE + client.max_chunk_size(), 0x5A);
+    for (uint16_t chunk = 0; chunk < 40; chunk++) {
+        ImageService::DataChunkHeader header = {chunk, client.max_chunk_size()};
+        memcpy(frame.data(), &header, sizeof(header));
+        client.write_data(frame.data(), static_cast<uint16_t>(frame.size()));
+    }
+    auto stop_start = std::chrono::steady_clock::now();
+    fixture.service.disable_ingest_task();
+    auto stop_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - stop_start).count();
+    CHECK(!fixture.service.is_ingest_task_enabled());
+    CHECK(stop_ms < static_cast<long long>(ImageService::INGEST_STOP_TIMEOUT_MS));
+    printf("%-22s stop with queued chunks: %lld ms\n", "ingest task", static_cast<long long>(stop_ms));
+    fixture.service.disable_ingest_task();  // No-op when stopped
+    
+    // Restart and finish on the direct path in between
+    client.disconnect();
+    CHECK_EQ(fixture.service.enable_ingest_task(INGEST_CONFIG), ESP_OK);
+    CHECK(fixture.service.is_ingest_task_enabled());
+    // The destructor stops the task again
+}
+
+// Blocks in write() until released, like a flash erase that takes too long
+class StallingSink : public TransferSink {
+public:
+    std::atomic<bool> stalled{false};
+    std::atomic<bool> released{false};
+    
+    bool begin(uint32_t total_size) override { return true; }
+    bool write(uint32_t offset, const uint8_t* data, uint32_t len) override {
+        stalled = true;
+        while (!released) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+    bool finish() override { return true; }
+    void abort() override {}
+};
+
+void test_ingest_task_stall() {
+    // The task is stuck in the sink past the stop timeout: nothing it uses may be torn down
+    StallingSink sink;
+    std::thread releaser;
+    {
+        Fixture fixture;
+        fixture.service.set_transfer_sink(&sink);
+        CHECK_EQ(fixture.service.enable_ingest_task(), ESP_OK);
+        LoopbackClient client(fixture, 800);
+        client.set_gatts_writes(true);
+        client.connect(185);
+        
+        ControlMessage init = {};
+        init.command = static_cast<uint8_t>(CommandType::TRANSFER_INIT);
+        init.param1 = 4 * client.max_chunk_size();
+        init.param2 = client.max_chunk_size();
+        init.param3 = 4;
+        client.write_control(init);
+        std::vector<uint8_t> frame(ImageService::DATA_HEADER_SIZE + client.max_chunk_size(), 0x33);
+        ImageService::DataChunkHeader header = {0, client.max_chunk_size()};
+        memcpy(frame.data(), &header, sizeof(header));
+        client.write_data(frame.data(), static_cast<uint16_t>(frame.size()));
+        auto wall_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!sink.stalled && std::chrono::steady_clock::now() < wall_deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(sink.stalled);
+        
+        auto stop_start = std::chrono::steady_clock::now();
+        fixture.service.disable_ingest_task();
+        auto stop_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - stop_start).count();
+        CHECK(!fixture.service.is_ingest_task_enabled());
+        CHECK(stop_ms >= static_cast<long long>(ImageService::INGEST_STOP_TIMEOUT_MS));
+        // The stuck task still owns the ring
+        CHECK_EQ(fixture.service.enable_ingest_task(), ESP_ERR_INVALID_STATE);
+        
+        // The destructor has to wait for the task
+        releaser = std::thread([&sink] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            sink.released = true;
+        });
+    }
+    CHECK(sink.released);
+    releaser.join();
+}
+
+// Holds the completion worker inside the image callback until released
+std::atomic<bool> completion_gate{false};
+std::atomic<bool> completion_entered{false};
+std::atomic<int> completion_callbacks{0};
+
+void on_image_gated(const uint8_t* image_data, uint32_t size, bool is_valid_jpeg) {
+    completion_entered = true;
+    while (!completion_gate) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    completion_callbacks++;
+}
+
+void test_completion_worker() {
+    // A full queue is answered with RECEIVER_BUSY; the callback never runs on the BLE path
+    constexpr ImageService::CompletionConfig COMPLETION_CONFIG = {1, 1, 5, 8192};
+    Fixture fixture;
+    fixture.service.set_image_transfer_callback(&on_image_gated);
+    CHECK_EQ(fixture.service.enable_completion_worker(COMPLETION_CONFIG), ESP_OK);
+    CHECK_EQ(fixture.service.enable_completion_worker(COMPLETION_CONFIG), ESP_ERR_INVALID_STATE);
+    completion_gate = false;
+    completion_entered = false;
+    completion_callbacks = 0;
+    
+    // First image blocks the worker in the callback, the second one waits in the queue
+    uint32_t seed = 900;
+    for (int transfer = 0; transfer < 3; transfer++) {
+        LoopbackClient client(fixture, seed);
+        std::vector<uint8_t> data = make_payload(20000, seed++);
+        client.connect(247);
+        TransferStats stats;
+        bool ok = client.upload(data, CLEAN_LINK, &stats);
+        if (transfer == 0) {
+            // Wait until the worker has taken the first image out of the queue
+            auto wall_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (!completion_entered && std::chrono::steady_clock::now() < wall_deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            CHECK(completion_entered);
+        }
+        if (transfer < 2) {
+            CHECK(ok);
+            CHECK_EQ(stats.ack_size, data.size());
+        } else {
+            CHECK(!ok);
+            CHECK_EQ(stats.error_code, static_cast<uint32_t>(ImageService::ErrorCode::RECEIVER_BUSY));
+        }
+        CHECK_EQ(completion_callbacks.load(), 0);
+        client.disconnect();
+    }
+    
+    // Stopping delivers the queued image before the worker exits
+    completion_gate = true;
+    fixture.service.disable_completion_worker();
+    CHECK(!fixture.service.is_completion_worker_enabled());
+    CHECK_EQ(completion_callbacks.load(), 2);
+    fixture.service.disable_completion_worker();  // No-op when stopped
+    CHECK_EQ(fixture.service.enable_completion_worker(COMPLETION_CONFIG), ESP_OK);
+}
+
+void test_delta_base() {
+    // The receive buffer of the last image becomes the base, inline and on the completion worker
+    Fixture fixture;
+    fixture.service.set_delta_base_enabled(true);
+    uint32_t seed = 950;
+    for (bool worker : {false, true}) {
+        if (worker) {
+            CHECK_EQ(fixture.service.enable_completion_worker(), ESP_OK);
+        }
+        LoopbackClient client(fixture, seed);
+        std::vector<uint8_t> data = make_payload(30000, seed++);
+        client.connect(247);
+        TransferStats stats;
+        CHECK(client.upload(data, CLEAN_LINK, &stats));
+        client.disconnect();
+        if (worker) {
+            fixture.service.disable_completion_worker();  // Returns after the queued image was delivered
+        }
+        CHECK(received_image == data);
+        CHECK(fixture.service.has_delta_base());
+        CHECK_EQ(fixture.service.get_delta_base_crc(), crc32(data.data(), data.size()));
+    }
+    fixture.service.set_delta_base_enabled(false);
+    CHECK(!fixture.service.has_delta_base());
+}
+
+void test_upload_streaming() {
+    // Sink path: reorder window in front of a flash partition
+    const esp_partition_t* partition = host_partition_add("upload", 256 * 1024);
+    CHECK(partition != nullptr);
+    PartitionSink sink(partition);
+    
+    uint32_t seed = 100;
+    for (uint16_t mtu : MTUS) {
+        Fixture fixture;
+        fixture.service.set_transfer_sink(&sink);
+        fixture.service.set_flow_mode(ImageService::FlowMode::SLIDING_WINDOW);
+        LoopbackClient client(fixture, seed);
+        std::vector<uint8_t> data = make_payload(mtu == 23 ? 10000 : 150000, seed);
+        seed++;
+        
+        client.connect(mtu);
+        TransferStats stats;
+        bool ok = client.upload(data, IMPAIRMENTS[4], &stats);
+        print_stats("upload/partition sink", IMPAIRMENTS[4].name, mtu, data.size(), stats);
+        CHECK(ok);
+        CHECK_EQ(stats.ack_crc, crc32(data.data(), data.size()));
+        
+        std::vector<uint8_t> stored(data.size());
+        CHECK_EQ(esp_partition_read(partition, 0, stored.data(), stored.size()), ESP_OK);
+        CHECK(stored == data);
+        fixture.service.set_transfer_sink(nullptr);
+    }
+}
+
+void test_download() {
+    // Flash partition without a stored CRC (worker task) and a RAM buffer with one
+    const esp_partition_t* partition = host_partition_add("logs", 128 * 1024);
+    CHECK(partition != nullptr);
+    std::vector<uint8_t> log_data = make_payload(100000, 200);
+    CHECK_EQ(esp_partition_write(partition, 0, log_data.data(), log_data.size()), ESP_OK);
+    PartitionSource partition_source(partition, 0, static_cast<uint32_t>(log_data.size()));
+    
+    std::vector<uint8_t> frame = make_payload(30000, 201);
+    BufferSource buffer_source(frame.data(), static_cast<uint32_t>(frame.size()));
+    buffer_source.set_crc32(crc32(frame.data(), frame.size()));
+    
+    download_sources[0] = &partition_source;
+    download_sources[1] = &buffer_source;
+    
+    uint32_t seed = 300;
+    for (uint16_t mtu : MTUS) {
+        for (uint32_t id = 0; id < 2; id++) {
+            const LinkImpairment& impairment = IMPAIRMENTS[(id == 0) ? 2 : 4];
+            const std::vector<uint8_t>& expected = (id == 0) ? log_data : frame;
+            Fixture fixture;
+            LoopbackClient client(fixture, seed++);
+            client.connect(mtu, true);
+            
+            std::vector<uint8_t> received;
+            TransferStats stats;
+            bool ok = client.download(id, impairment, &received, &stats);
+            print_stats(id == 0 ? "download/partition" : "download/buffer+crc", impairment.name, mtu,
+                        expected.size(), stats);
+            CHECK(ok);
+            CHECK(received == expected);
+            CHECK_EQ(download_completions, 1);
+            CHECK(download_success);
+            CHECK(fixture.service.get_status() == ImageService::Status::COMPLETE);
+            if (stats.chunks_dropped > 0) {
+                CHECK(stats.chunk_requests > 0);
+            }
+        }
+    }
+    
+    // An acknowledgment with the wrong CRC fails the download
+    {
+        Fixture fixture;
+        LoopbackClient client(fixture, 400);
+        client.connect(185, true);
+        ControlMessage request = {};
+        request.command = static_cast<uint8_t>(CommandType::REQUEST_DOWNLOAD);
+        request.param1 = 1;
+        client.write_control(request);
+        ControlMessage ack = {};
+        ack.command = static_cast<uint8_t>(CommandType::TRANSFER_COMPLETE_ACK);
+        ack.param1 = static_cast<uint32_t>(frame.size());
+        ack.param2 = crc32(frame.data(), frame.size()) ^ 1;
+        client.write_control(ack);
+        CHECK_EQ(download_completions, 1);
+        CHECK(!download_success);
+    }
+    
+    // A disconnect while the CRC is being computed cancels the worker's download
+    {
+        Fixture fixture;
+        LoopbackClient client(fixture, 401);
+        client.connect(247, true);
+        ControlMessage request = {};
+        request.command = static_cast<uint8_t>(CommandType::REQUEST_DOWNLOAD);
+        request.param1 = 0;
+        client.write_control(request);
+        client.disconnect();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        Packet packet;
+        CHECK(!client.next_packet(&packet));
+        CHECK(fixture.service.get_status() != ImageService::Status::SENDING);
+    }
+    
+    // Unknown download
+    {
+        Fixture fixture;
+        LoopbackClient client(fixture, 402);
+        client.connect(247, true);
+        std::vector<uint8_t> received;
+        TransferStats stats;
+        CHECK(!client.download(3, CLEAN_LINK, &received, &stats));
+        CHECK_EQ(stats.error_code, static_cast<uint32_t>(ImageService::ErrorCode::DOWNLOAD_UNAVAILABLE));
+    }
+    
+    download_sources[0] = nullptr;
+    download_sources[1] = nullptr;
+}
+
+void test_fuzz() {
+    // Random control and data writes, descriptor writes, MTU changes, reconnects and time
+    // jumps; afterwards the same service must still complete a clean upload
+    constexpr uint8_t COMMANDS[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x82, 0x83, 0x84, 0x00, 0x7f, 0xff};
+    constexpr int ROUNDS = 4;
+    constexpr int OPERATIONS = 20000;
+    
+    const esp_partition_t* partition = host_partition_add("fuzz", 64 * 1024);
+    PartitionSource source(partition, 0, 20000);
+    download_sources[2] = &source;
+    
+    for (int round = 0; round < ROUNDS; round++) {
+        auto wall_start = std::chrono::steady_clock::now();
+        Fixture fixture(2);
+        fixture.service.set_max_sessions(2);
+        LoopbackClient client(fixture, 500 + round);
+        std::mt19937& rng = client.rng();
+        uint16_t mtu = MTUS[rng() % 4];
+        client.connect(mtu, true);
+        
+        uint32_t chunk_size = mtu - 7;
+        uint32_t expected_chunks = 64;
+        std::vector<uint8_t> buffer(ImageService::MAX_MTU_SIZE);
+        for (int op = 0; op < OPERATIONS; op++) {
+            uint32_t kind = rng() % 100;
+            if (kind < 30) {
+                // Control message: mostly valid commands with plausible or random parameters
+                ControlMessage msg = {};
+                msg.command = COMMANDS[rng() % sizeof(COMMANDS)];
+                bool plausible = rng() % 2;
+                if (msg.command == 0x01 && plausible) {
+                    expected_chunks = 1 + rng() % 300;
+                    chunk_size = 1 + rng() % (mtu - 7);
+                    msg.param1 = expected_chunks * chunk_size - rng() % chunk_size;
+                    msg.param2 = chunk_size;
+                    msg.param3 = expected_chunks;
+                    msg.reserved[ImageService::TRANSFER_FLAGS_INDEX] = static_cast<uint8_t>(rng() & 0xE1);
+                } else if (plausible) {
+                    msg.param1 = rng() % (expected_chunks + 4);
+                    msg.param2 = rng() % 64;
+                    msg.param3 = rng() % 4;
+                } else {
+                    msg.param1 = rng();
+                    msg.param2 = rng();
+                    msg.param3 = rng();
+                }
+                for (auto& byte : msg.reserved) {
+                    byte = plausible ? byte : static_cast<uint8_t>(rng());
+                }
+                uint16_t len = (rng() % 10 == 0) ? static_cast<uint16_t>(rng() % sizeof(msg)) : sizeof(msg);
+                fixture.service.on_client_write(CONN_ID, fixture.service.get_control_char_handle(),
+                                                reinterpret_cast<const uint8_t*>(&msg), len);
+            } else if (kind < 85) {
+                // Data chunk: well-formed for the current layout, or random bytes
+                uint16_t len;
+                if (rng() % 4) {
+                    uint16_t payload = static_cast<uint16_t>(1 + rng() % chunk_size);
+                    ImageService::DataChunkHeader header = {static_cast<uint16_t>(rng() % (expected_chunks + 2)), payload};
+                    memcpy(buffer.data(), &header, sizeof(header));
+                    for (uint16_t i = 0; i < payload; i++) {
+                        buffer[sizeof(header) + i] = static_cast<uint8_t>(rng());
+                    }
+                    len = static_cast<uint16_t>(sizeof(header) + payload);
+                } else {
+                    len = static_cast<uint16_t>(rng() % (mtu - 2));
+                    for (uint16_t i = 0; i < len; i++) {
+                        buffer[i] = static_cast<uint8_t>(rng());
+                    }
+                }
+                client.write_data(buffer.data(), len, static_cast<uint8_t>(rng() % 2));
+            } else if (kind < 88) {
+                uint16_t handles[] = {fixture.service.get_control_notify_handle(),
+                                      fixture.service.get_data_notify_handle(0),
+                                      fixture.service.get_data_notify_handle(1), 0, 0xffff};
+                client.write_descriptor(handles[rng() % 5], rng() % 2);
+            } else if (kind < 90) {
+                mtu = MTUS[rng() % 4];
+                fixture.service.on_client_mtu(CONN_ID, mtu);
+            } else if (kind < 91) {
+                fixture.service.on_client_disconnected(CONN_ID);
+                fixture.service.on_client_connected(CONN_ID);
+                fixture.service.on_client_mtu(CONN_ID, mtu);
+                client.write_descriptor(fixture.service.get_control_notify_handle(), true);
+                client.write_descriptor(fixture.service.get_data_notify_handle(0), true);
+            } else if (kind < 92) {
+                // Second connection
+                uint16_t other = 1;
+                fixture.service.on_client_connected(other);
+                fixture.service.on_client_write(other, fixture.service.get_control_char_handle(),
+                                                buffer.data(), static_cast<uint16_t>(rng() % 21));
+                fixture.service.on_client_disconnected(other);
+            } else {
+                host_advance_time_us(static_cast<int64_t>(rng() % 700) * 1000);
+            }
+            
+            // Drain the link; react to close requests like the stack would
+            Packet packet;
+            while (client.next_packet(&packet)) {
+            }
+            while (fixture.link.next(1, &packet)) {
+            }
+            if (fixture.link.take_close(CONN_ID)) {
+                fixture.service.on_client_disconnected(CONN_ID);
+                fixture.service.on_client_connected(CONN_ID);
+                fixture.service.on_client_mtu(CONN_ID, mtu);
+                client.write_descriptor(fixture.service.get_control_notify_handle(), true);
+                client.write_descriptor(fixture.service.get_data_notify_handle(0), true);
+            }
+            fixture.link.take_close(1);
+        }
+        
+        // The service recovers: a fresh connection uploads cleanly
+        fixture.service.on_client_disconnected(CONN_ID);
+        fixture.link.clear();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));  // CRC workers notice the reset
+        fixture.link.clear();
+        host_advance_time_us(static_cast<int64_t>(ImageService::RESUME_GRACE_PERIOD_MS) * 1000 + 1000);
+        image_callbacks = 0;
+        
+        LoopbackClient clean(fixture, 600 + round);
+        std::vector<uint8_t> data = make_payload(40000, 600 + round);
+        clean.connect(247);
+        TransferStats stats;
+        bool ok = clean.upload(data, CLEAN_LINK, &stats);
+        CHECK(ok);
+        CHECK_EQ(image_callbacks, 1);
+        CHECK(received_image == data);
+        
+        auto wall_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - wall_start).count();
+        printf("%-22s round %d    MTU %3u %7d ops %lld ms wall\n", "fuzz", round, mtu, OPERATIONS,
+               static_cast<long long>(wall_ms));
+    }
+    download_sources[2] = nullptr;
+}
+
+}  // namespace
+
+int main() {
+    if (!getenv("TINYFLOW_HOST_LOG")) {
+        host_log_set_level(ESP_LOG_NONE);
+    }
+    
+    test_upload(ImageService::FlowMode::STOP_AND_WAIT, false, "upload/stop-and-wait");
+    test_upload(ImageService::FlowMode::SLIDING_WINDOW, false, "upload/sliding window");
+    test_upload(ImageService::FlowMode::SLIDING_WINDOW, true, "upload/adaptive");
+    test_upload_channels();
+    test_upload_max_chunks();
+    test_ingest_task();
+    test_ingest_task_stall();
+    test_completion_worker();
+    test_delta_base();
+    test_upload_streaming();
+    test_download();
+    test_fuzz();
+    
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}